@@ -1,16 +1,45 @@
+#define _DEFAULT_SOURCE
+
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
 #include "audio.h"
+#include "rtcheck.h"
+#include "rtlog.h"
+#include "rtsched.h"
 
 #include <FLAC/stream_decoder.h>
 #include <vorbis/vorbisfile.h>
 
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Default ring of interleaved stereo float samples between the decode thread
+// and the audio callback (~1.5 s at 44.1 kHz). Sizes are powers of two.
+#define AUDIO_RING_SIZE (1 << 17)
+#define AUDIO_RING_MAX (1 << 24)
+
+// Low-latency profile: 128 frames is ~2.9 ms at 44.1 kHz
+#define LOW_LATENCY_PERIOD_FRAMES 128
+#define LOW_LATENCY_PERIODS 2
+
+// Power-saver profile: ~93 ms periods and about ten seconds decoded ahead,
+// refilled in one burst once two seconds are left
+#define POWER_SAVER_PERIOD_FRAMES 4096
+#define POWER_SAVER_PERIODS 3
+#define POWER_SAVER_BUFFER_MS 10000
+#define POWER_SAVER_REFILL_MS 2000
 
-#define AUDIO_BUFFER_SIZE (16384)
+// Room the decoder needs before producing another chunk: one ov_read() of
+// 4096 bytes can expand to 4096 output samples for mono input.
+#define VORBIS_CHUNK_SAMPLES 4096
 
 typedef struct {
     // Miniaudio
@@ -20,13 +49,13 @@ typedef struct {
     // Current format
     AudioFormat format;
     AudioState state;
-    bool finished;
+    bool eof;  // decoder has produced its last sample (atomic)
 
     // Audio properties
     unsigned int sample_rate;
     unsigned int channels;
     uint64_t total_samples;    // total samples in file
-    uint64_t samples_played;   // samples played so far
+    uint64_t samples_played;   // samples played so far (atomic, written by callback)
 
     // Volume (0.0 to 1.0)
     float volume;
@@ -34,22 +63,69 @@ typedef struct {
     // FLAC decoder
     FLAC__StreamDecoder *flac_decoder;
     FILE *flac_file;
+    size_t flac_reserve;  // ring space needed for the largest frame
 
     // Vorbis decoder
     OggVorbis_File vorbis_file;
     bool vorbis_open;
 
-    // Sample buffer (interleaved float samples)
-    float buffer[AUDIO_BUFFER_SIZE];
-    size_t buffer_read_pos;
-    size_t buffer_write_pos;
-    size_t buffer_count;
+    // Decode thread. decoder_lock guards the decoders and everything the
+    // producer side of the ring touches; the audio callback never takes it.
+    pthread_t decode_thread;
+    bool decode_thread_running;
+    pthread_mutex_t decoder_lock;
+    sem_t wake;  // posted by the callback when the ring runs low
+    bool quit;
+    bool refill_pending;  // wake posted and not yet serviced (atomic)
+
+    // Single-producer/single-consumer ring. Indices increase monotonically
+    // and are masked on access; write_idx belongs to the decode thread,
+    // read_idx to the audio callback.
+    float *ring;
+    size_t ring_size;   // samples, power of two
+    size_t low_water;   // callback wakes the decoder at or below this
+    size_t write_idx;
+    size_t read_idx;
+
+    // Pending discard of ring contents after a seek, published by the
+    // producer side and applied by the callback. flush_seq is odd while an
+    // update is in progress.
+    unsigned int flush_seq;
+    unsigned int flush_seen;  // callback only
+    size_t flush_target;      // read_idx to jump to
+    uint64_t flush_frame;     // samples_played to report after the jump
+
+    // Thread last seen running the callback; scheduling is (re)applied
+    // when it changes. Callback only.
+    pthread_t callback_thread;
+    bool callback_thread_known;
+
+    // Counters (atomic)
+    unsigned long underruns;
+    unsigned long callbacks;
+    unsigned long decoder_wakeups;
+    bool memory_locked;
+
+    // Callback timing. last_callback_* belong to the callback (reset while
+    // the device is stopped); the sums are atomic and reset by
+    // audio_take_jitter().
+    uint64_t last_callback_ns;
+    ma_uint32 last_callback_frames;
+    unsigned long jitter_count;
+    uint64_t interval_sum_ns;
+    uint64_t jitter_sum_us;
+    uint64_t jitter_sum_sq_us;
+    uint64_t jitter_max_ns;
+
+    bool exclusive;  // device was opened in exclusive mode
 } AudioContext;
 
 static AudioContext ctx = {0};
 
 // Forward declarations
 static void audio_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count);
+static void *decode_thread_main(void *arg);
+static void fill_ring(void);
 static bool decode_flac_samples(void);
 static bool decode_vorbis_samples(void);
 
@@ -68,32 +144,225 @@ static void flac_error_callback(
     FLAC__StreamDecoderErrorStatus status,
     void *client_data);
 
-bool audio_init(void) {
-    ma_device_config config = ma_device_config_init(ma_device_type_playback);
-    config.playback.format = ma_format_f32;
-    config.playback.channels = 2;
-    config.sampleRate = 44100;
-    config.dataCallback = audio_callback;
-    config.pUserData = &ctx;
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Space the producer may write into. Data behind a pending flush target is
+// already discarded, so it counts as free even before the callback jumps.
+static size_t ring_free(void) {
+    size_t read = __atomic_load_n(&ctx.read_idx, __ATOMIC_ACQUIRE);
+    if ((ptrdiff_t)(ctx.flush_target - read) > 0) {
+        read = ctx.flush_target;
+    }
+    return ctx.ring_size - (ctx.write_idx - read);
+}
+
+static size_t ring_count(void) {
+    return __atomic_load_n(&ctx.write_idx, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&ctx.read_idx, __ATOMIC_ACQUIRE);
+}
+
+static void ring_put(float left, float right) {
+    ctx.ring[ctx.write_idx & (ctx.ring_size - 1)] = left;
+    ctx.ring[(ctx.write_idx + 1) & (ctx.ring_size - 1)] = right;
+    __atomic_store_n(&ctx.write_idx, ctx.write_idx + 2, __ATOMIC_RELEASE);
+}
+
+// Discard everything queued so far and report `frame` as the new position.
+// Caller holds decoder_lock.
+static void ring_flush(uint64_t frame) {
+    if (ctx.state != AUDIO_STATE_PLAYING) {
+        // Callback isn't running; reset directly
+        __atomic_store_n(&ctx.read_idx, ctx.write_idx, __ATOMIC_RELEASE);
+        __atomic_store_n(&ctx.samples_played, frame, __ATOMIC_RELAXED);
+        ctx.flush_target = ctx.write_idx;
+        return;
+    }
+
+    __atomic_fetch_add(&ctx.flush_seq, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&ctx.flush_target, ctx.write_idx, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx.flush_frame, frame, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx.flush_seq, 1, __ATOMIC_ACQ_REL);
+}
+
+// Apply a flush published by ring_flush(). Callback only.
+static void ring_apply_flush(void) {
+    unsigned int seq = __atomic_load_n(&ctx.flush_seq, __ATOMIC_ACQUIRE);
+    if (seq == ctx.flush_seen || (seq & 1)) return;
+
+    size_t target = __atomic_load_n(&ctx.flush_target, __ATOMIC_RELAXED);
+    uint64_t frame = __atomic_load_n(&ctx.flush_frame, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&ctx.flush_seq, __ATOMIC_ACQUIRE) != seq) return;  // torn, retry next time
+
+    __atomic_store_n(&ctx.read_idx, target, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx.samples_played, frame, __ATOMIC_RELAXED);
+    ctx.flush_seen = seq;
+}
+
+// Keep the ring and our state out of swap so the callback never page-faults.
+static void lock_memory(void) {
+    memset(ctx.ring, 0, ctx.ring_size * sizeof(float));  // prefault
+    if (mlock(&ctx, sizeof(ctx)) == 0 && mlock(ctx.ring, ctx.ring_size * sizeof(float)) == 0) {
+        ctx.memory_locked = true;
+    } else {
+        int err = errno;
+        munlock(&ctx, sizeof(ctx));
+        fprintf(stderr, "Warning: could not lock audio buffers in memory: %s\n", strerror(err));
+    }
+}
+
+static void free_ring(void) {
+    if (ctx.memory_locked) {
+        munlock(ctx.ring, ctx.ring_size * sizeof(float));
+        munlock(&ctx, sizeof(ctx));
+        ctx.memory_locked = false;
+    }
+    free(ctx.ring);
+    ctx.ring = NULL;
+    ctx.ring_size = 0;
+}
 
-    if (ma_device_init(NULL, &config, &ctx.device) != MA_SUCCESS) {
+void audio_config_init(AudioConfig *config, AudioProfile profile) {
+    memset(config, 0, sizeof(*config));
+    config->profile = profile;
+
+    if (profile == AUDIO_PROFILE_LOW_LATENCY) {
+        config->period_frames = LOW_LATENCY_PERIOD_FRAMES;
+        config->periods = LOW_LATENCY_PERIODS;
+        config->exclusive = true;
+        config->no_fixup = true;
+    } else if (profile == AUDIO_PROFILE_POWER_SAVER) {
+        config->period_frames = POWER_SAVER_PERIOD_FRAMES;
+        config->periods = POWER_SAVER_PERIODS;
+        config->buffer_ms = POWER_SAVER_BUFFER_MS;
+        config->refill_ms = POWER_SAVER_REFILL_MS;
+    }
+}
+
+// Size the ring for buffer_ms of stereo audio and set the refill threshold.
+static bool alloc_ring(const AudioConfig *config, unsigned int sample_rate) {
+    size_t size = AUDIO_RING_SIZE;
+    if (config->buffer_ms > 0) {
+        size_t wanted = (size_t)sample_rate * 2 * config->buffer_ms / 1000;
+        size = 1 << 16;  // still holds the largest FLAC frame
+        while (size < wanted && size < AUDIO_RING_MAX) size <<= 1;
+    }
+
+    ctx.ring = malloc(size * sizeof(float));
+    if (!ctx.ring) {
+        fprintf(stderr, "Failed to allocate audio buffer\n");
+        return false;
+    }
+    ctx.ring_size = size;
+
+    ctx.low_water = size;
+    if (config->refill_ms > 0) {
+        size_t low = (size_t)sample_rate * 2 * config->refill_ms / 1000;
+        if (low < size / 2) ctx.low_water = low;
+    }
+    return true;
+}
+
+bool audio_init(const AudioConfig *config) {
+    AudioConfig defaults;
+    if (!config) {
+        audio_config_init(&defaults, AUDIO_PROFILE_DEFAULT);
+        config = &defaults;
+    }
+
+    rtlog_init();
+    if (!alloc_ring(config, 44100)) return false;
+    lock_memory();
+
+    ma_device_config device_config = ma_device_config_init(ma_device_type_playback);
+    device_config.playback.format = ma_format_f32;
+    device_config.playback.channels = 2;
+    device_config.sampleRate = 44100;
+    device_config.dataCallback = audio_callback;
+    device_config.pUserData = &ctx;
+    device_config.periodSizeInFrames = config->period_frames;
+    device_config.periods = config->periods;
+
+    if (config->profile == AUDIO_PROFILE_LOW_LATENCY) {
+        device_config.performanceProfile = ma_performance_profile_low_latency;
+        device_config.noPreSilencedOutputBuffer = MA_TRUE;  // the callback writes every sample
+    } else if (config->profile == AUDIO_PROFILE_POWER_SAVER) {
+        device_config.performanceProfile = ma_performance_profile_conservative;
+    }
+    if (config->no_fixup) {
+        device_config.noFixedSizedCallback = MA_TRUE;
+        device_config.alsa.noAutoFormat = MA_TRUE;
+        device_config.alsa.noAutoChannels = MA_TRUE;
+        device_config.alsa.noAutoResample = MA_TRUE;
+    }
+    if (config->exclusive) {
+        device_config.playback.shareMode = ma_share_mode_exclusive;
+    }
+
+    ma_result result = ma_device_init(NULL, &device_config, &ctx.device);
+    if (result != MA_SUCCESS && (config->exclusive || config->no_fixup)) {
+        // The backend may not support exclusive mode or the raw format;
+        // fall back to shared mode with conversions
+        fprintf(stderr, "Warning: exclusive/raw audio output unavailable, using shared mode\n");
+        device_config.playback.shareMode = ma_share_mode_shared;
+        device_config.alsa.noAutoFormat = MA_FALSE;
+        device_config.alsa.noAutoChannels = MA_FALSE;
+        device_config.alsa.noAutoResample = MA_FALSE;
+        result = ma_device_init(NULL, &device_config, &ctx.device);
+    }
+    if (result != MA_SUCCESS) {
         fprintf(stderr, "Failed to initialize audio device\n");
+        free_ring();
         return false;
     }
+    ctx.exclusive = device_config.playback.shareMode == ma_share_mode_exclusive;
 
     ctx.device_initialized = true;
     ctx.state = AUDIO_STATE_STOPPED;
     ctx.volume = 1.0f;
+
+    pthread_mutex_init(&ctx.decoder_lock, NULL);
+    sem_init(&ctx.wake, 0, 0);
+    ctx.quit = false;
+    if (pthread_create(&ctx.decode_thread, NULL, decode_thread_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start decode thread\n");
+        sem_destroy(&ctx.wake);
+        pthread_mutex_destroy(&ctx.decoder_lock);
+        ma_device_uninit(&ctx.device);
+        ctx.device_initialized = false;
+        free_ring();
+        return false;
+    }
+    ctx.decode_thread_running = true;
+    rtsched_apply(RTSCHED_THREAD_DECODE, ctx.decode_thread);
+
     return true;
 }
 
 void audio_shutdown(void) {
     audio_stop();
 
+    if (ctx.decode_thread_running) {
+        pthread_mutex_lock(&ctx.decoder_lock);
+        ctx.quit = true;
+        pthread_mutex_unlock(&ctx.decoder_lock);
+        sem_post(&ctx.wake);
+        pthread_join(ctx.decode_thread, NULL);
+        sem_destroy(&ctx.wake);
+        pthread_mutex_destroy(&ctx.decoder_lock);
+        ctx.decode_thread_running = false;
+    }
+
     if (ctx.device_initialized) {
         ma_device_uninit(&ctx.device);
         ctx.device_initialized = false;
     }
+
+    free_ring();
+    rtlog_drain(stderr);
 }
 
 static AudioFormat detect_format(const char *path) {
@@ -141,7 +410,11 @@ static bool open_flac(const char *path) {
     }
 
     // Process metadata to get sample rate and channels
+    ctx.flac_reserve = 0;
     FLAC__stream_decoder_process_until_end_of_metadata(ctx.flac_decoder);
+    if (ctx.flac_reserve == 0 || ctx.flac_reserve > ctx.ring_size) {
+        ctx.flac_reserve = ctx.flac_reserve ? ctx.ring_size : 4608 * 2;
+    }
 
     ctx.format = AUDIO_FORMAT_FLAC;
     return true;
@@ -179,6 +452,7 @@ bool audio_play_file(const char *path) {
         return false;
     }
 
+    pthread_mutex_lock(&ctx.decoder_lock);
     bool opened = false;
     if (format == AUDIO_FORMAT_FLAC) {
         opened = open_flac(path);
@@ -186,23 +460,23 @@ bool audio_play_file(const char *path) {
         opened = open_vorbis(path);
     }
 
-    if (!opened) return false;
+    // Reset ring and position. The device is stopped, so the callback
+    // can't be touching them.
+    ctx.write_idx = 0;
+    ctx.flush_target = 0;
+    ctx.flush_seen = __atomic_load_n(&ctx.flush_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx.read_idx, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx.samples_played, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx.eof, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx.decoder_lock);
 
-    // Reset buffer and position
-    ctx.buffer_read_pos = 0;
-    ctx.buffer_write_pos = 0;
-    ctx.buffer_count = 0;
-    ctx.samples_played = 0;
-    ctx.finished = false;
+    if (!opened) return false;
 
-    // Pre-fill buffer
-    if (ctx.format == AUDIO_FORMAT_FLAC) {
-        decode_flac_samples();
-    } else {
-        decode_vorbis_samples();
-    }
+    // Pre-fill so the first callback has data
+    fill_ring();
 
     // Start playback
+    ctx.last_callback_ns = 0;
     if (ma_device_start(&ctx.device) != MA_SUCCESS) {
         fprintf(stderr, "Failed to start audio device\n");
         audio_stop();
@@ -210,6 +484,7 @@ bool audio_play_file(const char *path) {
     }
 
     ctx.state = AUDIO_STATE_PLAYING;
+    sem_post(&ctx.wake);
     return true;
 }
 
@@ -218,6 +493,9 @@ void audio_stop(void) {
         ma_device_stop(&ctx.device);
     }
 
+    if (!ctx.decode_thread_running) return;
+    pthread_mutex_lock(&ctx.decoder_lock);
+
     if (ctx.flac_decoder) {
         FLAC__stream_decoder_finish(ctx.flac_decoder);
         FLAC__stream_decoder_delete(ctx.flac_decoder);
@@ -238,7 +516,8 @@ void audio_stop(void) {
 
     ctx.format = AUDIO_FORMAT_UNKNOWN;
     ctx.state = AUDIO_STATE_STOPPED;
-    ctx.buffer_count = 0;
+    __atomic_store_n(&ctx.read_idx, ctx.write_idx, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx.decoder_lock);
 }
 
 void audio_toggle_pause(void) {
@@ -246,8 +525,10 @@ void audio_toggle_pause(void) {
         ma_device_stop(&ctx.device);
         ctx.state = AUDIO_STATE_PAUSED;
     } else if (ctx.state == AUDIO_STATE_PAUSED) {
+        ctx.last_callback_ns = 0;
         ma_device_start(&ctx.device);
         ctx.state = AUDIO_STATE_PLAYING;
+        sem_post(&ctx.wake);
     }
 }
 
@@ -256,50 +537,134 @@ AudioState audio_get_state(void) {
 }
 
 bool audio_is_finished(void) {
-    return ctx.finished && ctx.buffer_count == 0;
+    return __atomic_load_n(&ctx.eof, __ATOMIC_ACQUIRE) && ring_count() == 0;
+}
+
+// Track how far each callback interval strays from the audio the previous
+// callback produced. Callback only; clock_gettime() goes through the vDSO.
+static void record_callback_timing(ma_uint32 frame_count) {
+    uint64_t now = now_ns();
+
+    if (ctx.last_callback_ns != 0 && ctx.last_callback_frames > 0) {
+        uint64_t interval = now - ctx.last_callback_ns;
+        uint64_t expected = (uint64_t)ctx.last_callback_frames * 1000000000ULL / ctx.device.sampleRate;
+        uint64_t jitter = interval > expected ? interval - expected : expected - interval;
+        uint64_t jitter_us = jitter / 1000;
+
+        __atomic_fetch_add(&ctx.jitter_count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx.interval_sum_ns, interval, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx.jitter_sum_us, jitter_us, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx.jitter_sum_sq_us, jitter_us * jitter_us, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&ctx.jitter_max_ns, __ATOMIC_RELAXED);
+        while (jitter > max &&
+               !__atomic_compare_exchange_n(&ctx.jitter_max_ns, &max, jitter, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    ctx.last_callback_ns = now;
+    ctx.last_callback_frames = frame_count;
 }
 
-// Miniaudio callback - called from audio thread
+// Miniaudio callback - called from audio thread. Only copies out of the
+// ring: no decoding, locking, allocation or I/O happens here.
 static void audio_callback(ma_device *device, void *output, const void *input, ma_uint32 frame_count) {
     (void)device;
     (void)input;
 
-    float *out = (float *)output;
-    ma_uint32 frames_written = 0;
-
-    while (frames_written < frame_count) {
-        // If buffer is empty, try to decode more
-        if (ctx.buffer_count == 0) {
-            bool decoded = false;
-            if (ctx.format == AUDIO_FORMAT_FLAC) {
-                decoded = decode_flac_samples();
-            } else if (ctx.format == AUDIO_FORMAT_VORBIS) {
-                decoded = decode_vorbis_samples();
+    // The device thread isn't ours, so configure it the first time we see
+    // it. This is a one-off set of syscalls, deliberately outside rtcheck.
+    pthread_t self = pthread_self();
+    if (!ctx.callback_thread_known || !pthread_equal(self, ctx.callback_thread)) {
+        ctx.callback_thread = self;
+        ctx.callback_thread_known = true;
+        if (rtsched_configured(RTSCHED_THREAD_CALLBACK)) {
+            if (rtsched_apply(RTSCHED_THREAD_CALLBACK, self)) {
+                rtlog_post("Scheduling: callback thread configured", NULL);
+            } else {
+                rtlog_post("Scheduling: callback thread: ", rtsched_error(RTSCHED_THREAD_CALLBACK));
             }
+        }
+    }
 
-            if (!decoded || ctx.buffer_count == 0) {
-                // End of file or error - fill rest with silence
-                ma_uint32 remaining = frame_count - frames_written;
-                memset(out + frames_written * 2, 0, remaining * 2 * sizeof(float));
-                ctx.finished = true;
-                return;
-            }
+    rtcheck_enter();
+
+    __atomic_fetch_add(&ctx.callbacks, 1, __ATOMIC_RELAXED);
+    record_callback_timing(frame_count);
+    ring_apply_flush();
+
+    float *out = (float *)output;
+    size_t read = ctx.read_idx;
+    size_t available = __atomic_load_n(&ctx.write_idx, __ATOMIC_ACQUIRE) - read;
+    size_t needed = (size_t)frame_count * 2;  // stereo
+    size_t count = available < needed ? available : needed;
+    float volume = ctx.volume;
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = ctx.ring[(read + i) & (ctx.ring_size - 1)] * volume;
+    }
+    __atomic_store_n(&ctx.read_idx, read + count, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&ctx.samples_played, count / 2, __ATOMIC_RELAXED);
+
+    if (count < needed) {
+        // End of file or the decoder fell behind - fill rest with silence
+        memset(out + count, 0, (needed - count) * sizeof(float));
+        if (!__atomic_load_n(&ctx.eof, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_add(&ctx.underruns, 1, __ATOMIC_RELAXED);
         }
+    }
+
+    // Wake the decoder once the ring drops to the low-water mark. It then
+    // refills completely, so with a large ring it runs in rare bursts.
+    if (available - count <= ctx.low_water && !__atomic_load_n(&ctx.eof, __ATOMIC_ACQUIRE) &&
+        !__atomic_exchange_n(&ctx.refill_pending, true, __ATOMIC_ACQ_REL)) {
+        sem_post(&ctx.wake);
+    }
+    rtcheck_leave();
+}
+
+// Decode thread - keeps the ring topped up and sleeps until the callback
+// (or a control call) wakes it.
+static void *decode_thread_main(void *arg) {
+    (void)arg;
 
-        // Copy samples from buffer to output
-        size_t samples_available = ctx.buffer_count;
-        size_t samples_needed = (frame_count - frames_written) * 2;  // stereo
-        size_t samples_to_copy = samples_available < samples_needed ? samples_available : samples_needed;
+    for (;;) {
+        sem_wait(&ctx.wake);
+        __atomic_fetch_add(&ctx.decoder_wakeups, 1, __ATOMIC_RELAXED);
+        // Clear before filling so a request made during the fill isn't lost
+        __atomic_store_n(&ctx.refill_pending, false, __ATOMIC_RELEASE);
 
-        for (size_t i = 0; i < samples_to_copy; i++) {
-            out[frames_written * 2 + i] = ctx.buffer[ctx.buffer_read_pos] * ctx.volume;
-            ctx.buffer_read_pos = (ctx.buffer_read_pos + 1) % AUDIO_BUFFER_SIZE;
+        pthread_mutex_lock(&ctx.decoder_lock);
+        bool quit = ctx.quit;
+        pthread_mutex_unlock(&ctx.decoder_lock);
+        if (quit) break;
+
+        fill_ring();
+    }
+
+    return NULL;
+}
+
+// Decode until the ring is full or the stream ends. The lock is dropped
+// between chunks so control calls never wait for a whole refill.
+static void fill_ring(void) {
+    for (;;) {
+        pthread_mutex_lock(&ctx.decoder_lock);
+
+        size_t reserve = ctx.format == AUDIO_FORMAT_FLAC ? ctx.flac_reserve : VORBIS_CHUNK_SAMPLES;
+        bool more = !ctx.quit && ctx.format != AUDIO_FORMAT_UNKNOWN &&
+                    !__atomic_load_n(&ctx.eof, __ATOMIC_ACQUIRE) && ring_free() >= reserve;
+        if (more) {
+            bool decoded = ctx.format == AUDIO_FORMAT_FLAC ? decode_flac_samples()
+                                                           : decode_vorbis_samples();
+            if (!decoded) {
+                __atomic_store_n(&ctx.eof, true, __ATOMIC_RELEASE);
+                more = false;
+            }
         }
 
-        ctx.buffer_count -= samples_to_copy;
-        size_t frames_copied = samples_to_copy / 2;
-        ctx.samples_played += frames_copied;
-        frames_written += frames_copied;
+        pthread_mutex_unlock(&ctx.decoder_lock);
+        if (!more) break;
     }
 }
 
@@ -323,26 +688,17 @@ static FLAC__StreamDecoderWriteStatus flac_write_callback(
     float scale = 1.0f / (float)(1 << (bits - 1));
 
     for (unsigned int i = 0; i < frame->header.blocksize; i++) {
-        // Check if buffer has space
-        if (ctx.buffer_count >= AUDIO_BUFFER_SIZE - 2) {
+        // Check if ring has space
+        if (ring_free() < 2) {
             return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
         }
 
         // Convert to float and store (handle mono/stereo)
         if (ctx.channels == 1) {
             float sample = buffer[0][i] * scale;
-            ctx.buffer[ctx.buffer_write_pos] = sample;
-            ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-            ctx.buffer[ctx.buffer_write_pos] = sample;  // duplicate for stereo output
-            ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-            ctx.buffer_count += 2;
+            ring_put(sample, sample);  // duplicate for stereo output
         } else {
-            for (unsigned int ch = 0; ch < 2 && ch < ctx.channels; ch++) {
-                float sample = buffer[ch][i] * scale;
-                ctx.buffer[ctx.buffer_write_pos] = sample;
-                ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-                ctx.buffer_count++;
-            }
+            ring_put(buffer[0][i] * scale, buffer[1][i] * scale);
         }
     }
 
@@ -361,6 +717,7 @@ static void flac_metadata_callback(
         ctx.sample_rate = metadata->data.stream_info.sample_rate;
         ctx.channels = metadata->data.stream_info.channels;
         ctx.total_samples = metadata->data.stream_info.total_samples;
+        ctx.flac_reserve = (size_t)metadata->data.stream_info.max_blocksize * 2;
     }
 }
 
@@ -371,7 +728,8 @@ static void flac_error_callback(
 {
     (void)decoder;
     (void)client_data;
-    fprintf(stderr, "FLAC decode error: %s\n", FLAC__StreamDecoderErrorStatusString[status]);
+    // Runs on the decode thread; don't block it on stderr
+    rtlog_post("FLAC decode error: ", FLAC__StreamDecoderErrorStatusString[status]);
 }
 
 static bool decode_flac_samples(void) {
@@ -407,23 +765,16 @@ static bool decode_vorbis_samples(void) {
     int16_t *samples = (int16_t *)pcm_buffer;
     size_t sample_count = bytes_read / 2;
 
-    for (size_t i = 0; i < sample_count; i++) {
-        if (ctx.buffer_count >= AUDIO_BUFFER_SIZE) break;
-
-        float sample = samples[i] / 32768.0f;
-
-        if (ctx.channels == 1) {
-            // Mono: duplicate for stereo output
-            ctx.buffer[ctx.buffer_write_pos] = sample;
-            ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-            ctx.buffer[ctx.buffer_write_pos] = sample;
-            ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-            ctx.buffer_count += 2;
-            i++;  // We processed mono, but output stereo
-        } else {
-            ctx.buffer[ctx.buffer_write_pos] = sample;
-            ctx.buffer_write_pos = (ctx.buffer_write_pos + 1) % AUDIO_BUFFER_SIZE;
-            ctx.buffer_count++;
+    if (ctx.channels == 1) {
+        // Mono: duplicate for stereo output
+        for (size_t i = 0; i < sample_count; i++) {
+            float sample = samples[i] / 32768.0f;
+            ring_put(sample, sample);
+        }
+    } else {
+        // Keep the first two channels of each frame
+        for (size_t i = 0; i + ctx.channels <= sample_count; i += ctx.channels) {
+            ring_put(samples[i] / 32768.0f, samples[i + 1] / 32768.0f);
         }
     }
 
@@ -432,7 +783,7 @@ static bool decode_vorbis_samples(void) {
 
 double audio_get_position(void) {
     if (ctx.sample_rate == 0) return 0.0;
-    return (double)ctx.samples_played / (double)ctx.sample_rate;
+    return (double)__atomic_load_n(&ctx.samples_played, __ATOMIC_RELAXED) / (double)ctx.sample_rate;
 }
 
 double audio_get_duration(void) {
@@ -444,29 +795,31 @@ bool audio_seek(double position) {
     if (ctx.state == AUDIO_STATE_STOPPED) return false;
     if (position < 0) position = 0;
 
-    // Clear buffer
-    ctx.buffer_read_pos = 0;
-    ctx.buffer_write_pos = 0;
-    ctx.buffer_count = 0;
+    pthread_mutex_lock(&ctx.decoder_lock);
+
+    // Discard what's queued. Samples the decoder writes from here on
+    // (including the frame decoded by the seek itself) are kept.
+    uint64_t sample_pos = (uint64_t)(position * ctx.sample_rate);
+    bool ok = true;
 
     if (ctx.format == AUDIO_FORMAT_FLAC) {
-        uint64_t sample_pos = (uint64_t)(position * ctx.sample_rate);
         if (sample_pos >= ctx.total_samples) {
             sample_pos = ctx.total_samples > 0 ? ctx.total_samples - 1 : 0;
         }
-        if (!FLAC__stream_decoder_seek_absolute(ctx.flac_decoder, sample_pos)) {
-            return false;
-        }
-        ctx.samples_played = sample_pos;
+        ring_flush(sample_pos);
+        ok = FLAC__stream_decoder_seek_absolute(ctx.flac_decoder, sample_pos);
     } else if (ctx.format == AUDIO_FORMAT_VORBIS) {
-        if (ov_time_seek(&ctx.vorbis_file, position) != 0) {
-            return false;
-        }
-        ctx.samples_played = (uint64_t)(position * ctx.sample_rate);
+        ring_flush(sample_pos);
+        ok = ov_time_seek(&ctx.vorbis_file, position) == 0;
     }
 
-    ctx.finished = false;
-    return true;
+    if (ok) {
+        __atomic_store_n(&ctx.eof, false, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ctx.decoder_lock);
+
+    sem_post(&ctx.wake);
+    return ok;
 }
 
 void audio_set_volume(float volume) {
@@ -478,3 +831,45 @@ void audio_set_volume(float volume) {
 float audio_get_volume(void) {
     return ctx.volume;
 }
+
+void audio_get_output_info(AudioOutputInfo *info) {
+    memset(info, 0, sizeof(*info));
+    if (!ctx.device_initialized) return;
+
+    info->backend = ma_get_backend_name(ctx.device.pContext->backend);
+    info->sample_rate = ctx.device.playback.internalSampleRate;
+    info->period_frames = ctx.device.playback.internalPeriodSizeInFrames;
+    info->periods = ctx.device.playback.internalPeriods;
+    info->exclusive = ctx.exclusive;
+    if (info->sample_rate > 0) {
+        info->latency_ms = 1000.0 * info->period_frames * info->periods / info->sample_rate;
+    }
+}
+
+void audio_take_jitter(AudioJitter *jitter) {
+    unsigned long count = __atomic_exchange_n(&ctx.jitter_count, 0, __ATOMIC_RELAXED);
+    uint64_t interval_sum = __atomic_exchange_n(&ctx.interval_sum_ns, 0, __ATOMIC_RELAXED);
+    uint64_t sum = __atomic_exchange_n(&ctx.jitter_sum_us, 0, __ATOMIC_RELAXED);
+    uint64_t sum_sq = __atomic_exchange_n(&ctx.jitter_sum_sq_us, 0, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_exchange_n(&ctx.jitter_max_ns, 0, __ATOMIC_RELAXED);
+
+    memset(jitter, 0, sizeof(*jitter));
+    jitter->callbacks = count;
+    if (count == 0) return;
+
+    double mean_us = (double)sum / (double)count;
+    double var_us = (double)sum_sq / (double)count - mean_us * mean_us;
+    jitter->mean_interval_ms = (double)interval_sum / (double)count / 1e6;
+    jitter->mean_jitter_ms = mean_us / 1000.0;
+    jitter->stddev_jitter_ms = var_us > 0 ? sqrt(var_us) / 1000.0 : 0.0;
+    jitter->max_jitter_ms = (double)max / 1e6;
+}
+
+void audio_get_stats(AudioStats *stats) {
+    stats->underruns = __atomic_load_n(&ctx.underruns, __ATOMIC_RELAXED);
+    stats->callbacks = __atomic_load_n(&ctx.callbacks, __ATOMIC_RELAXED);
+    stats->decoder_wakeups = __atomic_load_n(&ctx.decoder_wakeups, __ATOMIC_RELAXED);
+    stats->rt_violations = rtcheck_violations();
+    stats->memory_locked = ctx.memory_locked;
+    stats->buffered_seconds = (double)ring_count() / 2.0 / (double)ctx.device.sampleRate;
+}
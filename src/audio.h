@@ -15,8 +15,63 @@ typedef enum {
     AUDIO_STATE_PAUSED
 } AudioState;
 
-// Initialize the audio system. Call once at startup.
-bool audio_init(void);
+typedef enum {
+    AUDIO_PROFILE_DEFAULT,      // backend's default buffering
+    AUDIO_PROFILE_LOW_LATENCY,  // small periods, exclusive access, for live cueing
+    AUDIO_PROFILE_POWER_SAVER   // large buffers and periods, decoding in bursts
+} AudioProfile;
+
+typedef struct {
+    AudioProfile profile;
+    unsigned int period_frames;  // device period size; 0 = backend default
+    unsigned int periods;        // number of periods; 0 = backend default
+    bool exclusive;              // ask for exclusive device access (falls back to shared)
+    bool no_fixup;               // skip backend format/rate conversion and miniaudio's
+                                 // fixed-size callback buffer where possible
+    unsigned int buffer_ms;      // decoded audio kept ahead of playback; 0 = default
+    unsigned int refill_ms;      // wake the decoder only once less than this is
+                                 // buffered; 0 = after every callback
+} AudioConfig;
+
+// What the device actually gave us
+typedef struct {
+    const char *backend;
+    unsigned int sample_rate;
+    unsigned int period_frames;
+    unsigned int periods;
+    bool exclusive;
+    double latency_ms;  // period_frames * periods at sample_rate
+} AudioOutputInfo;
+
+// Callback timing since the last audio_take_jitter() call. Jitter is the
+// difference between the measured interval and the duration of audio the
+// previous callback produced.
+typedef struct {
+    unsigned long callbacks;
+    double mean_interval_ms;
+    double mean_jitter_ms;
+    double stddev_jitter_ms;
+    double max_jitter_ms;
+} AudioJitter;
+
+typedef struct {
+    unsigned long underruns;        // callbacks that ran out of decoded audio
+    unsigned long callbacks;        // device callbacks so far
+    unsigned long decoder_wakeups;  // times the decode thread woke up
+    unsigned long rt_violations;    // unsafe calls on the audio thread (RT_DEBUG builds)
+    bool memory_locked;             // audio buffers are mlock()ed
+    double buffered_seconds;        // decoded audio waiting in the ring
+} AudioStats;
+
+// Fill in the settings for a profile.
+void audio_config_init(AudioConfig *config, AudioProfile profile);
+
+// Initialize the audio system. Call once at startup. config may be NULL for
+// the default profile. Decoding runs on its own thread; messages it
+// produces are queued in rtlog (see rtlog.h). Thread scheduling configured
+// through rtsched beforehand is applied to the decode thread here and to
+// the device thread on its first callback.
+bool audio_init(const AudioConfig *config);
 
 // Shutdown the audio system. Call once at exit.
 void audio_shutdown(void);
@@ -51,4 +106,13 @@ void audio_set_volume(float volume);
 // Get current volume (0.0 to 1.0).
 float audio_get_volume(void);
 
+// Snapshot of playback health counters.
+void audio_get_stats(AudioStats *stats);
+
+// Effective device settings after audio_init().
+void audio_get_output_info(AudioOutputInfo *info);
+
+// Callback timing statistics since the previous call; resets them.
+void audio_take_jitter(AudioJitter *jitter);
+
 #endif
@@ -0,0 +1,818 @@
+#define _DEFAULT_SOURCE
+
+#include "dirlist.h"
+#include "natsort.h"
+#include "plfile.h"
+#include "pool.h"
+#include "tags.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COUNT_SEND_MS 50            // counts go back at least this often
+#define COUNT_CACHE_MAX (1u << 18)  // cached counts; all dropped beyond
+
+// Entries read by a job, handed over to the owner in one piece
+typedef struct DirBatch {
+    struct DirBatch *next;
+    uint32_t slot;
+    uint32_t serial;
+    bool first;        // the listing starts over with this batch
+    bool last;         // the read is over
+    bool unchanged;    // the mtime matched: the listing is still right
+    bool failed;
+    int64_t mtime_ns;
+    StrArena names;
+    DirListEntry *entries;
+    uint32_t count;
+    uint32_t capacity;
+} DirBatch;
+
+// Directories counted since the last batch
+typedef struct {
+    uint32_t index;    // into the listing's entries
+    uint32_t tracks;
+    uint32_t seconds;
+    int64_t mtime_ns;
+} CountResult;
+
+typedef struct CountBatch {
+    struct CountBatch *next;
+    uint32_t slot;
+    uint32_t serial;
+    bool last;
+    uint32_t count;
+    CountResult results[DIRLIST_BATCH];
+} CountBatch;
+
+// A cached count. Keys are 64-bit hashes of the full path: a collision
+// would take billions of directories, and costs only a wrong count.
+typedef struct {
+    uint64_t key;      // 0 for an empty slot
+    int64_t mtime_ns;
+    uint32_t tracks;
+    uint32_t seconds;
+} DirCount;
+
+struct DirList {
+    bool locale_sort;
+    bool (*is_audio)(const char *name);
+    PoolGroup group;
+    PoolGroup count_group;   // counting for the listing last asked for
+    int refs;    // the owner plus every queued or running job
+
+    pthread_mutex_t lock;   // guards the batch lists
+    DirBatch *head;
+    DirBatch *tail;
+    CountBatch *count_head;
+    CountBatch *count_tail;
+
+    // Owner only
+    DirListing slots[DIRLIST_CACHE];
+    int current;       // slot last asked for, -1 if none
+    uint64_t clock;    // for DirListing.used
+    uint32_t serial;
+    DirCount *counts;  // open addressing, linear probing
+    uint32_t counts_mask;
+    uint32_t counts_used;
+};
+
+typedef struct {
+    DirList *dl;
+    uint32_t slot;
+    uint32_t serial;
+    int64_t known_mtime_ns;   // skip reading if it still matches; 0 to read anyway
+    bool stream;              // send batches as they fill, not one at the end
+    char path[];
+} ListJob;
+
+typedef struct {
+    uint32_t index;
+    uint32_t name;             // offset into CountJob.names
+    int64_t known_mtime_ns;    // of the cached count, 0 if none
+} CountItem;
+
+typedef struct {
+    DirList *dl;
+    uint32_t slot;
+    uint32_t serial;
+    StrArena names;
+    CountItem *items;
+    uint32_t count;
+    char path[];
+} CountJob;
+
+static void batch_free(DirBatch *batch) {
+    strarena_free(&batch->names);
+    free(batch->entries);
+    free(batch);
+}
+
+static void destroy(DirList *dl) {
+    DirBatch *batch = dl->head;
+    while (batch) {
+        DirBatch *next = batch->next;
+        batch_free(batch);
+        batch = next;
+    }
+    CountBatch *counted = dl->count_head;
+    while (counted) {
+        CountBatch *next = counted->next;
+        free(counted);
+        counted = next;
+    }
+    free(dl->counts);
+    for (int i = 0; i < DIRLIST_CACHE; i++) {
+        free(dl->slots[i].path);
+        strarena_free(&dl->slots[i].names);
+        free(dl->slots[i].entries);
+        free(dl->slots[i].by_prefix);
+    }
+    pthread_mutex_destroy(&dl->lock);
+    free(dl);
+}
+
+static void unref(DirList *dl) {
+    if (__atomic_sub_fetch(&dl->refs, 1, __ATOMIC_ACQ_REL) == 0) destroy(dl);
+}
+
+static DirBatch *new_batch(const ListJob *job, bool first, int64_t mtime_ns) {
+    DirBatch *batch = calloc(1, sizeof(DirBatch));
+    if (!batch) return NULL;
+    batch->slot = job->slot;
+    batch->serial = job->serial;
+    batch->first = first;
+    batch->mtime_ns = mtime_ns;
+    return batch;
+}
+
+static bool batch_add(DirBatch *batch, const char *name, uint8_t kind) {
+    if (batch->count == batch->capacity) {
+        uint32_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+        DirListEntry *entries = realloc(batch->entries, capacity * sizeof(DirListEntry));
+        if (!entries) return false;
+        batch->entries = entries;
+        batch->capacity = capacity;
+    }
+    DirListEntry *entry = &batch->entries[batch->count];
+    if (!strarena_push(&batch->names, name, strlen(name), &entry->name)) return false;
+    entry->kind = kind;
+    entry->counted = false;
+    entry->tracks = 0;
+    entry->seconds = 0;
+    batch->count++;
+    return true;
+}
+
+static void send(DirList *dl, DirBatch *batch) {
+    pthread_mutex_lock(&dl->lock);
+    if (dl->tail) dl->tail->next = batch;
+    else dl->head = batch;
+    dl->tail = batch;
+    pthread_mutex_unlock(&dl->lock);
+}
+
+// DIRLIST_DIR or DIRLIST_PLAYLIST, or -1 to leave the entry out. Links
+// are followed, since the browser opens them like what they point to.
+static int entry_kind(int fd, const struct dirent *entry) {
+    unsigned char type = entry->d_type;
+    if (type == DT_LNK || type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(fd, entry->d_name, &st, 0) != 0) return -1;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+    if (type == DT_DIR) return DIRLIST_DIR;
+    if (type == DT_REG && plfile_format(entry->d_name) != PLFILE_UNKNOWN) return DIRLIST_PLAYLIST;
+    return -1;
+}
+
+static void read_listing(ListJob *job, const PoolToken *token) {
+    DirList *dl = job->dl;
+    DirBatch *batch = new_batch(job, true, 0);
+    if (!batch) return;
+
+    int fd = open(job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = NULL;
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        batch->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        if (job->known_mtime_ns != 0 && batch->mtime_ns == job->known_mtime_ns) {
+            close(fd);
+            batch->unchanged = true;
+            batch->last = true;
+            send(dl, batch);
+            return;
+        }
+        dir = fdopendir(fd);
+    }
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        batch->failed = true;
+        batch->last = true;
+        send(dl, batch);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip hidden entries and . / ..
+        if (entry->d_name[0] == '.') continue;
+        if (pool_cancelled(token)) break;
+
+        int kind = entry_kind(dirfd(dir), entry);
+        if (kind < 0) continue;
+        if (!batch_add(batch, entry->d_name, (uint8_t)kind)) break;
+
+        if (job->stream && batch->count == DIRLIST_BATCH) {
+            DirBatch *next = new_batch(job, false, batch->mtime_ns);
+            if (!next) break;
+            send(dl, batch);
+            batch = next;
+        }
+    }
+    closedir(dir);
+
+    batch->last = true;
+    send(dl, batch);
+}
+
+static void list_job(void *arg, const PoolToken *token) {
+    ListJob *job = arg;
+    DirList *dl = job->dl;
+    if (!pool_cancelled(token)) read_listing(job, token);
+    free(job);
+    unref(dl);
+}
+
+// Read a cached listing's directory in the background
+static void submit(DirList *dl, int slot, int64_t known_mtime_ns, bool stream) {
+    DirListing *listing = &dl->slots[slot];
+    size_t len = strlen(listing->path);
+    ListJob *job = malloc(sizeof(ListJob) + len + 1);
+    listing->serial = ++dl->serial;
+    listing->reading = job != NULL;
+    if (!job) {
+        listing->done = true;
+        return;
+    }
+
+    job->dl = dl;
+    job->slot = (uint32_t)slot;
+    job->serial = listing->serial;
+    job->known_mtime_ns = known_mtime_ns;
+    job->stream = stream;
+    memcpy(job->path, listing->path, len + 1);
+
+    __atomic_fetch_add(&dl->refs, 1, __ATOMIC_RELAXED);
+    if (!pool_submit(POOL_LANE_INTERACTIVE, &dl->group, list_job, job)) {
+        free(job);
+        listing->reading = false;
+        listing->done = true;
+        unref(dl);
+    }
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static void send_counts(DirList *dl, CountBatch *batch) {
+    pthread_mutex_lock(&dl->lock);
+    if (dl->count_tail) dl->count_tail->next = batch;
+    else dl->count_head = batch;
+    dl->count_tail = batch;
+    pthread_mutex_unlock(&dl->lock);
+}
+
+static CountBatch *new_count_batch(const CountJob *job) {
+    CountBatch *batch = calloc(1, sizeof(CountBatch));
+    if (!batch) return NULL;
+    batch->slot = job->slot;
+    batch->serial = job->serial;
+    return batch;
+}
+
+// Audio files directly inside a directory, taken the way playlist_scan()
+// takes them, and their total duration from the tags
+static void count_audio(const CountJob *job, int fd, const char *name, CountResult *result,
+                        const PoolToken *token) {
+    int dir_fd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) return;
+    DIR *dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+
+    uint64_t duration_ms = 0;
+    struct dirent *entry;
+    while (!pool_cancelled(token) && (entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) continue;
+        if (!job->dl->is_audio(entry->d_name)) continue;
+        result->tracks++;
+
+        char path[PLFILE_PATH_MAX];
+        Tags tags;
+        int n = snprintf(path, sizeof(path), "%s/%s/%s", job->path, name, entry->d_name);
+        if (n >= 0 && (size_t)n < sizeof(path) && tags_read(path, &tags)) duration_ms += tags.duration_ms;
+    }
+    closedir(dir);
+    result->seconds = (uint32_t)(duration_ms / 1000);
+}
+
+static void count_job(void *arg, const PoolToken *token) {
+    CountJob *job = arg;
+    DirList *dl = job->dl;
+
+    CountBatch *batch = pool_cancelled(token) ? NULL : new_count_batch(job);
+    int fd = batch ? open(job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (fd >= 0) {
+        double sent_ms = now_ms();
+        for (uint32_t i = 0; i < job->count && !pool_cancelled(token); i++) {
+            const CountItem *item = &job->items[i];
+            const char *name = strarena_get(&job->names, item->name);
+            struct stat st;
+            if (fstatat(fd, name, &st, 0) != 0 || !S_ISDIR(st.st_mode)) continue;
+
+            // A cached count stands until the directory's entries change
+            CountResult result = {0};
+            result.index = item->index;
+            result.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            if (result.mtime_ns == item->known_mtime_ns) continue;
+            count_audio(job, fd, name, &result, token);
+            if (pool_cancelled(token)) break;
+
+            batch->results[batch->count++] = result;
+            if (batch->count == DIRLIST_BATCH || now_ms() - sent_ms >= COUNT_SEND_MS) {
+                CountBatch *next = new_count_batch(job);
+                if (!next) break;
+                send_counts(dl, batch);
+                batch = next;
+                sent_ms = now_ms();
+            }
+        }
+        close(fd);
+    }
+    if (batch) {
+        batch->last = true;
+        send_counts(dl, batch);
+    }
+
+    strarena_free(&job->names);
+    free(job->items);
+    free(job);
+    unref(dl);
+}
+
+static uint64_t hash_more(uint64_t hash, const char *s) {
+    for (; *s; s++) hash = (hash ^ (unsigned char)*s) * 1099511628211u;
+    return hash;
+}
+
+static uint64_t count_key(const char *dir, const char *name) {
+    uint64_t hash = hash_more(hash_more(hash_more(14695981039346656037u, dir), "/"), name);
+    return hash != 0 ? hash : 1;
+}
+
+static DirCount *find_count(const DirList *dl, uint64_t key) {
+    if (!dl->counts) return NULL;
+    for (uint32_t i = (uint32_t)key & dl->counts_mask; dl->counts[i].key != 0; i = (i + 1) & dl->counts_mask) {
+        if (dl->counts[i].key == key) return &dl->counts[i];
+    }
+    return NULL;
+}
+
+static void store_count(DirList *dl, uint64_t key, const CountResult *result) {
+    DirCount *count = find_count(dl, key);
+    if (!count) {
+        if (dl->counts_used >= COUNT_CACHE_MAX) {
+            memset(dl->counts, 0, ((size_t)dl->counts_mask + 1) * sizeof(DirCount));
+            dl->counts_used = 0;
+        }
+        if (!dl->counts || (dl->counts_used + 1) * 2 > dl->counts_mask + 1) {
+            // Twice the room, rehashed
+            uint32_t capacity = dl->counts ? (dl->counts_mask + 1) * 2 : 1024;
+            DirCount *counts = calloc(capacity, sizeof(DirCount));
+            if (!counts) return;
+            for (uint32_t i = 0; dl->counts && i <= dl->counts_mask; i++) {
+                if (dl->counts[i].key == 0) continue;
+                uint32_t j = (uint32_t)dl->counts[i].key & (capacity - 1);
+                while (counts[j].key != 0) j = (j + 1) & (capacity - 1);
+                counts[j] = dl->counts[i];
+            }
+            free(dl->counts);
+            dl->counts = counts;
+            dl->counts_mask = capacity - 1;
+        }
+        uint32_t i = (uint32_t)key & dl->counts_mask;
+        while (dl->counts[i].key != 0) i = (i + 1) & dl->counts_mask;
+        count = &dl->counts[i];
+        count->key = key;
+        dl->counts_used++;
+    }
+    count->mtime_ns = result->mtime_ns;
+    count->tracks = result->tracks;
+    count->seconds = result->seconds;
+}
+
+// Count a complete listing's directories in the background. Cached counts
+// are filled in right away, and read again only if their mtime changed.
+static void submit_counts(DirList *dl, int slot) {
+    DirListing *listing = &dl->slots[slot];
+    listing->count_stale = false;
+
+    size_t len = strlen(listing->path);
+    CountJob *job = calloc(1, sizeof(CountJob) + len + 1);
+    if (!job) return;
+    job->dl = dl;
+    job->slot = (uint32_t)slot;
+    job->serial = listing->count_serial = ++dl->serial;
+    memcpy(job->path, listing->path, len + 1);
+    job->items = malloc((listing->count ? listing->count : 1) * sizeof(CountItem));
+
+    bool ok = job->items != NULL;
+    for (uint32_t i = 0; ok && i < listing->count; i++) {
+        DirListEntry *entry = &listing->entries[i];
+        if (entry->kind != DIRLIST_DIR) continue;
+
+        const char *name = dirlist_name(listing, i);
+        const DirCount *cached = find_count(dl, count_key(listing->path, name));
+        entry->counted = cached != NULL;
+        entry->tracks = cached ? cached->tracks : 0;
+        entry->seconds = cached ? cached->seconds : 0;
+
+        CountItem *item = &job->items[job->count];
+        ok = strarena_push(&job->names, name, strlen(name), &item->name);
+        item->index = i;
+        item->known_mtime_ns = cached ? cached->mtime_ns : 0;
+        if (ok) job->count++;
+    }
+
+    if (ok && job->count > 0) {
+        __atomic_fetch_add(&dl->refs, 1, __ATOMIC_RELAXED);
+        if (pool_submit(POOL_LANE_BULK, &dl->count_group, count_job, job)) {
+            listing->counting = true;
+            return;
+        }
+        unref(dl);
+    }
+    strarena_free(&job->names);
+    free(job->items);
+    free(job);
+}
+
+// Drop the counting running for a listing, and count it again later
+static void stop_counting(DirList *dl, int slot) {
+    DirListing *listing = &dl->slots[slot];
+    if (listing->counting) pool_group_cancel(&dl->count_group);
+    listing->counting = false;
+    listing->count_serial = 0;
+    listing->count_stale = true;
+}
+
+static int find_slot(const DirList *dl, const char *path) {
+    for (int i = 0; i < DIRLIST_CACHE; i++) {
+        if (dl->slots[i].path && strcmp(dl->slots[i].path, path) == 0) return i;
+    }
+    return -1;
+}
+
+// An empty slot, or else the least recently used one
+static int evict(DirList *dl) {
+    int oldest = 0;
+    for (int i = 0; i < DIRLIST_CACHE; i++) {
+        if (!dl->slots[i].path) return i;
+        if (dl->slots[i].used < dl->slots[oldest].used) oldest = i;
+    }
+    stop_counting(dl, oldest);
+    DirListing *listing = &dl->slots[oldest];
+    free(listing->path);
+    listing->path = NULL;
+    return oldest;
+}
+
+// Append a batch to the listing's pending entries. Returns true if the
+// entries changed.
+static bool take_batch(DirListing *listing, const DirBatch *batch) {
+    if (batch->last) listing->reading = false;
+    if (batch->unchanged) {
+        // Still worth checking the directories, whose own mtimes don't
+        // show in it
+        listing->done = true;
+        listing->count_stale = true;
+        return false;
+    }
+    if (batch->first) {
+        strarena_clear(&listing->names);
+        listing->count = 0;
+        listing->pending = 0;
+        listing->failed = batch->failed;
+        listing->mtime_ns = batch->mtime_ns;
+    }
+    listing->done = batch->last;
+
+    uint32_t read = listing->count + listing->pending;
+    uint32_t needed = read + batch->count;
+    if (needed > listing->capacity) {
+        if (needed > UINT32_MAX / 2) return true;
+        uint32_t capacity = listing->capacity ? listing->capacity : 64;
+        while (capacity < needed) capacity *= 2;
+        DirListEntry *entries = realloc(listing->entries, (size_t)capacity * sizeof(DirListEntry));
+        if (!entries) return true;
+        listing->entries = entries;
+        listing->capacity = capacity;
+    }
+    for (uint32_t i = 0; i < batch->count; i++) {
+        const char *name = strarena_get(&batch->names, batch->entries[i].name);
+        DirListEntry *entry = &listing->entries[listing->count + listing->pending];
+        *entry = batch->entries[i];
+        if (!strarena_push(&listing->names, name, strlen(name), &entry->name)) break;
+        listing->pending++;
+    }
+    return true;
+}
+
+static __thread const DirListing *prefix_listing;
+
+// Kind, then name with ASCII letters folded, as dirlist_seek() matches
+static int compare_entries(const DirListing *listing, uint32_t x, uint32_t y) {
+    if (listing->entries[x].kind != listing->entries[y].kind) {
+        return listing->entries[x].kind < listing->entries[y].kind ? -1 : 1;
+    }
+    int cmp = strcasecmp(dirlist_name(listing, x), dirlist_name(listing, y));
+    return cmp ? cmp : strcmp(dirlist_name(listing, x), dirlist_name(listing, y));
+}
+
+static int compare_prefix_order(const void *a, const void *b) {
+    return compare_entries(prefix_listing, *(const uint32_t *)a, *(const uint32_t *)b);
+}
+
+// Natural order doesn't keep names that start alike together ("200 x"
+// sorts between "19 x" and "1999 x"), so type-ahead searches its own
+// index. Out of memory, dirlist_seek() scans instead.
+static void index_prefixes(DirListing *listing) {
+    uint32_t count = listing->count;
+    uint32_t *by_prefix = realloc(listing->by_prefix, (count ? count : 1) * sizeof(uint32_t));
+    if (!by_prefix) {
+        free(listing->by_prefix);
+        listing->by_prefix = NULL;
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) by_prefix[i] = i;
+    prefix_listing = listing;
+    qsort(by_prefix, count, sizeof(uint32_t), compare_prefix_order);
+    prefix_listing = NULL;
+    listing->by_prefix = by_prefix;
+}
+
+// Sort the pending entries in with the rest: directories, then playlist
+// files, each in natural order. Entries already shown are sorted again
+// along with them, so while a big directory streams in this only runs
+// once the pending entries are as many as those shown (or the read is
+// over), for O(n log n) in all.
+static void sort_listing(const DirList *dl, DirListing *listing) {
+    uint32_t count = listing->count + listing->pending;
+    listing->count = count;
+    listing->pending = 0;
+    if (count < 2) {
+        index_prefixes(listing);
+        return;
+    }
+
+    const char **names = malloc(count * sizeof(char *));
+    uint32_t *order = malloc(count * sizeof(uint32_t));
+    DirListEntry *sorted = malloc(count * sizeof(DirListEntry));
+    if (names && order && sorted) {
+        for (uint32_t i = 0; i < count; i++) names[i] = dirlist_name(listing, i);
+        if (natsort_order(names, count, dl->locale_sort, order)) {
+            uint32_t n = 0;
+            for (uint8_t kind = DIRLIST_DIR; kind <= DIRLIST_PLAYLIST; kind++) {
+                for (uint32_t i = 0; i < count; i++) {
+                    if (listing->entries[order[i]].kind == kind) sorted[n++] = listing->entries[order[i]];
+                }
+            }
+            memcpy(listing->entries, sorted, count * sizeof(DirListEntry));
+        }
+    }
+    free(names);
+    free(order);
+    free(sorted);
+    index_prefixes(listing);
+}
+
+DirList *dirlist_open(bool locale_sort, bool (*is_audio)(const char *name)) {
+    DirList *dl = pool_thread_count() > 0 ? calloc(1, sizeof(DirList)) : NULL;
+    if (!dl) return NULL;
+    dl->locale_sort = locale_sort;
+    dl->is_audio = is_audio;
+    dl->refs = 1;
+    dl->current = -1;
+    pthread_mutex_init(&dl->lock, NULL);
+    return dl;
+}
+
+void dirlist_close(DirList *dl) {
+    if (!dl) return;
+    pool_group_cancel(&dl->group);
+    pool_group_cancel(&dl->count_group);
+    unref(dl);
+}
+
+const DirListing *dirlist_get(DirList *dl, const char *path) {
+    int slot = find_slot(dl, path);
+    if (dl->current >= 0 && dl->current != slot) stop_counting(dl, dl->current);
+    if (slot >= 0) {
+        // Shown as it was, and read again if it changed since
+        DirListing *listing = &dl->slots[slot];
+        listing->used = ++dl->clock;
+        dl->current = slot;
+        if (listing->done && !listing->reading) submit(dl, slot, listing->failed ? 0 : listing->mtime_ns, false);
+        return listing;
+    }
+
+    char *copy = strdup(path);
+    if (!copy) return NULL;
+    slot = evict(dl);
+    DirListing *listing = &dl->slots[slot];
+    listing->path = copy;
+    strarena_clear(&listing->names);
+    listing->count = 0;
+    listing->done = false;
+    listing->failed = false;
+    listing->pending = 0;
+    listing->counting = false;
+    listing->count_stale = true;
+    listing->count_serial = 0;
+    listing->mtime_ns = 0;
+    listing->used = ++dl->clock;
+    dl->current = slot;
+    submit(dl, slot, 0, true);
+    return listing;
+}
+
+void dirlist_invalidate(DirList *dl, const char *path) {
+    int slot = find_slot(dl, path);
+    if (slot >= 0) submit(dl, slot, 0, false);
+}
+
+bool dirlist_poll(DirList *dl) {
+    pthread_mutex_lock(&dl->lock);
+    DirBatch *batch = dl->head;
+    CountBatch *counted = dl->count_head;
+    dl->head = NULL;
+    dl->tail = NULL;
+    dl->count_head = NULL;
+    dl->count_tail = NULL;
+    pthread_mutex_unlock(&dl->lock);
+
+    bool changed = false;
+    while (batch) {
+        DirBatch *next = batch->next;
+        int slot = (int)batch->slot;
+        DirListing *listing = &dl->slots[slot];
+        if (listing->path && listing->serial == batch->serial && take_batch(listing, batch)) {
+            // Counts in flight are for the old entries
+            stop_counting(dl, slot);
+            changed |= slot == dl->current;
+        }
+        batch_free(batch);
+        batch = next;
+    }
+
+    // Once per call however many batches came in
+    for (int i = 0; i < DIRLIST_CACHE; i++) {
+        DirListing *listing = &dl->slots[i];
+        if (listing->path && listing->pending > 0 && (listing->done || listing->pending >= listing->count)) {
+            sort_listing(dl, listing);
+            changed |= i == dl->current;
+        }
+    }
+
+    while (counted) {
+        CountBatch *next = counted->next;
+        DirListing *listing = &dl->slots[counted->slot];
+        if (listing->path && listing->count_serial == counted->serial) {
+            for (uint32_t i = 0; i < counted->count; i++) {
+                const CountResult *result = &counted->results[i];
+                DirListEntry *entry = &listing->entries[result->index];
+                entry->counted = true;
+                entry->tracks = result->tracks;
+                entry->seconds = result->seconds;
+                store_count(dl, count_key(listing->path, dirlist_name(listing, result->index)), result);
+            }
+            if (counted->last) listing->counting = false;
+            changed |= counted->count > 0 && (int)counted->slot == dl->current;
+        }
+        free(counted);
+        counted = next;
+    }
+
+    // Only the listing on screen is counted
+    if (dl->current >= 0) {
+        DirListing *listing = &dl->slots[dl->current];
+        if (listing->count_stale && listing->done && !listing->reading && !listing->counting && !listing->failed) {
+            submit_counts(dl, dl->current);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+const char *dirlist_name(const DirListing *listing, uint32_t index) {
+    return strarena_get(&listing->names, listing->entries[index].name);
+}
+
+// First entry of [lo, hi) that doesn't sort before prefix
+static uint32_t lower_bound(const DirList *dl, const DirListing *listing, uint32_t lo, uint32_t hi,
+                            const char *prefix) {
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (natsort_compare(dirlist_name(listing, mid), prefix, dl->locale_sort) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Directories are the entries before this
+static uint32_t dir_count(const DirListing *listing) {
+    uint32_t lo = 0, hi = listing->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (listing->entries[mid].kind == DIRLIST_DIR) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+uint32_t dirlist_find(const DirList *dl, const DirListing *listing, const char *name) {
+    uint32_t dirs = dir_count(listing);
+    uint32_t dir = lower_bound(dl, listing, 0, dirs, name);
+    if (dir < dirs && strcmp(dirlist_name(listing, dir), name) == 0) return dir;
+    uint32_t file = lower_bound(dl, listing, dirs, listing->count, name);
+    if (file < listing->count && strcmp(dirlist_name(listing, file), name) == 0) return file;
+    return listing->count;
+}
+
+// First position of [lo, hi) in by_prefix whose name doesn't sort before
+// prefix, ignoring ASCII case
+static uint32_t prefix_bound(const DirListing *listing, uint32_t lo, uint32_t hi, const char *prefix) {
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcasecmp(dirlist_name(listing, listing->by_prefix[mid]), prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// The same choice as the binary search, without the index, in O(n)
+static uint32_t scan_prefix(const DirListing *listing, const char *prefix) {
+    size_t len = strlen(prefix);
+    uint32_t best = listing->count;
+    bool best_matches = false;
+    for (uint32_t i = 0; i < listing->count; i++) {
+        const char *name = dirlist_name(listing, i);
+        bool matches = strncasecmp(name, prefix, len) == 0;
+        if (!matches && strcasecmp(name, prefix) < 0) continue;
+        if (best < listing->count && (best_matches > matches ||
+                                      (best_matches == matches && compare_entries(listing, best, i) < 0))) {
+            continue;
+        }
+        best = i;
+        best_matches = matches;
+    }
+    return best;
+}
+
+uint32_t dirlist_seek(const DirListing *listing, const char *prefix) {
+    if (listing->count == 0) return 0;
+
+    uint32_t found;
+    if (listing->by_prefix) {
+        uint32_t dirs = dir_count(listing);
+        size_t len = strlen(prefix);
+        uint32_t dir = prefix_bound(listing, 0, dirs, prefix);
+        uint32_t file = prefix_bound(listing, dirs, listing->count, prefix);
+        if (dir < dirs && strncasecmp(dirlist_name(listing, listing->by_prefix[dir]), prefix, len) == 0) {
+            found = listing->by_prefix[dir];
+        } else if (file < listing->count &&
+                   strncasecmp(dirlist_name(listing, listing->by_prefix[file]), prefix, len) == 0) {
+            found = listing->by_prefix[file];
+        } else {
+            found = dir < dirs ? listing->by_prefix[dir] :
+                    file < listing->count ? listing->by_prefix[file] : listing->count;
+        }
+    } else {
+        found = scan_prefix(listing, prefix);
+    }
+    return found < listing->count ? found : listing->count - 1;
+}
@@ -0,0 +1,97 @@
+#ifndef DIRLIST_H
+#define DIRLIST_H
+
+#include "strarena.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Directory listings for the browser, read on the worker pool so a slow
+// file system never holds up a frame. Entries are typed by d_type, with
+// fstatat() only for symbolic links and file systems that leave it
+// unknown, and arrive in batches while the directory is still being read.
+//
+// The last DIRLIST_CACHE listings are kept, so going back to a directory
+// shows it at once. Its mtime is checked again in the background then,
+// and it is read again if it changed; dirlist_invalidate() does the same
+// for a directory inotify reported. A listing being read again keeps its
+// old entries until the new ones are complete.
+//
+// Once the listing last asked for is complete, the audio files directly
+// inside each of its directories are counted and their durations added up
+// on the bulk lane, top of the listing first. Counts are cached by path
+// with the directory's mtime, so a directory is only read again once
+// files were added, removed or renamed in it.
+
+#define DIRLIST_CACHE 16
+#define DIRLIST_BATCH 256   // entries per batch while a listing streams in
+
+typedef enum {
+    DIRLIST_DIR,
+    DIRLIST_PLAYLIST    // a file plfile_format() knows
+} DirListKind;
+
+typedef struct {
+    uint32_t name;      // offset into DirListing.names
+    uint8_t kind;
+    bool counted;       // tracks and seconds are known (directories only)
+    uint32_t tracks;    // audio files directly inside
+    uint32_t seconds;   // their total duration, as far as known
+} DirListEntry;
+
+// Hidden entries and other files are left out. Directories come first,
+// then playlist files, each in natural order (see natsort.h). There is no
+// limit on the entries; a name costs its length plus one byte in names, an
+// entry and its place in by_prefix.
+typedef struct {
+    char *path;
+    StrArena names;
+    DirListEntry *entries;
+    uint32_t count;    // sorted, shown
+    uint32_t pending;  // read after those, sorted in once they are as many
+    uint32_t capacity;
+    uint32_t *by_prefix;  // the count entries by kind and case-folded name
+    bool done;         // read to the end
+    bool failed;       // couldn't be opened
+    bool reading;      // a read or an mtime check is running
+    bool counting;     // directories are being counted
+    bool count_stale;  // count them once the listing is complete
+    int64_t mtime_ns;  // of the directory as read
+    uint32_t serial;   // of the latest read; older results are dropped
+    uint32_t count_serial;
+    uint64_t used;     // when last asked for, for eviction
+} DirListing;
+
+typedef struct DirList DirList;
+
+// is_audio picks the files directories are counted by. Returns NULL if out
+// of memory or the pool isn't running.
+DirList *dirlist_open(bool locale_sort, bool (*is_audio)(const char *name));
+void dirlist_close(DirList *dl);
+
+// Listing of path, from the cache or empty while it is being read. The
+// pointer stays valid until another path is asked for; the entries change
+// in dirlist_poll(). Returns NULL if out of memory.
+const DirListing *dirlist_get(DirList *dl, const char *path);
+
+// Read path again if it is cached. Its entries stay until then.
+void dirlist_invalidate(DirList *dl, const char *path);
+
+// Take in the entries read and the directories counted since the last
+// call. Returns true if the listing last asked for changed.
+bool dirlist_poll(DirList *dl);
+
+const char *dirlist_name(const DirListing *listing, uint32_t index);
+
+// Index of the entry with exactly this name, count if there is none. Binary
+// search, like dirlist_seek().
+uint32_t dirlist_find(const DirList *dl, const DirListing *listing, const char *name);
+
+// Type-ahead: the entry whose name starts with prefix (ignoring ASCII
+// case), directories before playlist files, found by binary search in
+// by_prefix in O(log n) comparisons. Of several, the first in case-folded
+// byte order; without one, the entry that follows prefix in that order, or
+// the last entry. 0 if the listing is empty.
+uint32_t dirlist_seek(const DirListing *listing, const char *prefix);
+
+#endif
@@ -0,0 +1,815 @@
+#define _DEFAULT_SOURCE
+
+#include "flacpar.h"
+
+#include <FLAC/stream_decoder.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STREAMINFO_SIZE 34
+#define SEEKPOINT_SIZE 18
+#define SEEKPOINT_PLACEHOLDER 0xFFFFFFFFFFFFFFFFULL
+#define SYNC_SCAN_CHUNK (64 * 1024)
+#define FRAME_HEADER_MAX 16
+
+// Synthetic stream header handed to every decoder instance: "fLaC" followed
+// by a single STREAMINFO block flagged as the last metadata block.
+#define PREFIX_SIZE (4 + 4 + STREAMINFO_SIZE)
+
+typedef struct {
+    int fd;
+    uint64_t audio_start;  // offset of the first frame
+    uint64_t audio_end;    // end of frame data (trailing ID3v1 tag excluded)
+    unsigned char streaminfo[STREAMINFO_SIZE];
+    FlacParInfo info;
+    unsigned int min_blocksize;
+    unsigned int max_framesize;   // 0 if unknown
+    bool variable_blocksize;  // blocking strategy bit of the first frame
+
+    // Non-placeholder seek points, as absolute file offsets
+    uint64_t *seek_offsets;
+    int seek_count;
+} FlacFile;
+
+typedef enum {
+    SEGMENT_PENDING,
+    SEGMENT_RUNNING,
+    SEGMENT_DONE
+} SegmentState;
+
+typedef struct {
+    uint64_t start, end;  // byte range [start, end)
+    SegmentState state;
+    bool ok;              // decoded to the end, errors or not
+    int errors;           // decoder errors it resynced after
+
+    float *samples;       // interleaved, info.channels per frame
+    size_t frames;
+    size_t capacity;      // in frames
+    uint64_t first_frame;
+    bool has_first;
+} Segment;
+
+typedef struct FlacParJob FlacParJob;
+
+typedef struct {
+    FlacParJob *job;
+    pthread_t thread;
+    FLAC__StreamDecoder *decoder;
+    Segment *seg;
+    uint64_t pos;          // next file offset to read within seg
+    size_t prefix_pos;     // bytes of the synthetic header already served
+    int errors;            // decoder errors in the current segment
+    double decode_seconds;
+} Worker;
+
+struct FlacParJob {
+    FlacFile file;
+    unsigned char prefix[PREFIX_SIZE];
+
+    Segment *segs;
+    int seg_count;
+
+    // Protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int next;       // next segment to claim
+    int delivered;  // segments handed to the callback and freed
+    int window;     // max segments decoded ahead of delivery
+    bool abort;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool read_at(int fd, void *buf, size_t len, uint64_t offset) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+static uint64_t read_be(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static unsigned char crc8(const unsigned char *p, size_t len) {
+    unsigned char crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t crc16(uint16_t crc, const unsigned char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(p[i] << 8);
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Whether bytes [start, end) of the file are a whole frame: the CRC-16 in
+// its last two bytes matches the rest
+static bool check_frame_crc(const FlacFile *f, uint64_t start, uint64_t end) {
+    if (end < start + 2 + 2) return false;
+    unsigned char buf[4096];
+    uint16_t crc = 0;
+    for (uint64_t off = start; off < end - 2;) {
+        size_t n = end - 2 - off < sizeof(buf) ? (size_t)(end - 2 - off) : sizeof(buf);
+        if (!read_at(f->fd, buf, n, off)) return false;
+        crc = crc16(crc, buf, n);
+        off += n;
+    }
+    if (!read_at(f->fd, buf, 2, end - 2)) return false;
+    return crc == (uint16_t)(buf[0] << 8 | buf[1]);
+}
+
+// Validate a frame header at p. Returns the stream position of the frame's
+// first sample, or -1 if p does not look like a frame belonging to this file.
+// Sets *blocksize to the frame's sample frames.
+static int64_t check_frame_header(const FlacFile *f, const unsigned char *p, size_t avail,
+                                  unsigned int *blocksize) {
+    static const unsigned int rates[12] = {
+        0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000
+    };
+    static const unsigned int sizes[8] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+
+    if (avail < 6) return -1;
+    if (p[0] != 0xFF || (p[1] & 0xFE) != 0xF8) return -1;
+    if ((bool)(p[1] & 1) != f->variable_blocksize) return -1;
+
+    unsigned int bs_code = p[2] >> 4;
+    unsigned int sr_code = p[2] & 0x0F;
+    unsigned int ch_code = p[3] >> 4;
+    unsigned int ss_code = (p[3] >> 1) & 0x07;
+    if (bs_code == 0 || sr_code == 0x0F || ss_code == 3 || (p[3] & 1)) return -1;
+    if (ch_code > 10) return -1;
+
+    // Cross-check against STREAMINFO so random data rarely passes
+    unsigned int channels = ch_code < 8 ? ch_code + 1 : 2;
+    if (channels != f->info.channels) return -1;
+    if (ss_code != 0 && sizes[ss_code] != f->info.bits_per_sample) return -1;
+    if (sr_code >= 1 && sr_code <= 11 && rates[sr_code] != f->info.sample_rate) return -1;
+
+    // UTF-8 style coded frame/sample number
+    size_t i = 4;
+    unsigned char b = p[i];
+    int extra;
+    uint64_t number;
+    if (!(b & 0x80))             { extra = 0; number = b; }
+    else if ((b & 0xE0) == 0xC0) { extra = 1; number = b & 0x1F; }
+    else if ((b & 0xF0) == 0xE0) { extra = 2; number = b & 0x0F; }
+    else if ((b & 0xF8) == 0xF0) { extra = 3; number = b & 0x07; }
+    else if ((b & 0xFC) == 0xF8) { extra = 4; number = b & 0x03; }
+    else if ((b & 0xFE) == 0xFC) { extra = 5; number = b & 0x01; }
+    else if (b == 0xFE)          { extra = 6; number = 0; }
+    else return -1;
+    i++;
+    if (i + (size_t)extra >= avail) return -1;
+    for (int k = 0; k < extra; k++, i++) {
+        if ((p[i] & 0xC0) != 0x80) return -1;
+        number = (number << 6) | (p[i] & 0x3F);
+    }
+
+    size_t bs_at = i;
+    if (bs_code == 6) i += 1;
+    else if (bs_code == 7) i += 2;
+    if (sr_code == 12) i += 1;
+    else if (sr_code == 13 || sr_code == 14) i += 2;
+
+    if (i >= avail || crc8(p, i) != p[i]) return -1;
+
+    if (bs_code == 1) *blocksize = 192;
+    else if (bs_code <= 5) *blocksize = 576u << (bs_code - 2);
+    else if (bs_code == 6) *blocksize = p[bs_at] + 1u;
+    else if (bs_code == 7) *blocksize = ((unsigned int)p[bs_at] << 8 | p[bs_at + 1]) + 1u;
+    else *blocksize = 256u << (bs_code - 8);
+
+    uint64_t sample = f->variable_blocksize ? number : number * f->min_blocksize;
+    if (f->info.total_samples > 0 && sample >= f->info.total_samples) return -1;
+    return (int64_t)sample;
+}
+
+static bool open_flac_file(FlacFile *f, const char *path) {
+    memset(f, 0, sizeof(*f));
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0) {
+        fprintf(stderr, "Failed to open file: %s\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(f->fd, &st) != 0) goto fail;
+    uint64_t size = (uint64_t)st.st_size;
+
+    // Skip a leading ID3v2 tag if present
+    unsigned char hdr[10];
+    uint64_t off = 0;
+    if (!read_at(f->fd, hdr, 10, 0)) goto fail;
+    if (memcmp(hdr, "ID3", 3) == 0) {
+        off = 10 + (((uint64_t)(hdr[6] & 0x7F) << 21) | ((uint64_t)(hdr[7] & 0x7F) << 14) |
+                    ((uint64_t)(hdr[8] & 0x7F) << 7) | (uint64_t)(hdr[9] & 0x7F));
+        if (hdr[5] & 0x10) off += 10;  // footer
+        if (!read_at(f->fd, hdr, 4, off)) goto fail;
+    }
+    if (memcmp(hdr, "fLaC", 4) != 0) {
+        fprintf(stderr, "Not a FLAC file: %s\n", path);
+        goto fail;
+    }
+    off += 4;
+
+    bool have_streaminfo = false;
+    for (;;) {
+        unsigned char block[4];
+        if (!read_at(f->fd, block, 4, off)) goto fail;
+        bool last = block[0] & 0x80;
+        int type = block[0] & 0x7F;
+        uint64_t len = read_be(block + 1, 3);
+        off += 4;
+
+        if (type == 0 && len == STREAMINFO_SIZE) {
+            if (!read_at(f->fd, f->streaminfo, STREAMINFO_SIZE, off)) goto fail;
+            have_streaminfo = true;
+        } else if (type == 3 && f->seek_offsets == NULL) {
+            size_t count = (size_t)(len / SEEKPOINT_SIZE);
+            unsigned char *raw = malloc(count * SEEKPOINT_SIZE + 1);
+            f->seek_offsets = malloc((count + 1) * sizeof(uint64_t));
+            if (!raw || !f->seek_offsets || !read_at(f->fd, raw, count * SEEKPOINT_SIZE, off)) {
+                free(raw);
+                goto fail;
+            }
+            for (size_t i = 0; i < count; i++) {
+                const unsigned char *sp = raw + i * SEEKPOINT_SIZE;
+                if (read_be(sp, 8) == SEEKPOINT_PLACEHOLDER) continue;
+                f->seek_offsets[f->seek_count++] = read_be(sp + 8, 8);  // relative, fixed up below
+            }
+            free(raw);
+        }
+
+        off += len;
+        if (last) break;
+        if (off >= size) goto fail;
+    }
+
+    if (!have_streaminfo) {
+        fprintf(stderr, "FLAC file has no STREAMINFO: %s\n", path);
+        goto fail;
+    }
+
+    const unsigned char *si = f->streaminfo;
+    f->min_blocksize = (unsigned int)read_be(si, 2);
+    f->max_framesize = (unsigned int)read_be(si + 7, 3);
+    f->info.sample_rate = (unsigned int)((si[10] << 12) | (si[11] << 4) | (si[12] >> 4));
+    f->info.channels = ((si[12] >> 1) & 0x07) + 1;
+    f->info.bits_per_sample = (unsigned int)((((si[12] & 1) << 4) | (si[13] >> 4)) + 1);
+    f->info.total_samples = ((uint64_t)(si[13] & 0x0F) << 32) | read_be(si + 14, 4);
+
+    f->audio_start = off;
+    f->audio_end = size;
+    if (size >= off + 128) {
+        unsigned char tag[3];
+        if (read_at(f->fd, tag, 3, size - 128) && memcmp(tag, "TAG", 3) == 0) {
+            f->audio_end = size - 128;
+        }
+    }
+
+    for (int i = 0; i < f->seek_count; i++) {
+        f->seek_offsets[i] += f->audio_start;
+    }
+
+    // The blocking strategy bit must match on every frame; take it from the first
+    unsigned char first[2];
+    if (!read_at(f->fd, first, 2, f->audio_start)) goto fail;
+    f->variable_blocksize = first[1] & 1;
+
+    return true;
+
+fail:
+    close(f->fd);
+    free(f->seek_offsets);
+    f->seek_offsets = NULL;
+    return false;
+}
+
+static void close_flac_file(FlacFile *f) {
+    close(f->fd);
+    free(f->seek_offsets);
+    f->seek_offsets = NULL;
+}
+
+// Whether the frame header at offset, giving sample and blocksize, starts
+// a whole frame: the header of the frame after it follows, or the end of
+// the stream, and the CRC-16 up to there matches. A header can pass the
+// checks and CRC-8 by chance inside a frame's data; the CRC-16 of the
+// bytes from it practically can't. A real frame turned down this way only
+// moves a split point.
+static bool confirm_frame(const FlacFile *f, uint64_t offset, uint64_t sample, unsigned int blocksize) {
+    uint64_t next = sample + blocksize;
+    if (f->info.total_samples > 0 && next > f->info.total_samples) return false;
+    bool last = next == f->info.total_samples;
+
+    // No frame is longer than STREAMINFO says, or than its samples stored
+    // verbatim (a side channel takes a bit more)
+    uint64_t longest = f->max_framesize;
+    if (longest == 0) {
+        longest = FRAME_HEADER_MAX + 2 +
+                  f->info.channels * (1 + ((uint64_t)blocksize * (f->info.bits_per_sample + 1) + 7) / 8);
+    }
+    unsigned char buf[SYNC_SCAN_CHUNK + FRAME_HEADER_MAX];
+    uint64_t limit = offset + longest + 1;
+    uint64_t off = offset + 1;
+    while (off < f->audio_end && off < limit) {
+        uint64_t remaining = f->audio_end - off;
+        size_t len = remaining < sizeof(buf) ? (size_t)remaining : sizeof(buf);
+        if (!read_at(f->fd, buf, len, off)) return false;
+
+        size_t scan = len > FRAME_HEADER_MAX ? len - FRAME_HEADER_MAX : len;
+        for (size_t i = 0; i < scan && off + i < limit; i++) {
+            if (buf[i] != 0xFF) continue;
+            unsigned int size;
+            int64_t at = check_frame_header(f, buf + i, len - i, &size);
+            if (at >= 0 && !last && (uint64_t)at == next && check_frame_crc(f, offset, off + i)) return true;
+        }
+        if (len < sizeof(buf)) {   // the last frame
+            return (last || f->info.total_samples == 0) && f->audio_end < limit &&
+                   check_frame_crc(f, offset, f->audio_end);
+        }
+        off += scan;
+    }
+    return false;
+}
+
+// Find the first frame boundary at or after target by scanning for sync
+// codes, confirmed by the frame after it. Returns audio_end if there is
+// none.
+static uint64_t sync_scan(const FlacFile *f, uint64_t target) {
+    unsigned char buf[SYNC_SCAN_CHUNK + FRAME_HEADER_MAX];
+    uint64_t off = target;
+
+    while (off < f->audio_end) {
+        uint64_t remaining = f->audio_end - off;
+        size_t len = remaining < sizeof(buf) ? (size_t)remaining : sizeof(buf);
+        if (!read_at(f->fd, buf, len, off)) break;
+
+        size_t scan = len > FRAME_HEADER_MAX ? len - FRAME_HEADER_MAX : len;
+        for (size_t i = 0; i < scan; i++) {
+            if (buf[i] != 0xFF) continue;
+            unsigned int blocksize;
+            int64_t sample = check_frame_header(f, buf + i, len - i, &blocksize);
+            if (sample >= 0 && confirm_frame(f, off + i, (uint64_t)sample, blocksize)) {
+                return off + i;
+            }
+        }
+        if (len < sizeof(buf)) break;
+        off += scan;
+    }
+    return f->audio_end;
+}
+
+// Closest seek point at or before target, if it falls within half a segment.
+static bool seektable_lookup(const FlacFile *f, uint64_t target, uint64_t *out) {
+    int lo = 0, hi = f->seek_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (f->seek_offsets[mid] <= target) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return false;
+    uint64_t point = f->seek_offsets[lo - 1];
+    if (target - point > FLACPAR_SEGMENT_BYTES / 2) return false;
+    *out = point;
+    return true;
+}
+
+static bool plan_segments(FlacParJob *job, int threads, bool *used_seektable) {
+    FlacFile *f = &job->file;
+    uint64_t span = f->audio_end - f->audio_start;
+
+    uint64_t count = span / FLACPAR_SEGMENT_BYTES;
+    if (count < (uint64_t)threads) count = (uint64_t)threads;
+    if (count > span / 64 + 1) count = span / 64 + 1;
+    if (count < 1) count = 1;
+
+    job->segs = calloc((size_t)count, sizeof(Segment));
+    if (!job->segs) return false;
+
+    *used_seektable = false;
+    uint64_t prev = f->audio_start;
+    int n = 0;
+    for (uint64_t k = 1; k < count; k++) {
+        uint64_t target = f->audio_start + span / count * k;
+        uint64_t boundary;
+        if (seektable_lookup(f, target, &boundary) && boundary > prev) {
+            *used_seektable = true;
+        } else {
+            boundary = sync_scan(f, target);
+        }
+        if (boundary <= prev || boundary >= f->audio_end) continue;
+
+        job->segs[n].start = prev;
+        job->segs[n].end = boundary;
+        n++;
+        prev = boundary;
+    }
+    job->segs[n].start = prev;
+    job->segs[n].end = f->audio_end;
+    job->seg_count = n + 1;
+    return true;
+}
+
+static FLAC__StreamDecoderReadStatus worker_read(
+    const FLAC__StreamDecoder *decoder,
+    FLAC__byte buffer[],
+    size_t *bytes,
+    void *client_data)
+{
+    (void)decoder;
+    Worker *w = client_data;
+    size_t want = *bytes;
+    size_t got = 0;
+
+    if (w->prefix_pos < PREFIX_SIZE) {
+        size_t n = PREFIX_SIZE - w->prefix_pos;
+        if (n > want) n = want;
+        memcpy(buffer, w->job->prefix + w->prefix_pos, n);
+        w->prefix_pos += n;
+        got += n;
+    }
+
+    uint64_t remaining = w->seg->end - w->pos;
+    size_t n = want - got;
+    if (n > remaining) n = (size_t)remaining;
+    if (n > 0) {
+        if (!read_at(w->job->file.fd, buffer + got, n, w->pos)) {
+            return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+        }
+        w->pos += n;
+        got += n;
+    }
+
+    *bytes = got;
+    return got == 0 ? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM
+                    : FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+// Room for frames more sample frames at the end of a segment
+static bool reserve(Segment *s, size_t frames, unsigned int channels) {
+    if (s->frames + frames <= s->capacity) return true;
+    size_t cap = s->capacity ? s->capacity * 2 : 65536;
+    while (cap < s->frames + frames) cap *= 2;
+    float *grown = realloc(s->samples, cap * channels * sizeof(float));
+    if (!grown) return false;
+    s->samples = grown;
+    s->capacity = cap;
+    return true;
+}
+
+// Frames arrive in order, but the decoder drops one it can't decode and
+// goes on with the next it finds. The gap is filled with silence, so the
+// segment stays one run of samples.
+static FLAC__StreamDecoderWriteStatus worker_write(
+    const FLAC__StreamDecoder *decoder,
+    const FLAC__Frame *frame,
+    const FLAC__int32 *const buffer[],
+    void *client_data)
+{
+    (void)decoder;
+    Worker *w = client_data;
+    Segment *s = w->seg;
+    const FlacFile *f = &w->job->file;
+    unsigned int channels = f->info.channels;
+    unsigned int blocksize = frame->header.blocksize;
+
+    if (frame->header.channels != channels) {
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    uint64_t at;
+    if (frame->header.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER) {
+        at = frame->header.number.sample_number;
+    } else {
+        at = (uint64_t)frame->header.number.frame_number * f->min_blocksize;
+    }
+    if (!s->has_first) {
+        s->first_frame = at;
+        s->has_first = true;
+    }
+    uint64_t next = s->first_frame + s->frames;
+    if (at < next) return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+    size_t gap = (size_t)(at - next);
+    if (!reserve(s, gap + blocksize, channels)) return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    memset(s->samples + s->frames * channels, 0, gap * channels * sizeof(float));
+    s->frames += gap;
+
+    float scale = 1.0f / (float)(1ULL << (frame->header.bits_per_sample - 1));
+    float *out = s->samples + s->frames * channels;
+    for (unsigned int i = 0; i < blocksize; i++) {
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            *out++ = (float)buffer[ch][i] * scale;
+        }
+    }
+    s->frames += blocksize;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void worker_error(
+    const FLAC__StreamDecoder *decoder,
+    FLAC__StreamDecoderErrorStatus status,
+    void *client_data)
+{
+    (void)decoder;
+    (void)status;
+    Worker *w = client_data;
+    w->errors++;
+}
+
+// Decode a segment, resyncing after errors as a decoder reading the whole
+// file would; s->errors counts them. Returns false if the decoder gave up.
+static bool decode_segment(Worker *w, Segment *s) {
+    w->seg = s;
+    w->pos = s->start;
+    w->prefix_pos = 0;
+    w->errors = 0;
+
+    FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_stream(
+        w->decoder, worker_read, NULL, NULL, NULL, NULL,
+        worker_write, NULL, worker_error, w);
+    if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        return false;
+    }
+
+    FLAC__stream_decoder_process_until_end_of_stream(w->decoder);
+    bool ok = FLAC__stream_decoder_get_state(w->decoder) == FLAC__STREAM_DECODER_END_OF_STREAM;
+    FLAC__stream_decoder_finish(w->decoder);
+    s->errors = w->errors;
+    return ok;
+}
+
+// Hand frames sample frames of silence to fn, starting at first_frame
+static void deliver_silence(const FlacParInfo *info, uint64_t first_frame, uint64_t frames,
+                            FlacParBlockFn fn, void *user) {
+    static const float zeros[4096];
+    size_t chunk = sizeof(zeros) / sizeof(zeros[0]) / info->channels;
+    while (frames > 0) {
+        size_t n = frames < chunk ? (size_t)frames : chunk;
+        fn(info, zeros, n, first_frame, user);
+        first_frame += n;
+        frames -= n;
+    }
+}
+
+static void wait_done(FlacParJob *job, const Segment *s) {
+    pthread_mutex_lock(&job->lock);
+    while (s->state != SEGMENT_DONE) {
+        pthread_cond_wait(&job->cond, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Decode segments k and k + 1 again as one, in the calling thread, for a
+// frame that straddles a bad split point. Keeps the result in k, leaving
+// k + 1 empty, if it has fewer errors than the two had apart.
+static void merge_segments(FlacParJob *job, Worker *retry, int k) {
+    Segment *s = &job->segs[k];
+    Segment *t = &job->segs[k + 1];
+    wait_done(job, t);
+
+    if (!retry->decoder) {
+        retry->decoder = FLAC__stream_decoder_new();
+        if (!retry->decoder) return;
+        FLAC__stream_decoder_set_md5_checking(retry->decoder, false);
+    }
+    Segment merged;
+    memset(&merged, 0, sizeof(merged));
+    merged.start = s->start;
+    merged.end = t->end;
+    double t0 = now_seconds();
+    merged.ok = decode_segment(retry, &merged);
+    retry->decode_seconds += now_seconds() - t0;
+    if (!merged.ok || merged.errors >= s->errors + t->errors) {
+        free(merged.samples);
+        return;
+    }
+
+    merged.state = SEGMENT_DONE;
+    free(s->samples);
+    free(t->samples);
+    *s = merged;
+    t->samples = NULL;
+    t->frames = 0;
+    t->errors = 0;
+    t->ok = true;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    FlacParJob *job = w->job;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (!job->abort && job->next < job->seg_count &&
+               job->next >= job->delivered + job->window) {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        if (job->abort || job->next >= job->seg_count) break;
+
+        Segment *s = &job->segs[job->next++];
+        s->state = SEGMENT_RUNNING;
+        pthread_mutex_unlock(&job->lock);
+
+        double t0 = now_seconds();
+        bool ok = decode_segment(w, s);
+        w->decode_seconds += now_seconds() - t0;
+
+        pthread_mutex_lock(&job->lock);
+        s->ok = ok;
+        s->state = SEGMENT_DONE;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+bool flacpar_probe(const char *path, FlacParInfo *info) {
+    FlacFile f;
+    if (!open_flac_file(&f, path)) return false;
+    *info = f.info;
+    close_flac_file(&f);
+    return true;
+}
+
+bool flacpar_decode(const char *path, int threads, FlacParBlockFn fn, void *user,
+                    FlacParStats *stats) {
+    double t_start = now_seconds();
+
+    if (threads < 1) threads = 1;
+    if (threads > FLACPAR_MAX_THREADS) threads = FLACPAR_MAX_THREADS;
+
+    FlacParJob job;
+    memset(&job, 0, sizeof(job));
+    if (!open_flac_file(&job.file, path)) return false;
+
+    memcpy(job.prefix, "fLaC", 4);
+    job.prefix[4] = 0x80;  // last metadata block, type STREAMINFO
+    job.prefix[5] = 0;
+    job.prefix[6] = 0;
+    job.prefix[7] = STREAMINFO_SIZE;
+    memcpy(job.prefix + 8, job.file.streaminfo, STREAMINFO_SIZE);
+
+    bool used_seektable = false;
+    if (!plan_segments(&job, threads, &used_seektable)) {
+        close_flac_file(&job.file);
+        return false;
+    }
+    if (threads > job.seg_count) threads = job.seg_count;
+    job.window = threads * 2;
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    Worker workers[FLACPAR_MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].job = &job;
+        workers[i].decoder = FLAC__stream_decoder_new();
+        if (!workers[i].decoder) break;
+        FLAC__stream_decoder_set_md5_checking(workers[i].decoder, false);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            FLAC__stream_decoder_delete(workers[i].decoder);
+            workers[i].decoder = NULL;
+            break;
+        }
+        started++;
+    }
+
+    bool ok = started > 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to start FLAC decoder threads\n");
+    }
+
+    // Deliver segments in order as they complete. Like a decoder reading
+    // the whole file, errors are skipped: a segment with some is decoded
+    // again with the next one first, and the frames still lost come out as
+    // silence.
+    Worker retry;
+    memset(&retry, 0, sizeof(retry));
+    retry.job = &job;
+    const FlacParInfo *info = &job.file.info;
+    uint64_t expected = 0;
+    uint64_t delivered_frames = 0;
+    int errors = 0;
+    for (int k = 0; ok && k < job.seg_count; k++) {
+        Segment *s = &job.segs[k];
+        wait_done(&job, s);
+        if (s->ok && s->errors > 0 && k + 1 < job.seg_count) merge_segments(&job, &retry, k);
+
+        if (!s->ok) {
+            fprintf(stderr, "FLAC decode error in bytes %llu-%llu of %s\n",
+                    (unsigned long long)s->start, (unsigned long long)s->end, path);
+            ok = false;
+        } else {
+            if (s->errors > 0) {
+                fprintf(stderr, "FLAC decode errors in bytes %llu-%llu of %s, skipped\n",
+                        (unsigned long long)s->start, (unsigned long long)s->end, path);
+                errors += s->errors;
+            }
+            if (s->frames == 0) {
+                // Nothing, or merged into the segment before
+            } else if (s->first_frame > expected && errors == 0) {
+                fprintf(stderr, "FLAC frame discontinuity at sample %llu in %s\n",
+                        (unsigned long long)expected, path);
+                ok = false;
+            } else {
+                if (s->first_frame > expected) {
+                    deliver_silence(info, expected, s->first_frame - expected, fn, user);
+                    delivered_frames += s->first_frame - expected;
+                    expected = s->first_frame;
+                }
+                uint64_t skip = expected - s->first_frame;
+                if (skip < s->frames) {
+                    fn(info, s->samples + skip * info->channels, (size_t)(s->frames - skip), expected, user);
+                    delivered_frames += s->frames - skip;
+                    expected = s->first_frame + s->frames;
+                }
+            }
+        }
+
+        free(s->samples);
+        s->samples = NULL;
+
+        pthread_mutex_lock(&job.lock);
+        job.delivered = k + 1;
+        if (!ok) job.abort = true;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    double decode_seconds = retry.decode_seconds;
+    if (retry.decoder) FLAC__stream_decoder_delete(retry.decoder);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        FLAC__stream_decoder_delete(workers[i].decoder);
+        decode_seconds += workers[i].decode_seconds;
+    }
+
+    if (ok && errors > 0 && expected < info->total_samples) {
+        deliver_silence(info, expected, info->total_samples - expected, fn, user);
+        delivered_frames += info->total_samples - expected;
+        expected = info->total_samples;
+    }
+    if (ok && job.file.info.total_samples > 0 && expected != job.file.info.total_samples) {
+        fprintf(stderr, "FLAC stream ended early (%llu of %llu samples): %s\n",
+                (unsigned long long)expected,
+                (unsigned long long)job.file.info.total_samples, path);
+        ok = false;
+    }
+
+    if (stats) {
+        stats->threads = started;
+        stats->segments = job.seg_count;
+        stats->used_seektable = used_seektable;
+        stats->errors = errors;
+        stats->frames_decoded = delivered_frames;
+        stats->wall_seconds = now_seconds() - t_start;
+        stats->decode_seconds = decode_seconds;
+    }
+
+    for (int k = 0; k < job.seg_count; k++) {
+        free(job.segs[k].samples);
+    }
+    free(job.segs);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    close_flac_file(&job.file);
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef FLACPAR_H
+#define FLACPAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Upper bound on decoder instances used by flacpar_decode().
+#define FLACPAR_MAX_THREADS 16
+
+// Compressed bytes handed to one decoder instance at a time. Decoded output
+// for a segment is held in memory until it is delivered, so this bounds
+// memory use to roughly 2 * threads * (decoded size of one segment).
+#define FLACPAR_SEGMENT_BYTES (2 * 1024 * 1024)
+
+typedef struct {
+    unsigned int sample_rate;
+    unsigned int channels;
+    unsigned int bits_per_sample;
+    uint64_t total_samples;  // 0 if unknown
+} FlacParInfo;
+
+typedef struct {
+    int threads;              // decoder instances actually started
+    int segments;             // byte ranges the file was split into
+    bool used_seektable;      // split points came from SEEKTABLE (else sync scan)
+    int errors;               // decoder errors skipped; lost frames came out silent
+    uint64_t frames_decoded;  // sample frames delivered to the callback
+    double wall_seconds;      // total time spent in flacpar_decode()
+    double decode_seconds;    // decoder time summed across all workers
+} FlacParStats;
+
+// Receives decoded audio in stream order. Samples are interleaved floats in
+// [-1, 1) with all of the file's channels (no downmix). first_frame is the
+// stream position of samples[0]. Called on the thread that called
+// flacpar_decode(), never concurrently.
+typedef void (*FlacParBlockFn)(const FlacParInfo *info, const float *samples,
+                               size_t frames, uint64_t first_frame, void *user);
+
+// Read STREAMINFO from a FLAC file without setting up a decoder.
+bool flacpar_probe(const char *path, FlacParInfo *info);
+
+// Decode a whole FLAC file with up to `threads` decoder instances running in
+// parallel. The file is split at frame boundaries (taken from the SEEKTABLE
+// when present, otherwise found by scanning for frame sync codes) and the
+// results are reassembled in order before being passed to fn. Intended for
+// offline work such as analysis and export, not for playback.
+// Corrupt frames are skipped as a sequential decode would, and passed to
+// fn as silence. Returns false on error; stats may be NULL.
+bool flacpar_decode(const char *path, int threads, FlacParBlockFn fn, void *user,
+                    FlacParStats *stats);
+
+#endif
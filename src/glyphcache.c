@@ -0,0 +1,400 @@
+#define _DEFAULT_SOURCE
+
+#include "glyphcache.h"
+#include "font_atlas.h"  // generated by tools/fontbake
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Codepoints rasterized together in one LoadFontData() call
+#define RASTER_BATCH 64
+
+// Extra advance between glyphs, matching the spacing DrawTextEx() was given
+#define GLYPH_SPACING 1
+
+typedef struct {
+    int codepoint;           // -1 while the cell is free
+    short page;
+    short x, y;              // cell origin on the page
+    short width, height;     // bitmap size, clipped to the cell
+    short offset_x, offset_y;
+    short advance;
+    unsigned int last_used;  // frame stamp
+    int prev, next;          // LRU list (most recent first); free list uses next
+} GlyphSlot;
+
+static struct {
+    bool ready;
+    const unsigned char *font_data;
+    unsigned char *loaded_data;  // font_data when read from a file
+    int font_data_size;
+    int font_size;
+    int cell;                // cell edge in pixels, gutter included
+    int cells_per_page;
+
+    Texture2D pages[GLYPHCACHE_MAX_PAGES];
+    int page_count;
+
+    GlyphSlot *slots;        // GLYPHCACHE_MAX_PAGES * cells_per_page
+    int free_head;
+    int lru_head;
+    int lru_tail;
+
+    // Codepoint -> slot, linear probing, -1 marks an empty bucket
+    int *table;
+    unsigned int table_mask;
+
+    unsigned char *scratch;  // RGBA staging for one cell
+    unsigned int frame;
+
+    GlyphCacheStats stats;
+} cache;
+
+static unsigned int home_bucket(int codepoint) {
+    return ((unsigned int)codepoint * 2654435761u) & cache.table_mask;
+}
+
+static int lookup(int codepoint) {
+    for (unsigned int i = home_bucket(codepoint);; i = (i + 1) & cache.table_mask) {
+        int slot = cache.table[i];
+        if (slot < 0) return -1;
+        if (cache.slots[slot].codepoint == codepoint) return slot;
+    }
+}
+
+static void table_insert(int codepoint, int slot) {
+    unsigned int i = home_bucket(codepoint);
+    while (cache.table[i] >= 0) i = (i + 1) & cache.table_mask;
+    cache.table[i] = slot;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void table_remove(int codepoint) {
+    unsigned int i = home_bucket(codepoint);
+    while (cache.slots[cache.table[i]].codepoint != codepoint) i = (i + 1) & cache.table_mask;
+
+    cache.table[i] = -1;
+    for (unsigned int j = (i + 1) & cache.table_mask; cache.table[j] >= 0; j = (j + 1) & cache.table_mask) {
+        unsigned int k = home_bucket(cache.slots[cache.table[j]].codepoint);
+        bool in_place = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (in_place) continue;
+        cache.table[i] = cache.table[j];
+        cache.table[j] = -1;
+        i = j;
+    }
+}
+
+static void lru_unlink(int s) {
+    GlyphSlot *slot = &cache.slots[s];
+    if (slot->prev >= 0) cache.slots[slot->prev].next = slot->next;
+    else cache.lru_head = slot->next;
+    if (slot->next >= 0) cache.slots[slot->next].prev = slot->prev;
+    else cache.lru_tail = slot->prev;
+    slot->prev = slot->next = -1;
+}
+
+static void lru_push_front(int s) {
+    GlyphSlot *slot = &cache.slots[s];
+    slot->prev = -1;
+    slot->next = cache.lru_head;
+    if (cache.lru_head >= 0) cache.slots[cache.lru_head].prev = s;
+    cache.lru_head = s;
+    if (cache.lru_tail < 0) cache.lru_tail = s;
+}
+
+static void touch(int s) {
+    cache.slots[s].last_used = cache.frame;
+    if (cache.lru_head != s) {
+        lru_unlink(s);
+        lru_push_front(s);
+    }
+}
+
+// Upload image (RGBA, GLYPHCACHE_PAGE_SIZE square) as a new page and put
+// its cells on the free list. Takes ownership of the image.
+static bool add_page_image(Image image) {
+    if (cache.page_count == GLYPHCACHE_MAX_PAGES) {
+        UnloadImage(image);
+        return false;
+    }
+
+    Texture2D texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+    if (texture.id == 0) return false;
+    SetTextureFilter(texture, TEXTURE_FILTER_POINT);
+
+    int page = cache.page_count++;
+    cache.pages[page] = texture;
+
+    // Thread the new cells onto the free list in reading order
+    int per_row = GLYPHCACHE_PAGE_SIZE / cache.cell;
+    for (int i = cache.cells_per_page - 1; i >= 0; i--) {
+        int s = page * cache.cells_per_page + i;
+        GlyphSlot *slot = &cache.slots[s];
+        slot->codepoint = -1;
+        slot->page = (short)page;
+        slot->x = (short)((i % per_row) * cache.cell);
+        slot->y = (short)((i / per_row) * cache.cell);
+        slot->prev = -1;
+        slot->next = cache.free_head;
+        cache.free_head = s;
+    }
+
+    cache.stats.pages = cache.page_count;
+    cache.stats.capacity += cache.cells_per_page;
+    cache.stats.atlas_bytes += (size_t)GLYPHCACHE_PAGE_SIZE * GLYPHCACHE_PAGE_SIZE * 4;
+    return true;
+}
+
+static bool add_page(void) {
+    return add_page_image(GenImageColor(GLYPHCACHE_PAGE_SIZE, GLYPHCACHE_PAGE_SIZE, BLANK));
+}
+
+// Fill a slot with glyph metrics and index it
+static void slot_store(int s, int codepoint, int width, int height, int offset_x, int offset_y, int advance) {
+    GlyphSlot *slot = &cache.slots[s];
+    slot->codepoint = codepoint;
+    slot->width = (short)width;
+    slot->height = (short)height;
+    slot->offset_x = (short)offset_x;
+    slot->offset_y = (short)offset_y;
+    slot->advance = (short)(advance ? advance : width);
+    if (slot->advance == 0) slot->advance = (short)(cache.font_size / 2);
+
+    table_insert(codepoint, s);
+    slot->last_used = cache.frame;
+    lru_push_front(s);
+    cache.stats.glyphs++;
+}
+
+// Coverage becomes the alpha of white pixels so glyphs can be tinted
+static void alpha_to_rgba(unsigned char *dst, const unsigned char *src, int width, int height, int src_stride, int dst_stride) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char *px = &dst[(y * dst_stride + x) * 4];
+            px[0] = px[1] = px[2] = 255;
+            px[3] = src[y * src_stride + x];
+        }
+    }
+}
+
+// Build the first page from the atlas baked into the binary, so the usual
+// glyphs need no rasterization at all.
+static bool load_baked_page(void) {
+    if (FONT_ATLAS_FONT_SIZE != cache.font_size || FONT_ATLAS_CELL != cache.cell ||
+        FONT_ATLAS_GLYPH_COUNT > cache.cells_per_page) {
+        return false;
+    }
+
+    Image image = GenImageColor(GLYPHCACHE_PAGE_SIZE, GLYPHCACHE_PAGE_SIZE, BLANK);
+    if (!image.data) return false;
+
+    int per_row = GLYPHCACHE_PAGE_SIZE / cache.cell;
+    for (int i = 0; i < FONT_ATLAS_GLYPH_COUNT; i++) {
+        int x = (i % per_row) * cache.cell;
+        int y = (i / per_row) * cache.cell;
+        unsigned char *dst = (unsigned char *)image.data + ((size_t)y * GLYPHCACHE_PAGE_SIZE + x) * 4;
+        alpha_to_rgba(dst, &font_atlas_alpha[font_atlas_glyphs[i].pixels],
+                      font_atlas_glyphs[i].width, font_atlas_glyphs[i].height,
+                      font_atlas_glyphs[i].width, GLYPHCACHE_PAGE_SIZE);
+    }
+    if (!add_page_image(image)) return false;
+
+    // The free list runs through the page in reading order, matching the
+    // baker's layout
+    for (int i = 0; i < FONT_ATLAS_GLYPH_COUNT; i++) {
+        int s = cache.free_head;
+        cache.free_head = cache.slots[s].next;
+        slot_store(s, font_atlas_glyphs[i].codepoint,
+                   font_atlas_glyphs[i].width, font_atlas_glyphs[i].height,
+                   font_atlas_glyphs[i].offset_x, font_atlas_glyphs[i].offset_y,
+                   font_atlas_glyphs[i].advance);
+    }
+    cache.stats.baked = FONT_ATLAS_GLYPH_COUNT;
+    return true;
+}
+
+// A free cell: unused, on a new page, or the least recently drawn glyph.
+// Returns -1 if every cell was drawn this frame.
+static int alloc_slot(void) {
+    if (cache.free_head < 0) add_page();
+
+    if (cache.free_head >= 0) {
+        int s = cache.free_head;
+        cache.free_head = cache.slots[s].next;
+        return s;
+    }
+
+    int s = cache.lru_tail;
+    if (s < 0 || cache.slots[s].last_used == cache.frame) return -1;
+
+    table_remove(cache.slots[s].codepoint);
+    lru_unlink(s);
+    cache.slots[s].codepoint = -1;
+    cache.stats.glyphs--;
+    cache.stats.evictions++;
+    return s;
+}
+
+static void rasterize(int *codepoints, int count) {
+    double start = GetTime();
+
+    GlyphInfo *glyphs = LoadFontData((unsigned char *)cache.font_data, cache.font_data_size, cache.font_size,
+                                     codepoints, count, FONT_DEFAULT);
+    if (!glyphs) return;
+
+    int max_edge = cache.cell - GLYPHCACHE_CELL_GUTTER;
+    for (int i = 0; i < count; i++) {
+        int s = alloc_slot();
+        if (s < 0) {
+            cache.stats.dropped++;
+            continue;
+        }
+
+        const GlyphInfo *glyph = &glyphs[i];
+        const GlyphSlot *slot = &cache.slots[s];
+        int width = glyph->image.data ? glyph->image.width : 0;
+        int height = glyph->image.data ? glyph->image.height : 0;
+        if (width > max_edge) width = max_edge;
+        if (height > max_edge) height = max_edge;
+
+        if (width > 0 && height > 0) {
+            alpha_to_rgba(cache.scratch, glyph->image.data, width, height, glyph->image.width, width);
+            Rectangle rec = { slot->x, slot->y, (float)width, (float)height };
+            UpdateTextureRec(cache.pages[slot->page], rec, cache.scratch);
+        }
+
+        slot_store(s, codepoints[i], width, height, glyph->offsetX, glyph->offsetY, glyph->advanceX);
+        cache.stats.misses++;
+    }
+
+    UnloadFontData(glyphs, count);
+    cache.stats.raster_ms += (GetTime() - start) * 1000.0;
+}
+
+bool glyphcache_init(const char *font_path, int font_size) {
+    double start = GetTime();
+    memset(&cache, 0, sizeof(cache));
+    cache.font_size = font_size;
+    cache.free_head = cache.lru_head = cache.lru_tail = -1;
+
+    if (font_path) {
+        cache.loaded_data = LoadFileData(font_path, &cache.font_data_size);
+        if (!cache.loaded_data) {
+            fprintf(stderr, "Warning: Failed to load font %s, using default\n", font_path);
+            return false;
+        }
+        cache.font_data = cache.loaded_data;
+    } else {
+        cache.font_data = font_ttf_data;
+        cache.font_data_size = (int)sizeof(font_ttf_data);
+    }
+
+    cache.cell = GLYPHCACHE_CELL(font_size);
+    int per_row = GLYPHCACHE_PAGE_SIZE / cache.cell;
+    cache.cells_per_page = per_row * per_row;
+
+    int max_slots = cache.cells_per_page * GLYPHCACHE_MAX_PAGES;
+    unsigned int buckets = 1;
+    while (buckets < (unsigned int)max_slots * 2) buckets <<= 1;
+
+    cache.slots = calloc((size_t)max_slots, sizeof(GlyphSlot));
+    cache.table = malloc(buckets * sizeof(int));
+    cache.scratch = malloc((size_t)cache.cell * cache.cell * 4);
+    if (!cache.slots || !cache.table || !cache.scratch) {
+        fprintf(stderr, "Failed to allocate glyph cache\n");
+        glyphcache_shutdown();
+        return false;
+    }
+    memset(cache.table, 0xff, buckets * sizeof(int));
+    cache.table_mask = buckets - 1;
+
+    if (!(font_path == NULL && load_baked_page()) && !add_page()) {
+        fprintf(stderr, "Failed to create glyph atlas\n");
+        glyphcache_shutdown();
+        return false;
+    }
+
+    cache.ready = true;
+    cache.stats.init_ms = (GetTime() - start) * 1000.0;
+    return true;
+}
+
+void glyphcache_shutdown(void) {
+    for (int i = 0; i < cache.page_count; i++) {
+        UnloadTexture(cache.pages[i]);
+    }
+    free(cache.slots);
+    free(cache.table);
+    free(cache.scratch);
+    if (cache.loaded_data) UnloadFileData(cache.loaded_data);
+
+    int font_size = cache.font_size;
+    memset(&cache, 0, sizeof(cache));
+    cache.font_size = font_size;
+    cache.free_head = cache.lru_head = cache.lru_tail = -1;
+}
+
+void glyphcache_begin_frame(void) {
+    cache.frame++;
+}
+
+void glyphcache_draw_text(const char *text, Vector2 pos, Color color) {
+    if (!cache.ready) {
+        DrawTextEx(GetFontDefault(), text, pos, (float)cache.font_size, GLYPH_SPACING, color);
+        return;
+    }
+
+    // Rasterize everything this string is missing in one batch. Glyphs it
+    // already has are stamped first so the batch can't evict them.
+    int missing[RASTER_BATCH];
+    int missing_count = 0;
+    for (const char *p = text; *p;) {
+        int size;
+        int codepoint = GetCodepointNext(p, &size);
+        p += size;
+
+        int s = lookup(codepoint);
+        if (s >= 0) {
+            touch(s);
+            cache.stats.hits++;
+            continue;
+        }
+
+        bool queued = false;
+        for (int i = 0; i < missing_count; i++) {
+            if (missing[i] == codepoint) queued = true;
+        }
+        if (!queued && missing_count < RASTER_BATCH) missing[missing_count++] = codepoint;
+    }
+    if (missing_count > 0) {
+        rasterize(missing, missing_count);
+    }
+
+    float x = pos.x;
+    for (const char *p = text; *p;) {
+        int size;
+        int codepoint = GetCodepointNext(p, &size);
+        p += size;
+
+        int s = lookup(codepoint);
+        if (s < 0) {
+            x += cache.font_size / 2 + GLYPH_SPACING;
+            continue;
+        }
+
+        const GlyphSlot *slot = &cache.slots[s];
+        if (slot->width > 0) {
+            Rectangle source = { slot->x, slot->y, slot->width, slot->height };
+            Vector2 at = { floorf(x + slot->offset_x), floorf(pos.y + slot->offset_y) };
+            DrawTextureRec(cache.pages[slot->page], source, at, color);
+        }
+        x += slot->advance + GLYPH_SPACING;
+    }
+}
+
+void glyphcache_get_stats(GlyphCacheStats *stats) {
+    *stats = cache.stats;
+}
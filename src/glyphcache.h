@@ -0,0 +1,50 @@
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Glyphs are rasterized the first time a codepoint is drawn and packed
+// into fixed-size cells on atlas pages. Pages are added up to
+// GLYPHCACHE_MAX_PAGES; after that the least recently drawn glyph is
+// evicted, never one already drawn in the current frame.
+#define GLYPHCACHE_PAGE_SIZE 512
+#define GLYPHCACHE_MAX_PAGES 4
+
+// Square cells fit one double-width (CJK) glyph, plus empty pixels so
+// point-sampled glyphs never pick up a neighbour. tools/fontbake lays out
+// the embedded atlas with the same geometry.
+#define GLYPHCACHE_CELL_GUTTER 1
+#define GLYPHCACHE_CELL(font_size) ((font_size) + 4 + GLYPHCACHE_CELL_GUTTER)
+
+typedef struct {
+    int glyphs;             // codepoints currently cached
+    int capacity;           // cells on the pages allocated so far
+    int pages;
+    size_t atlas_bytes;     // texture memory of those pages
+    unsigned long hits;
+    unsigned long misses;   // rasterized on demand
+    unsigned long evictions;
+    unsigned long dropped;  // not drawn because every cell was in use this frame
+    double raster_ms;       // total time spent rasterizing and uploading
+    int baked;              // glyphs preloaded from the embedded atlas
+    double init_ms;         // glyphcache_init() wall time
+} GlyphCacheStats;
+
+// Load a TTF/OTF font, or with a NULL path the font embedded at build
+// time, whose common glyphs come pre-rasterized. On failure text is drawn
+// with raylib's default font. Needs a window (GL context).
+bool glyphcache_init(const char *font_path, int font_size);
+void glyphcache_shutdown(void);
+
+// Start a frame. Glyphs drawn after this are protected from eviction until
+// the next call.
+void glyphcache_begin_frame(void);
+
+// Draw UTF-8 text with its top-left corner at pos.
+void glyphcache_draw_text(const char *text, Vector2 pos, Color color);
+
+void glyphcache_get_stats(GlyphCacheStats *stats);
+
+#endif
@@ -0,0 +1,339 @@
+#define _DEFAULT_SOURCE
+
+#include "libindex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LIBINDEX_MAGIC "OSCYLIDX"
+#define LIBINDEX_PATH_MAX 4096
+
+// ~/.cache/oscyl/library-<hash of root>.idx; creates the directories
+static bool index_path(const char *root, bool create, char *buf, size_t size) {
+    char base[LIBINDEX_PATH_MAX];
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (cache && cache[0] == '/') {
+        n = snprintf(base, sizeof(base), "%s", cache);
+    } else if (home && home[0]) {
+        n = snprintf(base, sizeof(base), "%s/.cache", home);
+    } else {
+        return false;
+    }
+    if (n < 0 || (size_t)n >= sizeof(base)) return false;
+
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *)root; *p; p++) {
+        hash = (hash ^ *p) * 0x100000001b3ULL;
+    }
+
+    if (create) {
+        if (mkdir(base, 0700) != 0 && errno != EEXIST) return false;
+    }
+    n = snprintf(buf, size, "%s/oscyl", base);
+    if (n < 0 || (size_t)n >= size) return false;
+    if (create) {
+        if (mkdir(buf, 0700) != 0 && errno != EEXIST) return false;
+    }
+    n = snprintf(buf, size, "%s/oscyl/library-%016llx.idx", base, (unsigned long long)hash);
+    return n >= 0 && (size_t)n < size;
+}
+
+static bool valid_string(const LibIndexHeader *header, uint32_t offset) {
+    return offset < header->strings_size;
+}
+
+static bool valid_link(const LibIndexHeader *header, uint32_t dir) {
+    return dir == LIBINDEX_NONE || dir < header->dir_count;
+}
+
+// Everything read later is checked here once, so a truncated or
+// half-written file can't send lookups out of the mapping
+static bool validate(const LibIndex *index, const char *root, uint32_t flags) {
+    const LibIndexHeader *header = index->map;
+    uint64_t size = index->map_size;
+
+    if (memcmp(header->magic, LIBINDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != LIBINDEX_VERSION || header->flags != flags ||
+        header->file_size != size || header->dir_count == 0) {
+        return false;
+    }
+    if (header->dirs_offset % 8 != 0 || header->tracks_offset % 8 != 0 ||
+        header->dirs_offset < sizeof(LibIndexHeader) ||
+        header->dirs_offset + (uint64_t)header->dir_count * sizeof(LibIndexDir) > header->tracks_offset ||
+        header->tracks_offset + (uint64_t)header->track_count * sizeof(LibIndexTrack) > header->strings_offset ||
+        header->strings_size == 0 || header->strings_size > UINT32_MAX ||
+        header->strings_offset + header->strings_size > size) {
+        return false;
+    }
+
+    const char *strings = (const char *)index->map + header->strings_offset;
+    if (strings[0] != '\0' || strings[header->strings_size - 1] != '\0') return false;
+    if (!valid_string(header, header->root) || strcmp(strings + header->root, root) != 0) return false;
+
+    const LibIndexDir *dirs = (const LibIndexDir *)((const char *)index->map + header->dirs_offset);
+    if (!valid_string(header, dirs[0].path) || strings[dirs[0].path] != '\0') return false;
+    for (uint32_t i = 0; i < header->dir_count; i++) {
+        const LibIndexDir *dir = &dirs[i];
+        if (!valid_string(header, dir->path) || !valid_link(header, dir->parent) ||
+            !valid_link(header, dir->first_child) || !valid_link(header, dir->next_sibling) ||
+            (uint64_t)dir->first_track + dir->track_count > header->track_count) {
+            return false;
+        }
+        // A child sorts after its parent and a sibling after the one before
+        // it, so links that only point forward can't form a loop
+        if (dir->parent != LIBINDEX_NONE && dir->parent >= i) return false;
+        if (dir->first_child != LIBINDEX_NONE &&
+            (dir->first_child <= i || dirs[dir->first_child].parent != i)) {
+            return false;
+        }
+        if (dir->next_sibling != LIBINDEX_NONE &&
+            (dir->next_sibling <= i || dirs[dir->next_sibling].parent != dir->parent)) {
+            return false;
+        }
+    }
+
+    const LibIndexTrack *tracks = (const LibIndexTrack *)((const char *)index->map + header->tracks_offset);
+    for (uint32_t i = 0; i < header->track_count; i++) {
+        const LibIndexTrack *track = &tracks[i];
+        if (!valid_string(header, track->name) || track->dir >= header->dir_count ||
+            !valid_string(header, track->artist) || !valid_string(header, track->title) ||
+            !valid_string(header, track->album)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool libindex_open(LibIndex *index, const char *root, uint32_t flags) {
+    memset(index, 0, sizeof(*index));
+
+    char path[LIBINDEX_PATH_MAX];
+    if (!index_path(root, false, path, sizeof(path))) return false;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LibIndexHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    index->map = map;
+    index->map_size = (size_t)st.st_size;
+    if (!validate(index, root, flags)) {
+        fprintf(stderr, "Ignoring stale library index %s\n", path);
+        libindex_close(index);
+        return false;
+    }
+
+    const LibIndexHeader *header = map;
+    index->flags = header->flags;
+    index->dir_count = header->dir_count;
+    index->track_count = header->track_count;
+    index->dirs = (const LibIndexDir *)((const char *)map + header->dirs_offset);
+    index->tracks = (const LibIndexTrack *)((const char *)map + header->tracks_offset);
+    index->strings = (const char *)map + header->strings_offset;
+    return true;
+}
+
+void libindex_close(LibIndex *index) {
+    if (index->map) munmap(index->map, index->map_size);
+    memset(index, 0, sizeof(*index));
+}
+
+const char *libindex_string(const LibIndex *index, uint32_t offset) {
+    return index->strings + offset;
+}
+
+uint32_t libindex_find_dir(const LibIndex *index, const char *path) {
+    uint32_t lo = 0, hi = index->dir_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(path, index->strings + index->dirs[mid].path);
+        if (cmp == 0) return mid;
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return LIBINDEX_NONE;
+}
+
+bool libindex_add_string(LibIndexBuilder *builder, const char *s, uint32_t *offset) {
+    return strintern_add(&builder->strings, s, strlen(s), offset);
+}
+
+bool libindex_add_dir(LibIndexBuilder *builder, const char *path, int64_t mtime_ns, uint32_t *index) {
+    if (builder->dir_count == builder->dir_capacity) {
+        uint32_t capacity = builder->dir_capacity ? builder->dir_capacity * 2 : 256;
+        LibIndexDir *dirs = realloc(builder->dirs, capacity * sizeof(LibIndexDir));
+        if (!dirs) return false;
+        builder->dirs = dirs;
+        builder->dir_capacity = capacity;
+    }
+
+    LibIndexDir *dir = &builder->dirs[builder->dir_count];
+    memset(dir, 0, sizeof(*dir));
+    if (!libindex_add_string(builder, path, &dir->path)) return false;
+    dir->mtime_ns = mtime_ns;
+    *index = builder->dir_count++;
+    return true;
+}
+
+bool libindex_add_track(LibIndexBuilder *builder, const LibIndexTrack *track) {
+    if (builder->track_count == builder->track_capacity) {
+        uint32_t capacity = builder->track_capacity ? builder->track_capacity * 2 : 1024;
+        LibIndexTrack *tracks = realloc(builder->tracks, capacity * sizeof(LibIndexTrack));
+        if (!tracks) return false;
+        builder->tracks = tracks;
+        builder->track_capacity = capacity;
+    }
+    builder->tracks[builder->track_count++] = *track;
+    return true;
+}
+
+// qsort() has no context argument
+static __thread const LibIndexBuilder *sort_builder;
+
+static int compare_dirs(const void *a, const void *b) {
+    const char *strings = sort_builder->strings.strings.data;
+    const LibIndexDir *da = &sort_builder->dirs[*(const uint32_t *)a];
+    const LibIndexDir *db = &sort_builder->dirs[*(const uint32_t *)b];
+    return strcmp(strings + da->path, strings + db->path);
+}
+
+// Sort the directories by path and fill in the links and track ranges
+static bool link_dirs(LibIndexBuilder *builder) {
+    uint32_t count = builder->dir_count;
+    uint32_t *order = malloc(count * sizeof(uint32_t));
+    uint32_t *moved = malloc(count * sizeof(uint32_t));   // old index -> new
+    LibIndexDir *sorted = malloc(count * sizeof(LibIndexDir));
+    if (!order || !moved || !sorted) {
+        free(order);
+        free(moved);
+        free(sorted);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) order[i] = i;
+    sort_builder = builder;
+    qsort(order, count, sizeof(uint32_t), compare_dirs);
+    sort_builder = NULL;
+
+    for (uint32_t i = 0; i < count; i++) {
+        sorted[i] = builder->dirs[order[i]];
+        sorted[i].parent = sorted[i].first_child = sorted[i].next_sibling = LIBINDEX_NONE;
+        sorted[i].first_track = 0;
+        sorted[i].track_count = 0;
+        moved[order[i]] = i;
+    }
+    free(builder->dirs);
+    builder->dirs = sorted;
+    builder->dir_capacity = count;
+
+    for (uint32_t i = 0; i < builder->track_count; i++) {
+        builder->tracks[i].dir = moved[builder->tracks[i].dir];
+    }
+    free(order);
+    free(moved);
+
+    // Going backwards leaves each child list in path order
+    const char *strings = builder->strings.strings.data;
+    LibIndex lookup = { .dir_count = count, .dirs = sorted, .strings = strings };
+    char parent[LIBINDEX_PATH_MAX];
+    for (uint32_t i = count; i-- > 1;) {
+        const char *path = strings + sorted[i].path;
+        const char *slash = strrchr(path, '/');
+        size_t len = slash ? (size_t)(slash - path) : 0;
+        if (len >= sizeof(parent)) continue;
+        memcpy(parent, path, len);
+        parent[len] = '\0';
+
+        uint32_t p = libindex_find_dir(&lookup, parent);
+        if (p == LIBINDEX_NONE) continue;
+        sorted[i].parent = p;
+        sorted[i].next_sibling = sorted[p].first_child;
+        sorted[p].first_child = i;
+    }
+
+    for (uint32_t i = 0; i < builder->track_count; i++) {
+        LibIndexDir *dir = &sorted[builder->tracks[i].dir];
+        if (dir->track_count == 0) {
+            dir->first_track = i;
+        } else if (dir->first_track + dir->track_count != i) {
+            return false;   // not grouped by directory
+        }
+        dir->track_count++;
+    }
+    return true;
+}
+
+bool libindex_write(LibIndexBuilder *builder, const char *root, uint32_t flags) {
+    char path[LIBINDEX_PATH_MAX], tmp[LIBINDEX_PATH_MAX + 8];
+    if (!index_path(root, true, path, sizeof(path))) {
+        fprintf(stderr, "Cannot create library index directory for %s\n", root);
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    LibIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    if (!libindex_add_string(builder, root, &header.root) || !link_dirs(builder)) {
+        fprintf(stderr, "Cannot build library index for %s\n", root);
+        return false;
+    }
+    if (builder->dir_count == 0 || builder->strings.strings.data[builder->dirs[0].path] != '\0') {
+        fprintf(stderr, "Library index for %s has no root directory\n", root);
+        return false;
+    }
+
+    memcpy(header.magic, LIBINDEX_MAGIC, sizeof(header.magic));
+    header.version = LIBINDEX_VERSION;
+    header.flags = flags;
+    header.dir_count = builder->dir_count;
+    header.track_count = builder->track_count;
+    header.dirs_offset = sizeof(LibIndexHeader);
+    header.tracks_offset = header.dirs_offset + (uint64_t)header.dir_count * sizeof(LibIndexDir);
+    header.strings_offset = header.tracks_offset + (uint64_t)header.track_count * sizeof(LibIndexTrack);
+    header.strings_size = builder->strings.strings.used;
+    header.file_size = header.strings_offset + header.strings_size;
+
+    // Written next to the old index and renamed over it, so a reader
+    // never maps a half-written file
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", tmp, strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(builder->dirs, sizeof(LibIndexDir), header.dir_count, f) == header.dir_count &&
+              fwrite(builder->tracks, sizeof(LibIndexTrack), header.track_count, f) == header.track_count &&
+              fwrite(builder->strings.strings.data, 1, header.strings_size, f) == header.strings_size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+void libindex_builder_free(LibIndexBuilder *builder) {
+    strintern_free(&builder->strings);
+    free(builder->dirs);
+    free(builder->tracks);
+    memset(builder, 0, sizeof(*builder));
+}
@@ -0,0 +1,124 @@
+#ifndef LIBINDEX_H
+#define LIBINDEX_H
+
+#include "strintern.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Persistent index of a recursively scanned library, one file per root
+// under $XDG_CACHE_HOME/oscyl (~/.cache/oscyl). It is memory-mapped and
+// used in place: a header, the directory table, the track table and the
+// string block. Everything is in native byte order; a file written on
+// another machine or by another version is simply rejected.
+//
+// Directories record their mtime, so a rescan only needs to read the ones
+// whose mtime changed: adding, removing or renaming an entry updates the
+// mtime of the directory holding it.
+
+#define LIBINDEX_VERSION 2
+
+// Header flags
+#define LIBINDEX_LOCALE_SORT 0x1   // tracks are in --sort locale order
+
+// Track flags
+#define LIBINDEX_TRACK_TAGGED 0x1   // artist, title and album were read (any may be empty)
+
+#define LIBINDEX_NONE UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t file_size;
+    uint32_t dir_count;
+    uint32_t track_count;
+    uint64_t dirs_offset;
+    uint64_t tracks_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint32_t root;            // absolute path of the scanned directory
+    uint32_t reserved;
+} LibIndexHeader;
+
+// String fields are offsets into the string block; offset 0 is always the
+// empty string, which also stands for "unknown".
+
+// Directories are sorted by path (strcmp) so they can be looked up with a
+// binary search. dirs[0] is the root, with the empty path.
+typedef struct {
+    uint32_t path;            // relative to the root
+    uint32_t parent;          // LIBINDEX_NONE for the root
+    uint32_t first_child;     // LIBINDEX_NONE if there are no subdirectories
+    uint32_t next_sibling;
+    uint32_t first_track;     // a directory's tracks are contiguous
+    uint32_t track_count;
+    int64_t mtime_ns;
+} LibIndexDir;
+
+// Tracks are stored in playlist order
+typedef struct {
+    uint32_t name;
+    uint32_t dir;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t duration_ms;     // 0 if unknown
+    uint32_t artist;
+    uint32_t title;
+    uint32_t album;
+    uint32_t flags;
+} LibIndexTrack;
+
+// An index mapped read-only
+typedef struct {
+    void *map;
+    size_t map_size;
+    uint32_t flags;
+    uint32_t dir_count;
+    uint32_t track_count;
+    const LibIndexDir *dirs;
+    const LibIndexTrack *tracks;
+    const char *strings;
+} LibIndex;
+
+// Map the index for root. Returns false if there is none, or it doesn't
+// match root and flags, or it fails validation.
+bool libindex_open(LibIndex *index, const char *root, uint32_t flags);
+void libindex_close(LibIndex *index);
+
+const char *libindex_string(const LibIndex *index, uint32_t offset);
+
+// Index of the directory with the given relative path, or LIBINDEX_NONE
+uint32_t libindex_find_dir(const LibIndex *index, const char *path);
+
+// Collects a new index in memory. Zero-initialize, add directories (any
+// order) and tracks (in playlist order, each directory's contiguous), then
+// write it out.
+typedef struct {
+    StrIntern strings;
+    LibIndexDir *dirs;
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+    LibIndexTrack *tracks;
+    uint32_t track_count;
+    uint32_t track_capacity;
+} LibIndexBuilder;
+
+// Equal strings share one copy, so an artist or album name is stored once
+// however many tracks carry it. Empty strings map to offset 0.
+bool libindex_add_string(LibIndexBuilder *builder, const char *s, uint32_t *offset);
+
+bool libindex_add_dir(LibIndexBuilder *builder, const char *path, int64_t mtime_ns, uint32_t *index);
+
+// track->dir is the index returned by libindex_add_dir(); string fields
+// must come from libindex_add_string().
+bool libindex_add_track(LibIndexBuilder *builder, const LibIndexTrack *track);
+
+// Write the index for root, replacing the old one atomically. Prints the
+// reason and returns false on failure.
+bool libindex_write(LibIndexBuilder *builder, const char *root, uint32_t flags);
+
+void libindex_builder_free(LibIndexBuilder *builder);
+
+#endif
@@ -1,14 +1,26 @@
 #define _DEFAULT_SOURCE
 
 #include "audio.h"
+#include "dirlist.h"
+#include "glyphcache.h"
 #include "playlist.h"
-
+#include "plfile.h"
+#include "pool.h"
+#include "render.h"
+#include "rtlog.h"
+#include "rtsched.h"
+#include "search.h"
+#include "vlist.h"
+
+#include <getopt.h>
+#include <locale.h>
+#include <pthread.h>
 #include <raylib.h>
 #include <stdio.h>
 #include <string.h>
-#include <dirent.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define WINDOW_WIDTH 600
 #define WINDOW_HEIGHT 400
@@ -31,6 +43,19 @@ static const Color COLOR_ACCENT     = { 0x5f, 0x87, 0x87, 0xff };
 #define TRACK_LIST_HEIGHT (WINDOW_HEIGHT - NOW_PLAYING_HEIGHT)
 #define MAX_VISIBLE_TRACKS ((TRACK_LIST_HEIGHT - PANEL_PADDING * 2) / LINE_HEIGHT)
 
+// Frame pacing
+#define ACTIVE_FPS 60
+#define IDLE_FPS 10               // only the clock is changing
+#define POWER_SAVER_IDLE_FPS 4    // still enough for the clock and progress bar
+#define IDLE_AFTER_SECONDS 1.0    // drop to idle this long after the last change
+#define WAKEUP_LOG_SECONDS 5.0
+#define QUEUE_SAVE_SECONDS 2.0
+
+// Long lists
+#define WHEEL_ROWS 3           // rows scrolled per mouse wheel step
+#define SCROLL_THUMB_MIN 8     // pixels
+#define SCROLL_CHAR_WIDTH 8    // about, for right-aligning the row range
+
 static void draw_panel(int x, int y, int w, int h) {
     DrawRectangle(x, y, w, h, COLOR_PANEL);
     DrawRectangleLines(x, y, w, h, COLOR_BORDER);
@@ -50,27 +75,65 @@ static const char *state_icon(AudioState state) {
     }
 }
 
-// Directory browser
-#define BROWSER_MAX_ENTRIES 256
-
+// Directory browser. Listings are read in the background and cached (see
+// dirlist.h); entry 0 is ".." unless at the root.
 typedef struct {
     bool active;
     char path[PLAYLIST_MAX_PATH];
-    char entries[BROWSER_MAX_ENTRIES][256];
-    bool is_dir[BROWSER_MAX_ENTRIES];
+    bool jumping;                 // typing the start of a name to select
+    char jump[256];
+    int jump_len;
+    DirList *lister;
+    const DirListing *listing;   // of path, NULL if out of memory
     int count;
     int selected;
-    int scroll_offset;
+    VList view;       // rows below the header
+    bool watch_changes;
+    Watch *watch;   // on path, to list it again when it changes
 } Browser;
 
-static int compare_entries(const void *a, const void *b) {
-    return strcasecmp((const char *)a, (const char *)b);
+// --sort locale, for the listings
+static bool locale_sort;
+
+static int browser_parent_count(const Browser *br) {
+    return strcmp(br->path, "/") != 0 ? 1 : 0;
+}
+
+static const char *browser_entry_name(const Browser *br, int index) {
+    int parent = browser_parent_count(br);
+    return index < parent ? ".." : dirlist_name(br->listing, (uint32_t)(index - parent));
+}
+
+// The listing entry behind a browser row, NULL for ".."
+static const DirListEntry *browser_entry(const Browser *br, int index) {
+    int parent = browser_parent_count(br);
+    return index < parent ? NULL : &br->listing->entries[index - parent];
+}
+
+static bool browser_entry_is_dir(const Browser *br, int index) {
+    const DirListEntry *entry = browser_entry(br, index);
+    return !entry || entry->kind == DIRLIST_DIR;
+}
+
+static void browser_count(Browser *br) {
+    br->count = browser_parent_count(br) + (br->listing ? (int)br->listing->count : 0);
+}
+
+static void browser_show_selected(Browser *br) {
+    vlist_follow(&br->view, br->selected, br->count);
+}
+
+// Select the first entry starting with what was typed, or the nearest
+static void browser_jump(Browser *br) {
+    if (!br->listing || br->listing->count == 0 || br->jump_len == 0) return;
+    br->selected = browser_parent_count(br) + (int)dirlist_seek(br->listing, br->jump);
+    browser_show_selected(br);
 }
 
 static void browser_scan(Browser *br, const char *path) {
-    br->count = 0;
     br->selected = 0;
-    br->scroll_offset = 0;
+    vlist_reset(&br->view, 0);
+    br->jumping = false;
     strncpy(br->path, path, PLAYLIST_MAX_PATH - 1);
     br->path[PLAYLIST_MAX_PATH - 1] = '\0';
 
@@ -80,49 +143,81 @@ static void browser_scan(Browser *br, const char *path) {
         br->path[len - 1] = '\0';
     }
 
-    DIR *dir = opendir(br->path);
-    if (!dir) return;
-
-    // Add parent directory entry if not at root
-    if (strcmp(br->path, "/") != 0) {
-        strcpy(br->entries[br->count], "..");
-        br->is_dir[br->count] = true;
-        br->count++;
+    // A fresh watch per directory; the old one goes with its events
+    watch_close(br->watch);
+    br->watch = br->watch_changes ? watch_open() : NULL;
+    if (br->watch && !watch_add(br->watch, br->path, 0)) {
+        watch_close(br->watch);
+        br->watch = NULL;
     }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && br->count < BROWSER_MAX_ENTRIES) {
-        // Skip hidden files and . / ..
-        if (entry->d_name[0] == '.') continue;
+    if (!br->lister) br->lister = dirlist_open(locale_sort, playlist_is_audio_file);
+    br->listing = br->lister ? dirlist_get(br->lister, br->path) : NULL;
+    browser_count(br);
+}
 
-        // Check if it's a directory
-        char full_path[PLAYLIST_MAX_PATH];
-        snprintf(full_path, sizeof(full_path), "%s/%s", br->path, entry->d_name);
+// Take in entries as they are read, and read the directory again if it
+// changed, keeping the cursor on the same entry. Returns true if the
+// entries changed.
+static bool browser_refresh(Browser *br) {
+    if (!br->lister) return false;
+    if (br->watch) {
+        uint32_t count;
+        bool overflow;
+        watch_poll(br->watch, &count, &overflow);
+        if (count > 0 || overflow) dirlist_invalidate(br->lister, br->path);
+    }
 
-        struct stat st;
-        if (stat(full_path, &st) != 0) continue;
+    int parent = browser_parent_count(br);
+    char selected[256] = "";
+    if (br->selected >= parent && br->selected < br->count) {
+        snprintf(selected, sizeof(selected), "%s", browser_entry_name(br, br->selected));
+    }
+    if (!dirlist_poll(br->lister)) return false;
+
+    // Found by binary search; a name not there any more leaves the cursor
+    // at the top
+    browser_count(br);
+    int index = 0;
+    if (selected[0] && br->listing) {
+        uint32_t found = dirlist_find(br->lister, br->listing, selected);
+        if (found < br->listing->count) index = parent + (int)found;
+    }
+    br->selected = index;
+    browser_show_selected(br);
+    return true;
+}
 
-        if (S_ISDIR(st.st_mode)) {
-            strncpy(br->entries[br->count], entry->d_name, 255);
-            br->entries[br->count][255] = '\0';
-            br->is_dir[br->count] = true;
-            br->count++;
-        }
+// Full path of the selected entry
+static void browser_entry_path(const Browser *br, char *buf, size_t size) {
+    const char *selected = browser_entry_name(br, br->selected);
+    if (strcmp(br->path, "/") == 0) {
+        snprintf(buf, size, "/%s", selected);
+    } else {
+        snprintf(buf, size, "%s/%s", br->path, selected);
     }
+}
 
-    closedir(dir);
+// Load the whole tree under the selected directory
+static void browser_load_tree(Browser *br, Playlist *pl) {
+    if (br->count == 0 || !browser_entry_is_dir(br, br->selected) ||
+        strcmp(browser_entry_name(br, br->selected), "..") == 0) {
+        return;
+    }
 
-    // Sort entries (skip ".." at index 0 if present)
-    int start = (strcmp(br->path, "/") != 0) ? 1 : 0;
-    if (br->count > start + 1) {
-        qsort(&br->entries[start], br->count - start, 256, compare_entries);
+    char path[PLAYLIST_MAX_PATH];
+    browser_entry_path(br, path, sizeof(path));
+    audio_stop();
+    if (!playlist_scan_recursive(pl, path)) {
+        fprintf(stderr, "Failed to scan directory: %s\n", path);
     }
+    br->active = false;
 }
 
-static void browser_select_entry(Browser *br, Playlist *pl) {
+static void browser_select_entry(Browser *br, Playlist *pl, bool recursive) {
     if (br->count == 0) return;
 
-    const char *selected = br->entries[br->selected];
+    const char *selected = browser_entry_name(br, br->selected);
 
     if (strcmp(selected, "..") == 0) {
         // Go to parent directory
@@ -133,19 +228,28 @@ static void browser_select_entry(Browser *br, Playlist *pl) {
             br->path[1] = '\0';  // Root
         }
         browser_scan(br, br->path);
+    } else if (!browser_entry_is_dir(br, br->selected)) {
+        // Load a playlist file
+        char path[PLAYLIST_MAX_PATH];
+        browser_entry_path(br, path, sizeof(path));
+        audio_stop();
+        if (!playlist_load_file(pl, path)) fprintf(stderr, "Failed to load playlist: %s\n", path);
+        br->active = false;
     } else {
         // Enter subdirectory
         char new_path[PLAYLIST_MAX_PATH];
-        if (strcmp(br->path, "/") == 0) {
-            snprintf(new_path, sizeof(new_path), "/%s", selected);
-        } else {
-            snprintf(new_path, sizeof(new_path), "%s/%s", br->path, selected);
-        }
+        browser_entry_path(br, new_path, sizeof(new_path));
 
-        // Check if this directory has audio files
-        Playlist test_pl = {0};
-        if (playlist_scan(&test_pl, new_path) && test_pl.count > 0) {
+        // Check if this directory has audio files: counted already, or
+        // else up to the first one
+        const DirListEntry *entry = browser_entry(br, br->selected);
+        bool has_audio = entry->counted ? entry->tracks > 0 : playlist_dir_has_audio(new_path);
+        if (has_audio) {
             // Load this directory into the main playlist
+            if (recursive) {
+                browser_load_tree(br, pl);
+                return;
+            }
             audio_stop();
             playlist_scan(pl, new_path);
             br->active = false;
@@ -156,56 +260,1025 @@ static void browser_select_entry(Browser *br, Playlist *pl) {
     }
 }
 
+static double monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// Search box over the playlist. Its index is built when the box opens and
+// again when track indices change; tags streaming in rebuild it at most
+// every SEARCH_REBUILD_MS, or ten times the last build time on big
+// libraries, so rebuilding never takes more than a tenth of the frames.
+#define SEARCH_REBUILD_MS 250.0
+
+typedef struct {
+    bool active;
+    char query[SEARCH_QUERY_MAX];
+    int len;
+    int selected;        // into search.ids
+    VList view;
+    SearchIndex index;   // entry i is track i
+    Search search;
+
+    bool built;
+    uint32_t tag_generation;   // of the playlist when built
+    uint32_t tag_updates;
+    int track_count;
+    double built_at;
+    double build_ms;
+} SearchBox;
+
+// Matching tracks, best first, or NULL for the whole playlist when the
+// query is empty
+static const uint32_t *search_rows(const SearchBox *sb, int *count) {
+    static const uint32_t no_rows[1];
+    if (sb->len == 0) return NULL;
+    *count = (int)sb->search.count;
+    return sb->search.count > 0 ? sb->search.ids : no_rows;
+}
+
+static void search_scroll_to_selected(SearchBox *sb) {
+    vlist_follow(&sb->view, sb->selected, (int)sb->search.count);
+}
+
+// Run the query and select its best match, or with keep_selection the
+// playlist's selected track if it still matches
+static void search_box_run(SearchBox *sb, Playlist *pl, bool keep_selection) {
+    sb->selected = 0;
+    vlist_reset(&sb->view, 0);
+    if (sb->len == 0) return;
+    if (!search_run(&sb->search, &sb->index, sb->query)) {
+        fprintf(stderr, "Out of memory searching the playlist\n");
+        return;
+    }
+    if (sb->search.count == 0) return;
+
+    if (keep_selection) {
+        for (uint32_t i = 0; i < sb->search.count; i++) {
+            if ((int)sb->search.ids[i] == pl->selected) sb->selected = (int)i;
+        }
+    }
+    pl->selected = (int)sb->search.ids[sb->selected];
+    search_scroll_to_selected(sb);
+}
+
+static bool search_box_build(SearchBox *sb, const Playlist *pl) {
+    double start = monotonic_ms();
+    search_index_clear(&sb->index);
+    search_invalidate(&sb->search);
+    sb->built = false;
+
+    for (int i = 0; i < pl->count; i++) {
+        const PlaylistTrack *track = &pl->tracks[i];
+        const char *fields[] = {
+            strintern_get(&pl->tags, track->title),
+            strintern_get(&pl->tags, track->artist),
+            strintern_get(&pl->tags, track->album),
+            playlist_track_name(pl, i)
+        };
+        if (!search_index_add(&sb->index, fields, 4)) return false;
+    }
+    if (!search_index_finish(&sb->index)) return false;
+
+    sb->built = true;
+    sb->tag_generation = pl->tag_generation;
+    sb->tag_updates = pl->tag_updates;
+    sb->track_count = pl->count;
+    sb->built_at = monotonic_ms();
+    sb->build_ms = sb->built_at - start;
+    return true;
+}
+
+// Rebuild the index if the playlist changed. Returns true if the results
+// changed.
+static bool search_box_update(SearchBox *sb, Playlist *pl) {
+    bool stale = sb->built && (sb->track_count != pl->count || sb->tag_updates != pl->tag_updates);
+    double interval = sb->build_ms * 10.0 > SEARCH_REBUILD_MS ? sb->build_ms * 10.0 : SEARCH_REBUILD_MS;
+    if (sb->built && sb->tag_generation == pl->tag_generation &&
+        (!stale || monotonic_ms() - sb->built_at < interval)) {
+        return false;
+    }
+
+    if (!search_box_build(sb, pl)) {
+        fprintf(stderr, "Out of memory indexing the playlist for search\n");
+        sb->active = false;
+        sb->len = 0;
+        sb->query[0] = '\0';
+        return true;
+    }
+    search_box_run(sb, pl, true);
+    return true;
+}
+
+static void search_box_open(SearchBox *sb) {
+    sb->active = true;
+    sb->len = 0;
+    sb->query[0] = '\0';
+    sb->selected = 0;
+    vlist_reset(&sb->view, 0);
+}
+
+// Characters typed this frame and Backspace, into a text of size bytes.
+// Returns true if the text changed.
+static bool text_edit(char *text, int *len, int size) {
+    bool changed = false;
+    int codepoint;
+    while ((codepoint = GetCharPressed()) != 0) {
+        if (codepoint < 0x20 || codepoint == 0x7f) continue;
+        int utf8_size;
+        const char *utf8 = CodepointToUTF8(codepoint, &utf8_size);
+        if (*len + utf8_size >= size) continue;
+        memcpy(text + *len, utf8, (size_t)utf8_size);
+        *len += utf8_size;
+        text[*len] = '\0';
+        changed = true;
+    }
+    if ((IsKeyPressed(KEY_BACKSPACE) || IsKeyPressedRepeat(KEY_BACKSPACE)) && *len > 0) {
+        // Back over UTF-8 continuation bytes to the start of the character
+        do {
+            (*len)--;
+        } while (*len > 0 && ((unsigned char)text[*len] & 0xC0) == 0x80);
+        text[*len] = '\0';
+        changed = true;
+    }
+    return changed;
+}
+
+// The list key pressed this frame, if any: arrows, Page Up/Down, Home, End
+static bool list_key(VListMove *move) {
+    static const struct { int key; VListMove move; } keys[] = {
+        { KEY_UP, VLIST_UP }, { KEY_DOWN, VLIST_DOWN },
+        { KEY_PAGE_UP, VLIST_PAGE_UP }, { KEY_PAGE_DOWN, VLIST_PAGE_DOWN },
+        { KEY_HOME, VLIST_HOME }, { KEY_END, VLIST_END },
+    };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (IsKeyPressed(keys[i].key) || IsKeyPressedRepeat(keys[i].key)) {
+            *move = keys[i].move;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The play queue, listed in place of the playlist. The queue is a linked
+// list, so the entry of a row is found by walking from the nearest row
+// whose entry is known: the selected one, the one looked up last, or
+// either end. A frame looks up the rows on screen in order and a key moves
+// the selection a page at most, so neither walks further than a screenful
+// however long the queue is.
+typedef struct {
+    bool active;
+    int selected;
+    uint32_t selected_id;   // PLAYQUEUE_NONE if the queue is empty
+    int last;               // row looked up last
+    uint32_t last_id;       // its entry, PLAYQUEUE_NONE if none
+    uint32_t generation;    // of the queue these were found in
+    VList view;             // rows below the header
+} QueueList;
+
+// Entry of a row of the queue, 0 <= row < count
+static uint32_t queue_list_entry(QueueList *ql, const PlayQueue *q, int row) {
+    int from = 0;
+    uint32_t id = q->head;
+    if ((int)q->count - 1 - row < row) {
+        from = (int)q->count - 1;
+        id = q->tail;
+    }
+    if (ql->selected_id != PLAYQUEUE_NONE && abs(ql->selected - row) < abs(from - row)) {
+        from = ql->selected;
+        id = ql->selected_id;
+    }
+    if (ql->last_id != PLAYQUEUE_NONE && abs(ql->last - row) < abs(from - row)) {
+        from = ql->last;
+        id = ql->last_id;
+    }
+    for (; from < row; from++) id = playqueue_next(q, id);
+    for (; from > row; from--) id = playqueue_prev(q, id);
+    ql->last = row;
+    ql->last_id = id;
+    return id;
+}
+
+static void queue_list_select(QueueList *ql, const PlayQueue *q, int row) {
+    int count = (int)q->count;
+    if (row >= count) row = count - 1;
+    if (row < 0) row = 0;
+    ql->selected_id = count > 0 ? queue_list_entry(ql, q, row) : PLAYQUEUE_NONE;
+    ql->selected = row;
+    vlist_follow(&ql->view, ql->selected, count);
+}
+
+// Find the selected entry in the queue as it is now: by its id while it
+// is queued, else the entry that took its row. One walk of the queue.
+static void queue_list_find(QueueList *ql, const PlayQueue *q) {
+    int row = 0;
+    uint32_t id = ql->selected_id != PLAYQUEUE_NONE ? playqueue_first(q) : PLAYQUEUE_NONE;
+    while (id != PLAYQUEUE_NONE && id != ql->selected_id) {
+        id = playqueue_next(q, id);
+        row++;
+    }
+    ql->selected_id = ql->last_id = PLAYQUEUE_NONE;
+    ql->generation = q->generation;
+    queue_list_select(ql, q, id != PLAYQUEUE_NONE ? row : ql->selected);
+}
+
+static void queue_list_open(QueueList *ql, const PlayQueue *q) {
+    ql->active = true;
+    queue_list_find(ql, q);
+}
+
+// Catch up with changes made to the queue elsewhere, as when playing takes
+// its first entry. Returns true if there were any.
+static bool queue_list_sync(QueueList *ql, const PlayQueue *q) {
+    if (ql->generation == q->generation) return false;
+    queue_list_find(ql, q);
+    return true;
+}
+
+// Before an entry is removed, select the one after it, which takes its
+// row, or the one before if it is the last
+static void queue_list_unselect(QueueList *ql, const PlayQueue *q, uint32_t id) {
+    uint32_t next = playqueue_next(q, id);
+    if (next != PLAYQUEUE_NONE) {
+        ql->selected_id = next;
+    } else {
+        ql->selected_id = playqueue_prev(q, id);
+        if (ql->selected > 0) ql->selected--;
+    }
+}
+
+// Keys of the queue list. Returns true if the queue changed.
+static bool queue_list_keys(QueueList *ql, Playlist *pl) {
+    PlayQueue *q = &pl->queue;
+    bool changed = queue_list_sync(ql, q);
+    VListMove move;
+    if (list_key(&move)) queue_list_select(ql, q, vlist_move(&ql->view, ql->selected, (int)q->count, move));
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0.0f) vlist_scroll_by(&ql->view, (int)(-wheel * WHEEL_ROWS), (int)q->count);
+
+    // Edits leave the selection on an entry whose row is known, so the
+    // entries of the rows are found from there as before
+    uint32_t id = ql->selected_id;
+    bool edited = true;
+    if (id != PLAYQUEUE_NONE && IsKeyPressed(KEY_ENTER)) {
+        queue_list_unselect(ql, q, id);
+        int track = playlist_play_queued(pl, id);
+        char path_buf[PLAYLIST_MAX_PATH];
+        if (track >= 0 && playlist_track_path(pl, track, path_buf, sizeof(path_buf))) {
+            audio_stop();
+            audio_play_file(path_buf);
+        }
+    } else if (id != PLAYQUEUE_NONE && (IsKeyPressed(KEY_DELETE) || IsKeyPressed(KEY_BACKSPACE))) {
+        queue_list_unselect(ql, q, id);
+        playqueue_remove(q, id);
+    } else if (id != PLAYQUEUE_NONE && (IsKeyPressed(KEY_LEFT_BRACKET) || IsKeyPressedRepeat(KEY_LEFT_BRACKET)) &&
+               playqueue_prev(q, id) != PLAYQUEUE_NONE) {
+        // Earlier: in front of the one before
+        playqueue_move(q, id, playqueue_prev(q, id));
+        ql->selected--;
+    } else if (id != PLAYQUEUE_NONE && (IsKeyPressed(KEY_RIGHT_BRACKET) || IsKeyPressedRepeat(KEY_RIGHT_BRACKET)) &&
+               playqueue_next(q, id) != PLAYQUEUE_NONE) {
+        // Later: in front of the one after the next, or last
+        playqueue_move(q, id, playqueue_next(q, playqueue_next(q, id)));
+        ql->selected++;
+    } else if (IsKeyPressed(KEY_C) && q->count > 0) {
+        playqueue_clear(q);
+        ql->selected = 0;
+        ql->selected_id = PLAYQUEUE_NONE;
+    } else {
+        edited = false;
+    }
+    if (edited) {
+        ql->last_id = PLAYQUEUE_NONE;
+        ql->generation = q->generation;
+        vlist_follow(&ql->view, ql->selected, (int)q->count);
+        changed = true;
+    }
+
+    if (IsKeyPressed(KEY_ESCAPE) || IsKeyPressed(KEY_U)) ql->active = false;
+    return changed;
+}
+
+// Drawing. The now-playing header and the list panel are drawn into cached
+// layers and only redrawn when what they show changes; the clock and
+// progress bar are cheap and drawn straight into every frame.
+
+// What the cached layers show; a change marks the layer dirty
+typedef struct {
+    int current;
+    AudioState state;
+    bool shuffle;
+    bool smart_shuffle;
+    RepeatMode repeat;
+    int volume;
+    uint32_t queued;
+    unsigned int generation;
+} HeaderView;
+
+typedef struct {
+    bool browser;
+    bool search;
+    bool queue;
+    double scroll;
+    int selected;
+    int current;
+    int count;
+    unsigned long scan_dirs;   // directories read by a running scan
+    unsigned int generation;
+} ListView;
+
+#define PROGRESS_Y (PANEL_PADDING + (LINE_HEIGHT + 8))
+
+static void draw_now_playing(const Playlist *pl, AudioState state) {
+    draw_panel(0, 0, WINDOW_WIDTH, NOW_PLAYING_HEIGHT);
+
+    char title[256];
+    const char *current_title = playlist_track_title(pl, pl->current, title, sizeof(title));
+    Vector2 pos = { PANEL_PADDING, PANEL_PADDING };
+
+    if (current_title) {
+        char now_playing[280];
+        snprintf(now_playing, sizeof(now_playing), "Now Playing: %s", current_title);
+        glyphcache_draw_text(now_playing, pos, COLOR_TEXT);
+    } else {
+        glyphcache_draw_text("Now Playing: -", pos, COLOR_TEXT_DIM);
+    }
+
+    // Playback state icon
+    pos.y = PROGRESS_Y;
+    glyphcache_draw_text(state_icon(state), pos, COLOR_ACCENT);
+
+    // Shuffle/Repeat/Volume display
+    char mode_str[32];
+    const char *repeat_str = pl->repeat == REPEAT_ONE ? "1" :
+                             pl->repeat == REPEAT_ALL ? "A" : "-";
+    snprintf(mode_str, sizeof(mode_str), "[%s][%s] %d%%",
+             !pl->shuffle ? "-" : pl->smart_shuffle ? "S+" : "S",
+             repeat_str,
+             (int)(audio_get_volume() * 100));
+    Vector2 mode_pos = { WINDOW_WIDTH - 110, pos.y };
+    glyphcache_draw_text(mode_str, mode_pos, COLOR_TEXT_DIM);
+    if (pl->queue.count > 0) {
+        char queue_str[32];
+        snprintf(queue_str, sizeof(queue_str), "%u queued", pl->queue.count);
+        Vector2 queue_pos = { WINDOW_WIDTH - 230, pos.y };
+        glyphcache_draw_text(queue_str, queue_pos, COLOR_TEXT_DIM);
+    }
+
+    // Progress bar track; the fill is drawn per frame
+    int bar_y = PROGRESS_Y + LINE_HEIGHT + 4;
+    DrawRectangle(PANEL_PADDING, bar_y, WINDOW_WIDTH - PANEL_PADDING * 2, 6, COLOR_BORDER);
+}
+
+static void draw_progress(void) {
+    double position = audio_get_position();
+    double duration = audio_get_duration();
+    char pos_str[16], dur_str[16], time_str[48];
+    format_time(position, pos_str, sizeof(pos_str));
+    format_time(duration, dur_str, sizeof(dur_str));
+    snprintf(time_str, sizeof(time_str), "%s / %s", pos_str, dur_str);
+    Vector2 time_pos = { PANEL_PADDING + 50, PROGRESS_Y };
+    glyphcache_draw_text(time_str, time_pos, COLOR_TEXT);
+
+    int bar_x = PANEL_PADDING;
+    int bar_y = PROGRESS_Y + LINE_HEIGHT + 4;
+    int bar_w = WINDOW_WIDTH - PANEL_PADDING * 2;
+    int bar_h = 6;
+    if (duration > 0) {
+        int fill_w = (int)(bar_w * (position / duration));
+        if (fill_w > bar_w) fill_w = bar_w;
+        DrawRectangle(bar_x, bar_y, fill_w, bar_h, COLOR_ACCENT);
+    }
+}
+
+// How the rows of a list read. The playlist, its search results and the
+// browser all draw through draw_rows().
+typedef struct {
+    VListFormatFn format;
+    bool (*accent)(void *user, int row);   // drawn in the accent color; NULL if none is
+    void *user;
+} RowModel;
+
+// The rows on screen, from where the list is scrolled to, clipped to the
+// rows area starting at y. Only their text is looked at, through the
+// view's cache, however long the list is.
+static void draw_rows(const RenderLayer *layer, VList *vl, int y, int count, int selected,
+                      const RowModel *model, uint32_t generation) {
+    double offset;
+    int first = vlist_first(vl, &offset);
+    render_layer_clip(layer, 0, y - 2, WINDOW_WIDTH, vl->rows * LINE_HEIGHT);
+    for (int i = 0; i <= vl->rows && first + i < count; i++) {
+        int row = first + i;
+        if (row < 0) continue;
+        Vector2 pos = { PANEL_PADDING, (float)(y + (i - offset) * LINE_HEIGHT) };
+
+        Color color = model->accent && model->accent(model->user, row) ? COLOR_ACCENT : COLOR_TEXT_DIM;
+        if (row == selected) {
+            DrawRectangle(PANEL_PADDING - 2, (int)pos.y - 2,
+                          WINDOW_WIDTH - PANEL_PADDING * 2 + 4, LINE_HEIGHT,
+                          COLOR_BORDER);
+            color = COLOR_TEXT;
+        }
+
+        glyphcache_draw_text(vlist_text(vl, row, generation, model->format, model->user), pos, color);
+    }
+    render_layer_unclip();
+}
+
+// Where a list longer than the screen is scrolled to: a thumb on the
+// right edge of the rows area at y, and with range the rows shown in the
+// bottom-right corner
+static void draw_scroll_info(const VList *vl, int y, int count, bool range) {
+    if (count <= vl->rows) return;
+
+    int height = vl->rows * LINE_HEIGHT;
+    int thumb = (int)((double)height * vl->rows / count);
+    if (thumb < SCROLL_THUMB_MIN) thumb = SCROLL_THUMB_MIN;
+    double at = vl->scroll / (count - vl->rows);
+    if (at < 0.0) at = 0.0;
+    if (at > 1.0) at = 1.0;
+    DrawRectangle(WINDOW_WIDTH - 5, y + (int)((height - thumb) * at), 3, thumb, COLOR_BORDER);
+
+    if (!range) return;
+    char info[48];
+    int last = vl->top + vl->rows > count ? count : vl->top + vl->rows;
+    int n = snprintf(info, sizeof(info), "[%d-%d of %d]", vl->top + 1, last, count);
+    Vector2 pos = { (float)(WINDOW_WIDTH - PANEL_PADDING - n * SCROLL_CHAR_WIDTH), WINDOW_HEIGHT - LINE_HEIGHT - 5 };
+    glyphcache_draw_text(info, pos, COLOR_TEXT_DIM);
+}
+
+static void format_browser_row(void *user, int row, char *buf, size_t size) {
+    static const char *const kinds[] = { "", "M3U", "PLS", "XSPF" };
+    const Browser *br = user;
+    const char *name = browser_entry_name(br, row);
+    const DirListEntry *entry = browser_entry(br, row);
+    if (entry && entry->counted && entry->tracks > 0) {
+        char duration[16];
+        format_time(entry->seconds, duration, sizeof(duration));
+        snprintf(buf, size, "  [DIR] %s  (%u %s, %s)", name, (unsigned)entry->tracks,
+                 entry->tracks == 1 ? "track" : "tracks", duration);
+    } else {
+        snprintf(buf, size, "  [%s] %s", browser_entry_is_dir(br, row) ? "DIR" : kinds[plfile_format(name)], name);
+    }
+}
+
+static void draw_browser(const RenderLayer *layer, Browser *br, uint32_t generation) {
+    draw_panel(0, TRACK_LIST_Y, WINDOW_WIDTH, TRACK_LIST_HEIGHT);
+    Vector2 pos = { PANEL_PADDING, TRACK_LIST_Y + PANEL_PADDING };
+
+    // Draw browser header
+    char header[280];
+    snprintf(header, sizeof(header), "Browse: %s%s", br->path,
+             br->listing && !br->listing->done ? "  (reading...)" : "");
+    glyphcache_draw_text(header, pos, COLOR_ACCENT);
+    pos.y += LINE_HEIGHT;
+
+    // Draw directory entries
+    RowModel model = { format_browser_row, NULL, br };
+    draw_rows(layer, &br->view, (int)pos.y, br->count, br->selected, &model, generation);
+    draw_scroll_info(&br->view, (int)pos.y, br->count, false);
+
+    // Browser hint, or the name being typed
+    Vector2 hint_pos = { PANEL_PADDING, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
+    if (br->jumping) {
+        char jump[280];
+        snprintf(jump, sizeof(jump), "Jump to: %s_", br->jump);
+        glyphcache_draw_text(jump, hint_pos, COLOR_TEXT);
+    } else {
+        glyphcache_draw_text("Tab:close  Enter:select  L:load tree  /:jump  Esc:cancel", hint_pos, COLOR_TEXT_DIM);
+    }
+}
+
+// Rows of the track list: all tracks, or the ones ids lists
+typedef struct {
+    const Playlist *pl;
+    const uint32_t *ids;
+} TrackRows;
+
+static int track_row_track(const TrackRows *rows, int row) {
+    return rows->ids ? (int)rows->ids[row] : row;
+}
+
+static void format_track_row(void *user, int row, char *buf, size_t size) {
+    const TrackRows *rows = user;
+    int track = track_row_track(rows, row);
+    char title[256];
+    const char *text = playlist_track_title(rows->pl, track, title, sizeof(title));
+    if (!text) {
+        buf[0] = '\0';
+        return;
+    }
+    snprintf(buf, size, "%2d. %s%s", track + 1, text, rows->pl->tracks[track].missing ? "  (missing)" : "");
+}
+
+static bool track_row_playing(void *user, int row) {
+    const TrackRows *rows = user;
+    return track_row_track(rows, row) == rows->pl->current;
+}
+
+// ids lists the tracks to show, NULL for all of them; selected is a row.
+// scan is NULL unless a recursive scan is running.
+static void draw_track_list(const RenderLayer *layer, const Playlist *pl, VList *vl, const uint32_t *ids,
+                            int id_count, int selected, const ScanProgress *scan, uint32_t generation) {
+    draw_panel(0, TRACK_LIST_Y, WINDOW_WIDTH, TRACK_LIST_HEIGHT);
+    int y = TRACK_LIST_Y + PANEL_PADDING;
+    int count = ids ? id_count : pl->count;
+
+    TrackRows rows = { pl, ids };
+    RowModel model = { format_track_row, track_row_playing, &rows };
+    draw_rows(layer, vl, y, count, selected, &model, generation);
+    draw_scroll_info(vl, y, count, true);
+
+    if (scan) {
+        char scan_info[80];
+        snprintf(scan_info, sizeof(scan_info), "Scanning... %llu files in %llu dirs",
+                 (unsigned long long)scan->files, (unsigned long long)scan->dirs);
+        Vector2 scan_pos = { PANEL_PADDING, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
+        glyphcache_draw_text(scan_info, scan_pos, COLOR_ACCENT);
+    }
+}
+
+// Rows of the queue list
+typedef struct {
+    Playlist *pl;
+    QueueList *ql;
+} QueueRows;
+
+static void format_queue_row(void *user, int row, char *buf, size_t size) {
+    QueueRows *rows = user;
+    const PlayQueue *q = &rows->pl->queue;
+    uint32_t id = queue_list_entry(rows->ql, q, row);
+    int track = playlist_queue_track(rows->pl, id);
+    char title[256];
+    if (track >= 0) {
+        snprintf(buf, size, "%2d. %s", row + 1, playlist_track_title(rows->pl, track, title, sizeof(title)));
+    } else {
+        const char *path = playqueue_path(q, id);
+        const char *slash = strrchr(path, '/');
+        snprintf(buf, size, "%2d. %s  (not in playlist)", row + 1, slash ? slash + 1 : path);
+    }
+}
+
+static void draw_queue_list(const RenderLayer *layer, Playlist *pl, QueueList *ql, uint32_t generation) {
+    draw_panel(0, TRACK_LIST_Y, WINDOW_WIDTH, TRACK_LIST_HEIGHT);
+    Vector2 pos = { PANEL_PADDING, TRACK_LIST_Y + PANEL_PADDING };
+    int count = (int)pl->queue.count;
+
+    char header[64];
+    snprintf(header, sizeof(header), "Up next: %d track%s", count, count == 1 ? "" : "s");
+    glyphcache_draw_text(header, pos, COLOR_ACCENT);
+    pos.y += LINE_HEIGHT;
+
+    QueueRows rows = { pl, ql };
+    RowModel model = { format_queue_row, NULL, &rows };
+    draw_rows(layer, &ql->view, (int)pos.y, count, ql->selected, &model, generation);
+    draw_scroll_info(&ql->view, (int)pos.y, count, false);
+
+    Vector2 hint_pos = { PANEL_PADDING, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
+    glyphcache_draw_text("U:close  Enter:play  Del:remove  [ ]:move  C:clear", hint_pos, COLOR_TEXT_DIM);
+}
+
+// Query line at the bottom of the track list, where the scan info goes
+static void draw_search_prompt(const SearchBox *sb) {
+    char prompt[SEARCH_QUERY_MAX + 32];
+    if (sb->len == 0) {
+        snprintf(prompt, sizeof(prompt), "/");
+    } else if (sb->search.count == 0) {
+        snprintf(prompt, sizeof(prompt), "/%s  no matches", sb->query);
+    } else {
+        snprintf(prompt, sizeof(prompt), "/%s  %u", sb->query, sb->search.count);
+    }
+    Vector2 prompt_pos = { PANEL_PADDING, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
+    glyphcache_draw_text(prompt, prompt_pos, COLOR_ACCENT);
+}
+
+// Command-line options
+typedef struct {
+    const char *dir_path;   // or a playlist file
+    const char *font_path;  // NULL for the embedded font
+    const char *export_path;   // write the playlist here and quit
+    RtSchedThreadConfig sched[RTSCHED_THREAD_COUNT];
+    AudioConfig audio;
+    bool log_jitter;
+    bool log_wakeups;
+    bool log_startup;
+    bool locale_sort;
+    bool recursive;
+    bool no_index;
+    bool no_watch;
+    uint64_t shuffle_seed;   // 0: from the clock
+} Options;
+
+enum {
+    OPT_RT_POLICY = 256,
+    OPT_RT_PRIORITY,
+    OPT_CPU_CALLBACK,
+    OPT_CPU_DECODE,
+    OPT_CPU_UI,
+    OPT_PROFILE,
+    OPT_PERIOD,
+    OPT_PERIODS,
+    OPT_EXCLUSIVE,
+    OPT_LOG_JITTER,
+    OPT_LOG_WAKEUPS,
+    OPT_LOG_STARTUP,
+    OPT_FONT,
+    OPT_SORT,
+    OPT_NO_INDEX,
+    OPT_NO_WATCH,
+    OPT_SHUFFLE_SEED,
+    OPT_EXPORT
+};
+
+// True if any key went down this frame or a repeatable key is held.
+static bool input_active(void) {
+    static const int held_keys[] = {
+        KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_EQUAL, KEY_MINUS, KEY_KP_ADD, KEY_KP_SUBTRACT,
+        KEY_BACKSPACE
+    };
+
+    bool active = false;
+    while (GetKeyPressed() != 0) active = true;
+    for (size_t i = 0; i < sizeof(held_keys) / sizeof(held_keys[0]); i++) {
+        if (IsKeyDown(held_keys[i])) active = true;
+    }
+    return active;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <directory|playlist>\n"
+            "\n"
+            "Options:\n"
+            "  --rt-policy fifo|rr|other  real-time policy for the callback and decode threads\n"
+            "  --rt-priority N            callback thread priority, 1-99 (decode runs 10 lower)\n"
+            "  --cpu-callback LIST        pin the audio callback thread, e.g. 3 or 2-3\n"
+            "  --cpu-decode LIST          pin the decode thread\n"
+            "  --cpu-ui LIST              pin the UI thread\n"
+            "  --profile default|lowlatency|powersaver\n"
+            "                             output buffering profile\n"
+            "  --period FRAMES            device period size in frames\n"
+            "  --periods N                number of device periods\n"
+            "  --exclusive                request exclusive access to the output device\n"
+            "  --log-jitter               print audio callback timing once per second\n"
+            "  --log-wakeups              print callback, decoder and UI wakeups per second\n"
+            "  --log-startup              print the time to the first frame, font setup and\n"
+            "                             recursive scan\n"
+            "  --font PATH                TTF/OTF font instead of the built-in Terminus\n"
+            "  --sort natural|locale      order names by number-aware byte order (default)\n"
+            "                             or by the locale's collation rules\n"
+            "  -r, --recursive            include subdirectories, scanned in the background\n"
+            "  --no-index                 don't load or save the library index (-r only)\n"
+            "  --no-watch                 don't follow files being added or removed\n"
+            "  --shuffle-seed N           repeatable shuffle order, N > 0\n"
+            "  --export FILE              write the tracks with their tags to an .m3u, .m3u8,\n"
+            "                             .pls or .xspf file and quit\n"
+            "\n"
+            "A playlist is an .m3u, .m3u8, .pls or .xspf file.\n",
+            prog);
+}
+
+static bool parse_options(int argc, char *argv[], Options *opts) {
+    static const struct option long_options[] = {
+        { "rt-policy",    required_argument, NULL, OPT_RT_POLICY },
+        { "rt-priority",  required_argument, NULL, OPT_RT_PRIORITY },
+        { "cpu-callback", required_argument, NULL, OPT_CPU_CALLBACK },
+        { "cpu-decode",   required_argument, NULL, OPT_CPU_DECODE },
+        { "cpu-ui",       required_argument, NULL, OPT_CPU_UI },
+        { "profile",      required_argument, NULL, OPT_PROFILE },
+        { "period",       required_argument, NULL, OPT_PERIOD },
+        { "periods",      required_argument, NULL, OPT_PERIODS },
+        { "exclusive",    no_argument,       NULL, OPT_EXCLUSIVE },
+        { "log-jitter",   no_argument,       NULL, OPT_LOG_JITTER },
+        { "log-wakeups",  no_argument,       NULL, OPT_LOG_WAKEUPS },
+        { "log-startup",  no_argument,       NULL, OPT_LOG_STARTUP },
+        { "font",         required_argument, NULL, OPT_FONT },
+        { "sort",         required_argument, NULL, OPT_SORT },
+        { "recursive",    no_argument,       NULL, 'r' },
+        { "no-index",     no_argument,       NULL, OPT_NO_INDEX },
+        { "no-watch",     no_argument,       NULL, OPT_NO_WATCH },
+        { "shuffle-seed", required_argument, NULL, OPT_SHUFFLE_SEED },
+        { "export",       required_argument, NULL, OPT_EXPORT },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    opts->sched[RTSCHED_THREAD_CALLBACK].priority = RTSCHED_DEFAULT_CALLBACK_PRIORITY;
+    opts->sched[RTSCHED_THREAD_DECODE].priority = RTSCHED_DEFAULT_DECODE_PRIORITY;
+
+    // Explicit buffer settings override the profile regardless of order
+    AudioProfile profile = AUDIO_PROFILE_DEFAULT;
+    int period_frames = -1;
+    int periods = -1;
+    bool exclusive = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "hr", long_options, NULL)) != -1) {
+        switch (c) {
+            case OPT_RT_POLICY: {
+                RtSchedPolicy policy;
+                if (!rtsched_parse_policy(optarg, &policy)) {
+                    fprintf(stderr, "Invalid --rt-policy: %s\n", optarg);
+                    return false;
+                }
+                opts->sched[RTSCHED_THREAD_CALLBACK].policy = policy;
+                opts->sched[RTSCHED_THREAD_DECODE].policy = policy;
+                break;
+            }
+            case OPT_RT_PRIORITY: {
+                int priority = atoi(optarg);
+                if (priority < 1 || priority > 99) {
+                    fprintf(stderr, "Invalid --rt-priority: %s\n", optarg);
+                    return false;
+                }
+                opts->sched[RTSCHED_THREAD_CALLBACK].priority = priority;
+                opts->sched[RTSCHED_THREAD_DECODE].priority = priority > 10 ? priority - 10 : 1;
+                break;
+            }
+            case OPT_CPU_CALLBACK:
+            case OPT_CPU_DECODE:
+            case OPT_CPU_UI: {
+                RtSchedThread which = c == OPT_CPU_CALLBACK ? RTSCHED_THREAD_CALLBACK :
+                                      c == OPT_CPU_DECODE ? RTSCHED_THREAD_DECODE : RTSCHED_THREAD_UI;
+                if (!rtsched_parse_cpus(optarg, &opts->sched[which].cpus)) {
+                    fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case OPT_PROFILE:
+                if (strcmp(optarg, "default") == 0) {
+                    profile = AUDIO_PROFILE_DEFAULT;
+                } else if (strcmp(optarg, "lowlatency") == 0) {
+                    profile = AUDIO_PROFILE_LOW_LATENCY;
+                } else if (strcmp(optarg, "powersaver") == 0) {
+                    profile = AUDIO_PROFILE_POWER_SAVER;
+                } else {
+                    fprintf(stderr, "Invalid --profile: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_PERIOD:
+                period_frames = atoi(optarg);
+                if (period_frames < 16 || period_frames > 65536) {
+                    fprintf(stderr, "Invalid --period: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_PERIODS:
+                periods = atoi(optarg);
+                if (periods < 2 || periods > 16) {
+                    fprintf(stderr, "Invalid --periods: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_EXCLUSIVE:
+                exclusive = true;
+                break;
+            case OPT_LOG_JITTER:
+                opts->log_jitter = true;
+                break;
+            case OPT_LOG_WAKEUPS:
+                opts->log_wakeups = true;
+                break;
+            case OPT_LOG_STARTUP:
+                opts->log_startup = true;
+                break;
+            case OPT_FONT:
+                opts->font_path = optarg;
+                break;
+            case 'r':
+                opts->recursive = true;
+                break;
+            case OPT_NO_INDEX:
+                opts->no_index = true;
+                break;
+            case OPT_NO_WATCH:
+                opts->no_watch = true;
+                break;
+            case OPT_SHUFFLE_SEED: {
+                char *end;
+                opts->shuffle_seed = strtoull(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || opts->shuffle_seed == 0) {
+                    fprintf(stderr, "Invalid --shuffle-seed: %s\n", optarg);
+                    return false;
+                }
+                break;
+            }
+            case OPT_EXPORT:
+                if (plfile_format(optarg) == PLFILE_UNKNOWN) {
+                    fprintf(stderr, "Invalid --export: %s (not .m3u, .m3u8, .pls or .xspf)\n", optarg);
+                    return false;
+                }
+                opts->export_path = optarg;
+                break;
+            case OPT_SORT:
+                if (strcmp(optarg, "natural") == 0) {
+                    opts->locale_sort = false;
+                } else if (strcmp(optarg, "locale") == 0) {
+                    opts->locale_sort = true;
+                } else {
+                    fprintf(stderr, "Invalid --sort: %s\n", optarg);
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    audio_config_init(&opts->audio, profile);
+    if (period_frames > 0) opts->audio.period_frames = (unsigned int)period_frames;
+    if (periods > 0) opts->audio.periods = (unsigned int)periods;
+    if (exclusive) opts->audio.exclusive = true;
+
+    if (optind >= argc) return false;
+    opts->dir_path = argv[optind];
+    return true;
+}
+
+// The directory or playlist file named on the command line
+static bool load_playlist(Playlist *pl, const Options *opts) {
+    struct stat st;
+    if (plfile_format(opts->dir_path) != PLFILE_UNKNOWN && stat(opts->dir_path, &st) == 0 &&
+        S_ISREG(st.st_mode)) {
+        return playlist_load_file(pl, opts->dir_path);
+    }
+    return opts->recursive ? playlist_scan_recursive(pl, opts->dir_path) : playlist_scan(pl, opts->dir_path);
+}
+
+// --export: load the tracks, wait for the scan and their tags, and write
+// them out, without audio or a window
+static bool export_playlist(const Options *opts) {
+    if (!pool_init(0)) {
+        fprintf(stderr, "Failed to start worker pool\n");
+        return false;
+    }
+    if (opts->locale_sort) setlocale(LC_COLLATE, "");
+
+    Playlist playlist = {0};
+    playlist.locale_sort = opts->locale_sort;
+    playlist.library_index = !opts->no_index;
+    bool ok = load_playlist(&playlist, opts);
+    if (!ok) fprintf(stderr, "Failed to load: %s\n", opts->dir_path);
+
+    struct timespec tick = { 0, 5000000 };
+    ScanProgress progress;
+    while (ok && playlist.scan) {
+        playlist_scan_poll(&playlist, &progress);
+        nanosleep(&tick, NULL);
+    }
+    while (ok && playlist_tags_busy(&playlist)) {
+        playlist_tags_update(&playlist, NULL, 0, 0, 0);
+        nanosleep(&tick, NULL);
+    }
+
+    ok = ok && playlist_save_file(&playlist, opts->export_path);
+    if (ok) fprintf(stderr, "Wrote %d tracks to %s\n", playlist.count, opts->export_path);
+    playlist_free(&playlist);
+    pool_shutdown();
+    return ok;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <directory>\n", argv[0]);
+    double start_ms = monotonic_ms();
+    bool first_frame = true;
+
+    Options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    const char *dir_path = argv[1];
+    const char *dir_path = opts.dir_path;
+    if (opts.export_path) return export_playlist(&opts) ? 0 : 1;
+
+    // Thread scheduling: audio threads are configured inside audio_init()
+    // and on the first callback, the UI thread right here
+    for (int i = 0; i < RTSCHED_THREAD_COUNT; i++) {
+        rtsched_configure((RtSchedThread)i, &opts.sched[i]);
+    }
+    rtsched_apply(RTSCHED_THREAD_UI, pthread_self());
 
     // Initialize audio
-    if (!audio_init()) {
+    if (!audio_init(&opts.audio)) {
         fprintf(stderr, "Failed to initialize audio\n");
         return 1;
     }
 
+    rtsched_report(stderr);
+
+    AudioOutputInfo output;
+    audio_get_output_info(&output);
+    fprintf(stderr, "Audio output: %s, %u Hz, %u x %u frames (%.1f ms)%s\n",
+            output.backend ? output.backend : "unknown", output.sample_rate,
+            output.periods, output.period_frames, output.latency_ms,
+            output.exclusive ? ", exclusive" : "");
+
+    // Background workers for scanning and analysis
+    if (!pool_init(0)) {
+        fprintf(stderr, "Failed to start worker pool\n");
+        audio_shutdown();
+        return 1;
+    }
+
+    // Collation only; number formatting stays "C"
+    if (opts.locale_sort) {
+        setlocale(LC_COLLATE, "");
+        locale_sort = true;
+    }
+
     // Scan directory for tracks
     Playlist playlist = {0};
-    if (!playlist_scan(&playlist, dir_path)) {
-        fprintf(stderr, "Failed to scan directory: %s\n", dir_path);
+    playlist.locale_sort = opts.locale_sort;
+    playlist.library_index = !opts.no_index;
+    playlist.watch_changes = !opts.no_watch;
+    playlist.shuffle_seed = opts.shuffle_seed;
+    if (!load_playlist(&playlist, &opts)) {
+        fprintf(stderr, "Failed to load: %s\n", dir_path);
+        playlist_free(&playlist);
+        pool_shutdown();
         audio_shutdown();
         return 1;
     }
 
-    if (playlist.count == 0) {
+    // A recursive scan reports its tracks later
+    if (playlist.count == 0 && !playlist.scan) {
         fprintf(stderr, "No audio files found in: %s\n", dir_path);
+        playlist_free(&playlist);
+        pool_shutdown();
         audio_shutdown();
         return 1;
     }
 
+    // The queue as the last run left it, saved again as it changes
+    char queue_path[PLAYLIST_MAX_PATH];
+    bool keep_queue = playqueue_state_path(queue_path, sizeof(queue_path));
+    if (keep_queue) keep_queue = playlist_load_queue(&playlist, queue_path);
+
     // Initialize raylib window
     SetTraceLogLevel(LOG_WARNING);
     InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "oscyl");
-    SetTargetFPS(60);
+    SetTargetFPS(ACTIVE_FPS);
     SetExitKey(KEY_NULL);  // Disable Esc closing window
 
-    // Load font
-    Font font = LoadFontEx("assets/terminus.ttf", FONT_SIZE, NULL, 0);
-    if (font.texture.id == 0) {
-        fprintf(stderr, "Warning: Failed to load font, using default\n");
-        font = GetFontDefault();
-    }
+    // Glyphs are rasterized as track names need them
+    glyphcache_init(opts.font_path, FONT_SIZE);
 
-    int scroll_offset = 0;
+    double last_jitter_log = GetTime();
+
+    // Cached layers and frame pacing
+    RenderLayer header_layer, list_layer;
+    if (!render_layer_init(&header_layer, (Rectangle){ 0, 0, WINDOW_WIDTH, NOW_PLAYING_HEIGHT }) ||
+        !render_layer_init(&list_layer, (Rectangle){ 0, TRACK_LIST_Y, WINDOW_WIDTH, TRACK_LIST_HEIGHT })) {
+        glyphcache_shutdown();
+        CloseWindow();
+        playlist_free(&playlist);
+        pool_shutdown();
+        audio_shutdown();
+        return 1;
+    }
+    HeaderView last_header_view;
+    ListView last_list_view;
+    memset(&last_header_view, 0, sizeof(last_header_view));
+    memset(&last_list_view, 0, sizeof(last_list_view));
+    unsigned int view_generation = 0;  // bumped when list contents change
+    bool show_overlay = false;
+
+    bool power_saver = opts.audio.profile == AUDIO_PROFILE_POWER_SAVER;
+    VList track_view = {0};
+    vlist_init(&track_view, MAX_VISIBLE_TRACKS, !power_saver);
+    double last_activity = GetTime();
+    int target_fps = ACTIVE_FPS;
+    bool event_waiting = false;
+    unsigned long frames = 0;
+    unsigned long last_frames = 0;
+    AudioStats last_wakeup_stats;
+    audio_get_stats(&last_wakeup_stats);
+    double last_wakeup_log = GetTime();
 
     // Browser state
     Browser browser = {0};
+    browser.watch_changes = !opts.no_watch;
+    vlist_init(&browser.view, MAX_VISIBLE_TRACKS - 1, !power_saver);
+    SearchBox search_box = {0};
+    vlist_init(&search_box.view, MAX_VISIBLE_TRACKS, !power_saver);
+    QueueList queue_list = {0};
+    vlist_init(&queue_list.view, MAX_VISIBLE_TRACKS - 1, !power_saver);
+    queue_list.selected_id = queue_list.last_id = PLAYQUEUE_NONE;
+    double last_queue_save = 0.0;
+    bool queue_save_failed = false;
+    uint32_t queue_failed_generation = 0;
 
     // Main loop
     while (!WindowShouldClose()) {
+        render_frame_begin();
+        glyphcache_begin_frame();
+
         // Input: toggle browser
-        if (IsKeyPressed(KEY_TAB)) {
+        if (!search_box.active && IsKeyPressed(KEY_TAB)) {
             browser.active = !browser.active;
             if (browser.active) {
                 // Start browsing from current playlist directory
@@ -215,61 +1288,113 @@ int main(int argc, char *argv[]) {
                 } else {
                     browser_scan(&browser, "/");
                 }
+                view_generation++;
             }
         }
 
-        // Input: quit (always available)
-        if (IsKeyPressed(KEY_Q)) {
+        // Input: quit (unless typing a search or a name to jump to)
+        if (!search_box.active && !(browser.active && browser.jumping) && IsKeyPressed(KEY_Q)) {
             break;
         }
 
+        // Input: frame timing overlay
+        if (IsKeyPressed(KEY_F3)) {
+            show_overlay = !show_overlay;
+        }
+
         if (browser.active) {
+            // Jump: typing selects the first name starting with the text
+            if (browser.jumping && text_edit(browser.jump, &browser.jump_len, (int)sizeof(browser.jump))) {
+                browser_jump(&browser);
+                view_generation++;
+            }
+
             // Browser navigation
-            if (IsKeyPressed(KEY_DOWN) || IsKeyPressedRepeat(KEY_DOWN)) {
-                if (browser.count > 0 && browser.selected < browser.count - 1) {
-                    browser.selected++;
-                    int visible = MAX_VISIBLE_TRACKS - 1;
-                    if (browser.selected >= browser.scroll_offset + visible) {
-                        browser.scroll_offset = browser.selected - visible + 1;
-                    }
-                }
+            VListMove move;
+            if (list_key(&move)) {
+                browser.selected = vlist_move(&browser.view, browser.selected, browser.count, move);
+                browser_show_selected(&browser);
+            }
+            float wheel = GetMouseWheelMove();
+            if (wheel != 0.0f) vlist_scroll_by(&browser.view, (int)(-wheel * WHEEL_ROWS), browser.count);
+            if (IsKeyPressed(KEY_ENTER)) {
+                browser.jumping = false;
+                browser_select_entry(&browser, &playlist, opts.recursive);
+                vlist_reset(&track_view, 0);  // Reset playlist scroll when loading new dir
+                view_generation++;
+            }
+            if (!browser.jumping && IsKeyPressed(KEY_L)) {
+                browser_load_tree(&browser, &playlist);
+                vlist_reset(&track_view, 0);
+                view_generation++;
+            }
+            if (!browser.jumping && IsKeyPressed(KEY_SLASH)) {
+                browser.jumping = true;
+                browser.jump_len = 0;
+                browser.jump[0] = '\0';
+                view_generation++;
+            } else if (IsKeyPressed(KEY_ESCAPE)) {
+                if (browser.jumping) browser.jumping = false;
+                else browser.active = false;
+                view_generation++;
             }
-            if (IsKeyPressed(KEY_UP) || IsKeyPressedRepeat(KEY_UP)) {
-                if (browser.selected > 0) {
-                    browser.selected--;
-                    if (browser.selected < browser.scroll_offset) {
-                        browser.scroll_offset = browser.selected;
-                    }
+        } else if (search_box.active) {
+            // Search: typing narrows the list to the matches, best first
+            if (text_edit(search_box.query, &search_box.len, SEARCH_QUERY_MAX)) {
+                search_box_run(&search_box, &playlist, false);
+                view_generation++;
+            }
+            int row_count = 0;
+            const uint32_t *rows = search_rows(&search_box, &row_count);
+            VListMove move;
+            if (list_key(&move)) {
+                if (!rows) {
+                    playlist.selected = vlist_move(&track_view, playlist.selected, playlist.count, move);
+                } else {
+                    search_box.selected = vlist_move(&search_box.view, search_box.selected, row_count, move);
                 }
             }
-            if (IsKeyPressed(KEY_ENTER)) {
-                browser_select_entry(&browser, &playlist);
-                scroll_offset = 0;  // Reset playlist scroll when loading new dir
+            if (rows && row_count > 0) {
+                playlist.selected = (int)rows[search_box.selected];
+                search_scroll_to_selected(&search_box);
+            }
+
+            // The full list shows the selection once the search closes
+            vlist_follow(&track_view, playlist.selected, playlist.count);
+
+            // Enter plays the selected match, Esc just closes the search
+            if (IsKeyPressed(KEY_ENTER) && (!rows || row_count > 0)) {
+                playlist_play_selected(&playlist);
+                char path_buf[PLAYLIST_MAX_PATH];
+                const char *path = playlist_selected_path(&playlist, path_buf, sizeof(path_buf));
+                if (path) {
+                    audio_stop();
+                    audio_play_file(path);
+                }
+                search_box.active = false;
             }
             if (IsKeyPressed(KEY_ESCAPE)) {
-                browser.active = false;
+                search_box.active = false;
+            }
+        } else if (queue_list.active) {
+            if (queue_list_keys(&queue_list, &playlist)) {
+                view_generation++;
             }
         } else {
             // Playlist navigation
-            if (IsKeyPressed(KEY_DOWN) || IsKeyPressedRepeat(KEY_DOWN)) {
-                playlist_select_next(&playlist);
-                if (playlist.selected >= scroll_offset + (int)MAX_VISIBLE_TRACKS) {
-                    scroll_offset = playlist.selected - (int)MAX_VISIBLE_TRACKS + 1;
-                }
-                if (scroll_offset < 0) scroll_offset = 0;
-            }
-            if (IsKeyPressed(KEY_UP) || IsKeyPressedRepeat(KEY_UP)) {
-                playlist_select_prev(&playlist);
-                if (playlist.selected < scroll_offset) {
-                    scroll_offset = playlist.selected;
-                }
-                if (scroll_offset < 0) scroll_offset = 0;
+            VListMove move;
+            if (list_key(&move)) {
+                playlist.selected = vlist_move(&track_view, playlist.selected, playlist.count, move);
+                vlist_follow(&track_view, playlist.selected, playlist.count);
             }
+            float wheel = GetMouseWheelMove();
+            if (wheel != 0.0f) vlist_scroll_by(&track_view, (int)(-wheel * WHEEL_ROWS), playlist.count);
 
             // Input: play selected
             if (IsKeyPressed(KEY_ENTER)) {
                 playlist_play_selected(&playlist);
-                const char *path = playlist_selected_path(&playlist);
+                char path_buf[PLAYLIST_MAX_PATH];
+                const char *path = playlist_selected_path(&playlist, path_buf, sizeof(path_buf));
                 if (path) {
                     audio_stop();
                     audio_play_file(path);
@@ -305,24 +1430,120 @@ int main(int argc, char *argv[]) {
 
             // Input: shuffle/repeat
             if (IsKeyPressed(KEY_S)) {
-                playlist_toggle_shuffle(&playlist);
+                playlist_cycle_shuffle(&playlist);
             }
             if (IsKeyPressed(KEY_R)) {
                 playlist_cycle_repeat(&playlist);
             }
+
+            // Input: search
+            if (IsKeyPressed(KEY_SLASH)) {
+                search_box_open(&search_box);
+            }
+
+            // Input: queue the selected track last, or next
+            if (IsKeyPressed(KEY_A) || IsKeyPressed(KEY_N)) {
+                playlist_queue_selected(&playlist, IsKeyPressed(KEY_N));
+            }
+            if (IsKeyPressed(KEY_U)) {
+                queue_list_open(&queue_list, &playlist.queue);
+                view_generation++;
+            }
+        }
+
+        // Keep the queue on disk, writing it out at most every
+        // QUEUE_SAVE_SECONDS however fast it changes; a pending write holds
+        // off event waiting. After a failed write, the next try waits for
+        // the queue to change again, or for quitting.
+        if (queue_save_failed && playlist.queue.generation != queue_failed_generation) {
+            queue_save_failed = false;
+        }
+        if (keep_queue && playlist.queue.dirty && !queue_save_failed &&
+            GetTime() - last_queue_save >= QUEUE_SAVE_SECONDS) {
+            queue_save_failed = !playqueue_save(&playlist.queue, queue_path);
+            queue_failed_generation = playlist.queue.generation;
+            last_queue_save = GetTime();
+        }
+
+        // Tracks found by a recursive scan
+        ScanProgress scan_progress;
+        bool scanning = playlist.scan != NULL;
+        if (scanning && playlist_scan_poll(&playlist, &scan_progress)) {
+            view_generation++;
+        }
+        if (scanning && scan_progress.done) {
+            if (opts.log_startup) {
+                fprintf(stderr, "Scanned %d tracks in %llu directories (%llu unchanged) in %.0f ms\n",
+                        playlist.count, (unsigned long long)scan_progress.dirs,
+                        (unsigned long long)scan_progress.reused, scan_progress.elapsed_ms);
+            }
+            scanning = false;
+        }
+
+        // Files added or removed since
+        if (playlist_watch_poll(&playlist)) {
+            vlist_follow(&track_view, playlist.selected, playlist.count);
+            view_generation++;
+        }
+        if (browser.active && browser_refresh(&browser)) {
+            view_generation++;
+        }
+
+        // Tags of the rows on screen first, the search results if they are
+        // shown, then of the rest
+        int shown_count = 0;
+        const uint32_t *shown = search_box.active ? search_rows(&search_box, &shown_count) : NULL;
+        const VList *shown_view = shown ? &search_box.view : &track_view;
+        if (playlist_tags_update(&playlist, shown, shown_count, shown_view->top, MAX_VISIBLE_TRACKS)) {
+            view_generation++;
+        }
+
+        // Search index for the tracks and tags so far
+        if (search_box.active && search_box_update(&search_box, &playlist)) {
+            view_generation++;
+        }
+        int search_count = 0;
+        const uint32_t *search_results = search_box.active ? search_rows(&search_box, &search_count) : NULL;
+
+        // Messages queued by the audio threads
+        rtlog_drain(stderr);
+
+        if (opts.log_jitter && GetTime() - last_jitter_log >= 1.0) {
+            last_jitter_log = GetTime();
+            AudioJitter jitter;
+            AudioStats stats;
+            audio_take_jitter(&jitter);
+            audio_get_stats(&stats);
+            if (jitter.callbacks > 0) {
+                fprintf(stderr, "Callback timing: %lu calls, interval %.2f ms, "
+                        "jitter mean %.3f sd %.3f max %.3f ms, underruns %lu\n",
+                        jitter.callbacks, jitter.mean_interval_ms, jitter.mean_jitter_ms,
+                        jitter.stddev_jitter_ms, jitter.max_jitter_ms, stats.underruns);
+            }
+        }
+
+        frames++;
+        if (opts.log_wakeups && GetTime() - last_wakeup_log >= WAKEUP_LOG_SECONDS) {
+            double elapsed = GetTime() - last_wakeup_log;
+            AudioStats stats;
+            audio_get_stats(&stats);
+            fprintf(stderr, "Wakeups/s: callback %.1f, decoder %.1f, ui %.1f\n",
+                    (double)(stats.callbacks - last_wakeup_stats.callbacks) / elapsed,
+                    (double)(stats.decoder_wakeups - last_wakeup_stats.decoder_wakeups) / elapsed,
+                    (double)(frames - last_frames) / elapsed);
+            last_wakeup_stats = stats;
+            last_frames = frames;
+            last_wakeup_log = GetTime();
         }
 
         // Auto-advance when track finishes
         if (audio_is_finished() && playlist.current >= 0) {
             int next = playlist_advance(&playlist);
-            if (next >= 0) {
-                audio_play_file(playlist.paths[next]);
+            char path_buf[PLAYLIST_MAX_PATH];
+            if (next >= 0 && playlist_track_path(&playlist, next, path_buf, sizeof(path_buf))) {
+                audio_play_file(path_buf);
                 // Scroll if needed
-                if (playlist.selected >= scroll_offset + MAX_VISIBLE_TRACKS) {
-                    scroll_offset = playlist.selected - MAX_VISIBLE_TRACKS + 1;
-                } else if (playlist.selected < scroll_offset) {
-                    scroll_offset = playlist.selected;
-                }
+                vlist_follow(&track_view, playlist.selected, playlist.count);
             } else {
                 // End of playlist
                 audio_stop();
@@ -330,140 +1551,165 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        // Draw
-        BeginDrawing();
-        ClearBackground(COLOR_BG);
-
-        // Now Playing panel
-        draw_panel(0, 0, WINDOW_WIDTH, NOW_PLAYING_HEIGHT);
-
-        const char *current_name = playlist_current_name(&playlist);
-        Vector2 pos = { PANEL_PADDING, PANEL_PADDING };
-
-        if (current_name) {
-            char now_playing[256];
-            snprintf(now_playing, sizeof(now_playing), "Now Playing: %s", current_name);
-            DrawTextEx(font, now_playing, pos, FONT_SIZE, 1, COLOR_TEXT);
-        } else {
-            DrawTextEx(font, "Now Playing: -", pos, FONT_SIZE, 1, COLOR_TEXT_DIM);
-        }
-
-        // Playback state icon and time
-        pos.y += LINE_HEIGHT + 8;
-        const char *icon = state_icon(audio_get_state());
-        DrawTextEx(font, icon, pos, FONT_SIZE, 1, COLOR_ACCENT);
-
-        // Time display
-        double position = audio_get_position();
-        double duration = audio_get_duration();
-        char pos_str[16], dur_str[16], time_str[48];
-        format_time(position, pos_str, sizeof(pos_str));
-        format_time(duration, dur_str, sizeof(dur_str));
-        snprintf(time_str, sizeof(time_str), "%s / %s", pos_str, dur_str);
-        Vector2 time_pos = { pos.x + 50, pos.y };
-        DrawTextEx(font, time_str, time_pos, FONT_SIZE, 1, COLOR_TEXT);
-
-        // Shuffle/Repeat/Volume display
-        char mode_str[32];
-        const char *repeat_str = playlist.repeat == REPEAT_ONE ? "1" :
-                                 playlist.repeat == REPEAT_ALL ? "A" : "-";
-        snprintf(mode_str, sizeof(mode_str), "[%s][%s] %d%%",
-                 playlist.shuffle ? "S" : "-",
-                 repeat_str,
-                 (int)(audio_get_volume() * 100));
-        Vector2 mode_pos = { WINDOW_WIDTH - 110, pos.y };
-        DrawTextEx(font, mode_str, mode_pos, FONT_SIZE, 1, COLOR_TEXT_DIM);
-
-        // Progress bar
-        pos.y += LINE_HEIGHT + 4;
-        int bar_x = PANEL_PADDING;
-        int bar_y = (int)pos.y;
-        int bar_w = WINDOW_WIDTH - PANEL_PADDING * 2;
-        int bar_h = 6;
-        DrawRectangle(bar_x, bar_y, bar_w, bar_h, COLOR_BORDER);
-        if (duration > 0) {
-            int fill_w = (int)(bar_w * (position / duration));
-            if (fill_w > bar_w) fill_w = bar_w;
-            DrawRectangle(bar_x, bar_y, fill_w, bar_h, COLOR_ACCENT);
-        }
-
-        // Track list / Browser panel
-        draw_panel(0, TRACK_LIST_Y, WINDOW_WIDTH, TRACK_LIST_HEIGHT);
-
-        pos.x = PANEL_PADDING;
-        pos.y = TRACK_LIST_Y + PANEL_PADDING;
+        // Playing may have taken the first entry off the queue on show
+        if (queue_list.active && queue_list_sync(&queue_list, &playlist.queue)) {
+            view_generation++;
+        }
 
-        if (browser.active) {
-            // Draw browser header
-            char header[280];
-            snprintf(header, sizeof(header), "Browse: %s", browser.path);
-            DrawTextEx(font, header, pos, FONT_SIZE, 1, COLOR_ACCENT);
-            pos.y += LINE_HEIGHT;
-
-            // Draw directory entries
-            int visible = MAX_VISIBLE_TRACKS - 1;  // -1 for header
-            for (int i = 0; i < visible && (browser.scroll_offset + i) < browser.count; i++) {
-                int idx = browser.scroll_offset + i;
-                char line[280];
-                snprintf(line, sizeof(line), "  [DIR] %s", browser.entries[idx]);
-
-                Color color = COLOR_TEXT_DIM;
-                if (idx == browser.selected) {
-                    DrawRectangle(PANEL_PADDING - 2, (int)pos.y - 2,
-                                  WINDOW_WIDTH - PANEL_PADDING * 2 + 4, LINE_HEIGHT,
-                                  COLOR_BORDER);
-                    color = COLOR_TEXT;
-                }
+        // Glide the lists toward where they scroll to
+        double dt = GetFrameTime();
+        bool gliding = vlist_animate(&track_view, dt);
+        gliding |= vlist_animate(&browser.view, dt);
+        gliding |= vlist_animate(&search_box.view, dt);
+        gliding |= vlist_animate(&queue_list.view, dt);
+
+        // Work out which cached layers are stale
+        HeaderView header_view;
+        memset(&header_view, 0, sizeof(header_view));
+        header_view.current = playlist.current;
+        header_view.state = audio_get_state();
+        header_view.shuffle = playlist.shuffle;
+        header_view.smart_shuffle = playlist.smart_shuffle;
+        header_view.repeat = playlist.repeat;
+        header_view.volume = (int)(audio_get_volume() * 100);
+        header_view.queued = playlist.queue.count;
+        header_view.generation = view_generation;
+        if (memcmp(&header_view, &last_header_view, sizeof(header_view)) != 0) {
+            header_layer.dirty = true;
+            last_header_view = header_view;
+        }
 
-                DrawTextEx(font, line, pos, FONT_SIZE, 1, color);
-                pos.y += LINE_HEIGHT;
-            }
+        ListView list_view;
+        memset(&list_view, 0, sizeof(list_view));
+        list_view.browser = browser.active;
+        list_view.search = search_box.active;
+        list_view.queue = queue_list.active;
+        list_view.scroll = browser.active ? browser.view.scroll :
+                           search_results ? search_box.view.scroll :
+                           queue_list.active ? queue_list.view.scroll : track_view.scroll;
+        list_view.selected = browser.active ? browser.selected :
+                             queue_list.active ? queue_list.selected : playlist.selected;
+        list_view.current = playlist.current;
+        list_view.count = browser.active ? browser.count : search_results ? search_count :
+                          queue_list.active ? (int)playlist.queue.count : playlist.count;
+        list_view.scan_dirs = scanning ? (unsigned long)scan_progress.dirs + 1 : 0;
+        list_view.generation = view_generation;
+        if (memcmp(&list_view, &last_list_view, sizeof(list_view)) != 0) {
+            list_layer.dirty = true;
+            last_list_view = list_view;
+        }
 
-            // Browser hint
-            Vector2 hint_pos = { PANEL_PADDING, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
-            DrawTextEx(font, "Tab:close  Enter:select  Esc:cancel", hint_pos, FONT_SIZE, 1, COLOR_TEXT_DIM);
-        } else {
-            // Draw track list
-            for (int i = 0; i < MAX_VISIBLE_TRACKS && (scroll_offset + i) < playlist.count; i++) {
-                int track_idx = scroll_offset + i;
-                char line[280];
-                snprintf(line, sizeof(line), "%2d. %s", track_idx + 1, playlist.names[track_idx]);
-
-                Color color = COLOR_TEXT_DIM;
-                if (track_idx == playlist.current) {
-                    color = COLOR_ACCENT;
-                }
-                if (track_idx == playlist.selected) {
-                    DrawRectangle(PANEL_PADDING - 2, (int)pos.y - 2,
-                                  WINDOW_WIDTH - PANEL_PADDING * 2 + 4, LINE_HEIGHT,
-                                  COLOR_BORDER);
-                    color = COLOR_TEXT;
-                }
+        // Frame pacing: full rate while the user is interacting or the
+        // layers change. If only the clock moves, an idle rate is enough;
+        // if nothing can change, sleep until the next input event.
+        if (input_active() || header_layer.dirty || list_layer.dirty) {
+            last_activity = GetTime();
+        }
+        bool idle = GetTime() - last_activity > IDLE_AFTER_SECONDS;
+        bool playing = header_view.state == AUDIO_STATE_PLAYING;
+        int fps = !idle ? ACTIVE_FPS : power_saver ? POWER_SAVER_IDLE_FPS : IDLE_FPS;
+        bool wait = idle && !playing && !show_overlay && !scanning && !gliding && !playlist_tags_busy(&playlist) &&
+                    (!playlist.queue.dirty || queue_save_failed) &&
+                    !(browser.listing && (browser.listing->reading || browser.listing->counting));
+        if (fps != target_fps) {
+            SetTargetFPS(fps);
+            target_fps = fps;
+        }
+        if (wait != event_waiting) {
+            if (wait) EnableEventWaiting();
+            else DisableEventWaiting();
+            event_waiting = wait;
+        }
 
-                DrawTextEx(font, line, pos, FONT_SIZE, 1, color);
-                pos.y += LINE_HEIGHT;
+        // Draw
+        if (render_layer_begin(&header_layer)) {
+            draw_now_playing(&playlist, header_view.state);
+            render_layer_end(&header_layer);
+        }
+        if (render_layer_begin(&list_layer)) {
+            if (browser.active) {
+                draw_browser(&list_layer, &browser, view_generation);
+            } else if (search_box.active) {
+                draw_track_list(&list_layer, &playlist, search_results ? &search_box.view : &track_view,
+                                search_results, search_count,
+                                search_results ? search_box.selected : playlist.selected, NULL, view_generation);
+                draw_search_prompt(&search_box);
+            } else if (queue_list.active) {
+                draw_queue_list(&list_layer, &playlist, &queue_list, view_generation);
+            } else {
+                draw_track_list(&list_layer, &playlist, &track_view, NULL, 0, playlist.selected,
+                                scanning ? &scan_progress : NULL, view_generation);
             }
+            render_layer_end(&list_layer);
+        }
 
-            // Scroll indicator if needed
-            if (playlist.count > MAX_VISIBLE_TRACKS) {
-                char scroll_info[32];
-                snprintf(scroll_info, sizeof(scroll_info), "[%d-%d of %d]",
-                         scroll_offset + 1,
-                         scroll_offset + MAX_VISIBLE_TRACKS > playlist.count ?
-                             playlist.count : scroll_offset + (int)MAX_VISIBLE_TRACKS,
-                         playlist.count);
-                Vector2 scroll_pos = { WINDOW_WIDTH - 100, WINDOW_HEIGHT - LINE_HEIGHT - 5 };
-                DrawTextEx(font, scroll_info, scroll_pos, FONT_SIZE, 1, COLOR_TEXT_DIM);
+        BeginDrawing();
+        ClearBackground(COLOR_BG);
+        render_layer_draw(&header_layer);
+        render_layer_draw(&list_layer);
+        draw_progress();
+        if (show_overlay) {
+            GlyphCacheStats glyphs;
+            glyphcache_get_stats(&glyphs);
+            SearchLatency latency;
+            search_get_latency(&search_box.search, &latency);
+            char lines[6][96];
+            snprintf(lines[0], sizeof(lines[0]), "glyphs %d/%d, %d pg, %.1f MB",
+                     glyphs.glyphs, glyphs.capacity, glyphs.pages,
+                     (double)glyphs.atlas_bytes / (1024.0 * 1024.0));
+            snprintf(lines[1], sizeof(lines[1]), "raster %lu, %.1f ms, evict %lu",
+                     glyphs.misses, glyphs.raster_ms, glyphs.evictions);
+            snprintf(lines[2], sizeof(lines[2]), "search %u tracks, index %.1f ms",
+                     search_box.index.count, search_box.build_ms);
+            snprintf(lines[3], sizeof(lines[3]), "query p50 %.1f p95 %.1f p99 %.1f ms",
+                     latency.p50_ms, latency.p95_ms, latency.p99_ms);
+            // Worker pool: queued jobs, wait average/max and run average
+            static const char *const lane_names[] = { "ui", "bulk" };
+            for (int lane = 0; lane < POOL_LANE_COUNT; lane++) {
+                PoolLaneStats pool_stats;
+                pool_get_stats((PoolLane)lane, &pool_stats);
+                snprintf(lines[4 + lane], sizeof(lines[4 + lane]), "%-4s q %d, wait %.1f/%.1f, run %.1f ms",
+                         lane_names[lane], pool_stats.depth, pool_stats.avg_wait_ms, pool_stats.max_wait_ms,
+                         pool_stats.avg_run_ms);
             }
+            const char *extra[] = { lines[0], lines[1], lines[2], lines[3], lines[4], lines[5] };
+            render_draw_overlay(glyphcache_draw_text, LINE_HEIGHT, extra, 6);
         }
-
+        render_frame_end(show_overlay);
         EndDrawing();
+
+        if (first_frame && opts.log_startup) {
+            GlyphCacheStats glyphs;
+            glyphcache_get_stats(&glyphs);
+            fprintf(stderr, "First frame after %.1f ms (font setup %.1f ms)\n",
+                    monotonic_ms() - start_ms, glyphs.init_ms);
+        }
+        first_frame = false;
     }
 
     // Cleanup
-    UnloadFont(font);
+    render_layer_free(&header_layer);
+    render_layer_free(&list_layer);
+    vlist_free(&track_view);
+    vlist_free(&browser.view);
+    vlist_free(&search_box.view);
+    vlist_free(&queue_list.view);
+    glyphcache_shutdown();
     CloseWindow();
+    watch_close(browser.watch);
+    dirlist_close(browser.lister);
+    search_free(&search_box.search);
+    search_index_free(&search_box.index);
+    if (keep_queue && playlist.queue.dirty) playqueue_save(&playlist.queue, queue_path);
+    playlist_free(&playlist);
+    pool_shutdown();
+
+    AudioStats stats;
+    audio_get_stats(&stats);
     audio_shutdown();
+    if (stats.underruns > 0) {
+        fprintf(stderr, "Audio underruns: %lu\n", stats.underruns);
+    }
 
     return 0;
 }
@@ -0,0 +1,208 @@
+#define _DEFAULT_SOURCE
+
+#include "natsort.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Key layout: one segment per run of digits or of other characters, and
+// one per '/'.
+//   number:    KEY_NUMBER, digit count without leading zeros, the digits
+//   text:      KEY_TEXT, folded (or strxfrm()ed) bytes, 0
+//   separator: KEY_SEPARATOR
+// The tags make a number compare below text, the count makes longer
+// numbers compare higher, and the 0 terminator ends a text run below any
+// character that could continue it. A separator compares below both, so
+// a directory's contents come before its siblings with longer names.
+#define KEY_SEPARATOR 0x00
+#define KEY_NUMBER 0x01
+#define KEY_TEXT 0x02
+
+#define KEY_STACK_SIZE 512
+
+typedef struct {
+    unsigned char *out;
+    size_t size;
+    size_t len;   // may run past size; only the length is wanted then
+} KeyWriter;
+
+static void put(KeyWriter *w, unsigned char c) {
+    if (w->len < w->size) w->out[w->len] = c;
+    w->len++;
+}
+
+static bool is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+// ASCII only: multi-byte UTF-8 sequences are left alone
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + 'a' - 'A') : c;
+}
+
+static void put_folded(KeyWriter *w, const unsigned char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) put(w, fold(text[i]));
+}
+
+// strxfrm() needs a terminated copy of the run. Folding first keeps the
+// "C" locale case-insensitive; real locales ignore case at the first level
+// anyway.
+static void put_collated(KeyWriter *w, const unsigned char *text, size_t len) {
+    char stack[KEY_STACK_SIZE];
+    char *copy = len < sizeof(stack) ? stack : malloc(len + 1);
+    if (!copy) {
+        put_folded(w, text, len);
+        return;
+    }
+    for (size_t i = 0; i < len; i++) copy[i] = (char)fold(text[i]);
+    copy[len] = '\0';
+
+    size_t room = w->len < w->size ? w->size - w->len : 0;
+    w->len += strxfrm(room ? (char *)w->out + w->len : NULL, copy, room);
+
+    if (copy != stack) free(copy);
+}
+
+size_t natsort_key(const char *name, bool locale, unsigned char *out, size_t size) {
+    KeyWriter w = { out, size, 0 };
+    const unsigned char *p = (const unsigned char *)name;
+
+    while (*p) {
+        if (*p == '/') {
+            put(&w, KEY_SEPARATOR);
+            p++;
+        } else if (is_digit(*p)) {
+            while (*p == '0') p++;
+            const unsigned char *digits = p;
+            while (is_digit(*p)) p++;
+            size_t count = (size_t)(p - digits);
+
+            put(&w, KEY_NUMBER);
+            put(&w, (unsigned char)(count > 255 ? 255 : count));
+            for (size_t i = 0; i < count; i++) put(&w, digits[i]);
+        } else {
+            const unsigned char *text = p;
+            while (*p && *p != '/' && !is_digit(*p)) p++;
+
+            put(&w, KEY_TEXT);
+            if (locale) {
+                put_collated(&w, text, (size_t)(p - text));
+            } else {
+                put_folded(&w, text, (size_t)(p - text));
+            }
+            put(&w, 0);
+        }
+    }
+
+    return w.len;
+}
+
+static int compare_keys(const unsigned char *a, size_t a_len, const unsigned char *b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0) return cmp;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+// Key in a stack buffer if it fits, otherwise on the heap
+static unsigned char *build_key(const char *name, bool locale, unsigned char *stack, size_t *len) {
+    *len = natsort_key(name, locale, stack, KEY_STACK_SIZE);
+    if (*len <= KEY_STACK_SIZE) return stack;
+
+    unsigned char *key = malloc(*len);
+    if (key) natsort_key(name, locale, key, *len);
+    return key;
+}
+
+int natsort_compare(const char *a, const char *b, bool locale) {
+    unsigned char a_stack[KEY_STACK_SIZE], b_stack[KEY_STACK_SIZE];
+    size_t a_len, b_len;
+    unsigned char *a_key = build_key(a, locale, a_stack, &a_len);
+    unsigned char *b_key = build_key(b, locale, b_stack, &b_len);
+
+    int cmp = 0;
+    if (a_key && b_key) cmp = compare_keys(a_key, a_len, b_key, b_len);
+    if (cmp == 0) cmp = strcmp(a, b);
+
+    if (a_key != a_stack) free(a_key);
+    if (b_key != b_stack) free(b_key);
+    return cmp;
+}
+
+// Sorting moves these small records rather than strings. The first eight
+// key bytes are kept inline, so most comparisons never touch the key
+// buffer.
+typedef struct {
+    uint64_t prefix;   // big-endian, zero-padded
+    uint32_t key;      // offset into the key buffer
+    uint32_t len;
+    uint32_t index;
+} SortEntry;
+
+// qsort() has no context argument
+static __thread const unsigned char *sort_keys;
+static __thread const char *const *sort_names;
+
+static int compare_entries(const void *a, const void *b) {
+    const SortEntry *ea = a;
+    const SortEntry *eb = b;
+
+    if (ea->prefix != eb->prefix) return ea->prefix < eb->prefix ? -1 : 1;
+
+    int cmp = compare_keys(sort_keys + ea->key, ea->len, sort_keys + eb->key, eb->len);
+    if (cmp == 0) cmp = strcmp(sort_names[ea->index], sort_names[eb->index]);
+    if (cmp == 0) cmp = (ea->index > eb->index) - (ea->index < eb->index);
+    return cmp;
+}
+
+bool natsort_order(const char *const *names, uint32_t count, bool locale, uint32_t *order) {
+    if (count == 0) return true;
+
+    SortEntry *entries = malloc((size_t)count * sizeof(SortEntry));
+    size_t capacity = (size_t)count * 24;
+    unsigned char *keys = malloc(capacity);
+    if (!entries || !keys) {
+        free(entries);
+        free(keys);
+        return false;
+    }
+
+    size_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t len = natsort_key(names[i], locale, keys + used, capacity - used);
+        if (len > capacity - used) {
+            while (capacity - used < len) capacity *= 2;
+            unsigned char *grown = realloc(keys, capacity);
+            if (!grown) {
+                free(entries);
+                free(keys);
+                return false;
+            }
+            keys = grown;
+            natsort_key(names[i], locale, keys + used, capacity - used);
+        }
+        if (used + len > UINT32_MAX) {
+            free(entries);
+            free(keys);
+            return false;
+        }
+
+        uint64_t prefix = 0;
+        for (size_t b = 0; b < 8; b++) {
+            prefix = (prefix << 8) | (b < len ? keys[used + b] : 0);
+        }
+        entries[i] = (SortEntry){ prefix, (uint32_t)used, (uint32_t)len, i };
+        used += len;
+    }
+
+    sort_keys = keys;
+    sort_names = names;
+    qsort(entries, count, sizeof(SortEntry), compare_entries);
+    sort_keys = NULL;
+    sort_names = NULL;
+
+    for (uint32_t i = 0; i < count; i++) order[i] = entries[i].index;
+
+    free(entries);
+    free(keys);
+    return true;
+}
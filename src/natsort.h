@@ -0,0 +1,31 @@
+#ifndef NATSORT_H
+#define NATSORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Natural ordering of file names: ASCII case is ignored and runs of
+// digits compare by value, so "2 - x" sorts before "10 - x". Numbers sort
+// before text at the same position. With locale collation the text
+// between numbers is compared with the LC_COLLATE rules (setlocale() must
+// have been called); otherwise byte by byte. In paths, components are
+// compared one by one, so "a/z" sorts before "a b/c".
+//
+// Names that only differ in case or leading zeros fall back to strcmp(),
+// so the order is total and deterministic.
+
+// Write the sort key of name to out (which may be NULL if size is 0).
+// Keys compare with memcmp() over their lengths, shorter first. Returns
+// the key length, which may exceed size like strxfrm().
+size_t natsort_key(const char *name, bool locale, unsigned char *out, size_t size);
+
+// Compare two names. Builds both keys, so prefer natsort_order() for
+// sorting many names.
+int natsort_compare(const char *a, const char *b, bool locale);
+
+// Fill order[0..count) with the indices of names in sorted order. Each key
+// is built once. Returns false if out of memory; order is then unchanged.
+bool natsort_order(const char *const *names, uint32_t count, bool locale, uint32_t *order);
+
+#endif
@@ -1,132 +1,1455 @@
 #define _DEFAULT_SOURCE
 
 #include "playlist.h"
+#include "natsort.h"
+#include "plfile.h"
+#include "watch.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <time.h>
 
+// Tags are read TAG_BULK_SIZE files per job. The queue is topped up once a
+// frame, to TAG_BULK_IN_FLIGHT tracks: enough to keep the workers busy at
+// the power-saver frame rate, few enough that a rescan has little to cancel.
+#define TAG_BULK_SIZE 32
+#define TAG_BULK_IN_FLIGHT 4096
+
+// One random sequence for all playlists, seeded on first use
+static ShuffleRng rng;
 static bool seeded = false;
 
-static bool is_audio_file(const char *name) {
+static void start_watch(Playlist *pl);
+
+bool playlist_is_audio_file(const char *name) {
     const char *ext = strrchr(name, '.');
     if (!ext) return false;
     return strcasecmp(ext, ".flac") == 0 || strcasecmp(ext, ".ogg") == 0;
 }
 
-static void generate_shuffle_order(Playlist *pl) {
+static ShuffleRng *shuffle_rng(const Playlist *pl) {
     if (!seeded) {
-        srand((unsigned int)time(NULL));
+        uint64_t seed = pl->shuffle_seed;
+        if (seed == 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            seed = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+        }
+        shuffle_rng_seed(&rng, seed);
         seeded = true;
     }
+    return &rng;
+}
+
+static void generate_shuffle_order(Playlist *pl) {
+    shuffle_generate(&pl->shuffle_order, pl->count, shuffle_rng(pl));
+    pl->shuffle_pos = 0;
+}
+
+// Point shuffle_pos at the current track, if there is one
+static void sync_shuffle_pos(Playlist *pl) {
+    if (pl->current < 0 || pl->current >= pl->shuffle_order.count) return;
+    pl->shuffle_pos = shuffle_position(&pl->shuffle_order, pl->current);
+}
+
+// Group the tracks for the smart shuffle by album and artist tag, tracks
+// without an album tag by directory, if the tracks or tags changed since
+// the last build. What was played carries over while track indices stay
+// the same. Returns false if out of memory.
+static bool update_smart(Playlist *pl) {
+    if (pl->smart_built && pl->smart_generation == pl->tag_generation &&
+        pl->smart_updates == pl->tag_updates) {
+        return true;
+    }
+    bool keep = pl->smart_built && pl->smart_generation == pl->tag_generation;
+    pl->smart_built = false;
+    pl->smart_drawn = false;
 
-    // Initialize with sequential order
+    uint32_t *keys = malloc(((size_t)pl->count + 1) * 2 * sizeof(uint32_t));
+    if (!keys) {
+        smartshuffle_free(&pl->smart);
+        return false;
+    }
+    uint32_t *albums = keys, *artists = keys + pl->count + 1;
     for (int i = 0; i < pl->count; i++) {
-        pl->shuffle_order[i] = i;
+        const PlaylistTrack *track = &pl->tracks[i];
+        albums[i] = track->album ? track->album : track->dir | 0x80000000u;
+        artists[i] = track->artist;
     }
+    bool ok = smartshuffle_build(&pl->smart, pl->count, albums, artists, keep);
+    free(keys);
+    if (!ok) return false;
+
+    pl->smart_built = true;
+    pl->smart_generation = pl->tag_generation;
+    pl->smart_updates = pl->tag_updates;
+    if (!keep) smartshuffle_played(&pl->smart, pl->current);
+    return true;
+}
+
+// Grow tracks and shuffle_order together so shuffle_order always covers
+// every track.
+static bool reserve_tracks(Playlist *pl, int needed) {
+    if (needed <= pl->capacity) return true;
+
+    int capacity = pl->capacity ? pl->capacity : 256;
+    while (capacity < needed) capacity *= 2;
 
-    // Fisher-Yates shuffle
-    for (int i = pl->count - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        int tmp = pl->shuffle_order[i];
-        pl->shuffle_order[i] = pl->shuffle_order[j];
-        pl->shuffle_order[j] = tmp;
+    PlaylistTrack *tracks = realloc(pl->tracks, (size_t)capacity * sizeof(PlaylistTrack));
+    if (!tracks) return false;
+    pl->tracks = tracks;
+
+    if (!shuffle_reserve(&pl->shuffle_order, capacity)) return false;
+
+    pl->capacity = capacity;
+    return true;
+}
+
+// Store a directory path once; tracks refer to it by index.
+static bool add_dir(Playlist *pl, const char *path, size_t len, int64_t mtime_ns, int *index) {
+    if (pl->dir_count == pl->dir_capacity) {
+        int capacity = pl->dir_capacity ? pl->dir_capacity * 2 : 16;
+        PlaylistDir *dirs = realloc(pl->dirs, (size_t)capacity * sizeof(PlaylistDir));
+        if (!dirs) return false;
+        pl->dirs = dirs;
+        pl->dir_capacity = capacity;
     }
 
-    pl->shuffle_pos = 0;
+    PlaylistDir *dir = &pl->dirs[pl->dir_count];
+    if (!strarena_push(&pl->strings, path, len, &dir->path)) return false;
+    dir->mtime_ns = mtime_ns;
+    dir->watched = false;
+    *index = pl->dir_count++;
+    return true;
 }
 
-bool playlist_scan(Playlist *pl, const char *dir_path) {
+static bool intern_tag(Playlist *pl, const char *tag, uint32_t *offset) {
+    return strintern_add(&pl->tags, tag ? tag : "", tag ? strlen(tag) : 0, offset);
+}
+
+// file may be NULL if nothing is known about it
+static bool add_track(Playlist *pl, int dir, const char *name, const ScanFile *file) {
+    if (!reserve_tracks(pl, pl->count + 1)) return false;
+
+    PlaylistTrack *track = &pl->tracks[pl->count];
+    if (!strarena_push(&pl->strings, name, strlen(name), &track->name)) return false;
+    track->dir = (uint32_t)dir;
+    track->duration_ms = file ? file->duration_ms : 0;
+    track->size = file ? file->size : 0;
+    track->mtime_ns = file ? file->mtime_ns : 0;
+    track->artist = track->title = track->album = 0;
+    track->tag_state = TAG_UNREAD;
+    track->missing = false;
+    if (file && file->tagged) {
+        if (!intern_tag(pl, file->artist, &track->artist) ||
+            !intern_tag(pl, file->title, &track->title) ||
+            !intern_tag(pl, file->album, &track->album)) {
+            return false;
+        }
+        track->tag_state = TAG_READ;
+    }
+    pl->count++;
+    return true;
+}
+
+// Track indices are about to change: results of the tag jobs queued so far
+// would land on the wrong tracks, so drop them and queue again
+static void restart_tags(Playlist *pl) {
+    pool_group_cancel(&pl->jobs);
+    pl->tag_generation++;
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->tracks[i].tag_state != TAG_READ) pl->tracks[i].tag_state = TAG_UNREAD;
+    }
+    pl->tag_cursor = 0;
+    pl->tag_pending = 0;
+}
+
+// Put tracks in natural order of their file names
+static bool sort_tracks(Playlist *pl) {
+    uint32_t count = (uint32_t)pl->count;
+    const char **names = malloc((size_t)count * sizeof(char *));
+    uint32_t *order = malloc((size_t)count * sizeof(uint32_t));
+    PlaylistTrack *sorted = malloc((size_t)pl->capacity * sizeof(PlaylistTrack));
+
+    bool ok = names && order && sorted;
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) {
+            names[i] = strarena_get(&pl->strings, pl->tracks[i].name);
+        }
+        ok = natsort_order(names, count, pl->locale_sort, order);
+    }
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) sorted[i] = pl->tracks[order[i]];
+        free(pl->tracks);
+        pl->tracks = sorted;
+        sorted = NULL;
+    }
+
+    free(names);
+    free(order);
+    free(sorted);
+    return ok;
+}
+
+static void free_staging(Playlist *pl) {
+    if (!pl->staging) return;
+    playlist_free(pl->staging);
+    free(pl->staging);
+    pl->staging = NULL;
+}
+
+// Forget the current tracks and store dir_path as dirs[0]
+static bool reset(Playlist *pl, const char *dir_path) {
     // Preserve playback modes across rescans
     bool was_shuffle = pl->shuffle;
+    bool was_smart = pl->smart_shuffle;
     RepeatMode was_repeat = pl->repeat;
 
+    // Jobs queued for the old directory refer to tracks that are going away
+    restart_tags(pl);
+    scan_free(pl->scan);
+    pl->scan = NULL;
+    free_staging(pl);
+    watch_close(pl->watch);
+    pl->watch = NULL;
+    pl->recursive = false;
+
+    strarena_clear(&pl->strings);
+    strintern_clear(&pl->tags);
+    pl->tags_unsaved = false;
+    pl->dir_count = 0;
     pl->count = 0;
     pl->current = -1;
     pl->selected = 0;
     pl->shuffle = was_shuffle;
+    pl->smart_shuffle = was_smart;
     pl->repeat = was_repeat;
+    pl->shuffle_order.count = 0;
     pl->shuffle_pos = 0;
+    pl->smart_built = false;
+    pl->smart_drawn = false;
+    pl->resuming = false;
+
+    // Remove trailing slash if present (unless root)
+    size_t len = strlen(dir_path);
+    while (len > 1 && dir_path[len - 1] == '/') len--;
+
+    int root;
+    if (!reserve_tracks(pl, 1) || !add_dir(pl, dir_path, len, 0, &root)) {
+        fprintf(stderr, "Out of memory scanning %s\n", dir_path);
+        return false;
+    }
+    return true;
+}
 
-    strncpy(pl->dir_path, dir_path, PLAYLIST_MAX_PATH - 1);
-    pl->dir_path[PLAYLIST_MAX_PATH - 1] = '\0';
+bool playlist_scan(Playlist *pl, const char *dir_path) {
+    if (!reset(pl, dir_path)) return false;
+    int root = 0;
 
     DIR *dir = opendir(dir_path);
     if (!dir) {
         return false;
     }
 
+    bool ok = true;
     struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && pl->count < PLAYLIST_MAX_TRACKS) {
+    while ((entry = readdir(dir)) != NULL) {
         if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) {
             continue;  // skip non-files
         }
 
-        if (!is_audio_file(entry->d_name)) {
+        if (!playlist_is_audio_file(entry->d_name)) {
             continue;
         }
 
-        // Store filename
-        strncpy(pl->names[pl->count], entry->d_name, PLAYLIST_MAX_PATH - 1);
-        pl->names[pl->count][PLAYLIST_MAX_PATH - 1] = '\0';
+        if (!add_track(pl, root, entry->d_name, NULL)) {
+            fprintf(stderr, "Out of memory scanning %s\n", dir_path);
+            ok = false;
+            break;
+        }
+    }
 
-        // Store full path
-        snprintf(pl->paths[pl->count], PLAYLIST_MAX_PATH, "%s/%s", dir_path, entry->d_name);
+    closedir(dir);
 
-        pl->count++;
+    // Sort by filename
+    if (pl->count > 1 && !sort_tracks(pl)) {
+        fprintf(stderr, "Out of memory sorting %s\n", dir_path);
+        ok = false;
     }
 
-    closedir(dir);
+    // Generate shuffle order
+    generate_shuffle_order(pl);
 
-    // Sort by filename first
-    if (pl->count > 1) {
-        // Sort both arrays together by sorting names and keeping paths in sync
-        // Simple bubble sort since we're dealing with small lists
-        for (int i = 0; i < pl->count - 1; i++) {
-            for (int j = 0; j < pl->count - i - 1; j++) {
-                if (strcasecmp(pl->names[j], pl->names[j + 1]) > 0) {
-                    // Swap names
-                    char temp[PLAYLIST_MAX_PATH];
-                    strcpy(temp, pl->names[j]);
-                    strcpy(pl->names[j], pl->names[j + 1]);
-                    strcpy(pl->names[j + 1], temp);
-                    // Swap paths
-                    strcpy(temp, pl->paths[j]);
-                    strcpy(pl->paths[j], pl->paths[j + 1]);
-                    strcpy(pl->paths[j + 1], temp);
-                }
+    if (ok) start_watch(pl);
+    return ok;
+}
+
+static uint32_t index_flags(const Playlist *pl) {
+    return pl->locale_sort ? LIBINDEX_LOCALE_SORT : 0;
+}
+
+// Full path of a directory below the root
+static int join_path(const char *root, const char *rel, char *buf, size_t size) {
+    if (rel[0] == '\0') return snprintf(buf, size, "%s", root);
+    return snprintf(buf, size, "%s%s%s", root, strcmp(root, "/") == 0 ? "" : "/", rel);
+}
+
+// Fill a freshly reset playlist from the index. Its directories map one to
+// one onto the playlist's, the root being dirs[0] in both.
+static bool load_index(Playlist *pl, const LibIndex *index) {
+    char root[PLAYLIST_MAX_PATH];
+    snprintf(root, sizeof(root), "%s", playlist_get_dir(pl));
+
+    pl->dirs[0].mtime_ns = index->dirs[0].mtime_ns;
+    for (uint32_t d = 1; d < index->dir_count; d++) {
+        char path[PLAYLIST_MAX_PATH];
+        int n = join_path(root, libindex_string(index, index->dirs[d].path), path, sizeof(path));
+        if (n < 0 || (size_t)n >= sizeof(path)) n = 0;   // keeps the numbering
+
+        int dir;
+        if (!add_dir(pl, path, (size_t)n, index->dirs[d].mtime_ns, &dir)) return false;
+    }
+
+    if (!reserve_tracks(pl, (int)index->track_count)) return false;
+    for (uint32_t t = 0; t < index->track_count; t++) {
+        const LibIndexTrack *track = &index->tracks[t];
+        ScanFile file = {
+            .size = track->size,
+            .mtime_ns = track->mtime_ns,
+            .duration_ms = track->duration_ms,
+            .tagged = (track->flags & LIBINDEX_TRACK_TAGGED) != 0,
+            .artist = libindex_string(index, track->artist),
+            .title = libindex_string(index, track->title),
+            .album = libindex_string(index, track->album),
+        };
+        if (!add_track(pl, (int)track->dir, libindex_string(index, track->name), &file)) return false;
+    }
+    return true;
+}
+
+// Directories of an imported playlist by path, so that tracks in the same
+// directory share it
+typedef struct {
+    Playlist *pl;
+    uint32_t *slots;   // directory index + 1, 0 for an empty slot
+    uint32_t mask;
+    int last;          // directory of the previous entry, the likely next one
+    bool ok;
+} Import;
+
+// FNV-1a, carrying on from hash
+static uint32_t hash_more(uint32_t hash, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t hash_path(const char *s, size_t len) {
+    return hash_more(2166136261u, s, len);
+}
+
+static bool same_path(const Playlist *pl, int dir, const char *path, size_t len) {
+    const char *stored = strarena_get(&pl->strings, pl->dirs[dir].path);
+    return strncmp(stored, path, len) == 0 && stored[len] == '\0';
+}
+
+// Room for twice the directories, rehashed from the playlist
+static bool import_grow(Import *im) {
+    uint32_t capacity = im->slots ? (im->mask + 1) * 2 : 64;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots) return false;
+
+    for (int d = 0; d < im->pl->dir_count; d++) {
+        const char *path = strarena_get(&im->pl->strings, im->pl->dirs[d].path);
+        uint32_t slot = hash_path(path, strlen(path)) & (capacity - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = (uint32_t)d + 1;
+    }
+    free(im->slots);
+    im->slots = slots;
+    im->mask = capacity - 1;
+    return true;
+}
+
+static bool import_dir(Import *im, const char *path, size_t len, int *index) {
+    Playlist *pl = im->pl;
+    if (same_path(pl, im->last, path, len)) {
+        *index = im->last;
+        return true;
+    }
+    if ((uint32_t)(pl->dir_count + 1) * 2 > im->mask + 1 && !import_grow(im)) return false;
+
+    uint32_t slot = hash_path(path, len) & im->mask;
+    for (; im->slots[slot] != 0; slot = (slot + 1) & im->mask) {
+        int dir = (int)im->slots[slot] - 1;
+        if (same_path(pl, dir, path, len)) {
+            *index = im->last = dir;
+            return true;
+        }
+    }
+    if (!add_dir(pl, path, len, 0, index)) return false;
+    im->slots[slot] = (uint32_t)*index + 1;
+    im->last = *index;
+    return true;
+}
+
+static bool import_entry(void *user, const PlFileEntry *entry) {
+    Import *im = user;
+    Playlist *pl = im->pl;
+    if (!playlist_is_audio_file(entry->name)) return true;
+
+    int dir;
+    if (!import_dir(im, entry->path, entry->dir_len, &dir) || !add_track(pl, dir, entry->name, NULL)) {
+        im->ok = false;
+        return false;
+    }
+
+    // The playlist's title shows until the tags are read, and stays if
+    // they can't be
+    PlaylistTrack *track = &pl->tracks[pl->count - 1];
+    track->duration_ms = entry->duration_ms;
+    if (entry->title[0] && !intern_tag(pl, entry->title, &track->title)) {
+        im->ok = false;
+        return false;
+    }
+    return true;
+}
+
+bool playlist_load_file(Playlist *pl, const char *path) {
+    char dir[PLAYLIST_MAX_PATH];
+    if (!plfile_dir(path, dir, sizeof(dir))) {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!reset(pl, dir)) return false;
+
+    Import im = { .pl = pl, .ok = true };
+    bool ok = import_grow(&im) && plfile_read(path, import_entry, &im);
+    if (!im.ok || !im.slots) fprintf(stderr, "Out of memory loading %s\n", path);
+    free(im.slots);
+
+    // Kept in the playlist's order, and not watched: files added to these
+    // directories aren't part of it
+    generate_shuffle_order(pl);
+    return ok;
+}
+
+bool playlist_save_file(const Playlist *pl, const char *path) {
+    PlFileWriter w;
+    if (!plfile_writer_open(&w, path)) return false;
+
+    for (int i = 0; i < pl->count; i++) {
+        const PlaylistTrack *track = &pl->tracks[i];
+        plfile_writer_add(&w, strarena_get(&pl->strings, pl->dirs[track->dir].path),
+                          strarena_get(&pl->strings, track->name), strintern_get(&pl->tags, track->artist),
+                          strintern_get(&pl->tags, track->title), track->duration_ms);
+    }
+    return plfile_writer_close(&w);
+}
+
+bool playlist_scan_recursive(Playlist *pl, const char *dir_path) {
+    if (!reset(pl, dir_path)) return false;
+
+    char root[PLAYLIST_MAX_PATH];
+    snprintf(root, sizeof(root), "%s", playlist_get_dir(pl));
+
+    // Show the indexed library right away; the scan then only reads
+    // directories that changed, into a staging playlist that replaces
+    // this one when it's done
+    LibIndex index;
+    bool indexed = pl->library_index && libindex_open(&index, root, index_flags(pl));
+    if (indexed && !load_index(pl, &index)) {
+        libindex_close(&index);
+        indexed = false;
+        if (!reset(pl, root)) return false;
+    }
+    if (pl->count > 0) {
+        pl->staging = calloc(1, sizeof(Playlist));
+        if (!pl->staging || !reset(pl->staging, root)) {
+            free(pl->staging);
+            pl->staging = NULL;
+            libindex_close(&index);
+            return false;
+        }
+        pl->staging->locale_sort = pl->locale_sort;
+        pl->staging->shuffle_seed = pl->shuffle_seed;
+    }
+
+    pl->recursive = true;
+    pl->scan = scan_start(root, playlist_is_audio_file, pl->locale_sort, indexed ? &index : NULL);
+    if (!pl->scan) {
+        free_staging(pl);
+        return false;
+    }
+
+    generate_shuffle_order(pl);
+    return true;
+}
+
+// Append one directory's tracks. New tracks are dealt into the part of the
+// shuffle order not played yet, until the scan finishes and it is
+// regenerated.
+static bool add_batch(Playlist *pl, const ScanBatch *batch) {
+    if (!reserve_tracks(pl, pl->count + (int)batch->count)) return false;
+
+    int dir = 0;
+    if (batch->dir[0] == '\0') {
+        pl->dirs[0].mtime_ns = batch->mtime_ns;
+    } else {
+        char path[PLAYLIST_MAX_PATH];
+        int n = join_path(playlist_get_dir(pl), batch->dir, path, sizeof(path));
+        if (n < 0 || (size_t)n >= sizeof(path)) return true;  // skip what can't be played anyway
+        if (!add_dir(pl, path, (size_t)n, batch->mtime_ns, &dir)) return false;
+    }
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (!add_track(pl, dir, batch->names[i], &batch->files[i])) return false;
+        shuffle_append(&pl->shuffle_order, pl->shuffle_pos + 1, shuffle_rng(pl));
+    }
+    if (pl->shuffle_order.keyed) sync_shuffle_pos(pl);
+    return true;
+}
+
+// Tracks arrive grouped by directory, each group already sorted, so
+// ordering the directories is enough to put every track in path order.
+static bool sort_by_dir(Playlist *pl) {
+    uint32_t dirs = (uint32_t)pl->dir_count;
+    const char **paths = malloc(dirs * sizeof(char *));
+    uint32_t *order = malloc(dirs * sizeof(uint32_t));
+    int *first = malloc(dirs * sizeof(int));
+    int *moved = malloc((size_t)pl->count * sizeof(int));   // old index -> new
+    PlaylistTrack *sorted = malloc((size_t)pl->capacity * sizeof(PlaylistTrack));
+
+    bool ok = paths && order && first && moved && sorted;
+    if (ok) {
+        for (uint32_t d = 0; d < dirs; d++) {
+            paths[d] = strarena_get(&pl->strings, pl->dirs[d].path);
+            first[d] = -1;
+        }
+        for (int i = pl->count - 1; i >= 0; i--) first[pl->tracks[i].dir] = i;
+        ok = natsort_order(paths, dirs, pl->locale_sort, order);
+    }
+    if (ok) {
+        int next = 0;
+        for (uint32_t d = 0; d < dirs; d++) {
+            uint32_t dir = order[d];
+            for (int i = first[dir]; i >= 0 && i < pl->count && pl->tracks[i].dir == dir; i++) {
+                moved[i] = next;
+                sorted[next++] = pl->tracks[i];
             }
         }
+
+        if (pl->current >= 0) pl->current = moved[pl->current];
+        if (pl->selected < pl->count) pl->selected = moved[pl->selected];
+        if (pl->resuming && pl->resume >= 0) pl->resume = moved[pl->resume];
+        free(pl->tracks);
+        pl->tracks = sorted;
+        sorted = NULL;
+    }
+
+    free(paths);
+    free(order);
+    free(first);
+    free(moved);
+    free(sorted);
+    return ok;
+}
+
+// Where the order goes on after the queue, now that track indices changed:
+// the new index of the resume track, -1 if it is gone
+static void resume_at(Playlist *pl, int track) {
+    if (!pl->resuming || pl->resume < 0) return;
+    pl->resume = track;
+    if (track < 0) pl->resuming = false;
+}
+
+// Index of the track with the same path as track index of other, or -1
+static int find_same_track(const Playlist *pl, const Playlist *other, int index) {
+    if (index < 0 || index >= other->count) return -1;
+
+    const PlaylistTrack *track = &other->tracks[index];
+    const char *dir_path = strarena_get(&other->strings, other->dirs[track->dir].path);
+    const char *name = strarena_get(&other->strings, track->name);
+
+    int dir = -1;
+    for (int d = 0; d < pl->dir_count && dir < 0; d++) {
+        if (strcmp(strarena_get(&pl->strings, pl->dirs[d].path), dir_path) == 0) dir = d;
+    }
+    for (int i = 0; dir >= 0 && i < pl->count; i++) {
+        if (pl->tracks[i].dir == (uint32_t)dir &&
+            strcmp(strarena_get(&pl->strings, pl->tracks[i].name), name) == 0) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    // Generate shuffle order
+// Take over the staging playlist's tracks, keeping the current and
+// selected tracks if they still exist. Playback modes stay as they are.
+static void adopt_staging(Playlist *pl) {
+    Playlist *staging = pl->staging;
+    int current = find_same_track(staging, pl, pl->current);
+    int selected = find_same_track(staging, pl, pl->selected);
+    int resume = find_same_track(staging, pl, pl->resume);
+
+    strarena_free(&pl->strings);
+    strintern_free(&pl->tags);
+    free(pl->dirs);
+    free(pl->tracks);
+    shuffle_free(&pl->shuffle_order);
+
+    pl->strings = staging->strings;
+    pl->tags = staging->tags;
+    pl->dirs = staging->dirs;
+    pl->dir_count = staging->dir_count;
+    pl->dir_capacity = staging->dir_capacity;
+    pl->tracks = staging->tracks;
+    pl->count = staging->count;
+    pl->capacity = staging->capacity;
+    pl->shuffle_order = staging->shuffle_order;
+    pl->current = current;
+    pl->selected = selected >= 0 ? selected : 0;
+    resume_at(pl, resume);
+
+    free(staging);
+    pl->staging = NULL;
+}
+
+typedef struct {
+    LibIndexBuilder builder;
+    uint32_t flags;
+    char root[];
+} IndexWrite;
+
+// Runs even if cancelled: the data is complete and only needs writing
+static void write_index_job(void *arg, const PoolToken *token) {
+    (void)token;
+    IndexWrite *write = arg;
+    libindex_write(&write->builder, write->root, write->flags);
+    libindex_builder_free(&write->builder);
+    free(write);
+}
+
+// Copy the playlist into an index builder here; the file is written on a
+// worker
+static void save_index(const Playlist *pl) {
+    const char *root = playlist_get_dir(pl);
+    size_t root_len = strlen(root);
+    IndexWrite *write = calloc(1, sizeof(IndexWrite) + root_len + 1);
+    if (!write) return;
+    memcpy(write->root, root, root_len + 1);
+    write->flags = index_flags(pl);
+
+    bool ok = true;
+    for (int d = 0; ok && d < pl->dir_count; d++) {
+        const char *path = strarena_get(&pl->strings, pl->dirs[d].path);
+        const char *rel = d == 0 ? "" : path + root_len + (strcmp(root, "/") == 0 ? 0 : 1);
+        uint32_t index;
+        ok = libindex_add_dir(&write->builder, rel, pl->dirs[d].mtime_ns, &index);
+    }
+    for (int i = 0; ok && i < pl->count; i++) {
+        const PlaylistTrack *track = &pl->tracks[i];
+        LibIndexTrack entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.dir = track->dir;
+        entry.size = track->size;
+        entry.mtime_ns = track->mtime_ns;
+        entry.duration_ms = track->duration_ms;
+        ok = libindex_add_string(&write->builder, strarena_get(&pl->strings, track->name), &entry.name);
+        if (ok && track->tag_state == TAG_READ) {
+            entry.flags = LIBINDEX_TRACK_TAGGED;
+            ok = libindex_add_string(&write->builder, strintern_get(&pl->tags, track->artist), &entry.artist) &&
+                 libindex_add_string(&write->builder, strintern_get(&pl->tags, track->title), &entry.title) &&
+                 libindex_add_string(&write->builder, strintern_get(&pl->tags, track->album), &entry.album);
+        }
+        ok = ok && libindex_add_track(&write->builder, &entry);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Out of memory saving the library index for %s\n", root);
+        libindex_builder_free(&write->builder);
+        free(write);
+    } else if (!pool_submit(POOL_LANE_BULK, NULL, write_index_job, write)) {
+        write_index_job(write, NULL);
+    }
+}
+
+bool playlist_scan_poll(Playlist *pl, ScanProgress *progress) {
+    if (!pl->scan) return false;
+
+    // Check for the end first: every batch is queued before the scan
+    // counts as done
+    scan_get_progress(pl->scan, progress);
+    ScanBatch *batch = scan_take(pl->scan);
+    Playlist *target = pl->staging ? pl->staging : pl;
+    bool changed = batch != NULL && !pl->staging;
+
+    bool ok = true;
+    while (batch) {
+        ScanBatch *next = batch->next;
+        if (ok && !add_batch(target, batch)) {
+            fprintf(stderr, "Out of memory scanning %s\n", playlist_get_dir(pl));
+            ok = false;
+        }
+        free(batch);
+        batch = next;
+    }
+
+    if (!progress->done && ok) return changed;
+    progress->done = true;
+    scan_free(pl->scan);
+    pl->scan = NULL;
+
+    if (progress->errors > 0) {
+        fprintf(stderr, "Could not read %llu directories under %s\n",
+                (unsigned long long)progress->errors, playlist_get_dir(pl));
+    }
+
+    // Nothing changed on disk: keep showing what the index had
+    bool unchanged = pl->staging && ok && progress->errors == 0 && progress->reused == progress->dirs;
+    if (unchanged || !ok) {
+        free_staging(pl);
+        if (ok) start_watch(pl);
+        return changed;
+    }
+
+    if (target->count > 1 && !sort_by_dir(target)) {
+        fprintf(stderr, "Out of memory sorting %s\n", playlist_get_dir(pl));
+        free_staging(pl);
+        return changed;
+    }
+    if (pl->staging) adopt_staging(pl);
+    restart_tags(pl);
     generate_shuffle_order(pl);
+    if (pl->shuffle) sync_shuffle_pos(pl);
+    start_watch(pl);
+
+    // An incomplete tree isn't saved: the missing directories would not be
+    // looked at again until their parent changes
+    if (pl->library_index && progress->errors == 0) save_index(pl);
+    return true;
+}
+
+// Live updates. A flat playlist watches its directory, a recursive one
+// every directory of its tree. When a directory changes it is read again
+// and the difference merged into the track list in one pass, so a burst of
+// changes costs one merge however many files it touched.
+
+static void watch_dir(Playlist *pl, int dir) {
+    static bool warned = false;
+    PlaylistDir *d = &pl->dirs[dir];
+    if (d->watched) return;
+
+    const char *path = strarena_get(&pl->strings, d->path);
+    if (watch_add(pl->watch, path, (uint32_t)dir)) {
+        d->watched = true;
+    } else if (errno == ENOSPC && !warned) {
+        fprintf(stderr, "Too many directories to watch; raise fs.inotify.max_user_watches "
+                "to see changes everywhere under %s\n", playlist_get_dir(pl));
+        warned = true;
+    }
+}
+
+static void start_watch(Playlist *pl) {
+    if (!pl->watch_changes) return;
+
+    pl->watch = watch_open();
+    if (!pl->watch) {
+        fprintf(stderr, "Not watching %s for changes: %s\n", playlist_get_dir(pl), strerror(errno));
+        return;
+    }
+    for (int d = 0; d < pl->dir_count; d++) watch_dir(pl, d);
+}
+
+// New contents of one directory: files[first, first + count) of the
+// refresh, in natural order
+typedef struct {
+    uint32_t dir;
+    uint32_t first;
+    uint32_t count;
+    int start;      // where its tracks begin in the playlist
+    int old_count;  // how many tracks it has there now
+} FreshDir;
+
+typedef struct {
+    uint32_t name;  // offset into Refresh.names
+    ScanFile file;
+} FreshFile;
+
+typedef struct {
+    StrArena names;   // read from disk; copied to the playlist if new
+    FreshFile *files;
+    uint32_t file_count;
+    uint32_t file_capacity;
+    FreshDir *dirs;
+    uint32_t dir_count;
+    uint32_t dir_capacity;
+
+    uint32_t *queue;   // directories still to read
+    uint32_t queue_count;
+    uint32_t queue_capacity;
+    uint8_t *state;    // per playlist directory: REFRESH_*
+    uint32_t state_capacity;
+
+    uint32_t *by_path;   // recursive only: directories sorted by strcmp() of path
+    uint32_t by_path_count;
+    uint32_t by_path_capacity;
+} Refresh;
+
+enum { REFRESH_NONE, REFRESH_QUEUED, REFRESH_DONE };
+
+static bool grow(void *array, uint32_t *capacity, uint32_t needed, size_t size) {
+    if (needed <= *capacity) return true;
+    uint32_t grown = *capacity ? *capacity : 16;
+    while (grown < needed) grown *= 2;
+
+    void *p = realloc(*(void **)array, (size_t)grown * size);
+    if (!p) return false;
+    *(void **)array = p;
+    *capacity = grown;
+    return true;
+}
+
+static void refresh_free(Refresh *r) {
+    strarena_free(&r->names);
+    free(r->files);
+    free(r->dirs);
+    free(r->queue);
+    free(r->state);
+    free(r->by_path);
+}
+
+static bool queue_dir(const Playlist *pl, Refresh *r, uint32_t dir) {
+    uint32_t old = r->state_capacity;
+    if (!grow(&r->state, &r->state_capacity, (uint32_t)pl->dir_count, 1)) return false;
+    memset(r->state + old, REFRESH_NONE, r->state_capacity - old);
 
+    if (r->state[dir] != REFRESH_NONE) return true;
+    if (!grow(&r->queue, &r->queue_capacity, r->queue_count + 1, sizeof(uint32_t))) return false;
+    r->queue[r->queue_count++] = dir;
+    r->state[dir] = REFRESH_QUEUED;
     return true;
 }
 
-const char *playlist_selected_path(const Playlist *pl) {
+static bool add_fresh_dir(Refresh *r, uint32_t dir, uint32_t first) {
+    if (!grow(&r->dirs, &r->dir_capacity, r->dir_count + 1, sizeof(FreshDir))) return false;
+    FreshDir *fresh = &r->dirs[r->dir_count++];
+    memset(fresh, 0, sizeof(*fresh));
+    fresh->dir = dir;
+    fresh->first = first;
+    fresh->count = r->file_count - first;
+    r->state[dir] = REFRESH_DONE;
+    return true;
+}
+
+static __thread const Playlist *sort_playlist;
+
+static int compare_dir_paths(const void *a, const void *b) {
+    const StrArena *strings = &sort_playlist->strings;
+    return strcmp(strarena_get(strings, sort_playlist->dirs[*(const uint32_t *)a].path),
+                  strarena_get(strings, sort_playlist->dirs[*(const uint32_t *)b].path));
+}
+
+// First position in by_path whose path is not below path in strcmp() order
+static uint32_t lower_bound_path(const Playlist *pl, const Refresh *r, const char *path) {
+    uint32_t lo = 0, hi = r->by_path_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(strarena_get(&pl->strings, pl->dirs[r->by_path[mid]].path), path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Index of directory path if the playlist has it, else insert it. Returns
+// -1 if out of memory.
+static int find_or_add_dir(Playlist *pl, Refresh *r, const char *path, bool *added) {
+    uint32_t at = lower_bound_path(pl, r, path);
+    *added = false;
+    if (at < r->by_path_count &&
+        strcmp(strarena_get(&pl->strings, pl->dirs[r->by_path[at]].path), path) == 0) {
+        return (int)r->by_path[at];
+    }
+
+    int dir;
+    if (!grow(&r->by_path, &r->by_path_capacity, r->by_path_count + 1, sizeof(uint32_t)) ||
+        !add_dir(pl, path, strlen(path), 0, &dir)) {
+        return -1;
+    }
+    memmove(&r->by_path[at + 1], &r->by_path[at], (r->by_path_count - at) * sizeof(uint32_t));
+    r->by_path[at] = (uint32_t)dir;
+    r->by_path_count++;
+    *added = true;
+    return dir;
+}
+
+// Length of the path prefix that directories below path start with
+static size_t subtree_prefix(const char *path, char *buf, size_t size) {
+    int n = snprintf(buf, size, "%s%s", path, strcmp(path, "/") == 0 ? "" : "/");
+    return n < 0 || (size_t)n >= size ? 0 : (size_t)n;
+}
+
+// A directory that can't be read any more takes everything below it along:
+// moving a tree away only tells the watch of its top directory.
+static bool drop_subtree(Playlist *pl, Refresh *r, uint32_t dir) {
+    char prefix[PLAYLIST_MAX_PATH];
+    size_t len = subtree_prefix(strarena_get(&pl->strings, pl->dirs[dir].path), prefix, sizeof(prefix));
+    if (len == 0) return true;
+
+    for (uint32_t i = lower_bound_path(pl, r, prefix); i < r->by_path_count; i++) {
+        uint32_t below = r->by_path[i];
+        if (strncmp(strarena_get(&pl->strings, pl->dirs[below].path), prefix, len) != 0) break;
+        if (r->state[below] == REFRESH_DONE) continue;
+
+        if (pl->dirs[below].watched) {
+            watch_remove(pl->watch, below);
+            pl->dirs[below].watched = false;
+        }
+        if (!add_fresh_dir(r, below, r->file_count)) return false;
+    }
+    return true;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Queue new subdirectories of dir, recreated ones and ones that went away
+static bool sync_subdirs(Playlist *pl, Refresh *r, uint32_t dir, const char **subdirs, uint32_t count) {
+    char path[PLAYLIST_MAX_PATH];
+    size_t len = subtree_prefix(strarena_get(&pl->strings, pl->dirs[dir].path), path, sizeof(path));
+    if (len == 0) return true;
+
+    for (uint32_t i = 0; i < count; i++) {
+        int n = snprintf(path + len, sizeof(path) - len, "%s", subdirs[i]);
+        if (n < 0 || (size_t)n >= sizeof(path) - len) continue;
+
+        bool added;
+        int sub = find_or_add_dir(pl, r, path, &added);
+        if (sub < 0) return false;
+        if ((added || !pl->dirs[sub].watched) && !queue_dir(pl, r, (uint32_t)sub)) return false;
+    }
+
+    // Known direct subdirectories missing from the listing
+    qsort(subdirs, count, sizeof(char *), compare_strings);
+    path[len] = '\0';
+    for (uint32_t i = lower_bound_path(pl, r, path); i < r->by_path_count; i++) {
+        uint32_t below = r->by_path[i];
+        const char *below_path = strarena_get(&pl->strings, pl->dirs[below].path);
+        if (strncmp(below_path, path, len) != 0) break;
+
+        const char *name = below_path + len;
+        if (strchr(name, '/')) continue;
+        if (!bsearch(&name, subdirs, count, sizeof(char *), compare_strings) &&
+            !queue_dir(pl, r, below)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read one directory the way the scan that built the playlist did
+static bool read_fresh(Playlist *pl, Refresh *r, uint32_t dir) {
+    uint32_t first = r->file_count;
+    watch_dir(pl, (int)dir);
+
+    char path[PLAYLIST_MAX_PATH];
+    snprintf(path, sizeof(path), "%s", strarena_get(&pl->strings, pl->dirs[dir].path));
+    DIR *d = opendir(path);
+    if (!d) {
+        if (pl->recursive && !drop_subtree(pl, r, dir)) return false;
+        return r->state[dir] == REFRESH_DONE || add_fresh_dir(r, dir, first);
+    }
+
+    struct stat st;
+    if (fstat(dirfd(d), &st) == 0) {
+        pl->dirs[dir].mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    // Subdirectory names are kept as offsets until reading is done, since
+    // the arena may move
+    uint32_t *subdir_offsets = NULL;
+    uint32_t subdir_count = 0, subdir_capacity = 0;
+
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        if (pl->recursive && name[0] == '.') continue;   // as the scan does
+
+        unsigned char type = entry->d_type;
+        bool have_stat = false;
+        if (type == DT_UNKNOWN) {
+            if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            have_stat = true;
+        }
+
+        uint32_t offset;
+        if (type == DT_DIR && pl->recursive) {
+            ok = grow(&subdir_offsets, &subdir_capacity, subdir_count + 1, sizeof(uint32_t)) &&
+                 strarena_push(&r->names, name, strlen(name), &offset);
+            if (ok) subdir_offsets[subdir_count++] = offset;
+            continue;
+        }
+        if (type != DT_REG || !playlist_is_audio_file(name)) continue;
+        if (!have_stat && fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        ok = grow(&r->files, &r->file_capacity, r->file_count + 1, sizeof(FreshFile)) &&
+             strarena_push(&r->names, name, strlen(name), &offset);
+        if (ok) {
+            FreshFile *file = &r->files[r->file_count++];
+            file->name = offset;
+            file->file.size = (uint64_t)st.st_size;
+            file->file.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            file->file.duration_ms = 0;
+        }
+    }
+    closedir(d);
+
+    // Natural order, as the playlist has them
+    uint32_t count = r->file_count - first;
+    const char **names = malloc(((size_t)count + subdir_count + 1) * sizeof(char *));
+    uint32_t *order = malloc(((size_t)count + 1) * sizeof(uint32_t));
+    FreshFile *sorted = malloc(((size_t)count + 1) * sizeof(FreshFile));
+    ok = ok && names && order && sorted;
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) names[i] = strarena_get(&r->names, r->files[first + i].name);
+        ok = natsort_order(names, count, pl->locale_sort, order);
+    }
+    if (ok) {
+        for (uint32_t i = 0; i < count; i++) sorted[i] = r->files[first + order[i]];
+        memcpy(&r->files[first], sorted, count * sizeof(FreshFile));
+        ok = add_fresh_dir(r, dir, first);
+    }
+    if (ok && pl->recursive) {
+        for (uint32_t i = 0; i < subdir_count; i++) names[i] = strarena_get(&r->names, subdir_offsets[i]);
+        ok = sync_subdirs(pl, r, dir, names, subdir_count);
+    }
+
+    free(subdir_offsets);
+    free(names);
+    free(order);
+    free(sorted);
+    return ok;
+}
+
+// Position of the first track whose directory sorts after path
+static int dir_insert_position(const Playlist *pl, const char *path) {
+    int lo = 0, hi = pl->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const char *mid_path = strarena_get(&pl->strings, pl->dirs[pl->tracks[mid].dir].path);
+        if (natsort_compare(mid_path, path, pl->locale_sort) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Playlist order of the refreshed directories; an empty directory goes
+// before a non-empty one starting at the same position
+static int compare_fresh_dirs(const void *a, const void *b) {
+    const FreshDir *da = a;
+    const FreshDir *db = b;
+    if (da->start != db->start) return da->start < db->start ? -1 : 1;
+    if ((da->old_count > 0) != (db->old_count > 0)) return da->old_count > 0 ? 1 : -1;
+
+    const StrArena *strings = &sort_playlist->strings;
+    return natsort_compare(strarena_get(strings, sort_playlist->dirs[da->dir].path),
+                           strarena_get(strings, sort_playlist->dirs[db->dir].path),
+                           sort_playlist->locale_sort);
+}
+
+// Replace the refreshed directories' tracks with what was read. Returns
+// false if out of memory; the playlist is unchanged then.
+static bool apply_refresh(Playlist *pl, Refresh *r, bool *changed, bool *updated) {
+    int *first = malloc((size_t)pl->dir_count * sizeof(int));
+    int *count = calloc((size_t)pl->dir_count, sizeof(int));
+    int *moved = malloc(((size_t)pl->count + 1) * sizeof(int));
+    int *added = NULL;
+    PlaylistTrack *tracks = NULL;
+    bool ok = first && count && moved;
+
+    int new_count = pl->count;
+    int capacity = pl->capacity ? pl->capacity : 256;
+    if (ok) {
+        for (int i = pl->count - 1; i >= 0; i--) {
+            first[pl->tracks[i].dir] = i;
+            count[pl->tracks[i].dir]++;
+        }
+        for (uint32_t i = 0; i < r->dir_count; i++) {
+            FreshDir *fresh = &r->dirs[i];
+            fresh->old_count = count[fresh->dir];
+            fresh->start = fresh->old_count > 0 ? first[fresh->dir] :
+                dir_insert_position(pl, strarena_get(&pl->strings, pl->dirs[fresh->dir].path));
+            new_count += (int)fresh->count - fresh->old_count;
+        }
+        sort_playlist = pl;
+        qsort(r->dirs, r->dir_count, sizeof(FreshDir), compare_fresh_dirs);
+        sort_playlist = NULL;
+
+        while (capacity < new_count + 1) capacity *= 2;
+        tracks = malloc((size_t)capacity * sizeof(PlaylistTrack));
+        added = malloc(((size_t)new_count + 1) * sizeof(int));
+        ok = tracks && added;
+    }
+
+    int n = 0, added_count = 0, old = 0;
+    for (uint32_t i = 0; ok && i <= r->dir_count; i++) {
+        // Untouched tracks up to the next refreshed directory
+        int start = i < r->dir_count ? r->dirs[i].start : pl->count;
+        for (; old < start; old++) {
+            moved[old] = n;
+            tracks[n++] = pl->tracks[old];
+        }
+        if (i == r->dir_count) break;
+
+        const FreshDir *fresh = &r->dirs[i];
+        int old_end = start + fresh->old_count;
+        uint32_t f = fresh->first, f_end = fresh->first + fresh->count;
+        while (ok && (old < old_end || f < f_end)) {
+            int cmp = old >= old_end ? 1 : f >= f_end ? -1 :
+                natsort_compare(strarena_get(&pl->strings, pl->tracks[old].name),
+                                strarena_get(&r->names, r->files[f].name), pl->locale_sort);
+            if (cmp < 0) {
+                moved[old++] = -1;   // deleted
+                *changed = true;
+            } else if (cmp == 0) {
+                PlaylistTrack *track = &tracks[n];
+                *track = pl->tracks[old];
+                const ScanFile *file = &r->files[f].file;
+                if (track->size != file->size || track->mtime_ns != file->mtime_ns) {
+                    track->size = file->size;
+                    track->mtime_ns = file->mtime_ns;
+                    track->duration_ms = 0;   // rewritten in place
+                    track->artist = track->title = track->album = 0;
+                    track->tag_state = TAG_UNREAD;
+                    track->missing = false;
+                }
+                moved[old++] = n++;
+                f++;
+            } else {
+                const char *name = strarena_get(&r->names, r->files[f].name);
+                PlaylistTrack *track = &tracks[n];
+                ok = strarena_push(&pl->strings, name, strlen(name), &track->name);
+                track->dir = fresh->dir;
+                track->size = r->files[f].file.size;
+                track->mtime_ns = r->files[f].file.mtime_ns;
+                track->duration_ms = 0;
+                track->artist = track->title = track->album = 0;
+                track->tag_state = TAG_UNREAD;
+                track->missing = false;
+                added[added_count++] = n++;
+                f++;
+                *changed = true;
+            }
+        }
+        *updated = true;
+    }
+
+    if (ok) {
+        // Keep the shuffle order of the tracks that are left and deal the
+        // new ones into the part not played yet, at random places
+        PlaylistTrack *old_tracks = pl->tracks;
+        int old_count = pl->count;
+        if (!shuffle_reserve(&pl->shuffle_order, capacity) ||
+            !shuffle_remap(&pl->shuffle_order, moved, added, added_count, &pl->shuffle_pos,
+                           shuffle_rng(pl))) {
+            ok = false;
+        } else {
+            pl->tracks = tracks;
+            pl->count = n;
+            tracks = old_tracks;
+            pl->capacity = capacity;
+
+            int selected = pl->selected;
+            while (selected < old_count && moved[selected] < 0) selected++;
+            pl->selected = selected < old_count ? moved[selected] : n - 1;
+            if (pl->selected < 0) pl->selected = 0;
+            pl->current = pl->current >= 0 ? moved[pl->current] : -1;
+            resume_at(pl, pl->resume >= 0 ? moved[pl->resume] : -1);
+        }
+    }
+
+    free(first);
+    free(count);
+    free(moved);
+    free(added);
+    free(tracks);
+    return ok;
+}
+
+bool playlist_watch_poll(Playlist *pl) {
+    if (!pl->watch || pl->scan) return false;
+
+    uint32_t count;
+    bool overflow;
+    const WatchChange *changes = watch_poll(pl->watch, &count, &overflow);
+    if (count == 0 && !overflow) return false;
+
+    Refresh r;
+    memset(&r, 0, sizeof(r));
+    bool ok = true;
+    if (pl->recursive) {
+        ok = grow(&r.by_path, &r.by_path_capacity, (uint32_t)pl->dir_count, sizeof(uint32_t));
+        for (int d = 0; ok && d < pl->dir_count; d++) r.by_path[r.by_path_count++] = (uint32_t)d;
+        sort_playlist = pl;
+        if (ok) qsort(r.by_path, r.by_path_count, sizeof(uint32_t), compare_dir_paths);
+        sort_playlist = NULL;
+    }
+
+    // Events were lost: read everything again
+    for (int d = 0; ok && overflow && d < pl->dir_count; d++) ok = queue_dir(pl, &r, (uint32_t)d);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        if (changes[i].id >= (uint32_t)pl->dir_count) continue;
+        if (changes[i].gone) pl->dirs[changes[i].id].watched = false;
+        ok = queue_dir(pl, &r, changes[i].id);
+    }
+    for (uint32_t i = 0; ok && i < r.queue_count; i++) {
+        if (r.state[r.queue[i]] == REFRESH_QUEUED) ok = read_fresh(pl, &r, r.queue[i]);
+    }
+
+    bool changed = false, updated = false;
+    if (ok) ok = apply_refresh(pl, &r, &changed, &updated);
+    if (!ok) fprintf(stderr, "Out of memory updating %s\n", playlist_get_dir(pl));
+    refresh_free(&r);
+    if (updated) restart_tags(pl);
+
+    if (updated && pl->recursive && pl->library_index) save_index(pl);
+    return changed;
+}
+
+// Queue reading the tags of count tracks as one job
+static bool submit_tags(Playlist *pl, PoolLane lane, const uint32_t *tracks, uint32_t count) {
+    StrArena strings = {0};
+    uint32_t offsets[TAG_BULK_SIZE];
+    const char *paths[TAG_BULK_SIZE];
+    uint32_t submitted[TAG_BULK_SIZE];
+    uint32_t n = 0;
+
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < count && n < TAG_BULK_SIZE; i++) {
+        char path[PLAYLIST_MAX_PATH];
+        if (!playlist_track_path(pl, (int)tracks[i], path, sizeof(path))) {
+            pl->tracks[tracks[i]].tag_state = TAG_READ;   // can't be played either
+            continue;
+        }
+        ok = strarena_push(&strings, path, strlen(path), &offsets[n]);
+        submitted[n++] = tracks[i];
+    }
+    for (uint32_t i = 0; ok && i < n; i++) paths[i] = strarena_get(&strings, offsets[i]);
+
+    ok = ok && (n == 0 || tagreader_submit(pl->tag_reader, lane, &pl->jobs, pl->tag_generation,
+                                           submitted, paths, n));
+    strarena_free(&strings);
+    if (!ok) return false;
+
+    for (uint32_t i = 0; i < n; i++) {
+        pl->tracks[submitted[i]].tag_state = lane == POOL_LANE_INTERACTIVE ? TAG_URGENT : TAG_QUEUED;
+    }
+    pl->tag_pending += (int)n;
+    return true;
+}
+
+static void store_tags(Playlist *pl, const TagResult *result) {
+    PlaylistTrack *track = &pl->tracks[result->track];
+    track->tag_state = TAG_READ;
+    track->missing = result->missing;
+    pl->tags_unsaved = true;
+    pl->tag_updates++;
+    if (!result->ok) return;
+
+    if (!intern_tag(pl, result->tags.artist, &track->artist) ||
+        !intern_tag(pl, result->tags.title, &track->title) ||
+        !intern_tag(pl, result->tags.album, &track->album)) {
+        track->artist = track->title = track->album = 0;
+        fprintf(stderr, "Out of memory reading tags under %s\n", playlist_get_dir(pl));
+    }
+    if (result->tags.duration_ms > 0) track->duration_ms = result->tags.duration_ms;
+}
+
+// Track shown at row i of the rows on screen, -1 past the end
+static int shown_track(const Playlist *pl, const uint32_t *ids, int id_count, int i) {
+    if (i < 0 || i >= (ids ? id_count : pl->count)) return -1;
+    return ids ? (int)ids[i] : i;
+}
+
+static bool is_shown(const Playlist *pl, const uint32_t *ids, int id_count, int first, int count, int track) {
+    if (!ids) return track >= first && track < first + count;
+    for (int i = first; i < first + count; i++) {
+        if (shown_track(pl, ids, id_count, i) == track) return true;
+    }
+    return false;
+}
+
+bool playlist_tags_update(Playlist *pl, const uint32_t *ids, int id_count, int first, int count) {
+    if (!pl->tag_reader) {
+        pl->tag_reader = tagreader_create();
+        if (!pl->tag_reader) return false;
+    }
+
+    bool changed = false;
+    TagBatch *batch = tagreader_take(pl->tag_reader);
+    while (batch) {
+        TagBatch *next = batch->next;
+        if (batch->generation == pl->tag_generation) {
+            for (uint32_t i = 0; i < batch->count; i++) {
+                int track = (int)batch->results[i].track;
+                pl->tag_pending--;
+                if (track >= pl->count) continue;
+
+                store_tags(pl, &batch->results[i]);
+                if (track == pl->current || is_shown(pl, ids, id_count, first, count, track)) changed = true;
+            }
+        }
+        free(batch);
+        batch = next;
+    }
+
+    // The current track and what is on screen go ahead of the bulk, one
+    // job per track so the workers share them
+    for (int i = first - 1; i < first + count; i++) {
+        int track = i == first - 1 ? pl->current : shown_track(pl, ids, id_count, i);
+        if (track < 0 || track >= pl->count) continue;
+        uint8_t state = pl->tracks[track].tag_state;
+        if (state == TAG_URGENT || state == TAG_READ) continue;
+
+        uint32_t id = (uint32_t)track;
+        if (!submit_tags(pl, POOL_LANE_INTERACTIVE, &id, 1)) break;
+    }
+
+    while (pl->tag_pending < TAG_BULK_IN_FLIGHT && pl->tag_cursor < pl->count) {
+        uint32_t tracks[TAG_BULK_SIZE];
+        uint32_t n = 0;
+        for (; n < TAG_BULK_SIZE && pl->tag_cursor < pl->count; pl->tag_cursor++) {
+            if (pl->tracks[pl->tag_cursor].tag_state == TAG_UNREAD) tracks[n++] = (uint32_t)pl->tag_cursor;
+        }
+        if (n > 0 && !submit_tags(pl, POOL_LANE_BULK, tracks, n)) {
+            // Left for the rows that come into view
+            fprintf(stderr, "Cannot read tags under %s\n", playlist_get_dir(pl));
+            pl->tag_cursor = pl->count;
+        }
+    }
+
+    // Everything read: keep it for next time
+    if (pl->tags_unsaved && pl->tag_pending == 0 && pl->tag_cursor >= pl->count && !pl->scan) {
+        pl->tags_unsaved = false;
+        if (pl->recursive && pl->library_index) save_index(pl);
+    }
+    return changed;
+}
+
+bool playlist_tags_busy(const Playlist *pl) {
+    return pl->tag_pending > 0 || pl->tag_cursor < pl->count;
+}
+
+void playlist_free(Playlist *pl) {
+    pool_group_cancel(&pl->jobs);
+    scan_free(pl->scan);
+    pl->scan = NULL;
+    free_staging(pl);
+    watch_close(pl->watch);
+    pl->watch = NULL;
+    tagreader_free(pl->tag_reader);
+    pl->tag_reader = NULL;
+    strintern_free(&pl->tags);
+    strarena_free(&pl->strings);
+    free(pl->dirs);
+    free(pl->tracks);
+    shuffle_free(&pl->shuffle_order);
+    smartshuffle_free(&pl->smart);
+    pl->smart_built = false;
+    pl->smart_drawn = false;
+    playqueue_free(&pl->queue);
+    pl->queue_resolved = false;
+    pl->resuming = false;
+    pl->dirs = NULL;
+    pl->tracks = NULL;
+    pl->dir_count = pl->dir_capacity = 0;
+    pl->count = pl->capacity = 0;
+    pl->current = -1;
+    pl->selected = 0;
+}
+
+bool playlist_dir_has_audio(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return false;
+
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        found = (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) &&
+                playlist_is_audio_file(entry->d_name);
+    }
+
+    closedir(dir);
+    return found;
+}
+
+const char *playlist_track_name(const Playlist *pl, int index) {
+    if (index < 0 || index >= pl->count) return NULL;
+    return strarena_get(&pl->strings, pl->tracks[index].name);
+}
+
+const char *playlist_track_title(const Playlist *pl, int index, char *buf, size_t size) {
+    if (index < 0 || index >= pl->count) return NULL;
+
+    const PlaylistTrack *track = &pl->tracks[index];
+    const char *artist = strintern_get(&pl->tags, track->artist);
+    const char *title = strintern_get(&pl->tags, track->title);
+    if (title[0] == '\0') {
+        snprintf(buf, size, "%s", strarena_get(&pl->strings, track->name));
+    } else if (artist[0] == '\0') {
+        snprintf(buf, size, "%s", title);
+    } else {
+        snprintf(buf, size, "%s - %s", artist, title);
+    }
+    return buf;
+}
+
+const char *playlist_track_path(const Playlist *pl, int index, char *buf, size_t size) {
+    if (index < 0 || index >= pl->count) return NULL;
+
+    const PlaylistTrack *track = &pl->tracks[index];
+    const char *dir = strarena_get(&pl->strings, pl->dirs[track->dir].path);
+    const char *name = strarena_get(&pl->strings, track->name);
+    const char *sep = strcmp(dir, "/") == 0 ? "" : "/";
+
+    int n = snprintf(buf, size, "%s%s%s", dir, sep, name);
+    if (n < 0 || (size_t)n >= size) return NULL;
+    return buf;
+}
+
+const char *playlist_selected_path(const Playlist *pl, char *buf, size_t size) {
     if (pl->count == 0 || pl->selected < 0 || pl->selected >= pl->count) {
         return NULL;
     }
-    return pl->paths[pl->selected];
+    return playlist_track_path(pl, pl->selected, buf, size);
 }
 
 const char *playlist_selected_name(const Playlist *pl) {
     if (pl->count == 0 || pl->selected < 0 || pl->selected >= pl->count) {
         return NULL;
     }
-    return pl->names[pl->selected];
+    return playlist_track_name(pl, pl->selected);
 }
 
 const char *playlist_current_name(const Playlist *pl) {
     if (pl->current < 0 || pl->current >= pl->count) {
         return NULL;
     }
-    return pl->names[pl->current];
+    return playlist_track_name(pl, pl->current);
 }
 
 void playlist_select_next(Playlist *pl) {
@@ -148,16 +1471,167 @@ void playlist_select_prev(Playlist *pl) {
 void playlist_play_selected(Playlist *pl) {
     if (pl->count == 0) return;
     pl->current = pl->selected;
+    pl->resuming = false;
 
     // Sync shuffle position to current track
-    if (pl->shuffle) {
-        for (int i = 0; i < pl->count; i++) {
-            if (pl->shuffle_order[i] == pl->current) {
-                pl->shuffle_pos = i;
-                break;
+    if (pl->shuffle) sync_shuffle_pos(pl);
+    if (pl->shuffle && pl->smart_shuffle && pl->smart_built) {
+        smartshuffle_played(&pl->smart, pl->current);
+        pl->smart_drawn = false;
+    }
+}
+
+// Find the queued files among the tracks again, if tracks were added or
+// renumbered since. Each directory's path is hashed once and each track's
+// hash carries on from it with the name, so a track's path is only written
+// out to compare when its hash matches a queued one.
+static void resolve_queue(Playlist *pl) {
+    PlayQueue *q = &pl->queue;
+    if (pl->queue_resolved && pl->queue_generation == pl->tag_generation && pl->queue_count == pl->count) {
+        return;
+    }
+    for (uint32_t id = playqueue_first(q); id != PLAYQUEUE_NONE; id = playqueue_next(q, id)) {
+        q->entries[id].track = -1;
+    }
+    pl->queue_resolved = true;
+    pl->queue_generation = pl->tag_generation;
+    pl->queue_count = pl->count;
+    if (q->count == 0) return;
+
+    uint32_t size = 16;
+    while (size < q->count * 2) size *= 2;
+    uint32_t mask = size - 1;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));   // entry id + 1, 0 if free
+    uint32_t *hashes = malloc((size_t)q->used * sizeof(uint32_t));
+    uint32_t *dir_hashes = malloc(((size_t)pl->dir_count + 1) * sizeof(uint32_t));
+    if (!slots || !hashes || !dir_hashes) {
+        // Nothing found this time; looked for again when anything changes
+        free(slots);
+        free(hashes);
+        free(dir_hashes);
+        return;
+    }
+
+    for (uint32_t id = playqueue_first(q); id != PLAYQUEUE_NONE; id = playqueue_next(q, id)) {
+        const char *path = playqueue_path(q, id);
+        hashes[id] = hash_path(path, strlen(path));
+        uint32_t slot = hashes[id] & mask;
+        while (slots[slot]) slot = (slot + 1) & mask;
+        slots[slot] = id + 1;
+    }
+    for (int d = 0; d < pl->dir_count; d++) {
+        const char *dir = strarena_get(&pl->strings, pl->dirs[d].path);
+        size_t len = strlen(dir);
+        dir_hashes[d] = hash_path(dir, len);
+        if (strcmp(dir, "/") != 0) dir_hashes[d] = hash_more(dir_hashes[d], "/", 1);
+    }
+
+    uint32_t found = 0;
+    char path[PLAYLIST_MAX_PATH];
+    for (int i = 0; i < pl->count && found < q->count; i++) {
+        const char *name = strarena_get(&pl->strings, pl->tracks[i].name);
+        uint32_t hash = hash_more(dir_hashes[pl->tracks[i].dir], name, strlen(name));
+        bool written = false;
+        for (uint32_t slot = hash & mask; slots[slot]; slot = (slot + 1) & mask) {
+            uint32_t id = slots[slot] - 1;
+            if (hashes[id] != hash || q->entries[id].track >= 0) continue;
+            if (!written && !playlist_track_path(pl, i, path, sizeof(path))) break;
+            written = true;
+            if (strcmp(path, playqueue_path(q, id)) == 0) {
+                q->entries[id].track = i;
+                found++;
             }
         }
     }
+
+    free(slots);
+    free(hashes);
+    free(dir_hashes);
+}
+
+// First queued track in the playlist (-1 if none), taken off the queue if
+// take. Entries not in it are dropped on the way then, unless a scan may
+// still add them.
+static int next_queued(Playlist *pl, bool take) {
+    PlayQueue *q = &pl->queue;
+    if (q->count == 0) return -1;
+    resolve_queue(pl);
+
+    uint32_t id = playqueue_first(q);
+    while (id != PLAYQUEUE_NONE) {
+        uint32_t next = playqueue_next(q, id);
+        int track = q->entries[id].track;
+        if (track >= 0 && track < pl->count) {
+            if (take) playqueue_remove(q, id);
+            return track;
+        }
+        if (take && !pl->scan) playqueue_remove(q, id);
+        id = next;
+    }
+    return -1;
+}
+
+// Play a track off the queue. The playlist's order goes on from where it
+// was once the queue runs out.
+static void play_queued(Playlist *pl, int track) {
+    if (!pl->resuming) {
+        pl->resuming = true;
+        pl->resume = pl->current;
+    }
+    pl->current = track;
+    pl->selected = track;
+    if (pl->shuffle && pl->smart_shuffle && pl->smart_built) {
+        smartshuffle_played(&pl->smart, track);
+        pl->smart_drawn = false;
+    }
+}
+
+bool playlist_queue_selected(Playlist *pl, bool next) {
+    char path[PLAYLIST_MAX_PATH];
+    if (!playlist_selected_path(pl, path, sizeof(path))) return false;
+
+    // The rest first, so the new entry's index isn't looked up again
+    resolve_queue(pl);
+    return playqueue_push(&pl->queue, path, pl->selected, next) != PLAYQUEUE_NONE;
+}
+
+int playlist_queue_track(Playlist *pl, uint32_t id) {
+    if (id >= pl->queue.used) return -1;
+    resolve_queue(pl);
+    int track = pl->queue.entries[id].track;
+    return track < pl->count ? track : -1;
+}
+
+int playlist_play_queued(Playlist *pl, uint32_t id) {
+    int track = playlist_queue_track(pl, id);
+    playqueue_remove(&pl->queue, id);
+    if (track >= 0) play_queued(pl, track);
+    return track;
+}
+
+bool playlist_load_queue(Playlist *pl, const char *path) {
+    pl->queue_resolved = false;
+    return playqueue_load(&pl->queue, path);
+}
+
+// Draw the next track of the smart shuffle, starting over once everything
+// was played if repeating. Returns false if it can't be built; the plain
+// shuffle order is followed then.
+static bool next_smart(Playlist *pl, int *next) {
+    if (pl->smart_drawn && pl->smart_built && pl->smart_generation == pl->tag_generation) {
+        *next = pl->smart_next;
+        return true;
+    }
+    if (!update_smart(pl)) return false;
+
+    *next = smartshuffle_draw(&pl->smart, shuffle_rng(pl));
+    if (*next < 0 && pl->repeat == REPEAT_ALL) {
+        smartshuffle_restart(&pl->smart);
+        *next = smartshuffle_draw(&pl->smart, shuffle_rng(pl));
+    }
+    pl->smart_next = *next;
+    pl->smart_drawn = *next >= 0;
+    return true;
 }
 
 int playlist_next_track(Playlist *pl) {
@@ -168,8 +1642,16 @@ int playlist_next_track(Playlist *pl) {
         return pl->current;
     }
 
-    int next;
-    if (pl->shuffle) {
+    int next = next_queued(pl, false);
+    if (next >= 0) return next;
+
+    // After queued tracks, from where the order left off
+    int from = pl->current;
+    if (pl->resuming) from = pl->resume;
+
+    if (pl->shuffle && pl->smart_shuffle && next_smart(pl, &next)) {
+        return next;
+    } else if (pl->shuffle) {
         int next_pos = pl->shuffle_pos + 1;
         if (next_pos >= pl->count) {
             if (pl->repeat == REPEAT_ALL) {
@@ -180,11 +1662,11 @@ int playlist_next_track(Playlist *pl) {
         }
         // Bounds check
         if (next_pos < 0 || next_pos >= pl->count) return -1;
-        next = pl->shuffle_order[next_pos];
+        next = shuffle_track(&pl->shuffle_order, next_pos);
         // Validate the index
         if (next < 0 || next >= pl->count) return -1;
     } else {
-        next = pl->current + 1;
+        next = from + 1;
         if (next >= pl->count) {
             if (pl->repeat == REPEAT_ALL) {
                 next = 0;
@@ -197,12 +1679,24 @@ int playlist_next_track(Playlist *pl) {
     return next;
 }
 
-int playlist_advance(Playlist *pl) {
-    int next = playlist_next_track(pl);
+static int advance_once(Playlist *pl) {
+    int next = -1;
+    if (pl->count > 0 && pl->current >= 0 && pl->repeat != REPEAT_ONE) next = next_queued(pl, true);
+    if (next >= 0) {
+        play_queued(pl, next);
+        return next;
+    }
+
+    next = playlist_next_track(pl);
     if (next >= 0) {
+        pl->resuming = false;
         pl->current = next;
         pl->selected = next;
-        if (pl->shuffle) {
+        if (pl->shuffle && pl->smart_shuffle && pl->smart_built) {
+            smartshuffle_played(&pl->smart, next);
+            pl->smart_drawn = false;
+            sync_shuffle_pos(pl);
+        } else if (pl->shuffle) {
             pl->shuffle_pos++;
             if (pl->shuffle_pos >= pl->count) {
                 pl->shuffle_pos = 0;
@@ -212,20 +1706,33 @@ int playlist_advance(Playlist *pl) {
     return next;
 }
 
-void playlist_toggle_shuffle(Playlist *pl) {
-    pl->shuffle = !pl->shuffle;
-    if (pl->shuffle) {
+int playlist_advance(Playlist *pl) {
+    // Step over tracks found missing, at most once around and through
+    // the queue
+    int limit = pl->count + (int)pl->queue.count;
+    for (int tries = 0; tries < limit; tries++) {
+        int next = advance_once(pl);
+        if (next < 0 || !pl->tracks[next].missing) return next;
+    }
+    return -1;
+}
+
+void playlist_cycle_shuffle(Playlist *pl) {
+    if (!pl->shuffle) {
+        pl->shuffle = true;
         generate_shuffle_order(pl);
         // Sync shuffle position to current track
-        if (pl->current >= 0) {
-            for (int i = 0; i < pl->count; i++) {
-                if (pl->shuffle_order[i] == pl->current) {
-                    pl->shuffle_pos = i;
-                    break;
-                }
-            }
-        }
+        sync_shuffle_pos(pl);
+    } else if (!pl->smart_shuffle) {
+        // Built on the next draw, with only the current track played
+        pl->smart_shuffle = true;
+    } else {
+        pl->shuffle = false;
+        pl->smart_shuffle = false;
+        smartshuffle_free(&pl->smart);
     }
+    pl->smart_built = false;
+    pl->smart_drawn = false;
 }
 
 void playlist_cycle_repeat(Playlist *pl) {
@@ -237,5 +1744,6 @@ void playlist_cycle_repeat(Playlist *pl) {
 }
 
 const char *playlist_get_dir(const Playlist *pl) {
-    return pl->dir_path;
+    if (pl->dir_count == 0) return "";
+    return strarena_get(&pl->strings, pl->dirs[0].path);
 }
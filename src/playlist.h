@@ -1,10 +1,21 @@
 #ifndef PLAYLIST_H
 #define PLAYLIST_H
 
+#include "playqueue.h"
+#include "pool.h"
+#include "scan.h"
+#include "shuffle.h"
+#include "smartshuffle.h"
+#include "strarena.h"
+#include "strintern.h"
+#include "tags.h"
+#include "watch.h"
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define PLAYLIST_MAX_TRACKS 256
-#define PLAYLIST_MAX_PATH 512
+#define PLAYLIST_MAX_PATH 4096
 
 typedef enum {
     REPEAT_OFF,
@@ -13,25 +24,186 @@ typedef enum {
 } RepeatMode;
 
 typedef struct {
-    char paths[PLAYLIST_MAX_TRACKS][PLAYLIST_MAX_PATH];
-    char names[PLAYLIST_MAX_TRACKS][PLAYLIST_MAX_PATH];  // filename only
-    char dir_path[PLAYLIST_MAX_PATH];  // current directory
+    uint32_t path;      // arena offset of the full path
+    int64_t mtime_ns;   // 0 if unknown
+    bool watched;
+} PlaylistDir;
+
+// Where a track's tags are (see playlist_tags_update())
+enum {
+    TAG_UNREAD,
+    TAG_QUEUED,       // in a bulk job
+    TAG_URGENT,       // in a job of its own, because it's on screen
+    TAG_READ          // artist, title and album are set, maybe to ""
+};
+
+// A track is a file name plus the directory it lives in. Size and mtime
+// are only known for recursive scans (0 otherwise); they tell whether the
+// library index entry still describes the file.
+typedef struct {
+    uint32_t name;          // arena offset
+    uint32_t dir;           // index into Playlist.dirs
+    uint32_t duration_ms;   // 0 if unknown
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t artist;        // offsets into Playlist.tags, 0 if unknown
+    uint32_t title;
+    uint32_t album;
+    uint8_t tag_state;
+    bool missing;           // found not to exist when its tags were read
+} PlaylistTrack;
+
+// Zero-initialize, then playlist_scan(). Release with playlist_free().
+typedef struct Playlist {
+    StrArena strings;   // directory paths and file names
+    PlaylistDir *dirs;  // dirs[0] is the scanned root
+    int dir_count;
+    int dir_capacity;
+
+    PlaylistTrack *tracks;
     int count;
+    int capacity;
     int current;    // currently playing track (-1 if none)
     int selected;   // cursor position for navigation
 
     // Playback modes
     bool shuffle;
     RepeatMode repeat;
-    int shuffle_order[PLAYLIST_MAX_TRACKS];  // shuffled indices
-    int shuffle_pos;  // position in shuffle order
+    bool locale_sort;    // collate names by LC_COLLATE (see natsort.h)
+    Shuffle shuffle_order;   // shuffled tracks, capacity entries
+    int shuffle_pos;         // position in shuffle order
+    uint64_t shuffle_seed;   // for the first shuffle; 0 to seed from the clock
+    // Smart shuffle: draw each next track so that artists and albums are
+    // spread apart (see smartshuffle.h), rather than following
+    // shuffle_order. Only with shuffle set.
+    bool smart_shuffle;
+    SmartShuffle smart;
+    bool smart_built;
+    uint32_t smart_generation;   // tag_generation and tag_updates it was built at
+    uint32_t smart_updates;
+    bool smart_drawn;            // smart_next is the next track
+    int smart_next;
+
+    // Tracks the user queued, played before the order above goes on. The
+    // queue isn't tied to the directory: it outlives rescans, and its
+    // entries are found among the tracks again by path whenever track
+    // indices change (see playlist_queue_track()).
+    PlayQueue queue;
+    bool queue_resolved;        // entry tracks are right for the
+    uint32_t queue_generation;  // tag_generation and count they were
+    int queue_count;            // looked up at
+    // While queued tracks play, the order goes on from resume afterwards.
+    // Remapped like current when track indices change.
+    bool resuming;
+    int resume;
+
+    // Background work tied to this directory; cancelled on rescan
+    PoolGroup jobs;
+
+    // Recursive scan in progress (NULL if none)
+    Scan *scan;
+
+    // Load recursive scans from the library index and save them back
+    // (see libindex.h)
+    bool library_index;
+    // Tracks of a rescan that started from the index, swapped in when it
+    // finishes if anything changed (NULL if none)
+    struct Playlist *staging;
+
+    // Follow files being added and removed once scanned (see
+    // playlist_watch_poll())
+    bool watch_changes;
+    bool recursive;   // scanned with playlist_scan_recursive()
+    Watch *watch;
+
+    // Tags of every track, each distinct string stored once. Read in the
+    // background by playlist_tags_update(), or taken from the library
+    // index.
+    StrIntern tags;
+    TagReader *tag_reader;
+    uint32_t tag_generation;   // bumped when track indices change
+    uint32_t tag_updates;      // bumped as tags arrive
+    int tag_cursor;            // bulk reading has queued every track before it
+    int tag_pending;           // tracks queued and not back yet
+    bool tags_unsaved;         // read since the library index was written
 } Playlist;
 
-// Scan a directory for .flac and .ogg files. Returns false if directory can't be opened.
+// Scan a directory for .flac and .ogg files. Returns false if directory can't be opened
+// or memory runs out. Cancels any background jobs queued for the previous directory.
 bool playlist_scan(Playlist *pl, const char *dir_path);
 
-// Get path of currently selected track
-const char *playlist_selected_path(const Playlist *pl);
+// Start a recursive scan of a directory tree on the worker pool. Tracks
+// are appended by playlist_scan_poll() as directories are read, grouped by
+// directory; when the scan ends they are put in path order. Returns false
+// if the directory can't be opened.
+//
+// With library_index set, a tree scanned before is shown at once from its
+// index and only changed directories are read again. The playlist is then
+// replaced in one go when the scan ends, if anything changed.
+bool playlist_scan_recursive(Playlist *pl, const char *dir_path);
+
+// Load the tracks an M3U, M3U8, PLS or XSPF file lists, in its order (see
+// plfile.h). dirs[0] is the playlist file's directory. The files aren't
+// looked at until their tags are read; those found missing then are
+// skipped by playlist_advance(). Returns false if the file can't be read
+// or memory runs out; the tracks read until then are kept.
+bool playlist_load_file(Playlist *pl, const char *path);
+
+// Write the tracks to a playlist file of the format its extension names,
+// with their tags. Returns false if it can't be written.
+bool playlist_save_file(const Playlist *pl, const char *path);
+
+// Add the tracks found since the last call and fill in the scan's
+// progress; once progress->done is set the scan is over. Returns true if
+// tracks were added or reordered; indices held by the caller other than
+// current and selected are then stale. Does nothing if no scan is running.
+bool playlist_scan_poll(Playlist *pl, ScanProgress *progress);
+
+// Apply files added to or removed from the playlist's directories, once
+// they have settled. Tracks keep their order, new ones go where a scan
+// would put them; current, selected and the shuffle order are carried
+// over, with new tracks dealt into the part of the shuffle not played yet.
+// If the current track is deleted, current becomes -1. Returns true if
+// tracks were added or removed; other indices held by the caller are then
+// stale. Does nothing while a scan is running.
+bool playlist_watch_poll(Playlist *pl);
+
+// Read tags in the background: the rows first..first+count-1 on screen and
+// the current track right away, then the rest of the playlist in bulk.
+// The rows are the tracks ids lists (search results), or all tracks if ids
+// is NULL. Call it every frame; it picks up what was read since the last
+// call. Returns true if tags of the given rows or the current track
+// arrived. Once everything is read, a recursive playlist's library index
+// is saved again.
+bool playlist_tags_update(Playlist *pl, const uint32_t *ids, int id_count, int first, int count);
+
+// True while tags are being read
+bool playlist_tags_busy(const Playlist *pl);
+
+// Release the playlist's storage. It can be scanned again afterwards.
+void playlist_free(Playlist *pl);
+
+// True if a file name has the extension of a playable file.
+bool playlist_is_audio_file(const char *name);
+
+// True if the directory directly contains at least one playable file.
+// Stops reading at the first one.
+bool playlist_dir_has_audio(const char *dir_path);
+
+// File name of a track
+const char *playlist_track_name(const Playlist *pl, int index);
+
+// "Artist - Title" of a track, or just the title if there is no artist,
+// written to buf. Falls back to the file name until the tags are read or
+// if the file has no title. Returns NULL if the index is out of range.
+const char *playlist_track_title(const Playlist *pl, int index, char *buf, size_t size);
+
+// Full path of a track written to buf. Returns buf, or NULL if the index is
+// out of range or the path doesn't fit.
+const char *playlist_track_path(const Playlist *pl, int index, char *buf, size_t size);
+
+// Get path of currently selected track (see playlist_track_path)
+const char *playlist_selected_path(const Playlist *pl, char *buf, size_t size);
 
 // Get name of currently selected track
 const char *playlist_selected_name(const Playlist *pl);
@@ -46,14 +218,33 @@ void playlist_select_prev(Playlist *pl);
 // Set current playing track to selected
 void playlist_play_selected(Playlist *pl);
 
-// Get the next track index to play (-1 if none). Does not change state.
+// Get the next track index to play (-1 if none), queued tracks first. Does
+// not change state.
 int playlist_next_track(Playlist *pl);
 
-// Advance to next track. Returns the new track index (-1 if end of playlist).
+// Advance to next track, skipping tracks found missing: the first queued
+// track in the playlist if there is one, taking it off the queue, and the
+// next one in playlist order otherwise. Queued tracks that aren't in the
+// playlist are dropped on the way, unless a scan is still running. Returns
+// the new track index (-1 if end of playlist).
 int playlist_advance(Playlist *pl);
 
-// Toggle shuffle mode
-void playlist_toggle_shuffle(Playlist *pl);
+// Queue the selected track: at the end, or first if next. Returns false if
+// nothing is selected or memory runs out.
+bool playlist_queue_selected(Playlist *pl, bool next);
+
+// Track a queue entry refers to, or -1 if it isn't in the playlist (yet).
+int playlist_queue_track(Playlist *pl, uint32_t id);
+
+// Play a queue entry now and take it off the queue. Returns its track, or
+// -1 if it isn't in the playlist; it's dropped all the same.
+int playlist_play_queued(Playlist *pl, uint32_t id);
+
+// Replace the queue with the one saved at path (see playqueue_load()).
+bool playlist_load_queue(Playlist *pl, const char *path);
+
+// Cycle shuffle mode (off -> shuffle -> smart shuffle -> off)
+void playlist_cycle_shuffle(Playlist *pl);
 
 // Cycle repeat mode (off -> one -> all -> off)
 void playlist_cycle_repeat(Playlist *pl);
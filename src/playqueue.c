@@ -0,0 +1,226 @@
+#define _DEFAULT_SOURCE
+
+#include "playqueue.h"
+#include "plfile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PLAYQUEUE_INITIAL_CAPACITY 64
+
+// Paths of removed entries are dropped once they are this many bytes and
+// more than half the arena, so compacting costs O(1) per removal overall
+#define PLAYQUEUE_COMPACT_BYTES (64 * 1024)
+
+// Copy the paths still queued to a fresh arena, sized up front so that no
+// push fails halfway. Out of memory, the old one is kept.
+static void compact_paths(PlayQueue *q) {
+    StrArena fresh = {0};
+    fresh.capacity = q->paths.used - q->dead_bytes;
+    fresh.data = malloc(fresh.capacity);
+    if (!fresh.data) return;
+    for (uint32_t id = playqueue_first(q); id != PLAYQUEUE_NONE; id = q->entries[id].next) {
+        const char *path = strarena_get(&q->paths, q->entries[id].path);
+        strarena_push(&fresh, path, strlen(path), &q->entries[id].path);
+    }
+    strarena_free(&q->paths);
+    q->paths = fresh;
+    q->dead_bytes = 0;
+}
+
+// Unlink an entry from its neighbours, leaving it where it is in memory
+static void unlink_entry(PlayQueue *q, uint32_t id) {
+    PlayQueueEntry *e = &q->entries[id];
+    if (e->prev != PLAYQUEUE_NONE) q->entries[e->prev].next = e->next;
+    else q->head = e->next;
+    if (e->next != PLAYQUEUE_NONE) q->entries[e->next].prev = e->prev;
+    else q->tail = e->prev;
+    q->count--;
+}
+
+// Link an entry in front of another, or at the end
+static void link_entry(PlayQueue *q, uint32_t id, uint32_t before) {
+    PlayQueueEntry *e = &q->entries[id];
+    if (q->count == 0) {
+        e->prev = e->next = PLAYQUEUE_NONE;
+        q->head = q->tail = id;
+    } else if (before == PLAYQUEUE_NONE) {
+        e->prev = q->tail;
+        e->next = PLAYQUEUE_NONE;
+        q->entries[q->tail].next = id;
+        q->tail = id;
+    } else {
+        e->prev = q->entries[before].prev;
+        e->next = before;
+        if (e->prev != PLAYQUEUE_NONE) q->entries[e->prev].next = id;
+        else q->head = id;
+        q->entries[before].prev = id;
+    }
+    q->count++;
+}
+
+static uint32_t new_entry(PlayQueue *q) {
+    if (q->free_count > 0) {
+        uint32_t id = q->free_list;
+        q->free_list = q->entries[id].next;
+        q->free_count--;
+        return id;
+    }
+    if (q->used == q->capacity) {
+        if (q->capacity >= UINT32_MAX / 2) return PLAYQUEUE_NONE;
+        uint32_t capacity = q->capacity ? q->capacity * 2 : PLAYQUEUE_INITIAL_CAPACITY;
+        PlayQueueEntry *entries = realloc(q->entries, (size_t)capacity * sizeof(PlayQueueEntry));
+        if (!entries) return PLAYQUEUE_NONE;
+        q->entries = entries;
+        q->capacity = capacity;
+    }
+    return q->used++;
+}
+
+uint32_t playqueue_push(PlayQueue *q, const char *path, int track, bool next) {
+    uint32_t id = new_entry(q);
+    if (id == PLAYQUEUE_NONE) return PLAYQUEUE_NONE;
+    if (!strarena_push(&q->paths, path, strlen(path), &q->entries[id].path)) {
+        q->entries[id].next = q->free_list;
+        q->free_list = id;
+        q->free_count++;
+        return PLAYQUEUE_NONE;
+    }
+    q->entries[id].track = track;
+    link_entry(q, id, next && q->count > 0 ? q->head : PLAYQUEUE_NONE);
+    q->dirty = true;
+    q->generation++;
+    return id;
+}
+
+void playqueue_remove(PlayQueue *q, uint32_t id) {
+    if (id >= q->used) return;
+    unlink_entry(q, id);
+    q->dead_bytes += strlen(strarena_get(&q->paths, q->entries[id].path)) + 1;
+    q->entries[id].next = q->free_list;
+    q->entries[id].track = -1;
+    q->free_list = id;
+    q->free_count++;
+    q->dirty = true;
+    q->generation++;
+
+    if (q->count == 0) {
+        playqueue_clear(q);
+    } else if (q->dead_bytes >= PLAYQUEUE_COMPACT_BYTES && q->dead_bytes * 2 > q->paths.used) {
+        compact_paths(q);
+    }
+}
+
+void playqueue_move(PlayQueue *q, uint32_t id, uint32_t before) {
+    if (id >= q->used || id == before) return;
+    unlink_entry(q, id);
+    link_entry(q, id, before);
+    q->dirty = true;
+    q->generation++;
+}
+
+uint32_t playqueue_first(const PlayQueue *q) {
+    return q->count > 0 ? q->head : PLAYQUEUE_NONE;
+}
+
+uint32_t playqueue_next(const PlayQueue *q, uint32_t id) {
+    return id < q->used ? q->entries[id].next : PLAYQUEUE_NONE;
+}
+
+uint32_t playqueue_prev(const PlayQueue *q, uint32_t id) {
+    return id < q->used ? q->entries[id].prev : PLAYQUEUE_NONE;
+}
+
+uint32_t playqueue_at(const PlayQueue *q, uint32_t pos) {
+    if (pos >= q->count) return PLAYQUEUE_NONE;
+    uint32_t id;
+    if (pos < q->count / 2) {
+        id = q->head;
+        while (pos-- > 0) id = q->entries[id].next;
+    } else {
+        id = q->tail;
+        for (uint32_t i = q->count - 1; i > pos; i--) id = q->entries[id].prev;
+    }
+    return id;
+}
+
+const char *playqueue_path(const PlayQueue *q, uint32_t id) {
+    return id < q->used ? strarena_get(&q->paths, q->entries[id].path) : "";
+}
+
+void playqueue_clear(PlayQueue *q) {
+    q->used = q->count = q->free_count = 0;
+    strarena_clear(&q->paths);
+    q->dead_bytes = 0;
+    q->dirty = true;
+    q->generation++;
+}
+
+void playqueue_free(PlayQueue *q) {
+    free(q->entries);
+    strarena_free(&q->paths);
+    memset(q, 0, sizeof(*q));
+}
+
+static bool make_dir(const char *path) {
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+bool playqueue_state_path(char *buf, size_t size) {
+    char base[PLFILE_PATH_MAX];
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (state && state[0] == '/') {
+        n = snprintf(base, sizeof(base), "%s", state);
+    } else if (home && home[0]) {
+        n = snprintf(base, sizeof(base), "%s/.local", home);
+        if (n < 0 || (size_t)n >= sizeof(base) || !make_dir(base)) return false;
+        n = snprintf(base, sizeof(base), "%s/.local/state", home);
+    } else {
+        return false;
+    }
+    if (n < 0 || (size_t)n >= sizeof(base) || !make_dir(base)) return false;
+
+    n = snprintf(buf, size, "%s/oscyl", base);
+    if (n < 0 || (size_t)n >= size || !make_dir(buf)) return false;
+    n = snprintf(buf, size, "%s/oscyl/queue.m3u8", base);
+    return n >= 0 && (size_t)n < size;
+}
+
+static bool load_entry(void *user, const PlFileEntry *entry) {
+    return playqueue_push(user, entry->path, -1, false) != PLAYQUEUE_NONE;
+}
+
+bool playqueue_load(PlayQueue *q, const char *path) {
+    playqueue_clear(q);
+    q->dirty = false;
+
+    struct stat st;
+    if (stat(path, &st) != 0 && errno == ENOENT) return true;
+    bool ok = plfile_read(path, load_entry, q);
+    q->dirty = false;
+    return ok;
+}
+
+bool playqueue_save(PlayQueue *q, const char *path) {
+    PlFileWriter w;
+    if (!plfile_writer_open(&w, path)) return false;
+
+    char dir[PLFILE_PATH_MAX];
+    for (uint32_t id = playqueue_first(q); id != PLAYQUEUE_NONE; id = q->entries[id].next) {
+        const char *file = playqueue_path(q, id);
+        const char *slash = strrchr(file, '/');
+        size_t len = slash ? (size_t)(slash - file) : 0;
+        if (len >= sizeof(dir)) continue;
+        memcpy(dir, file, len);
+        dir[len] = '\0';
+        plfile_writer_add(&w, slash == file ? "/" : len > 0 ? dir : ".", slash ? slash + 1 : file, "", "", 0);
+    }
+    if (!plfile_writer_close(&w)) return false;
+    q->dirty = false;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef PLAYQUEUE_H
+#define PLAYQUEUE_H
+
+#include "strarena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Tracks picked to play next, ahead of the playlist's own order. Entries
+// are a doubly linked list through one array, with removed entries kept on
+// a free list for reuse: adding at either end, taking the first entry, and
+// moving or removing any entry by its id take O(1) however long the queue
+// is. An id stays valid until its entry is removed.
+//
+// An entry holds the full path of its file, so it survives rescans and
+// restarts, along with the caller's index for that file.
+
+#define PLAYQUEUE_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t path;    // offset into PlayQueue.paths
+    uint32_t prev;    // PLAYQUEUE_NONE at the ends
+    uint32_t next;
+    int track;        // caller's index for the file, -1 if unknown
+} PlayQueueEntry;
+
+// Zero-initialize. Release with playqueue_free().
+typedef struct {
+    PlayQueueEntry *entries;
+    uint32_t capacity;
+    uint32_t used;        // entries[0, used) were handed out at some point
+    uint32_t count;       // entries in the queue
+    uint32_t head;        // valid while count > 0
+    uint32_t tail;
+    uint32_t free_list;   // valid while free_count > 0
+    uint32_t free_count;
+    StrArena paths;       // compacted once mostly removed entries
+    size_t dead_bytes;    // of paths, belonging to removed entries
+    bool dirty;           // changed since loaded or saved
+    uint32_t generation;  // bumped by every change, for views of the queue
+} PlayQueue;
+
+// Add path at the end, or at the front if next. Returns the new entry's
+// id, or PLAYQUEUE_NONE if out of memory.
+uint32_t playqueue_push(PlayQueue *q, const char *path, int track, bool next);
+
+// Take an entry out of the queue; its id may be reused afterwards.
+void playqueue_remove(PlayQueue *q, uint32_t id);
+
+// Move an entry in front of another, or to the end if before is
+// PLAYQUEUE_NONE.
+void playqueue_move(PlayQueue *q, uint32_t id, uint32_t before);
+
+// Walk the queue: the first entry, and the ones after and before an entry.
+// PLAYQUEUE_NONE past either end.
+uint32_t playqueue_first(const PlayQueue *q);
+uint32_t playqueue_next(const PlayQueue *q, uint32_t id);
+uint32_t playqueue_prev(const PlayQueue *q, uint32_t id);
+
+// Entry at a position, walking from the nearer end: O(n), for a lookup now
+// and then; views that move about the queue walk from an entry they know.
+uint32_t playqueue_at(const PlayQueue *q, uint32_t pos);
+
+const char *playqueue_path(const PlayQueue *q, uint32_t id);
+
+void playqueue_clear(PlayQueue *q);
+void playqueue_free(PlayQueue *q);
+
+// Where the queue is kept between runs: ~/.local/state/oscyl/queue.m3u8,
+// or under $XDG_STATE_HOME. Creates the directories. Returns false if
+// there is no home directory or the path doesn't fit.
+bool playqueue_state_path(char *buf, size_t size);
+
+// Replace the queue with the tracks a playlist file lists, their indices
+// unknown (-1). A file that doesn't exist is an empty queue. Returns false
+// if it can't be read or memory runs out.
+bool playqueue_load(PlayQueue *q, const char *path);
+
+// Write the queue to a playlist file, through a temporary file renamed
+// into place. Returns false if it can't be written; the queue then stays
+// dirty, so a later save tries again.
+bool playqueue_save(PlayQueue *q, const char *path);
+
+#endif
@@ -0,0 +1,762 @@
+#define _DEFAULT_SOURCE
+
+#include "plfile.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define PLFILE_CHUNK (64 * 1024)
+#define PLFILE_RECORD_MAX (1024 * 1024)   // longest line or XML tag
+
+PlFileFormat plfile_format(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/')) return PLFILE_UNKNOWN;
+    if (strcasecmp(ext, ".m3u") == 0 || strcasecmp(ext, ".m3u8") == 0) return PLFILE_M3U;
+    if (strcasecmp(ext, ".pls") == 0) return PLFILE_PLS;
+    if (strcasecmp(ext, ".xspf") == 0) return PLFILE_XSPF;
+    return PLFILE_UNKNOWN;
+}
+
+bool plfile_dir(const char *path, char *buf, size_t size) {
+    char dir[PLFILE_PATH_MAX], resolved[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == path) {
+        snprintf(dir, sizeof(dir), "/");
+    } else if ((size_t)(slash - path) < sizeof(dir)) {
+        memcpy(dir, path, (size_t)(slash - path));
+        dir[slash - path] = '\0';
+    } else {
+        return false;
+    }
+
+    if (!realpath(dir, resolved)) return false;
+    size_t len = strlen(resolved);
+    if (len >= size) return false;
+    memcpy(buf, resolved, len + 1);
+    return true;
+}
+
+// Join path[0, len) to base (absolute, no trailing slash unless it is "/")
+// if it is relative, dropping empty, "." and ".." segments. Returns the
+// length, or 0 if it doesn't fit.
+static size_t resolve(const char *base, const char *path, size_t len, char *out, size_t size) {
+    size_t n = 0;
+    if (len == 0 || path[0] != '/') {
+        n = strlen(base);
+        if (n >= size) return 0;
+        memcpy(out, base, n);
+        if (n == 1) n = 0;   // segments bring their own slash
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/') i++;
+        size_t start = i;
+        while (i < len && path[i] != '/') i++;
+        size_t seg = i - start;
+
+        if (seg == 0 || (seg == 1 && path[start] == '.')) continue;
+        if (seg == 2 && path[start] == '.' && path[start + 1] == '.') {
+            while (n > 0 && out[n - 1] != '/') n--;
+            if (n > 0) n--;
+            continue;
+        }
+        if (n + 1 + seg >= size) return 0;
+        out[n++] = '/';
+        memcpy(out + n, path + start, seg);
+        n += seg;
+    }
+    if (n == 0) out[n++] = '/';
+    out[n] = '\0';
+    return n;
+}
+
+// Copy at most size - 1 bytes, cut on a UTF-8 boundary
+static void copy_text(char *dst, size_t size, const char *src, size_t len) {
+    if (len >= size) {
+        len = size - 1;
+        while (len > 0 && ((unsigned char)src[len] & 0xC0) == 0x80) len--;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static char *trim(char *s, size_t *len) {
+    while (*len > 0 && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) {
+        s++;
+        (*len)--;
+    }
+    while (*len > 0 && (s[*len - 1] == ' ' || s[*len - 1] == '\t' || s[*len - 1] == '\r' ||
+                        s[*len - 1] == '\n')) {
+        (*len)--;
+    }
+    s[*len] = '\0';
+    return s;
+}
+
+// Reading
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t size;
+    size_t start, end;   // unread bytes are buf[start, end)
+    bool eof;
+    const char *error;   // NULL while all is well
+} Reader;
+
+// The next record up to delim, which is replaced by a NUL; the last one
+// may end without it. Returns NULL at the end of the input or on error.
+static char *next_record(Reader *r, char delim, size_t *len) {
+    size_t scanned = r->start;
+    for (;;) {
+        char *hit = memchr(r->buf + scanned, delim, r->end - scanned);
+        if (hit || (r->eof && r->start < r->end)) {
+            char *record = r->buf + r->start;
+            if (!hit) hit = r->buf + r->end;   // there is always room for the NUL
+            *hit = '\0';
+            *len = (size_t)(hit - record);
+            r->start = hit < r->buf + r->end ? (size_t)(hit - r->buf) + 1 : r->end;
+            return record;
+        }
+        if (r->eof || r->error) return NULL;
+
+        // Keep the partial record and read more after it
+        scanned = r->end - r->start;
+        memmove(r->buf, r->buf + r->start, scanned);
+        r->end = scanned;
+        r->start = 0;
+        if (r->end + 1 >= r->size) {
+            if (r->size > PLFILE_RECORD_MAX) {
+                r->error = "line too long";
+                return NULL;
+            }
+            char *buf = realloc(r->buf, r->size * 2);
+            if (!buf) {
+                r->error = "out of memory";
+                return NULL;
+            }
+            r->buf = buf;
+            r->size *= 2;
+        }
+
+        ssize_t n = read(r->fd, r->buf + r->end, r->size - r->end - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            r->error = strerror(errno);
+            return NULL;
+        }
+        if (n == 0) r->eof = true;
+        r->end += (size_t)n;
+    }
+}
+
+typedef struct {
+    PlFileEntryFn fn;
+    void *user;
+    bool stopped;
+    char base[PLFILE_PATH_MAX];
+    char path[PLFILE_PATH_MAX];
+} Context;
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decode %XX in place; returns the new length
+static size_t percent_decode(char *s, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        int hi, lo;
+        if (s[i] == '%' && i + 2 < len &&
+            (hi = hex_value(s[i + 1])) >= 0 && (lo = hex_value(s[i + 2])) >= 0) {
+            s[out++] = (char)(hi << 4 | lo);
+            i += 2;
+        } else {
+            s[out++] = s[i];
+        }
+    }
+    s[out] = '\0';
+    return out;
+}
+
+// "scheme:" of at least two characters, so "C:\..." isn't one
+static bool has_scheme(const char *s) {
+    if (!isalpha((unsigned char)s[0])) return false;
+    size_t i = 1;
+    while (isalnum((unsigned char)s[i]) || s[i] == '+' || s[i] == '-' || s[i] == '.') i++;
+    return i > 1 && s[i] == ':';
+}
+
+// Pass on one entry: a path, or a URI reference if uri. Returns false if
+// fn stopped the reading.
+static bool emit(Context *cx, char *location, size_t len, bool uri, const char *title,
+                 uint32_t duration_ms) {
+    if (has_scheme(location)) {
+        if (strncasecmp(location, "file:", 5) != 0) return true;   // a stream
+        location += 5;
+        len -= 5;
+        if (len >= 2 && location[0] == '/' && location[1] == '/') {
+            // file://host/path; the host is taken to be this one
+            char *slash = memchr(location + 2, '/', len - 2);
+            if (!slash) return true;
+            len -= (size_t)(slash - location);
+            location = slash;
+        }
+        uri = true;
+    }
+    if (uri) len = percent_decode(location, len);
+    if (len == 0 || memchr(location, '\0', len)) return true;
+
+    if (resolve(cx->base, location, len, cx->path, sizeof(cx->path)) == 0) return true;
+    char *slash = strrchr(cx->path, '/');
+    if (slash[1] == '\0') return true;
+
+    PlFileEntry entry = {
+        .path = cx->path,
+        .dir_len = slash == cx->path ? 1 : (size_t)(slash - cx->path),
+        .name = slash + 1,
+        .title = title,
+        .duration_ms = duration_ms,
+    };
+    if (!cx->fn(cx->user, &entry)) {
+        cx->stopped = true;
+        return false;
+    }
+    return true;
+}
+
+static uint32_t seconds_to_ms(long seconds) {
+    return seconds > 0 && seconds < (long)(UINT32_MAX / 1000) ? (uint32_t)seconds * 1000 : 0;
+}
+
+// One path or URL per line; "#EXTINF:seconds,title" describes the next one
+static bool read_m3u(Reader *r, Context *cx) {
+    char title[PLFILE_TITLE_MAX] = "";
+    uint32_t duration_ms = 0;
+    bool first = true;
+
+    size_t len;
+    char *line;
+    while ((line = next_record(r, '\n', &len))) {
+        if (first && len >= 3 && memcmp(line, "\xEF\xBB\xBF", 3) == 0) {
+            line += 3;
+            len -= 3;
+        }
+        first = false;
+        line = trim(line, &len);
+        if (len == 0) continue;
+
+        if (line[0] == '#') {
+            if (strncmp(line, "#EXTINF:", 8) == 0) {
+                char *end;
+                duration_ms = seconds_to_ms(strtol(line + 8, &end, 10));
+                const char *comma = strchr(end, ',');
+                const char *text = comma ? comma + 1 : "";
+                copy_text(title, sizeof(title), text, strlen(text));
+            }
+            continue;
+        }
+        if (!emit(cx, line, len, false, title, duration_ms)) return false;
+        title[0] = '\0';
+        duration_ms = 0;
+    }
+    return !r->error;
+}
+
+// FileN=, TitleN= and LengthN= lines; an entry is passed on when a line
+// with another number comes, so its lines may be in any order as long as
+// they are together
+static bool read_pls(Reader *r, Context *cx) {
+    char location[PLFILE_PATH_MAX] = "";
+    char title[PLFILE_TITLE_MAX] = "";
+    uint32_t duration_ms = 0;
+    long number = -1;
+
+    size_t len;
+    char *line;
+    while ((line = next_record(r, '\n', &len))) {
+        line = trim(line, &len);
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+
+        int field;
+        size_t key_len;
+        if (strncasecmp(line, "File", 4) == 0) {
+            field = 0;
+            key_len = 4;
+        } else if (strncasecmp(line, "Title", 5) == 0) {
+            field = 1;
+            key_len = 5;
+        } else if (strncasecmp(line, "Length", 6) == 0) {
+            field = 2;
+            key_len = 6;
+        } else {
+            continue;
+        }
+        if (!isdigit((unsigned char)line[key_len])) continue;
+        long n = strtol(line + key_len, NULL, 10);
+
+        if (n != number) {
+            if (location[0] && !emit(cx, location, strlen(location), false, title, duration_ms)) {
+                return false;
+            }
+            location[0] = title[0] = '\0';
+            duration_ms = 0;
+            number = n;
+        }
+
+        char *value = eq + 1;
+        size_t value_len = len - (size_t)(value - line);
+        value = trim(value, &value_len);
+        if (field == 0) {
+            if (value_len < sizeof(location)) memcpy(location, value, value_len + 1);
+        } else if (field == 1) {
+            copy_text(title, sizeof(title), value, value_len);
+        } else {
+            duration_ms = seconds_to_ms(strtol(value, NULL, 10));
+        }
+    }
+    if (location[0] && !emit(cx, location, strlen(location), false, title, duration_ms)) return false;
+    return !r->error;
+}
+
+// XSPF
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t len;
+    bool overflow;
+} Text;
+
+static void text_append(Text *t, const char *s, size_t len) {
+    if (t->len + len >= t->size) {
+        t->overflow = true;
+        len = t->size - 1 - t->len;
+    }
+    memcpy(t->data + t->len, s, len);
+    t->len += len;
+    t->data[t->len] = '\0';
+}
+
+static size_t encode_utf8(unsigned long cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xC0 | cp >> 6);
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | cp >> 12);
+        out[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    } else if (cp < 0x110000) {
+        out[0] = (char)(0xF0 | cp >> 18);
+        out[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+        out[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+        out[3] = (char)(0x80 | (cp & 0x3F));
+        return 4;
+    }
+    return 0;
+}
+
+// Append character data, decoding the predefined and numeric entities
+static void text_append_xml(Text *t, const char *s, size_t len) {
+    static const struct { const char *name; char c; } entities[] = {
+        { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' }, { "apos", '\'' }
+    };
+
+    size_t i = 0;
+    while (i < len) {
+        const char *amp = memchr(s + i, '&', len - i);
+        size_t run = amp ? (size_t)(amp - s) - i : len - i;
+        text_append(t, s + i, run);
+        i += run;
+        if (!amp) break;
+
+        const char *semi = memchr(amp, ';', len - i);
+        if (!semi || semi - amp > 10) {
+            text_append(t, "&", 1);
+            i++;
+            continue;
+        }
+        const char *name = amp + 1;
+        size_t name_len = (size_t)(semi - name);
+        char out[4];
+        size_t out_len = 0;
+        if (name_len > 1 && name[0] == '#') {
+            bool hex = name[1] == 'x' || name[1] == 'X';
+            unsigned long cp = strtoul(name + 1 + hex, NULL, hex ? 16 : 10);
+            out_len = cp > 0 ? encode_utf8(cp, out) : 0;
+        } else {
+            for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]); e++) {
+                if (strlen(entities[e].name) == name_len && memcmp(entities[e].name, name, name_len) == 0) {
+                    out[0] = entities[e].c;
+                    out_len = 1;
+                }
+            }
+        }
+        if (out_len == 0) {
+            text_append(t, "&", 1);
+            i++;
+            continue;
+        }
+        text_append(t, out, out_len);
+        i += name_len + 2;
+    }
+}
+
+enum { XSPF_NONE, XSPF_LOCATION, XSPF_TITLE, XSPF_CREATOR, XSPF_DURATION, XSPF_FIELDS };
+
+static bool tag_is(const char *name, size_t len, const char *want) {
+    return strlen(want) == len && memcmp(name, want, len) == 0;
+}
+
+// Skip the rest of a comment or take the rest of a CDATA section: both
+// may hold '>', so the tag read so far isn't all of it. The content of a
+// CDATA section goes to t if there is one.
+static void read_special(Reader *r, char *tag, size_t len, Text *t) {
+    bool cdata = strncmp(tag, "![CDATA[", 8) == 0;
+    const char *end = cdata ? "]]" : "--";
+    char *part = tag + (cdata ? 8 : 3);
+    size_t part_len = len - (cdata ? 8 : 3);
+    for (;;) {
+        bool done = part_len >= 2 && part[part_len - 2] == end[0] && part[part_len - 1] == end[1];
+        if (t) text_append(t, part, done ? part_len - 2 : part_len);
+        if (done) return;
+        if (t) text_append(t, ">", 1);
+        part = next_record(r, '>', &part_len);
+        if (!part) return;
+    }
+}
+
+// <track> elements with <location>, <title>, <creator> and <duration>;
+// everything else, including <extension> content, is skipped
+static bool read_xspf(Reader *r, Context *cx) {
+    // Room for a location with every byte escaped
+    size_t location_size = PLFILE_PATH_MAX * 3;
+    char *buffers = malloc(location_size + (XSPF_FIELDS - 1) * PLFILE_TITLE_MAX);
+    if (!buffers) {
+        r->error = "out of memory";
+        return false;
+    }
+    Text fields[XSPF_FIELDS];
+    char *next = buffers;
+    for (int i = 0; i < XSPF_FIELDS; i++) {
+        size_t size = i == XSPF_LOCATION ? location_size : PLFILE_TITLE_MAX;
+        fields[i] = (Text){ next, size, 0, false };
+        next[0] = '\0';
+        next += size;
+    }
+    bool ok = true;
+    bool in_track = false, have_location = false;
+    int field = XSPF_NONE;
+    int skip = 0;   // depth of <extension> elements
+
+    size_t len;
+    char *text;
+    while ((text = next_record(r, '<', &len))) {
+        if (field != XSPF_NONE && !skip) text_append_xml(&fields[field], text, len);
+
+        char *tag = next_record(r, '>', &len);
+        if (!tag) break;
+        if (strncmp(tag, "!--", 3) == 0 || strncmp(tag, "![CDATA[", 8) == 0) {
+            read_special(r, tag, len, field != XSPF_NONE && !skip && tag[1] == '[' ? &fields[field] : NULL);
+            continue;
+        }
+        if (tag[0] == '?' || tag[0] == '!') continue;
+
+        bool closing = tag[0] == '/';
+        bool empty = len > 0 && tag[len - 1] == '/';
+        const char *name = tag + closing;
+        size_t name_len = strcspn(name, " \t\r\n/");
+
+        if (tag_is(name, name_len, "extension")) {
+            if (closing && skip > 0) skip--;
+            else if (!closing && !empty) skip++;
+            continue;
+        }
+        if (skip) continue;
+
+        if (tag_is(name, name_len, "track")) {
+            if (closing && in_track && have_location && !fields[XSPF_LOCATION].overflow) {
+                Text *loc = &fields[XSPF_LOCATION];
+                char *location = trim(loc->data, &loc->len);
+                size_t title_len = fields[XSPF_TITLE].len, creator_len = fields[XSPF_CREATOR].len;
+                char *title = trim(fields[XSPF_TITLE].data, &title_len);
+                char *creator = trim(fields[XSPF_CREATOR].data, &creator_len);
+                char full[PLFILE_TITLE_MAX];
+                snprintf(full, sizeof(full), "%s%s%s", creator, creator[0] && title[0] ? " - " : "", title);
+                uint32_t duration_ms = (uint32_t)strtoul(fields[XSPF_DURATION].data, NULL, 10);
+                if (location[0] && !emit(cx, location, strlen(location), true, full, duration_ms)) {
+                    ok = false;
+                    break;
+                }
+            }
+            in_track = !closing && !empty;
+            have_location = false;
+            field = XSPF_NONE;
+            for (int i = 0; i < XSPF_FIELDS; i++) {
+                fields[i].len = 0;
+                fields[i].overflow = false;
+                fields[i].data[0] = '\0';
+            }
+            continue;
+        }
+        if (!in_track) continue;
+
+        int which = tag_is(name, name_len, "location") ? XSPF_LOCATION :
+                    tag_is(name, name_len, "title") ? XSPF_TITLE :
+                    tag_is(name, name_len, "creator") ? XSPF_CREATOR :
+                    tag_is(name, name_len, "duration") ? XSPF_DURATION : XSPF_NONE;
+        if (which == XSPF_NONE) continue;
+        if (closing) {
+            if (field == which && which == XSPF_LOCATION) have_location = true;
+            field = XSPF_NONE;
+        } else if (!empty && !(which == XSPF_LOCATION && have_location)) {
+            // A track may list several locations; the first one is used
+            field = which;
+            fields[which].len = 0;
+            fields[which].data[0] = '\0';
+        }
+    }
+    free(buffers);
+    return ok && !r->error;
+}
+
+bool plfile_read(const char *path, PlFileEntryFn fn, void *user) {
+    PlFileFormat format = plfile_format(path);
+    if (format == PLFILE_UNKNOWN) {
+        fprintf(stderr, "Unknown playlist format: %s\n", path);
+        return false;
+    }
+
+    Context *cx = malloc(sizeof(Context));
+    Reader r = { .fd = -1, .size = PLFILE_CHUNK + 1 };
+    r.buf = malloc(r.size);
+    if (!cx || !r.buf) {
+        fprintf(stderr, "Out of memory reading %s\n", path);
+        free(cx);
+        free(r.buf);
+        return false;
+    }
+    cx->fn = fn;
+    cx->user = user;
+    cx->stopped = false;
+
+    bool ok = plfile_dir(path, cx->base, sizeof(cx->base));
+    if (ok) r.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (!ok || r.fd < 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        free(cx);
+        free(r.buf);
+        return false;
+    }
+
+    switch (format) {
+        case PLFILE_M3U: ok = read_m3u(&r, cx); break;
+        case PLFILE_PLS: ok = read_pls(&r, cx); break;
+        default: ok = read_xspf(&r, cx); break;
+    }
+    if (r.error) fprintf(stderr, "Cannot read %s: %s\n", path, r.error);
+
+    ok = ok && !r.error && !cx->stopped;
+    close(r.fd);
+    free(r.buf);
+    free(cx);
+    return ok;
+}
+
+// Writing
+
+bool plfile_writer_open(PlFileWriter *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    w->format = plfile_format(path);
+    if (w->format == PLFILE_UNKNOWN) {
+        fprintf(stderr, "Unknown playlist format: %s\n", path);
+        return false;
+    }
+
+    int n = snprintf(w->path, sizeof(w->path), "%s", path);
+    snprintf(w->tmp, sizeof(w->tmp), "%s.tmp", path);
+    if (n < 0 || (size_t)n >= sizeof(w->path) || !plfile_dir(path, w->base, sizeof(w->base)) ||
+        !getcwd(w->cwd, sizeof(w->cwd))) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno ? errno : ENAMETOOLONG));
+        return false;
+    }
+    w->base_len = strlen(w->base);
+
+    // Written next to the destination and renamed over it when complete
+    w->file = fopen(w->tmp, "wb");
+    if (!w->file) {
+        fprintf(stderr, "Cannot write %s: %s\n", w->tmp, strerror(errno));
+        return false;
+    }
+    setvbuf(w->file, NULL, _IOFBF, PLFILE_CHUNK);
+
+    switch (w->format) {
+        case PLFILE_M3U:
+            fputs("#EXTM3U\n", w->file);
+            break;
+        case PLFILE_PLS:
+            fputs("[playlist]\n", w->file);
+            break;
+        default:
+            fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+                  "  <trackList>\n", w->file);
+            break;
+    }
+    return true;
+}
+
+// A line of text with line breaks turned into spaces
+static void put_line_text(FILE *f, const char *s) {
+    for (; *s; s++) fputc(*s == '\n' || *s == '\r' ? ' ' : *s, f);
+}
+
+static void put_xml_text(FILE *f, const char *s) {
+    for (; *s; s++) {
+        switch (*s) {
+            case '&': fputs("&amp;", f); break;
+            case '<': fputs("&lt;", f); break;
+            case '>': fputs("&gt;", f); break;
+            default: fputc(*s, f); break;
+        }
+    }
+}
+
+// Percent-encode all but unreserved characters and '/'
+static void put_uri_path(FILE *f, const char *s) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '/') {
+            fputc(c, f);
+        } else {
+            fputc('%', f);
+            fputc(hex[c >> 4], f);
+            fputc(hex[c & 15], f);
+        }
+    }
+}
+
+// M3U and PLS lines are trimmed when read, so a path that starts or ends
+// with white space goes out as a file URI instead, which keeps it whole
+static void put_line_path(FILE *f, const char *path, const char *abs_path) {
+    size_t len = strlen(path);
+    if (len > 0 && (path[0] == ' ' || path[0] == '\t' || path[len - 1] == ' ' || path[len - 1] == '\t')) {
+        fputs("file://", f);
+        put_uri_path(f, abs_path);
+    } else {
+        fputs(path, f);
+    }
+}
+
+void plfile_writer_add(PlFileWriter *w, const char *dir, const char *name, const char *artist,
+                       const char *title, uint32_t duration_ms) {
+    if (!w->file) return;
+
+    char abs[PLFILE_PATH_MAX], path[PLFILE_PATH_MAX], abs_path[PLFILE_PATH_MAX];
+    size_t abs_len = resolve(w->cwd, dir, strlen(dir), abs, sizeof(abs));
+    if (abs_len == 0) return;
+
+    // Below the playlist's directory, relative to it
+    const char *rel = abs;
+    if (w->base_len == 1) {
+        rel = abs + 1;
+    } else if (strncmp(abs, w->base, w->base_len) == 0 && (abs[w->base_len] == '/' || abs[w->base_len] == '\0')) {
+        rel = abs + w->base_len + (abs[w->base_len] == '/');
+    }
+    bool relative = rel != abs;
+    const char *sep = rel[0] && rel[strlen(rel) - 1] != '/' ? "/" : "";
+    // A relative name could pass for a comment or a URI scheme
+    const char *prefix = relative && !rel[0] && (name[0] == '#' || has_scheme(name)) ? "./" : "";
+    int n = snprintf(path, sizeof(path), "%s%s%s%s", prefix, rel, sep, name);
+    if (n < 0 || (size_t)n >= sizeof(path) || strchr(path, '\n') || strchr(path, '\r')) return;
+    n = snprintf(abs_path, sizeof(abs_path), "%s%s%s", abs, abs[abs_len - 1] == '/' ? "" : "/", name);
+    if (n < 0 || (size_t)n >= sizeof(abs_path)) return;
+
+    FILE *f = w->file;
+    uint32_t index = ++w->count;
+    long seconds = duration_ms > 0 ? (long)((duration_ms + 500) / 1000) : -1;
+    const char *dash = artist[0] && title[0] ? " - " : "";
+    switch (w->format) {
+        case PLFILE_M3U:
+            if (title[0] || duration_ms > 0) {
+                fprintf(f, "#EXTINF:%ld,", seconds);
+                put_line_text(f, artist);
+                fputs(dash, f);
+                put_line_text(f, title);
+                fputc('\n', f);
+            }
+            put_line_path(f, path, abs_path);
+            fputc('\n', f);
+            break;
+        case PLFILE_PLS:
+            fprintf(f, "File%u=", index);
+            put_line_path(f, path, abs_path);
+            fputc('\n', f);
+            if (title[0]) {
+                fprintf(f, "Title%u=", index);
+                put_line_text(f, artist);
+                fputs(dash, f);
+                put_line_text(f, title);
+                fputc('\n', f);
+            }
+            fprintf(f, "Length%u=%ld\n", index, seconds);
+            break;
+        default:
+            fputs("    <track>\n      <location>", f);
+            if (!relative) fputs("file://", f);
+            put_uri_path(f, path);
+            fputs("</location>\n", f);
+            if (artist[0]) {
+                fputs("      <creator>", f);
+                put_xml_text(f, artist);
+                fputs("</creator>\n", f);
+            }
+            if (title[0]) {
+                fputs("      <title>", f);
+                put_xml_text(f, title);
+                fputs("</title>\n", f);
+            }
+            if (duration_ms > 0) fprintf(f, "      <duration>%u</duration>\n", duration_ms);
+            fputs("    </track>\n", f);
+            break;
+    }
+}
+
+bool plfile_writer_close(PlFileWriter *w) {
+    if (!w->file) return false;
+
+    if (w->format == PLFILE_PLS) {
+        fprintf(w->file, "NumberOfEntries=%u\nVersion=2\n", w->count);
+    } else if (w->format == PLFILE_XSPF) {
+        fputs("  </trackList>\n</playlist>\n", w->file);
+    }
+
+    bool ok = !ferror(w->file);
+    ok = fclose(w->file) == 0 && ok;
+    w->file = NULL;
+    if (!ok || rename(w->tmp, w->path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", w->path, strerror(errno));
+        unlink(w->tmp);
+        return false;
+    }
+    return true;
+}
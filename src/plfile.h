@@ -0,0 +1,77 @@
+#ifndef PLFILE_H
+#define PLFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Playlist files: M3U and M3U8 (with #EXTINF), PLS and XSPF, chosen by
+// extension. Files are read in 64 KB chunks and handed out one entry at a
+// time, so memory use doesn't grow with the length of the playlist; they
+// are written the same way, through stdio.
+//
+// Relative entries are taken from the playlist file's directory, which is
+// resolved once per file: each entry is then joined to it and "." and ".."
+// are removed as text, without a system call per entry. Nothing checks
+// whether the files exist.
+
+#define PLFILE_PATH_MAX 4096
+#define PLFILE_TITLE_MAX 512
+
+typedef enum {
+    PLFILE_UNKNOWN,
+    PLFILE_M3U,    // .m3u and .m3u8, always read and written as UTF-8
+    PLFILE_PLS,
+    PLFILE_XSPF
+} PlFileFormat;
+
+PlFileFormat plfile_format(const char *path);
+
+// Absolute directory of a playlist file, which relative entries are taken
+// from. Returns false if it doesn't exist or doesn't fit.
+bool plfile_dir(const char *path, char *buf, size_t size);
+
+typedef struct {
+    const char *path;        // absolute, without "." or ".." segments
+    size_t dir_len;          // path[0, dir_len) is its directory; "/" is kept
+    const char *name;        // last segment of path
+    const char *title;       // "" if the playlist doesn't give one
+    uint32_t duration_ms;    // 0 if unknown
+} PlFileEntry;
+
+// Called for each entry in order. Return false to stop reading.
+typedef bool (*PlFileEntryFn)(void *user, const PlFileEntry *entry);
+
+// Read the local files a playlist lists; URLs other than file:// are
+// skipped, as are paths that don't fit in PLFILE_PATH_MAX. Returns false
+// if the file can't be read or has an unknown extension, memory runs out,
+// or fn stopped it.
+bool plfile_read(const char *path, PlFileEntryFn fn, void *user);
+
+// Writes a playlist file next to its destination and renames it into
+// place on plfile_writer_close(), so a failed write leaves the old one.
+// Paths below the playlist's directory are written relative to it.
+typedef struct {
+    FILE *file;
+    PlFileFormat format;
+    char path[PLFILE_PATH_MAX];
+    char tmp[PLFILE_PATH_MAX + 8];
+    char base[PLFILE_PATH_MAX];   // directory of path
+    size_t base_len;
+    char cwd[PLFILE_PATH_MAX];    // for relative directories passed in
+    uint32_t count;
+} PlFileWriter;
+
+// Returns false if the extension is unknown or the file can't be created.
+bool plfile_writer_open(PlFileWriter *w, const char *path);
+
+// Add the file name in directory dir; artist and title may be "".
+void plfile_writer_add(PlFileWriter *w, const char *dir, const char *name, const char *artist,
+                       const char *title, uint32_t duration_ms);
+
+// Finish the file and rename it into place. Returns false if anything
+// failed to be written; the destination is untouched then.
+bool plfile_writer_close(PlFileWriter *w);
+
+#endif
@@ -0,0 +1,331 @@
+#define _DEFAULT_SOURCE
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    PoolJobFn fn;
+    void *arg;
+    PoolToken token;
+    uint64_t submit_ns;
+} PoolJob;
+
+// Ring buffer of jobs. The owning worker takes from the back (newest) for
+// bulk work so recursive jobs run depth-first, and from the front (oldest)
+// for interactive work so requests are served in order. Thieves always take
+// from the front.
+typedef struct {
+    PoolJob *items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} JobQueue;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    JobQueue queues[POOL_LANE_COUNT];
+} PoolWorker;
+
+typedef struct {
+    int depth;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t cancelled;
+    uint64_t stolen;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t run_ns;
+} LaneCounters;
+
+static struct {
+    bool running;
+    bool stopping;
+    int thread_count;
+    PoolWorker workers[POOL_MAX_THREADS];
+    unsigned int next_worker;  // round-robin target for external submits
+
+    // Idle workers sleep here until pending > 0
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int pending;
+
+    LaneCounters lanes[POOL_LANE_COUNT];  // updated with __atomic builtins
+} pool;
+
+static __thread int current_worker = -1;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool queue_push(JobQueue *q, const PoolJob *job) {
+    if (q->count == q->capacity) {
+        size_t cap = q->capacity ? q->capacity * 2 : 64;
+        PoolJob *items = malloc(cap * sizeof(PoolJob));
+        if (!items) return false;
+        for (size_t i = 0; i < q->count; i++) {
+            items[i] = q->items[(q->head + i) % q->capacity];
+        }
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->capacity = cap;
+    }
+    q->items[(q->head + q->count) % q->capacity] = *job;
+    q->count++;
+    return true;
+}
+
+static bool queue_pop_front(JobQueue *q, PoolJob *out) {
+    if (q->count == 0) return false;
+    *out = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    return true;
+}
+
+static bool queue_pop_back(JobQueue *q, PoolJob *out) {
+    if (q->count == 0) return false;
+    *out = q->items[(q->head + q->count - 1) % q->capacity];
+    q->count--;
+    return true;
+}
+
+static bool take_own(int self, PoolLane lane, PoolJob *out) {
+    PoolWorker *w = &pool.workers[self];
+    pthread_mutex_lock(&w->lock);
+    bool got = lane == POOL_LANE_BULK ? queue_pop_back(&w->queues[lane], out)
+                                      : queue_pop_front(&w->queues[lane], out);
+    pthread_mutex_unlock(&w->lock);
+    return got;
+}
+
+static bool steal(int self, PoolLane lane, PoolJob *out) {
+    for (int i = 1; i < pool.thread_count; i++) {
+        PoolWorker *victim = &pool.workers[(self + i) % pool.thread_count];
+        pthread_mutex_lock(&victim->lock);
+        bool got = queue_pop_front(&victim->queues[lane], out);
+        pthread_mutex_unlock(&victim->lock);
+        if (got) {
+            __atomic_fetch_add(&pool.lanes[lane].stolen, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool find_job(int self, PoolJob *out, PoolLane *lane) {
+    for (int l = 0; l < POOL_LANE_COUNT; l++) {
+        if (take_own(self, (PoolLane)l, out) || steal(self, (PoolLane)l, out)) {
+            *lane = (PoolLane)l;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_job(const PoolJob *job, PoolLane lane) {
+    LaneCounters *c = &pool.lanes[lane];
+    uint64_t start = now_ns();
+    uint64_t wait = start - job->submit_ns;
+
+    __atomic_fetch_sub(&c->depth, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->wait_ns, wait, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&c->max_wait_ns, __ATOMIC_RELAXED);
+    while (wait > max &&
+           !__atomic_compare_exchange_n(&c->max_wait_ns, &max, wait, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    if (pool_cancelled(&job->token)) {
+        __atomic_fetch_add(&c->cancelled, 1, __ATOMIC_RELAXED);
+    }
+
+    job->fn(job->arg, &job->token);
+
+    __atomic_fetch_add(&c->run_ns, now_ns() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->completed, 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_main(void *arg) {
+    int self = (int)(intptr_t)arg;
+    current_worker = self;
+
+    for (;;) {
+        PoolJob job;
+        PoolLane lane;
+        if (find_job(self, &job, &lane)) {
+            pthread_mutex_lock(&pool.idle_lock);
+            pool.pending--;
+            pthread_mutex_unlock(&pool.idle_lock);
+            run_job(&job, lane);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.idle_lock);
+        while (pool.pending <= 0 && !pool.stopping) {
+            pthread_cond_wait(&pool.idle_cond, &pool.idle_lock);
+        }
+        bool done = pool.stopping;
+        pthread_mutex_unlock(&pool.idle_lock);
+        if (done) break;
+    }
+
+    return NULL;
+}
+
+bool pool_init(int threads) {
+    if (pool.running) return true;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.idle_lock, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+    pool.running = true;
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.workers[i].lock, NULL);
+    }
+    // Publish the final count before any worker can look for victims
+    pool.thread_count = threads;
+
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool.workers[i].thread, NULL, worker_main, (void *)(intptr_t)i) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    if (started < threads) {
+        fprintf(stderr, "Failed to start worker threads (%d of %d)\n", started, threads);
+        pthread_mutex_lock(&pool.idle_lock);
+        pool.stopping = true;
+        pthread_cond_broadcast(&pool.idle_cond);
+        pthread_mutex_unlock(&pool.idle_lock);
+        for (int i = 0; i < started; i++) {
+            pthread_join(pool.workers[i].thread, NULL);
+        }
+        pool.running = false;
+        return false;
+    }
+
+    return true;
+}
+
+void pool_shutdown(void) {
+    if (!pool.running) return;
+
+    pthread_mutex_lock(&pool.idle_lock);
+    __atomic_store_n(&pool.stopping, true, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&pool.idle_cond);
+    pthread_mutex_unlock(&pool.idle_lock);
+
+    for (int i = 0; i < pool.thread_count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    // Let whatever was still queued release its resources
+    for (int i = 0; i < pool.thread_count; i++) {
+        PoolWorker *w = &pool.workers[i];
+        for (int l = 0; l < POOL_LANE_COUNT; l++) {
+            PoolJob job;
+            while (queue_pop_front(&w->queues[l], &job)) {
+                run_job(&job, (PoolLane)l);
+            }
+            free(w->queues[l].items);
+        }
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    pthread_cond_destroy(&pool.idle_cond);
+    pthread_mutex_destroy(&pool.idle_lock);
+    pool.running = false;
+    pool.thread_count = 0;
+}
+
+int pool_thread_count(void) {
+    return pool.running ? pool.thread_count : 0;
+}
+
+bool pool_submit(PoolLane lane, PoolGroup *group, PoolJobFn fn, void *arg) {
+    if (!pool.running || __atomic_load_n(&pool.stopping, __ATOMIC_RELAXED)) return false;
+
+    PoolJob job;
+    job.fn = fn;
+    job.arg = arg;
+    job.token.group = group;
+    job.token.generation = group ? __atomic_load_n(&group->generation, __ATOMIC_ACQUIRE) : 0;
+    job.submit_ns = now_ns();
+
+    // Jobs spawned by a worker stay local; others are spread round-robin
+    int target = current_worker;
+    if (target < 0) {
+        target = (int)(__atomic_fetch_add(&pool.next_worker, 1, __ATOMIC_RELAXED) %
+                       (unsigned int)pool.thread_count);
+    }
+
+    // Count the job before it becomes visible: a worker may take and finish
+    // it before queue_push() returns, and pending must not go below zero
+    __atomic_fetch_add(&pool.lanes[lane].depth, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool.idle_lock);
+    pool.pending++;
+    pthread_mutex_unlock(&pool.idle_lock);
+
+    PoolWorker *w = &pool.workers[target];
+    pthread_mutex_lock(&w->lock);
+    bool ok = queue_push(&w->queues[lane], &job);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&pool.idle_lock);
+    if (ok) {
+        pthread_cond_signal(&pool.idle_cond);
+    } else {
+        pool.pending--;
+    }
+    pthread_mutex_unlock(&pool.idle_lock);
+    if (!ok) {
+        __atomic_fetch_sub(&pool.lanes[lane].depth, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    __atomic_fetch_add(&pool.lanes[lane].submitted, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void pool_group_cancel(PoolGroup *group) {
+    __atomic_fetch_add(&group->generation, 1, __ATOMIC_RELEASE);
+}
+
+bool pool_cancelled(const PoolToken *token) {
+    if (__atomic_load_n(&pool.stopping, __ATOMIC_RELAXED)) return true;
+    if (!token->group) return false;
+    return __atomic_load_n(&token->group->generation, __ATOMIC_ACQUIRE) != token->generation;
+}
+
+void pool_get_stats(PoolLane lane, PoolLaneStats *stats) {
+    const LaneCounters *c = &pool.lanes[lane];
+    uint64_t completed = __atomic_load_n(&c->completed, __ATOMIC_RELAXED);
+
+    stats->depth = __atomic_load_n(&c->depth, __ATOMIC_RELAXED);
+    stats->submitted = __atomic_load_n(&c->submitted, __ATOMIC_RELAXED);
+    stats->completed = completed;
+    stats->cancelled = __atomic_load_n(&c->cancelled, __ATOMIC_RELAXED);
+    stats->stolen = __atomic_load_n(&c->stolen, __ATOMIC_RELAXED);
+    stats->max_wait_ms = (double)__atomic_load_n(&c->max_wait_ns, __ATOMIC_RELAXED) / 1e6;
+    stats->avg_wait_ms = completed ? (double)__atomic_load_n(&c->wait_ns, __ATOMIC_RELAXED) / 1e6 / (double)completed : 0.0;
+    stats->avg_run_ms = completed ? (double)__atomic_load_n(&c->run_ns, __ATOMIC_RELAXED) / 1e6 / (double)completed : 0.0;
+}
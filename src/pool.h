@@ -0,0 +1,68 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define POOL_MAX_THREADS 32
+
+// Priority lanes. Workers drain the interactive lane (across all workers)
+// before touching bulk work.
+typedef enum {
+    POOL_LANE_INTERACTIVE,  // visible rows, next track: latency matters
+    POOL_LANE_BULK,         // library-wide scans and analysis
+    POOL_LANE_COUNT
+} PoolLane;
+
+// A set of jobs that can be cancelled together. Zero-initialize before use.
+typedef struct {
+    unsigned int generation;
+} PoolGroup;
+
+// Identifies the group generation a job was submitted under.
+typedef struct {
+    const PoolGroup *group;
+    unsigned int generation;
+} PoolToken;
+
+// Job function. Cancelled jobs are still called (so they can release arg),
+// but pool_cancelled(token) is already true; long-running jobs should also
+// poll it and return early.
+typedef void (*PoolJobFn)(void *arg, const PoolToken *token);
+
+typedef struct {
+    int depth;               // jobs currently queued
+    uint64_t submitted;
+    uint64_t completed;      // includes cancelled jobs
+    uint64_t cancelled;      // cancelled before they started
+    uint64_t stolen;         // taken from another worker's queue
+    double avg_wait_ms;      // queue latency, submit to start
+    double max_wait_ms;
+    double avg_run_ms;
+} PoolLaneStats;
+
+// Start the pool. threads <= 0 uses the number of online CPUs.
+bool pool_init(int threads);
+
+// Stop all workers. Queued jobs are run as cancelled so they can clean up.
+void pool_shutdown(void);
+
+// Number of worker threads (0 if the pool is not running).
+int pool_thread_count(void);
+
+// Queue a job. group may be NULL for jobs that are never cancelled.
+// Returns false if the pool is not running or out of memory.
+bool pool_submit(PoolLane lane, PoolGroup *group, PoolJobFn fn, void *arg);
+
+// Cancel every job submitted to group so far. Jobs submitted afterwards
+// are unaffected.
+void pool_group_cancel(PoolGroup *group);
+
+// True if the job's group was cancelled after it was submitted, or the
+// pool is shutting down.
+bool pool_cancelled(const PoolToken *token);
+
+// Snapshot of per-lane queue depth and latency statistics.
+void pool_get_stats(PoolLane lane, PoolLaneStats *stats);
+
+#endif
@@ -0,0 +1,126 @@
+#define _DEFAULT_SOURCE
+
+#include "render.h"
+
+#include <GL/gl.h>
+#include <rlgl.h>
+#include <stdio.h>
+#include <string.h>
+
+// Weight of the newest sample in the smoothed timings
+#define SMOOTHING 0.1
+
+static struct {
+    double frame_start;
+    double cpu_ms;
+    double gpu_ms;
+    unsigned long frames;
+    unsigned long layer_redraws;
+} frame;
+
+bool render_layer_init(RenderLayer *layer, Rectangle bounds) {
+    memset(layer, 0, sizeof(*layer));
+    layer->target = LoadRenderTexture((int)bounds.width, (int)bounds.height);
+    if (layer->target.id == 0) {
+        fprintf(stderr, "Failed to create render texture\n");
+        return false;
+    }
+    layer->bounds = bounds;
+    layer->dirty = true;
+    return true;
+}
+
+void render_layer_free(RenderLayer *layer) {
+    if (layer->target.id != 0) {
+        UnloadRenderTexture(layer->target);
+    }
+    memset(layer, 0, sizeof(*layer));
+}
+
+bool render_layer_begin(RenderLayer *layer) {
+    if (!layer->dirty) return false;
+
+    BeginTextureMode(layer->target);
+    // Shift window coordinates so callers don't need to know the layer origin
+    Camera2D camera = { { 0, 0 }, { layer->bounds.x, layer->bounds.y }, 0.0f, 1.0f };
+    BeginMode2D(camera);
+    return true;
+}
+
+void render_layer_end(RenderLayer *layer) {
+    EndMode2D();
+    EndTextureMode();
+    layer->dirty = false;
+    layer->redraws++;
+    frame.layer_redraws++;
+}
+
+void render_layer_clip(const RenderLayer *layer, int x, int y, int width, int height) {
+    // The scissor rectangle is in the target's pixels; the camera doesn't apply
+    BeginScissorMode(x - (int)layer->bounds.x, y - (int)layer->bounds.y, width, height);
+}
+
+void render_layer_unclip(void) {
+    EndScissorMode();
+}
+
+void render_layer_draw(const RenderLayer *layer) {
+    // Render textures are stored bottom-up
+    Rectangle source = { 0, 0, layer->bounds.width, -layer->bounds.height };
+    Vector2 position = { layer->bounds.x, layer->bounds.y };
+    DrawTextureRec(layer->target.texture, source, position, WHITE);
+}
+
+void render_frame_begin(void) {
+    frame.frame_start = GetTime();
+}
+
+void render_frame_end(bool measure_gpu) {
+    double now = GetTime();
+    double cpu_ms = (now - frame.frame_start) * 1000.0;
+    frame.cpu_ms = frame.frames ? frame.cpu_ms + (cpu_ms - frame.cpu_ms) * SMOOTHING : cpu_ms;
+
+    if (measure_gpu) {
+        // Submit what raylib has batched and wait for it. Without timer
+        // queries in rlgl this is the closest we get to the frame's GPU cost.
+        rlDrawRenderBatchActive();
+        double start = GetTime();
+        glFinish();
+        double gpu_ms = (GetTime() - start) * 1000.0;
+        frame.gpu_ms = frame.gpu_ms > 0 ? frame.gpu_ms + (gpu_ms - frame.gpu_ms) * SMOOTHING : gpu_ms;
+    }
+
+    frame.frames++;
+}
+
+void render_get_stats(RenderStats *stats) {
+    stats->cpu_ms = frame.cpu_ms;
+    stats->gpu_ms = frame.gpu_ms;
+    stats->fps = GetFPS();
+    stats->frames = frame.frames;
+    stats->layer_redraws = frame.layer_redraws;
+}
+
+void render_draw_overlay(RenderTextFn draw_text, int line_height,
+                         const char *const *extra, int extra_count) {
+    RenderStats stats;
+    render_get_stats(&stats);
+
+    char lines[3][64];
+    snprintf(lines[0], sizeof(lines[0]), "cpu %.2f ms", stats.cpu_ms);
+    snprintf(lines[1], sizeof(lines[1]), "gpu %.2f ms", stats.gpu_ms);
+    snprintf(lines[2], sizeof(lines[2]), "%d fps, %lu redraws", stats.fps, stats.layer_redraws);
+
+    int count = 3 + extra_count;
+    int width = 300;
+    int height = line_height * count + 8;
+    int x = GetScreenWidth() - width - 4;
+    int y = 4;
+    Color color = { 0xd0, 0xd0, 0x60, 0xff };
+
+    DrawRectangle(x, y, width, height, (Color){ 0, 0, 0, 0xc0 });
+    for (int i = 0; i < count; i++) {
+        Vector2 pos = { (float)x + 6, (float)(y + 4 + i * line_height) };
+        draw_text(i < 3 ? lines[i] : extra[i - 3], pos, color);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <raylib.h>
+#include <stdbool.h>
+
+// A part of the window that changes rarely, kept in an offscreen texture.
+// It is only redrawn when marked dirty; every frame just composites it.
+typedef struct {
+    RenderTexture2D target;
+    Rectangle bounds;       // position and size in the window
+    bool dirty;
+    unsigned long redraws;
+} RenderLayer;
+
+// Per-frame timing, smoothed over recent frames
+typedef struct {
+    double cpu_ms;          // frame start until the buffer swap is requested
+    double gpu_ms;          // waiting for the GPU to drain the frame (overlay only)
+    int fps;
+    unsigned long frames;
+    unsigned long layer_redraws;
+} RenderStats;
+
+// Create a layer covering bounds. Starts dirty.
+bool render_layer_init(RenderLayer *layer, Rectangle bounds);
+void render_layer_free(RenderLayer *layer);
+
+// If the layer is dirty, start drawing into it and return true. Draw in
+// window coordinates, then call render_layer_end().
+bool render_layer_begin(RenderLayer *layer);
+void render_layer_end(RenderLayer *layer);
+
+// Between render_layer_begin() and render_layer_end(), limit drawing to a
+// rectangle given in window coordinates, until render_layer_unclip().
+void render_layer_clip(const RenderLayer *layer, int x, int y, int width, int height);
+void render_layer_unclip(void);
+
+// Composite the layer into the current frame.
+void render_layer_draw(const RenderLayer *layer);
+
+// Bracket the work for one frame. Call render_frame_end() right before
+// EndDrawing(). With measure_gpu it flushes and waits for the GPU, which
+// stalls the pipeline, so only do that while the overlay is visible.
+void render_frame_begin(void);
+void render_frame_end(bool measure_gpu);
+
+void render_get_stats(RenderStats *stats);
+
+// Draws one line of overlay text
+typedef void (*RenderTextFn)(const char *text, Vector2 pos, Color color);
+
+// Frame timing box in the top-right corner, followed by extra lines
+// supplied by the caller.
+void render_draw_overlay(RenderTextFn draw_text, int line_height,
+                         const char *const *extra, int extra_count);
+
+#endif
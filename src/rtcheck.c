@@ -0,0 +1,187 @@
+// Only built with `make RT_DEBUG=1`; see rtcheck.h.
+#define _GNU_SOURCE
+
+#include "rtcheck.h"
+#include "rtlog.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc's underlying allocator entry points; calling these avoids the
+// dlsym() bootstrap problem for malloc itself.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread int rt_depth;
+static unsigned long violations;
+static int abort_on_violation;
+
+__attribute__((constructor))
+static void rtcheck_setup(void) {
+    const char *env = getenv("OSCYL_RT_ABORT");
+    abort_on_violation = env && env[0] == '1';
+}
+
+void rtcheck_enter(void) {
+    rt_depth++;
+}
+
+void rtcheck_leave(void) {
+    rt_depth--;
+}
+
+unsigned long rtcheck_violations(void) {
+    return __atomic_load_n(&violations, __ATOMIC_RELAXED);
+}
+
+static void violation(const char *what) {
+    __atomic_fetch_add(&violations, 1, __ATOMIC_RELAXED);
+    rtlog_post("RT violation on audio thread: ", what);
+    if (abort_on_violation) {
+        abort();
+    }
+}
+
+#define CHECK(name) do { if (rt_depth > 0) violation(name); } while (0)
+
+// Look up the next definition of a libc symbol (the one we are shadowing)
+#define REAL(fn) \
+    static __typeof__(fn) *real_##fn; \
+    if (!real_##fn) *(void **)(&real_##fn) = dlsym(RTLD_NEXT, #fn)
+
+// Allocation
+
+void *malloc(size_t size) {
+    CHECK("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    CHECK("calloc");
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    CHECK("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr) CHECK("free");
+    __libc_free(ptr);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    CHECK("posix_memalign");
+    void *p = __libc_memalign(alignment, size);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    CHECK("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+// Blocking calls and syscalls commonly reached from decoders
+
+int open(const char *path, int flags, ...) {
+    REAL(open);
+    CHECK("open");
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t)va_arg(ap, int);
+        va_end(ap);
+    }
+    return real_open(path, flags, mode);
+}
+
+int close(int fd) {
+    REAL(close);
+    CHECK("close");
+    return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    REAL(read);
+    CHECK("read");
+    return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    REAL(write);
+    CHECK("write");
+    return real_write(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    REAL(pread);
+    CHECK("pread");
+    return real_pread(fd, buf, count, offset);
+}
+
+FILE *fopen(const char *path, const char *mode) {
+    REAL(fopen);
+    CHECK("fopen");
+    return real_fopen(path, mode);
+}
+
+size_t fread(void *ptr, size_t size, size_t count, FILE *stream) {
+    REAL(fread);
+    CHECK("fread");
+    return real_fread(ptr, size, count, stream);
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream) {
+    REAL(fwrite);
+    CHECK("fwrite");
+    return real_fwrite(ptr, size, count, stream);
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+    CHECK("fprintf");
+    va_list ap;
+    va_start(ap, format);
+    int n = vfprintf(stream, format, ap);
+    va_end(ap);
+    return n;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    REAL(nanosleep);
+    CHECK("nanosleep");
+    return real_nanosleep(req, rem);
+}
+
+int usleep(useconds_t usec) {
+    REAL(usleep);
+    CHECK("usleep");
+    return real_usleep(usec);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    REAL(pthread_mutex_lock);
+    CHECK("pthread_mutex_lock");
+    return real_pthread_mutex_lock(mutex);
+}
+
+int sem_wait(sem_t *sem) {
+    REAL(sem_wait);
+    CHECK("sem_wait");
+    return real_sem_wait(sem);
+}
@@ -0,0 +1,25 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+// Debug trap for work that is not real-time safe. Build with `make
+// RT_DEBUG=1` to interpose malloc and friends plus common blocking libc
+// calls; any of them made between rtcheck_enter() and rtcheck_leave() on the
+// same thread is counted and reported through rtlog. Set OSCYL_RT_ABORT=1
+// to abort() on the first violation instead, e.g. in soak tests.
+// In normal builds these compile to nothing.
+
+#ifdef OSCYL_RT_DEBUG
+
+void rtcheck_enter(void);
+void rtcheck_leave(void);
+unsigned long rtcheck_violations(void);
+
+#else
+
+#define rtcheck_enter() ((void)0)
+#define rtcheck_leave() ((void)0)
+#define rtcheck_violations() 0UL
+
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#include "rtlog.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded multi-producer queue: each cell carries a sequence number that
+// tells producers and the consumer whose turn it is, so no locks are needed.
+typedef struct {
+    size_t seq;
+    const char *msg;
+    const char *detail;
+} LogCell;
+
+static LogCell cells[RTLOG_CAPACITY];
+static size_t enqueue_pos;
+static size_t dequeue_pos;  // consumer only
+static unsigned long dropped;
+static unsigned long dropped_reported;  // consumer only
+
+void rtlog_init(void) {
+    for (size_t i = 0; i < RTLOG_CAPACITY; i++) {
+        __atomic_store_n(&cells[i].seq, i, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&enqueue_pos, 0, __ATOMIC_RELAXED);
+    dequeue_pos = 0;
+    __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+    dropped_reported = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+bool rtlog_post(const char *msg, const char *detail) {
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    LogCell *cell;
+
+    for (;;) {
+        cell = &cells[pos & (RTLOG_CAPACITY - 1)];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->msg = msg;
+    cell->detail = detail;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int rtlog_drain(FILE *out) {
+    int written = 0;
+
+    for (;;) {
+        LogCell *cell = &cells[dequeue_pos & (RTLOG_CAPACITY - 1)];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq != dequeue_pos + 1) break;
+
+        fprintf(out, "%s%s\n", cell->msg, cell->detail ? cell->detail : "");
+        __atomic_store_n(&cell->seq, dequeue_pos + RTLOG_CAPACITY, __ATOMIC_RELEASE);
+        dequeue_pos++;
+        written++;
+    }
+
+    unsigned long lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != dropped_reported) {
+        fprintf(out, "(%lu log messages dropped)\n", lost - dropped_reported);
+        dropped_reported = lost;
+    }
+
+    return written;
+}
@@ -0,0 +1,24 @@
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Lock-free log for real-time threads. Posting never blocks, allocates or
+// formats; messages are written out later by rtlog_drain() on a normal
+// thread. Any number of threads may post; only one may drain.
+
+#define RTLOG_CAPACITY 256  // must be a power of two
+
+// Reset the log. Call once before any thread posts.
+void rtlog_init(void);
+
+// Queue a message. Both strings must have static lifetime (string literals,
+// library status tables); detail may be NULL. Returns false and counts a
+// drop if the log is full.
+bool rtlog_post(const char *msg, const char *detail);
+
+// Write queued messages to out. Returns the number written.
+int rtlog_drain(FILE *out);
+
+#endif
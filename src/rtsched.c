@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+
+#include "rtsched.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+typedef struct {
+    RtSchedThreadConfig config;
+    bool configured;
+
+    // Outcome of the last rtsched_apply()
+    bool applied;
+    int policy;               // effective SCHED_* policy
+    int priority;
+    bool lowered;             // priority clamped to RLIMIT_RTPRIO
+    const char *sched_error;  // static reason, NULL on success
+    const char *affinity_error;
+} ThreadState;
+
+static ThreadState threads[RTSCHED_THREAD_COUNT];
+
+static const char *thread_names[RTSCHED_THREAD_COUNT] = {
+    "callback", "decode", "ui"
+};
+
+static const char *error_reason(int err) {
+    switch (err) {
+        case EPERM:  return "not permitted (needs CAP_SYS_NICE or an rtprio limit)";
+        case EINVAL: return "invalid setting";
+        case ESRCH:  return "thread not found";
+        default:     return "failed";
+    }
+}
+
+static const char *policy_name(int policy) {
+    switch (policy) {
+        case SCHED_FIFO: return "SCHED_FIFO";
+        case SCHED_RR:   return "SCHED_RR";
+        default:         return "SCHED_OTHER";
+    }
+}
+
+void rtsched_configure(RtSchedThread which, const RtSchedThreadConfig *config) {
+    threads[which].config = *config;
+    threads[which].configured = config->policy != RTSCHED_POLICY_DEFAULT || config->cpus != 0;
+}
+
+bool rtsched_configured(RtSchedThread which) {
+    return threads[which].configured;
+}
+
+bool rtsched_parse_policy(const char *text, RtSchedPolicy *policy) {
+    if (strcmp(text, "fifo") == 0) *policy = RTSCHED_POLICY_FIFO;
+    else if (strcmp(text, "rr") == 0) *policy = RTSCHED_POLICY_RR;
+    else if (strcmp(text, "other") == 0) *policy = RTSCHED_POLICY_DEFAULT;
+    else return false;
+    return true;
+}
+
+bool rtsched_parse_cpus(const char *text, uint64_t *mask) {
+    uint64_t result = 0;
+    const char *p = text;
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first > 63) return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last > 63) return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            result |= 1ULL << cpu;
+        }
+        if (*p == ',') p++;
+        else if (*p) return false;
+    }
+
+    if (result == 0) return false;
+    *mask = result;
+    return true;
+}
+
+bool rtsched_apply(RtSchedThread which, pthread_t thread) {
+    ThreadState *t = &threads[which];
+    t->applied = true;
+    t->lowered = false;
+    t->sched_error = NULL;
+    t->affinity_error = NULL;
+
+    struct sched_param param;
+    int policy;
+    if (pthread_getschedparam(thread, &policy, &param) == 0) {
+        t->policy = policy;
+        t->priority = param.sched_priority;
+    }
+
+    if (!t->configured) return true;
+
+    bool ok = true;
+
+    if (t->config.cpus != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if (t->config.cpus & (1ULL << cpu)) CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err != 0) {
+            t->affinity_error = error_reason(err);
+            ok = false;
+        }
+    }
+
+    if (t->config.policy != RTSCHED_POLICY_DEFAULT) {
+        policy = t->config.policy == RTSCHED_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+        int priority = t->config.priority;
+        int min = sched_get_priority_min(policy);
+        int max = sched_get_priority_max(policy);
+        if (priority < min) priority = min;
+        if (priority > max) priority = max;
+
+        param.sched_priority = priority;
+        int err = pthread_setschedparam(thread, policy, &param);
+
+        if (err == EPERM) {
+            // Unprivileged users may still get real-time up to RLIMIT_RTPRIO
+            struct rlimit limit;
+            if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+                (int)limit.rlim_cur >= min && (int)limit.rlim_cur < priority) {
+                param.sched_priority = (int)limit.rlim_cur;
+                err = pthread_setschedparam(thread, policy, &param);
+                t->lowered = err == 0;
+            }
+        }
+
+        if (err == 0) {
+            t->policy = policy;
+            t->priority = param.sched_priority;
+            if (t->lowered) ok = false;
+        } else {
+            t->sched_error = error_reason(err);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+const char *rtsched_error(RtSchedThread which) {
+    const ThreadState *t = &threads[which];
+    if (t->sched_error) return t->sched_error;
+    if (t->affinity_error) return t->affinity_error;
+    if (t->lowered) return "priority lowered to the rtprio limit";
+    return NULL;
+}
+
+const char *rtsched_describe(RtSchedThread which) {
+    static char buffers[RTSCHED_THREAD_COUNT][160];
+    const ThreadState *t = &threads[which];
+    char *buf = buffers[which];
+    size_t size = sizeof(buffers[which]);
+
+    if (!t->applied) {
+        snprintf(buf, size, "pending");
+        return buf;
+    }
+
+    int n;
+    if (t->policy == SCHED_FIFO || t->policy == SCHED_RR) {
+        n = snprintf(buf, size, "%s/%d", policy_name(t->policy), t->priority);
+    } else {
+        n = snprintf(buf, size, "%s", policy_name(t->policy));
+    }
+    if (t->lowered && n > 0 && (size_t)n < size) {
+        n += snprintf(buf + n, size - (size_t)n, " (lowered to rtprio limit, asked %d)",
+                      t->config.priority);
+    }
+    if (t->sched_error && n > 0 && (size_t)n < size) {
+        n += snprintf(buf + n, size - (size_t)n, " (%s denied: %s)",
+                      t->config.policy == RTSCHED_POLICY_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+                      t->sched_error);
+    }
+    if (t->config.cpus != 0 && n > 0 && (size_t)n < size) {
+        if (t->affinity_error) {
+            snprintf(buf + n, size - (size_t)n, ", cpus 0x%llx denied: %s",
+                     (unsigned long long)t->config.cpus, t->affinity_error);
+        } else {
+            snprintf(buf + n, size - (size_t)n, ", cpus 0x%llx",
+                     (unsigned long long)t->config.cpus);
+        }
+    }
+    return buf;
+}
+
+void rtsched_report(FILE *out) {
+    for (int i = 0; i < RTSCHED_THREAD_COUNT; i++) {
+        if (!threads[i].configured) continue;
+        if (!threads[i].applied) {
+            fprintf(out, "Scheduling: %s thread: applied when playback starts\n", thread_names[i]);
+        } else {
+            fprintf(out, "Scheduling: %s thread: %s\n", thread_names[i], rtsched_describe((RtSchedThread)i));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Threads whose scheduling can be configured
+typedef enum {
+    RTSCHED_THREAD_CALLBACK,  // miniaudio device thread running audio_callback()
+    RTSCHED_THREAD_DECODE,    // audio.c decode thread
+    RTSCHED_THREAD_UI,        // main/render thread
+    RTSCHED_THREAD_COUNT
+} RtSchedThread;
+
+typedef enum {
+    RTSCHED_POLICY_DEFAULT,   // leave the thread as created (SCHED_OTHER)
+    RTSCHED_POLICY_FIFO,
+    RTSCHED_POLICY_RR
+} RtSchedPolicy;
+
+typedef struct {
+    RtSchedPolicy policy;
+    int priority;       // 1-99, used with FIFO/RR
+    uint64_t cpus;      // affinity mask, bit n = CPU n; 0 leaves it unchanged
+} RtSchedThreadConfig;
+
+// Default real-time priorities when only a policy is given. The decoder sits
+// below the callback so it can never starve it.
+#define RTSCHED_DEFAULT_CALLBACK_PRIORITY 70
+#define RTSCHED_DEFAULT_DECODE_PRIORITY 60
+
+// Set the configuration used by later rtsched_apply() calls.
+void rtsched_configure(RtSchedThread which, const RtSchedThreadConfig *config);
+
+// Parse "fifo", "rr" or "other".
+bool rtsched_parse_policy(const char *text, RtSchedPolicy *policy);
+
+// Parse a CPU list such as "0,2-3" into a mask (CPUs 0-63).
+bool rtsched_parse_cpus(const char *text, uint64_t *mask);
+
+// Apply the configured policy and affinity to a thread. If the real-time
+// policy is refused, the priority is lowered to RLIMIT_RTPRIO when that
+// allows it, otherwise the thread keeps its normal policy. Never fails
+// hard; the outcome is recorded for rtsched_report(). Returns true if
+// everything requested was applied. Does no stdio, so it may be called
+// from the audio thread.
+bool rtsched_apply(RtSchedThread which, pthread_t thread);
+
+// True if anything was configured for this thread.
+bool rtsched_configured(RtSchedThread which);
+
+// Static reason the last rtsched_apply() fell short, or NULL.
+const char *rtsched_error(RtSchedThread which);
+
+// One-line outcome for a thread, e.g. "SCHED_FIFO/70, cpus 0x4". Static
+// storage; valid until the next rtsched_apply() for that thread.
+const char *rtsched_describe(RtSchedThread which);
+
+// Print the requested and effective settings for every configured thread.
+void rtsched_report(FILE *out);
+
+#endif
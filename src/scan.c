@@ -0,0 +1,455 @@
+#define _DEFAULT_SOURCE
+
+#include "scan.h"
+#include "natsort.h"
+#include "pool.h"
+#include "strarena.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// getdents64() returns as many entries as fit, so one call usually covers
+// a whole album directory; readdir() would use 32 KB
+#define SCAN_BUFFER_SIZE (64 * 1024)
+
+// Record layout of getdents64(), which glibc doesn't declare before 2.30
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct Scan {
+    int root_fd;    // directories are opened relative to this
+    bool (*accept)(const char *name);
+    bool locale_sort;
+    LibIndex index; // previous scan; index.map is NULL if there is none
+    PoolGroup group;
+    int refs;       // the owner plus every queued or running directory job
+
+    pthread_mutex_t lock;   // guards the batch list
+    ScanBatch *head;
+    ScanBatch *tail;
+
+    uint64_t dirs;          // counters updated with __atomic builtins
+    uint64_t reused;
+    uint64_t files;
+    uint64_t errors;
+
+    uint64_t start_ns;
+    double done_ms;         // owner only; set when it first sees the end
+};
+
+typedef struct {
+    Scan *scan;
+    char path[];    // relative to the root
+} DirJob;
+
+// Files collected from one directory before they become a batch
+typedef struct {
+    StrArena strings;
+    uint32_t *offsets;
+    ScanFile *files;
+    uint32_t count;
+    uint32_t capacity;
+} NameList;
+
+// Hash of the indexed file names of a directory that is being read again,
+// so files that didn't change keep what is known about them
+typedef struct {
+    const LibIndex *index;
+    uint32_t *slots;    // track indices, LIBINDEX_NONE if empty
+    uint32_t mask;
+} OldFiles;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static uint32_t hash_name(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static void old_files_init(OldFiles *old, const LibIndex *index, uint32_t dir) {
+    memset(old, 0, sizeof(*old));
+    if (dir == LIBINDEX_NONE || index->dirs[dir].track_count == 0) return;
+
+    const LibIndexDir *d = &index->dirs[dir];
+    uint32_t size = 16;
+    while (size < d->track_count * 2) size *= 2;
+    old->slots = malloc(size * sizeof(uint32_t));
+    if (!old->slots) return;   // nothing is carried over then
+    memset(old->slots, 0xff, size * sizeof(uint32_t));
+    old->index = index;
+    old->mask = size - 1;
+
+    for (uint32_t t = d->first_track; t < d->first_track + d->track_count; t++) {
+        uint32_t slot = hash_name(libindex_string(index, index->tracks[t].name)) & old->mask;
+        while (old->slots[slot] != LIBINDEX_NONE) slot = (slot + 1) & old->mask;
+        old->slots[slot] = t;
+    }
+}
+
+static const LibIndexTrack *old_files_find(const OldFiles *old, const char *name) {
+    if (!old->slots) return NULL;
+    for (uint32_t slot = hash_name(name) & old->mask; old->slots[slot] != LIBINDEX_NONE;
+         slot = (slot + 1) & old->mask) {
+        const LibIndexTrack *track = &old->index->tracks[old->slots[slot]];
+        if (strcmp(libindex_string(old->index, track->name), name) == 0) return track;
+    }
+    return NULL;
+}
+
+// What the index knows about a file beyond its size and mtime
+static void indexed_details(const LibIndex *index, const LibIndexTrack *track, ScanFile *file) {
+    file->duration_ms = track->duration_ms;
+    file->tagged = (track->flags & LIBINDEX_TRACK_TAGGED) != 0;
+    file->artist = libindex_string(index, track->artist);
+    file->title = libindex_string(index, track->title);
+    file->album = libindex_string(index, track->album);
+}
+
+static void destroy(Scan *scan) {
+    ScanBatch *batch = scan->head;
+    while (batch) {
+        ScanBatch *next = batch->next;
+        free(batch);
+        batch = next;
+    }
+    close(scan->root_fd);
+    libindex_close(&scan->index);
+    pthread_mutex_destroy(&scan->lock);
+    free(scan);
+}
+
+static void unref(Scan *scan) {
+    if (__atomic_sub_fetch(&scan->refs, 1, __ATOMIC_ACQ_REL) == 0) destroy(scan);
+}
+
+static void count_error(Scan *scan) {
+    __atomic_fetch_add(&scan->errors, 1, __ATOMIC_RELAXED);
+}
+
+static void scan_dir_job(void *arg, const PoolToken *token);
+
+// Queue a job for the directory at path (relative to the root)
+static void submit_dir(Scan *scan, const char *parent, size_t parent_len, const char *name) {
+    size_t name_len = strlen(name);
+    DirJob *job = malloc(sizeof(DirJob) + parent_len + 1 + name_len + 1);
+    if (!job) {
+        count_error(scan);
+        return;
+    }
+
+    job->scan = scan;
+    char *p = job->path;
+    if (parent_len > 0) {
+        memcpy(p, parent, parent_len);
+        p += parent_len;
+        *p++ = '/';
+    }
+    memcpy(p, name, name_len + 1);
+
+    __atomic_fetch_add(&scan->refs, 1, __ATOMIC_RELAXED);
+    if (!pool_submit(POOL_LANE_BULK, &scan->group, scan_dir_job, job)) {
+        free(job);
+        count_error(scan);
+        unref(scan);
+    }
+}
+
+static bool add_name(NameList *list, const char *name, const ScanFile *file) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+        uint32_t *offsets = realloc(list->offsets, capacity * sizeof(uint32_t));
+        if (!offsets) return false;
+        list->offsets = offsets;
+        ScanFile *files = realloc(list->files, capacity * sizeof(ScanFile));
+        if (!files) return false;
+        list->files = files;
+        list->capacity = capacity;
+    }
+    if (!strarena_push(&list->strings, name, strlen(name), &list->offsets[list->count])) return false;
+    list->files[list->count] = *file;
+    list->count++;
+    return true;
+}
+
+static void free_names(NameList *list) {
+    strarena_free(&list->strings);
+    free(list->offsets);
+    free(list->files);
+}
+
+static size_t tag_size(const char *tag) {
+    return tag && tag[0] ? strlen(tag) + 1 : 0;
+}
+
+// Copy a tag string to *p and advance it; an absent tag becomes ""
+static const char *copy_tag(char **p, const char *tag) {
+    size_t size = tag_size(tag);
+    if (size == 0) return "";
+    char *copy = memcpy(*p, tag, size);
+    *p += size;
+    return copy;
+}
+
+// Copy the files, sorted unless they come from the index, and the
+// directory path into one block. Tags come from the index, which may be
+// closed before the batch is taken, so they are copied too.
+static ScanBatch *make_batch(const Scan *scan, const char *dir, int64_t mtime, bool reused,
+                             const NameList *list) {
+    size_t dir_size = strlen(dir) + 1;
+    size_t tags_size = 0;
+    for (uint32_t i = 0; i < list->count; i++) {
+        const ScanFile *file = &list->files[i];
+        tags_size += tag_size(file->artist) + tag_size(file->title) + tag_size(file->album);
+    }
+    size_t size = sizeof(ScanBatch) + list->count * (sizeof(ScanFile) + sizeof(char *)) +
+                  dir_size + list->strings.used + tags_size;
+    ScanBatch *batch = malloc(size);
+    uint32_t *order = malloc((list->count ? list->count : 1) * sizeof(uint32_t));
+    if (!batch || !order) {
+        free(batch);
+        free(order);
+        return NULL;
+    }
+
+    ScanFile *files = (ScanFile *)(batch + 1);
+    const char **names = (const char **)(files + list->count);
+    char *strings = (char *)(names + list->count);
+    for (uint32_t i = 0; i < list->count; i++) {
+        names[i] = strarena_get(&list->strings, list->offsets[i]);
+        order[i] = i;
+    }
+    if (!reused && list->count > 1) {
+        natsort_order(names, list->count, scan->locale_sort, order);
+    }
+
+    memcpy(strings, dir, dir_size);
+    if (list->count > 0) memcpy(strings + dir_size, list->strings.data, list->strings.used);
+    char *tags = strings + dir_size + list->strings.used;
+    for (uint32_t i = 0; i < list->count; i++) {
+        names[i] = strings + dir_size + list->offsets[order[i]];
+        files[i] = list->files[order[i]];
+        files[i].artist = copy_tag(&tags, files[i].artist);
+        files[i].title = copy_tag(&tags, files[i].title);
+        files[i].album = copy_tag(&tags, files[i].album);
+    }
+
+    batch->next = NULL;
+    batch->dir = strings;
+    batch->mtime_ns = mtime;
+    batch->reused = reused;
+    batch->count = list->count;
+    batch->names = names;
+    batch->files = files;
+    free(order);
+    return batch;
+}
+
+static void push_batch(Scan *scan, ScanBatch *batch) {
+    pthread_mutex_lock(&scan->lock);
+    if (scan->tail) scan->tail->next = batch;
+    else scan->head = batch;
+    scan->tail = batch;
+    pthread_mutex_unlock(&scan->lock);
+
+    __atomic_fetch_add(&scan->files, batch->count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&scan->dirs, 1, __ATOMIC_RELAXED);
+    if (batch->reused) __atomic_fetch_add(&scan->reused, 1, __ATOMIC_RELAXED);
+}
+
+// Directory unchanged since the index was written: repeat what it lists
+static void reuse_dir(Scan *scan, const char *path, uint32_t indexed) {
+    const LibIndex *index = &scan->index;
+    const LibIndexDir *dir = &index->dirs[indexed];
+
+    for (uint32_t c = dir->first_child; c != LIBINDEX_NONE; c = index->dirs[c].next_sibling) {
+        submit_dir(scan, "", 0, libindex_string(index, index->dirs[c].path));
+    }
+
+    NameList list = {0};
+    bool ok = true;
+    for (uint32_t t = dir->first_track; ok && t < dir->first_track + dir->track_count; t++) {
+        const LibIndexTrack *track = &index->tracks[t];
+        ScanFile file = { .size = track->size, .mtime_ns = track->mtime_ns };
+        indexed_details(index, track, &file);
+        ok = add_name(&list, libindex_string(index, track->name), &file);
+    }
+
+    ScanBatch *batch = ok ? make_batch(scan, path, dir->mtime_ns, true, &list) : NULL;
+    free_names(&list);
+    if (batch) push_batch(scan, batch);
+    else count_error(scan);
+}
+
+static void read_dir(Scan *scan, const char *path, const PoolToken *token) {
+    const char *rel = path[0] ? path : ".";
+
+    struct stat st;
+    if (fstatat(scan->root_fd, rel, &st, 0) != 0) {
+        count_error(scan);
+        return;
+    }
+    int64_t mtime = mtime_ns(&st);
+
+    uint32_t indexed = scan->index.map ? libindex_find_dir(&scan->index, path) : LIBINDEX_NONE;
+    if (indexed != LIBINDEX_NONE && scan->index.dirs[indexed].mtime_ns == mtime) {
+        reuse_dir(scan, path, indexed);
+        return;
+    }
+
+    int fd = openat(scan->root_fd, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    unsigned char *buf = fd >= 0 ? malloc(SCAN_BUFFER_SIZE) : NULL;
+    if (!buf) {
+        if (fd >= 0) close(fd);
+        count_error(scan);
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    NameList list = {0};
+    OldFiles old;
+    old_files_init(&old, &scan->index, indexed);
+    bool ok = true;
+
+    while (ok && !pool_cancelled(token)) {
+        long n = syscall(SYS_getdents64, fd, buf, SCAN_BUFFER_SIZE);
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+
+        for (long pos = 0; pos < n;) {
+            const struct linux_dirent64 *entry = (const struct linux_dirent64 *)(buf + pos);
+            pos += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.') continue;
+
+            // Some file systems (older XFS, many FUSE and NFS setups)
+            // don't report types
+            unsigned char type = entry->d_type;
+            bool have_stat = false;
+            if (type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+                have_stat = true;
+            }
+
+            if (type == DT_DIR) {
+                submit_dir(scan, path, path_len, name);
+                continue;
+            }
+            if (type != DT_REG || !scan->accept(name)) continue;
+
+            // Size and mtime tell whether what the index knows about the
+            // file still holds
+            if (!have_stat && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            ScanFile file = { .size = (uint64_t)st.st_size, .mtime_ns = mtime_ns(&st) };
+            const LibIndexTrack *prev = old_files_find(&old, name);
+            if (prev && prev->size == file.size && prev->mtime_ns == file.mtime_ns) {
+                indexed_details(&scan->index, prev, &file);
+            }
+
+            if (!add_name(&list, name, &file)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    close(fd);
+    free(buf);
+    free(old.slots);
+
+    // Even an empty directory gets a batch: the index records its mtime
+    ScanBatch *batch = ok ? make_batch(scan, path, mtime, false, &list) : NULL;
+    free_names(&list);
+    if (batch) push_batch(scan, batch);
+    else count_error(scan);
+}
+
+static void scan_dir_job(void *arg, const PoolToken *token) {
+    DirJob *job = arg;
+    Scan *scan = job->scan;
+    if (!pool_cancelled(token)) read_dir(scan, job->path, token);
+    free(job);
+    unref(scan);
+}
+
+Scan *scan_start(const char *root, bool (*accept)(const char *name), bool locale_sort,
+                 LibIndex *index) {
+    Scan *scan = pool_thread_count() > 0 ? calloc(1, sizeof(Scan)) : NULL;
+    int root_fd = scan ? open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (root_fd < 0) {
+        free(scan);
+        if (index) libindex_close(index);
+        return NULL;
+    }
+
+    scan->root_fd = root_fd;
+    if (index) {
+        scan->index = *index;
+        memset(index, 0, sizeof(*index));
+    }
+    scan->accept = accept;
+    scan->locale_sort = locale_sort;
+    scan->refs = 1;
+    scan->start_ns = now_ns();
+    scan->done_ms = -1.0;
+    pthread_mutex_init(&scan->lock, NULL);
+
+    submit_dir(scan, "", 0, "");
+    return scan;
+}
+
+ScanBatch *scan_take(Scan *scan) {
+    pthread_mutex_lock(&scan->lock);
+    ScanBatch *batches = scan->head;
+    scan->head = NULL;
+    scan->tail = NULL;
+    pthread_mutex_unlock(&scan->lock);
+    return batches;
+}
+
+void scan_get_progress(Scan *scan, ScanProgress *progress) {
+    // Only the owner's reference left: every directory has been read and
+    // its batch queued
+    progress->done = __atomic_load_n(&scan->refs, __ATOMIC_ACQUIRE) == 1;
+    progress->dirs = __atomic_load_n(&scan->dirs, __ATOMIC_RELAXED);
+    progress->reused = __atomic_load_n(&scan->reused, __ATOMIC_RELAXED);
+    progress->files = __atomic_load_n(&scan->files, __ATOMIC_RELAXED);
+    progress->errors = __atomic_load_n(&scan->errors, __ATOMIC_RELAXED);
+
+    double elapsed_ms = (double)(now_ns() - scan->start_ns) / 1e6;
+    if (progress->done && scan->done_ms < 0.0) scan->done_ms = elapsed_ms;
+    progress->elapsed_ms = progress->done ? scan->done_ms : elapsed_ms;
+}
+
+void scan_free(Scan *scan) {
+    if (!scan) return;
+    pool_group_cancel(&scan->group);
+    unref(scan);
+}
@@ -0,0 +1,71 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "libindex.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Recursive directory scan on the worker pool. Every directory is read by
+// its own bulk job, so a tree is walked as many directories at a time as
+// there are workers; on network file systems that hides most of the
+// round-trip latency. Hidden entries and symbolic links are skipped.
+//
+// Results come back one directory at a time as batches the caller takes
+// whenever it likes, so a large tree shows up gradually.
+//
+// Given the library index of a previous scan, directories whose mtime
+// hasn't changed are not read again: their files and subdirectories come
+// from the index, and so do the tags of files whose size and mtime match.
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t duration_ms;   // 0 if unknown
+    bool tagged;            // the tags below were read; any may be empty
+    const char *artist;     // NULL or "" if unknown
+    const char *title;
+    const char *album;
+} ScanFile;
+
+// Playable files of one directory. Every directory gets a batch, even one
+// without files.
+typedef struct ScanBatch {
+    struct ScanBatch *next;
+    const char *dir;      // relative to the root, "" for the root itself
+    int64_t mtime_ns;     // of the directory
+    bool reused;          // unchanged since the index was written
+    uint32_t count;
+    const char **names;   // count file names in natural order
+    ScanFile *files;      // details of each name
+} ScanBatch;
+
+typedef struct {
+    uint64_t dirs;      // directories read so far
+    uint64_t reused;    // of those, taken from the index unchanged
+    uint64_t files;     // files accepted so far
+    uint64_t errors;    // directories that could not be read
+    double elapsed_ms;  // since scan_start(), frozen once done
+    bool done;
+} ScanProgress;
+
+typedef struct Scan Scan;
+
+// Start scanning root, keeping files for which accept() returns true.
+// accept is called on worker threads. index may be NULL; otherwise the
+// scan takes it over and closes it when done. Returns NULL if root can't
+// be opened or the pool isn't running; index is closed then too.
+Scan *scan_start(const char *root, bool (*accept)(const char *name), bool locale_sort,
+                 LibIndex *index);
+
+// Detach the batches finished so far, oldest first. Release each with
+// free(); the strings live in the same allocation.
+ScanBatch *scan_take(Scan *scan);
+
+void scan_get_progress(Scan *scan, ScanProgress *progress);
+
+// Stop the scan and release it. Jobs still queued return early; the
+// memory goes away with the last of them.
+void scan_free(Scan *scan);
+
+#endif
@@ -0,0 +1,441 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE   // memmem()
+
+#include "search.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Trigrams are hashed into this many buckets; a collision only adds
+// candidates, which are checked anyway
+#define SEARCH_BUCKETS (1u << 16)
+
+// Folded text kept per entry; longer entries are cut
+#define SEARCH_TEXT_MAX 1024
+
+#define SEARCH_MAX_WORDS 16
+
+// Ranking
+#define SCORE_MATCH 16         // per query character
+#define SCORE_BOUNDARY 24      // a word starts at the match
+#define SCORE_CONSECUTIVE 8    // per character continuing a run
+#define SCORE_MAX 4095
+
+enum { SEARCH_MODE_WORDS, SEARCH_MODE_FUZZY };
+
+// Four entry masks per operation; GCC lowers this to whatever vector
+// registers the target has
+typedef uint64_t MaskVec __attribute__((vector_size(32)));
+typedef int64_t MaskHits __attribute__((vector_size(32)));
+
+typedef struct {
+    const char *s;
+    size_t len;
+} Word;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+// Letters and digits get a bit each; everything else shares the rest
+static uint64_t char_bit(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + c % 28);
+}
+
+static bool is_word_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static uint32_t trigram_bucket(const unsigned char *p) {
+    uint32_t key = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (key * 2654435761u) >> 16;
+}
+
+static bool is_trigram(const unsigned char *p) {
+    return p[0] != '\n' && p[1] != '\n' && p[2] != '\n';
+}
+
+static const char *entry_text(const SearchIndex *index, uint32_t id, size_t *len) {
+    uint32_t start = index->offsets[id];
+    uint32_t end = id + 1 < index->count ? index->offsets[id + 1] : (uint32_t)index->text.used;
+    *len = end - start - 1;
+    return index->text.data + start;
+}
+
+void search_index_clear(SearchIndex *index) {
+    strarena_clear(&index->text);
+    index->count = 0;
+    free(index->bucket_start);
+    free(index->postings);
+    index->bucket_start = NULL;
+    index->postings = NULL;
+}
+
+bool search_index_add(SearchIndex *index, const char *const *fields, int count) {
+    if (index->count == index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : 1024;
+        uint32_t *offsets = realloc(index->offsets, capacity * sizeof(uint32_t));
+        if (!offsets) return false;
+        index->offsets = offsets;
+        uint64_t *masks = realloc(index->masks, capacity * sizeof(uint64_t));
+        if (!masks) return false;
+        index->masks = masks;
+        index->capacity = capacity;
+    }
+
+    char text[SEARCH_TEXT_MAX];
+    size_t len = 0;
+    uint64_t mask = 0;
+    for (int f = 0; f < count; f++) {
+        const char *field = fields[f];
+        if (!field || !field[0]) continue;
+        if (len > 0 && len < sizeof(text) - 1) text[len++] = '\n';
+        for (const char *p = field; *p && len < sizeof(text) - 1; p++) {
+            unsigned char c = fold((unsigned char)*p);
+            text[len++] = (char)c;
+            mask |= char_bit(c);
+        }
+    }
+
+    if (!strarena_push(&index->text, text, len, &index->offsets[index->count])) return false;
+    index->masks[index->count] = mask;
+    index->count++;
+    return true;
+}
+
+bool search_index_finish(SearchIndex *index) {
+    double start = now_ms();
+    free(index->bucket_start);
+    free(index->postings);
+    index->postings = NULL;
+
+    // Count each entry's distinct buckets, then fill them in entry order
+    uint32_t *starts = calloc(SEARCH_BUCKETS + 1, sizeof(uint32_t));
+    uint32_t *last = malloc(SEARCH_BUCKETS * sizeof(uint32_t));
+    index->bucket_start = starts;
+    if (!starts || !last) {
+        free(last);
+        return false;
+    }
+    memset(last, 0xff, SEARCH_BUCKETS * sizeof(uint32_t));
+
+    for (uint32_t id = 0; id < index->count; id++) {
+        size_t len;
+        const unsigned char *text = (const unsigned char *)entry_text(index, id, &len);
+        for (size_t i = 0; i + 3 <= len; i++) {
+            if (!is_trigram(text + i)) continue;
+            uint32_t b = trigram_bucket(text + i);
+            if (last[b] == id) continue;
+            last[b] = id;
+            starts[b + 1]++;
+        }
+    }
+    for (uint32_t b = 0; b < SEARCH_BUCKETS; b++) starts[b + 1] += starts[b];
+
+    // last becomes the fill position of each bucket
+    uint32_t total = starts[SEARCH_BUCKETS];
+    index->postings = malloc((total ? total : 1) * sizeof(uint32_t));
+    if (!index->postings) {
+        free(last);
+        return false;
+    }
+    memcpy(last, starts, SEARCH_BUCKETS * sizeof(uint32_t));
+    for (uint32_t id = 0; id < index->count; id++) {
+        size_t len;
+        const unsigned char *text = (const unsigned char *)entry_text(index, id, &len);
+        for (size_t i = 0; i + 3 <= len; i++) {
+            if (!is_trigram(text + i)) continue;
+            uint32_t b = trigram_bucket(text + i);
+            if (last[b] > starts[b] && index->postings[last[b] - 1] == id) continue;
+            index->postings[last[b]++] = id;
+        }
+    }
+
+    free(last);
+    index->build_ms = now_ms() - start;
+    return true;
+}
+
+void search_index_free(SearchIndex *index) {
+    strarena_free(&index->text);
+    free(index->offsets);
+    free(index->masks);
+    free(index->bucket_start);
+    free(index->postings);
+    memset(index, 0, sizeof(*index));
+}
+
+// Entries containing every character of want, in entry order
+static uint32_t scan_masks(const SearchIndex *index, uint64_t want, uint32_t *out) {
+    MaskVec wanted = { want, want, want, want };
+    uint32_t n = 0, i = 0;
+    for (; i + 4 <= index->count; i += 4) {
+        MaskVec masks;
+        memcpy(&masks, &index->masks[i], sizeof(masks));
+        MaskHits hits = (masks & wanted) == wanted;
+
+        // Branch-free append; out has room for every entry
+        out[n] = i;
+        n += hits[0] != 0;
+        out[n] = i + 1;
+        n += hits[1] != 0;
+        out[n] = i + 2;
+        n += hits[2] != 0;
+        out[n] = i + 3;
+        n += hits[3] != 0;
+    }
+    for (; i < index->count; i++) {
+        if ((index->masks[i] & want) == want) out[n++] = i;
+    }
+    return n;
+}
+
+static int position_bonus(size_t pos) {
+    return pos < 32 ? (int)(32 - pos) / 4 : 0;
+}
+
+static bool at_boundary(const char *text, const char *p) {
+    return p == text || !is_word_char((unsigned char)p[-1]);
+}
+
+// Best occurrence of word as a substring: the first at a word start, else
+// the first. -1 if there is none.
+static int substring_score(const char *text, size_t len, const Word *word) {
+    const char *first = memmem(text, len, word->s, word->len);
+    if (!first) return -1;
+
+    const char *best = first;
+    for (const char *p = first; p && !at_boundary(text, p);) {
+        p = memmem(p + 1, len - (size_t)(p + 1 - text), word->s, word->len);
+        if (p && at_boundary(text, p)) best = p;
+    }
+    return (int)word->len * SCORE_MATCH + (int)(word->len - 1) * SCORE_CONSECUTIVE +
+           (at_boundary(text, best) ? SCORE_BOUNDARY : 0) + position_bonus((size_t)(best - text));
+}
+
+// Word as a subsequence: the earliest match is found going forward, then
+// tightened going back from its end, and that window is scored. -1 if
+// there is none.
+static int fuzzy_score(const char *text, size_t len, const Word *word) {
+    const char *end = text + len;
+    const char *p = text;
+    for (size_t i = 0; i < word->len; i++) {
+        p = memchr(p, word->s[i], (size_t)(end - p));
+        if (!p) return -1;
+        p++;
+    }
+    const char *last = p - 1;
+
+    const char *start = last;
+    for (size_t i = word->len; i-- > 0; start--) {
+        while (*start != word->s[i]) start--;
+        if (i == 0) break;
+    }
+
+    int score = position_bonus((size_t)(start - text));
+    int run = 0;
+    size_t i = 0;
+    for (const char *c = start; c <= last && i < word->len; c++) {
+        if (*c != word->s[i]) {
+            run = 0;
+            score -= 1;   // gap
+            continue;
+        }
+        score += SCORE_MATCH + (at_boundary(text, c) ? SCORE_BOUNDARY : 0) + run * SCORE_CONSECUTIVE;
+        run++;
+        i++;
+    }
+    return score > 0 ? score : 0;
+}
+
+// Keep the candidates that match every word, scoring them. Works in place.
+static uint32_t filter(Search *search, const SearchIndex *index, uint32_t count,
+                       const Word *words, int word_count, int mode) {
+    uint32_t kept = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t id = search->matched[k];
+        size_t len;
+        const char *text = entry_text(index, id, &len);
+
+        int total = 0;
+        for (int w = 0; w < word_count && total >= 0; w++) {
+            int score = mode == SEARCH_MODE_WORDS ? substring_score(text, len, &words[w])
+                                                  : fuzzy_score(text, len, &words[w]);
+            total = score < 0 ? -1 : total + score;
+        }
+        if (total < 0) continue;
+
+        search->matched[kept] = id;
+        search->scores[kept] = (uint16_t)(total > SCORE_MAX ? SCORE_MAX : total);
+        kept++;
+    }
+    return kept;
+}
+
+// Candidates for the words mode: the postings of the rarest trigram, or
+// every entry with the right characters if all words are shorter
+static uint32_t word_candidates(Search *search, const SearchIndex *index, const Word *words,
+                                int word_count, uint64_t want) {
+    uint32_t best = UINT32_MAX, best_count = UINT32_MAX;
+    for (int w = 0; w < word_count; w++) {
+        for (size_t i = 0; i + 3 <= words[w].len; i++) {
+            uint32_t b = trigram_bucket((const unsigned char *)words[w].s + i);
+            uint32_t n = index->bucket_start[b + 1] - index->bucket_start[b];
+            if (n < best_count) {
+                best = b;
+                best_count = n;
+            }
+        }
+    }
+    if (best == UINT32_MAX) return scan_masks(index, want, search->matched);
+
+    memcpy(search->matched, index->postings + index->bucket_start[best], best_count * sizeof(uint32_t));
+    return best_count;
+}
+
+// Order matched by score, best first; ties stay in entry order
+static void rank(Search *search, uint32_t count) {
+    uint32_t counts[SCORE_MAX + 2];
+    memset(counts, 0, sizeof(counts));
+    for (uint32_t k = 0; k < count; k++) counts[SCORE_MAX - search->scores[k] + 1]++;
+    for (uint32_t s = 0; s <= SCORE_MAX; s++) counts[s + 1] += counts[s];
+    for (uint32_t k = 0; k < count; k++) {
+        search->ids[counts[SCORE_MAX - search->scores[k]]++] = search->matched[k];
+    }
+    search->count = count;
+}
+
+static bool reserve(Search *search, uint32_t count) {
+    if (count <= search->capacity) return true;
+    uint32_t capacity = search->capacity ? search->capacity : 1024;
+    while (capacity < count) capacity *= 2;
+
+    uint32_t *ids = realloc(search->ids, capacity * sizeof(uint32_t));
+    if (!ids) return false;
+    search->ids = ids;
+    uint32_t *matched = realloc(search->matched, capacity * sizeof(uint32_t));
+    if (!matched) return false;
+    search->matched = matched;
+    uint16_t *scores = realloc(search->scores, capacity * sizeof(uint16_t));
+    if (!scores) return false;
+    search->scores = scores;
+    search->capacity = capacity;
+    return true;
+}
+
+static void record_latency(Search *search, double ms) {
+    search->latency_ms[search->latency_count % SEARCH_LATENCY_SAMPLES] = ms;
+    search->latency_count++;
+}
+
+bool search_run(Search *search, const SearchIndex *index, const char *query) {
+    double start = now_ms();
+
+    // Fold the query and collapse the spaces between words
+    char folded[SEARCH_QUERY_MAX];
+    size_t len = 0;
+    uint64_t want = 0;
+    for (const char *p = query; *p && len < sizeof(folded) - 1; p++) {
+        unsigned char c = fold((unsigned char)*p);
+        if (c == ' ' && (len == 0 || folded[len - 1] == ' ')) continue;
+        folded[len++] = (char)c;
+        if (c != ' ') want |= char_bit(c);
+    }
+    if (len > 0 && folded[len - 1] == ' ') len--;
+    folded[len] = '\0';
+
+    Word words[SEARCH_MAX_WORDS];
+    int word_count = 0;
+    for (char *p = folded; *p && word_count < SEARCH_MAX_WORDS;) {
+        char *space = strchr(p, ' ');
+        size_t word_len = space ? (size_t)(space - p) : strlen(p);
+        words[word_count].s = p;
+        words[word_count].len = word_len;
+        word_count++;
+        p += word_len + (space ? 1 : 0);
+    }
+
+    search->count = 0;
+    if (word_count == 0 || index->count == 0 || !index->bucket_start) {
+        search->valid = false;
+        return true;
+    }
+    if (!reserve(search, index->count)) {
+        search->valid = false;
+        return false;
+    }
+
+    // More of the same query can only match fewer entries
+    size_t previous = strlen(search->query);
+    bool narrow = search->valid && previous > 0 && strncmp(search->query, folded, previous) == 0;
+    uint32_t count = narrow ? search->matched_count : 0;
+
+    int mode = SEARCH_MODE_WORDS;
+    if (narrow && search->mode == SEARCH_MODE_FUZZY) {
+        // No entry had all the shorter words, so none has these
+        mode = SEARCH_MODE_FUZZY;
+    } else {
+        if (!narrow) count = word_candidates(search, index, words, word_count, want);
+        count = filter(search, index, count, words, word_count, SEARCH_MODE_WORDS);
+        if (count == 0) {
+            mode = SEARCH_MODE_FUZZY;
+            narrow = false;
+        }
+    }
+    if (mode == SEARCH_MODE_FUZZY) {
+        if (!narrow) count = scan_masks(index, want, search->matched);
+        count = filter(search, index, count, words, word_count, SEARCH_MODE_FUZZY);
+    }
+
+    rank(search, count);
+    search->matched_count = count;
+    memcpy(search->query, folded, len + 1);
+    search->mode = mode;
+    search->valid = true;
+    record_latency(search, now_ms() - start);
+    return true;
+}
+
+void search_invalidate(Search *search) {
+    search->valid = false;
+    search->count = 0;
+    search->matched_count = 0;
+    search->query[0] = '\0';
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void search_get_latency(const Search *search, SearchLatency *latency) {
+    memset(latency, 0, sizeof(*latency));
+    uint32_t n = search->latency_count < SEARCH_LATENCY_SAMPLES ? search->latency_count
+                                                                : SEARCH_LATENCY_SAMPLES;
+    if (n == 0) return;
+
+    double sorted[SEARCH_LATENCY_SAMPLES];
+    memcpy(sorted, search->latency_ms, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    latency->p50_ms = sorted[(n - 1) * 50 / 100];
+    latency->p95_ms = sorted[(n - 1) * 95 / 100];
+    latency->p99_ms = sorted[(n - 1) * 99 / 100];
+    latency->max_ms = sorted[n - 1];
+    latency->samples = n;
+}
+
+void search_free(Search *search) {
+    free(search->ids);
+    free(search->matched);
+    free(search->scores);
+    memset(search, 0, sizeof(*search));
+}
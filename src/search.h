@@ -0,0 +1,92 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "strarena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// As-you-type search over a list of entries, each a few text fields (title,
+// artist, album, file name). ASCII case is ignored.
+//
+// A query is one or more words. Entries containing every word are found
+// through a trigram index: the rarest trigram of the query gives the
+// candidates, which are then checked. If no entry has them all, the words
+// are matched fuzzily instead, as subsequences ("dsotm" finds "dark side
+// of the moon"); that scans every entry, with a bitmask of the characters
+// each entry contains rejecting most of them four at a time. Typing more
+// of the same query only looks at what the previous one matched.
+//
+// Either way results are ranked by how well the words match: whole runs,
+// word starts and early fields score higher.
+
+#define SEARCH_QUERY_MAX 128
+#define SEARCH_LATENCY_SAMPLES 128
+
+// Entries and their trigram postings. Zero-initialize, add every entry,
+// then call search_index_finish() before searching.
+typedef struct {
+    StrArena text;          // folded fields of each entry, '\n' between them
+    uint32_t *offsets;      // of each entry's text
+    uint64_t *masks;        // characters present in each entry
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t *bucket_start; // postings of trigram bucket b: [start[b], start[b + 1])
+    uint32_t *postings;     // entry ids, ascending within a bucket
+    double build_ms;        // time spent in search_index_finish()
+} SearchIndex;
+
+// Results of the last query and what is needed to narrow them. Zero-
+// initialize.
+typedef struct {
+    uint32_t *ids;          // matching entries, best first
+    uint32_t count;
+
+    uint32_t *matched;      // the same, in entry order
+    uint32_t matched_count;
+    uint16_t *scores;       // of matched
+    uint32_t capacity;
+
+    char query[SEARCH_QUERY_MAX];   // folded
+    int mode;
+    bool valid;             // ids answer query against the current index
+
+    double latency_ms[SEARCH_LATENCY_SAMPLES];   // most recent queries
+    uint32_t latency_count;
+} Search;
+
+typedef struct {
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+    uint32_t samples;
+} SearchLatency;
+
+// Forget all entries but keep the memory.
+void search_index_clear(SearchIndex *index);
+
+// Add an entry from count fields; empty or NULL fields are skipped. Entries
+// are numbered from 0 in the order they are added. Returns false if out of
+// memory.
+bool search_index_add(SearchIndex *index, const char *const *fields, int count);
+
+// Build the trigram postings. Returns false if out of memory.
+bool search_index_finish(SearchIndex *index);
+
+void search_index_free(SearchIndex *index);
+
+// Run query against index. An empty query matches nothing. Returns false
+// if out of memory; there are no results then.
+bool search_run(Search *search, const SearchIndex *index, const char *query);
+
+// Call after rebuilding the index, so the next query starts from scratch.
+void search_invalidate(Search *search);
+
+void search_get_latency(const Search *search, SearchLatency *latency);
+
+void search_free(Search *search);
+
+#endif
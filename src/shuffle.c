@@ -0,0 +1,251 @@
+#define _DEFAULT_SOURCE
+
+#include "shuffle.h"
+
+#include <stdlib.h>
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void shuffle_rng_seed(ShuffleRng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) rng->s[i] = splitmix64(&seed);
+}
+
+uint64_t shuffle_rng_next(ShuffleRng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+uint32_t shuffle_rng_below(ShuffleRng *rng, uint32_t bound) {
+    // Lemire's multiply-shift: the high half of a 32x32 product is in
+    // range, and only products whose low half falls under 2^32 mod bound
+    // are drawn again
+    uint64_t m = (shuffle_rng_next(rng) >> 32) * bound;
+    uint32_t low = (uint32_t)m;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (shuffle_rng_next(rng) >> 32) * bound;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+// Round function: a 32-bit mix of one half and the round key
+static uint32_t feistel_round(uint32_t half, uint32_t key) {
+    uint32_t x = (half ^ key) * 0x9e3779b1u;
+    x ^= x >> 15;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    return x;
+}
+
+void shuffle_cipher_init(ShuffleCipher *cipher, uint32_t count, uint64_t key) {
+    int bits = 2;
+    while (bits < 32 && ((uint64_t)1 << bits) < count) bits += 2;
+    cipher->count = count;
+    cipher->half_bits = bits / 2;
+    for (int i = 0; i < SHUFFLE_ROUNDS; i++) cipher->keys[i] = (uint32_t)splitmix64(&key);
+}
+
+static uint32_t encrypt(const ShuffleCipher *cipher, uint32_t x) {
+    uint32_t mask = ((uint32_t)1 << cipher->half_bits) - 1;
+    uint32_t left = x >> cipher->half_bits, right = x & mask;
+    for (int i = 0; i < SHUFFLE_ROUNDS; i++) {
+        uint32_t next = left ^ (feistel_round(right, cipher->keys[i]) & mask);
+        left = right;
+        right = next;
+    }
+    return left << cipher->half_bits | right;
+}
+
+static uint32_t decrypt(const ShuffleCipher *cipher, uint32_t y) {
+    uint32_t mask = ((uint32_t)1 << cipher->half_bits) - 1;
+    uint32_t left = y >> cipher->half_bits, right = y & mask;
+    for (int i = SHUFFLE_ROUNDS - 1; i >= 0; i--) {
+        uint32_t prev = right ^ (feistel_round(left, cipher->keys[i]) & mask);
+        right = left;
+        left = prev;
+    }
+    return left << cipher->half_bits | right;
+}
+
+// The domain is less than four times count, so each walk takes under four
+// steps on average. It ends because the network is a permutation: the
+// cycle through x comes back into [0, count) at the latest at x itself.
+uint32_t shuffle_cipher_forward(const ShuffleCipher *cipher, uint32_t x) {
+    do {
+        x = encrypt(cipher, x);
+    } while (x >= cipher->count);
+    return x;
+}
+
+uint32_t shuffle_cipher_inverse(const ShuffleCipher *cipher, uint32_t y) {
+    do {
+        y = decrypt(cipher, y);
+    } while (y >= cipher->count);
+    return y;
+}
+
+static void free_tables(Shuffle *sh) {
+    free(sh->order);
+    free(sh->position);
+    sh->order = NULL;
+    sh->position = NULL;
+    sh->capacity = 0;
+}
+
+// Switch to, or stay with, a cipher over count tracks
+static void use_key(Shuffle *sh, int count, uint64_t key) {
+    free_tables(sh);
+    sh->keyed = true;
+    sh->key = key;
+    sh->count = count;
+    shuffle_cipher_init(&sh->cipher, (uint32_t)count, key);
+}
+
+bool shuffle_reserve(Shuffle *sh, int capacity) {
+    if (capacity > SHUFFLE_TABLE_MAX) capacity = SHUFFLE_TABLE_MAX;
+    if (sh->keyed || capacity <= sh->capacity) return true;
+
+    int *order = realloc(sh->order, (size_t)capacity * sizeof(int));
+    if (!order) return false;
+    sh->order = order;
+
+    int *position = realloc(sh->position, (size_t)capacity * sizeof(int));
+    if (!position) return false;
+    sh->position = position;
+
+    sh->capacity = capacity;
+    return true;
+}
+
+void shuffle_generate(Shuffle *sh, int count, ShuffleRng *rng) {
+    sh->keyed = false;
+    if (count > SHUFFLE_TABLE_MAX || !shuffle_reserve(sh, count)) {
+        use_key(sh, count, shuffle_rng_next(rng));
+        return;
+    }
+
+    for (int i = 0; i < count; i++) sh->order[i] = i;
+    for (int i = count - 1; i > 0; i--) {
+        int j = (int)shuffle_rng_below(rng, (uint32_t)i + 1);
+        int tmp = sh->order[i];
+        sh->order[i] = sh->order[j];
+        sh->order[j] = tmp;
+    }
+    for (int i = 0; i < count; i++) sh->position[sh->order[i]] = i;
+    sh->count = count;
+}
+
+int shuffle_track(const Shuffle *sh, int pos) {
+    return sh->keyed ? (int)shuffle_cipher_forward(&sh->cipher, (uint32_t)pos) : sh->order[pos];
+}
+
+int shuffle_position(const Shuffle *sh, int track) {
+    return sh->keyed ? (int)shuffle_cipher_inverse(&sh->cipher, (uint32_t)track) : sh->position[track];
+}
+
+void shuffle_append(Shuffle *sh, int first, ShuffleRng *rng) {
+    if (sh->keyed || sh->count >= sh->capacity) {
+        use_key(sh, sh->count + 1, sh->keyed ? sh->key : shuffle_rng_next(rng));
+        return;
+    }
+
+    int track = sh->count++;
+    if (first > track) first = track;
+    if (first < 0) first = 0;
+
+    // One step of the inside-out Fisher-Yates shuffle
+    int pos = first + (int)shuffle_rng_below(rng, (uint32_t)(track - first) + 1);
+    if (pos != track) {
+        int displaced = sh->order[pos];
+        sh->order[track] = displaced;
+        sh->position[displaced] = track;
+    }
+    sh->order[pos] = track;
+    sh->position[track] = pos;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+bool shuffle_remap(Shuffle *sh, const int *moved, int *added, int added_count, int *pos,
+                   ShuffleRng *rng) {
+    int kept = 0;
+    for (int i = 0; i < sh->count; i++) kept += moved[i] >= 0;
+    if (sh->keyed || kept + added_count > sh->capacity) {
+        int track = *pos < sh->count ? moved[shuffle_track(sh, *pos)] : -1;
+        use_key(sh, kept + added_count, sh->keyed ? sh->key : shuffle_rng_next(rng));
+        if (track >= 0) {
+            *pos = shuffle_position(sh, track);
+        } else if (*pos >= sh->count) {
+            *pos = sh->count > 0 ? sh->count - 1 : 0;
+        }
+        return true;
+    }
+
+    int *gaps = malloc(((size_t)added_count + 1) * sizeof(int));
+    if (!gaps) return false;
+
+    // Drop the tracks that are gone; the position ends up at the current
+    // track, or just before where it was
+    int new_pos = -1;
+    kept = 0;
+    for (int i = 0; i < sh->count; i++) {
+        int track = moved[sh->order[i]];
+        if (i == *pos) new_pos = track >= 0 ? kept : kept - 1;
+        if (track >= 0) sh->order[kept++] = track;
+    }
+    int base = new_pos < 0 ? 0 : new_pos + 1;
+
+    for (int i = added_count - 1; i > 0; i--) {
+        int j = (int)shuffle_rng_below(rng, (uint32_t)i + 1);
+        int tmp = added[i];
+        added[i] = added[j];
+        added[j] = tmp;
+    }
+    for (int i = 0; i < added_count; i++) {
+        gaps[i] = base + (int)shuffle_rng_below(rng, (uint32_t)(kept - base) + 1);
+    }
+    qsort(gaps, (size_t)added_count, sizeof(int), compare_ints);
+
+    // Merge from the back so the order can be filled in place
+    int out = kept + added_count;
+    int g = added_count - 1;
+    for (int i = kept - 1; i >= -1; i--) {
+        while (g >= 0 && gaps[g] > i) sh->order[--out] = added[g--];
+        if (i >= 0) sh->order[--out] = sh->order[i];
+    }
+
+    sh->count = kept + added_count;
+    for (int i = 0; i < sh->count; i++) sh->position[sh->order[i]] = i;
+    *pos = new_pos < 0 ? 0 : new_pos;
+    free(gaps);
+    return true;
+}
+
+void shuffle_free(Shuffle *sh) {
+    free_tables(sh);
+    sh->count = 0;
+    sh->keyed = false;
+}
@@ -0,0 +1,89 @@
+#ifndef SHUFFLE_H
+#define SHUFFLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Random numbers for shuffling: xoshiro256**, seeded through splitmix64 so
+// that any 64-bit seed, including 0, gives a good state. The same seed
+// always gives the same sequence.
+typedef struct {
+    uint64_t s[4];
+} ShuffleRng;
+
+void shuffle_rng_seed(ShuffleRng *rng, uint64_t seed);
+
+uint64_t shuffle_rng_next(ShuffleRng *rng);
+
+// Uniform in [0, bound), without the bias of a plain modulo. bound > 0.
+uint32_t shuffle_rng_below(ShuffleRng *rng, uint32_t bound);
+
+// Orders of up to SHUFFLE_TABLE_MAX tracks are kept in tables; longer ones
+// are computed on the fly
+#define SHUFFLE_TABLE_MAX (1 << 18)
+#define SHUFFLE_ROUNDS 6
+
+// A keyed permutation of [0, count): a balanced Feistel network over the
+// smallest power of four that holds count, applied again while the result
+// falls outside the range (cycle walking). That takes under four steps on
+// average either way, and no memory.
+typedef struct {
+    uint32_t count;
+    int half_bits;
+    uint32_t keys[SHUFFLE_ROUNDS];
+} ShuffleCipher;
+
+void shuffle_cipher_init(ShuffleCipher *cipher, uint32_t count, uint64_t key);
+
+// Where x goes, and where it came from. x < count.
+uint32_t shuffle_cipher_forward(const ShuffleCipher *cipher, uint32_t x);
+uint32_t shuffle_cipher_inverse(const ShuffleCipher *cipher, uint32_t y);
+
+// A random order of tracks 0..count-1 that also answers where a track is.
+// Up to SHUFFLE_TABLE_MAX tracks it is a table and its inverse; beyond
+// that, or if the tables can't be allocated, a ShuffleCipher keyed from
+// the seed, which is then all there is to the order. Zero-initialize.
+typedef struct {
+    int *order;      // track at each position, NULL when keyed
+    int *position;   // position of each track
+    int count;
+    int capacity;    // of the tables, at most SHUFFLE_TABLE_MAX
+
+    bool keyed;
+    ShuffleCipher cipher;
+    uint64_t key;
+} Shuffle;
+
+// Make room in the tables for capacity tracks, or SHUFFLE_TABLE_MAX if
+// fewer, keeping the order. Returns false if out of memory.
+bool shuffle_reserve(Shuffle *sh, int capacity);
+
+// A fresh order of count tracks (Fisher-Yates, or a new key).
+void shuffle_generate(Shuffle *sh, int count, ShuffleRng *rng);
+
+// Track at a position and position of a track; O(1) either way.
+int shuffle_track(const Shuffle *sh, int pos);
+int shuffle_position(const Shuffle *sh, int track);
+
+// Add track sh->count at a random position from first on, moving the track
+// there to the end. The order stays uniformly random, so a new track lands
+// in the part not played yet when first is just past the current position.
+// A keyed order is keyed again for the new count instead, which moves
+// every track: look up the current one again after. Call shuffle_reserve()
+// for the new count first.
+void shuffle_append(Shuffle *sh, int first, ShuffleRng *rng);
+
+// Follow a change of track numbers: moved[t] is the new number of old
+// track t, or -1 if it is gone; the added tracks (new numbers) are dealt
+// in at random places after the position *pos, which is updated to where
+// its track is now, or the position before it if that track is gone. A
+// keyed order keeps its key over the new count and *pos follows its track
+// if it is still there. Call
+// shuffle_reserve() for the new count first. Returns false if out of
+// memory; the order is unchanged then.
+bool shuffle_remap(Shuffle *sh, const int *moved, int *added, int added_count, int *pos,
+                   ShuffleRng *rng);
+
+void shuffle_free(Shuffle *sh);
+
+#endif
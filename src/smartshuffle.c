@@ -0,0 +1,207 @@
+#define _DEFAULT_SOURCE
+
+#include "smartshuffle.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_pairs(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Uniform in [0, bound) for 64-bit bounds, drawing again past the last
+// whole multiple of bound
+static uint64_t below64(ShuffleRng *rng, uint64_t bound) {
+    uint64_t limit = UINT64_MAX - UINT64_MAX % bound;
+    uint64_t x;
+    do {
+        x = shuffle_rng_next(rng);
+    } while (x >= limit);
+    return x % bound;
+}
+
+static uint8_t weight_of(const SmartShuffle *ss, int track) {
+    if (ss->played[track]) return 0;
+    if (ss->recent[ss->album[track]]) return SMART_WEIGHT_ALBUM;
+    uint32_t artist = ss->artist[track];
+    if (artist != SMART_NO_GROUP && ss->recent[artist]) return SMART_WEIGHT_ARTIST;
+    return SMART_WEIGHT;
+}
+
+static void set_weight(SmartShuffle *ss, int track, uint8_t weight) {
+    uint64_t delta = (uint64_t)weight - ss->weight[track];   // wraps when lighter
+    if (delta == 0) return;
+    ss->weight[track] = weight;
+    ss->total += delta;
+    for (int i = track + 1; i <= ss->count; i += i & -i) ss->tree[i] += delta;
+}
+
+static void reweigh_group(SmartShuffle *ss, uint32_t group) {
+    for (uint32_t i = ss->group_start[group]; i < ss->group_start[group + 1]; i++) {
+        int track = (int)ss->members[i];
+        set_weight(ss, track, weight_of(ss, track));
+    }
+}
+
+// Every weight from scratch, and the tree from them in O(n)
+static void reweigh_all(SmartShuffle *ss) {
+    ss->total = 0;
+    for (int i = 0; i < ss->count; i++) {
+        ss->weight[i] = weight_of(ss, i);
+        ss->tree[i + 1] = ss->weight[i];
+        ss->total += ss->weight[i];
+    }
+    for (int i = 1; i <= ss->count; i++) {
+        int parent = i + (i & -i);
+        if (parent <= ss->count) ss->tree[parent] += ss->tree[i];
+    }
+}
+
+static void enter_history(SmartShuffle *ss, int track) {
+    uint32_t groups[2] = { ss->album[track], ss->artist[track] };
+    for (int i = 0; i < 2; i++) {
+        if (groups[i] != SMART_NO_GROUP && ss->recent[groups[i]]++ == 0) reweigh_group(ss, groups[i]);
+    }
+}
+
+static void leave_history(SmartShuffle *ss, int track) {
+    uint32_t groups[2] = { ss->album[track], ss->artist[track] };
+    for (int i = 0; i < 2; i++) {
+        if (groups[i] != SMART_NO_GROUP && --ss->recent[groups[i]] == 0) reweigh_group(ss, groups[i]);
+    }
+}
+
+// Number the distinct keys as groups from ss->group_count on, skipping
+// tracks whose key is 0 if skip_zero; pairs has room for count entries
+static void make_groups(SmartShuffle *ss, const uint32_t *keys, bool skip_zero, uint32_t *group_of,
+                        uint64_t *pairs, uint32_t *member) {
+    int n = 0;
+    for (int i = 0; i < ss->count; i++) {
+        group_of[i] = SMART_NO_GROUP;
+        if (skip_zero && keys[i] == 0) continue;
+        pairs[n++] = (uint64_t)keys[i] << 32 | (uint32_t)i;
+    }
+    qsort(pairs, (size_t)n, sizeof(uint64_t), compare_pairs);
+
+    for (int i = 0; i < n; i++) {
+        uint32_t track = (uint32_t)pairs[i];
+        if (i == 0 || pairs[i] >> 32 != pairs[i - 1] >> 32) ss->group_start[ss->group_count++] = *member;
+        group_of[track] = ss->group_count - 1;
+        ss->members[(*member)++] = track;
+    }
+}
+
+// Everything but what was played and the history
+static void free_groups(SmartShuffle *ss) {
+    free(ss->tree);
+    free(ss->weight);
+    free(ss->album);
+    free(ss->artist);
+    free(ss->members);
+    free(ss->group_start);
+    free(ss->recent);
+    ss->tree = NULL;
+    ss->weight = NULL;
+    ss->album = ss->artist = ss->members = ss->group_start = NULL;
+    ss->recent = NULL;
+    ss->group_count = 0;
+    ss->total = 0;
+}
+
+bool smartshuffle_build(SmartShuffle *ss, int count, const uint32_t *album_keys,
+                        const uint32_t *artist_keys, bool keep) {
+    free_groups(ss);
+    if (keep && ss->played && count >= ss->count) {
+        uint8_t *played = realloc(ss->played, (size_t)count + 1);
+        if (played) memset(played + ss->count, 0, (size_t)(count - ss->count) + 1);
+        else free(ss->played);
+        ss->played = played;
+    } else {
+        free(ss->played);
+        ss->played = calloc((size_t)count + 1, 1);
+        ss->history_count = ss->history_next = 0;
+    }
+
+    // At most one album and one artist group per track
+    size_t n = (size_t)count;
+    ss->count = count;
+    ss->tree = malloc((n + 1) * sizeof(uint64_t));
+    ss->weight = malloc(n + 1);
+    ss->album = malloc((n + 1) * sizeof(uint32_t));
+    ss->artist = malloc((n + 1) * sizeof(uint32_t));
+    ss->members = malloc((2 * n + 1) * sizeof(uint32_t));
+    ss->group_start = malloc((2 * n + 1) * sizeof(uint32_t));
+    ss->recent = calloc(2 * n + 1, sizeof(uint16_t));
+    uint64_t *pairs = malloc((n + 1) * sizeof(uint64_t));
+    if (!ss->played || !ss->tree || !ss->weight || !ss->album || !ss->artist || !ss->members ||
+        !ss->group_start || !ss->recent || !pairs) {
+        free(pairs);
+        smartshuffle_free(ss);
+        return false;
+    }
+
+    uint32_t member = 0;
+    make_groups(ss, album_keys, false, ss->album, pairs, &member);
+    make_groups(ss, artist_keys, true, ss->artist, pairs, &member);
+    ss->group_start[ss->group_count] = member;
+    free(pairs);
+
+    ss->left = 0;
+    for (int i = 0; i < count; i++) ss->left += !ss->played[i];
+    for (int i = 0; i < ss->history_count; i++) {
+        int track = ss->history[i];
+        ss->recent[ss->album[track]]++;
+        if (ss->artist[track] != SMART_NO_GROUP) ss->recent[ss->artist[track]]++;
+    }
+    ss->tree_top = 1;
+    while (ss->tree_top * 2 <= count) ss->tree_top *= 2;
+    reweigh_all(ss);
+    return true;
+}
+
+int smartshuffle_draw(const SmartShuffle *ss, ShuffleRng *rng) {
+    if (ss->total == 0) return -1;
+
+    // Descend to the track whose weight covers r: the last prefix <= r
+    uint64_t r = below64(rng, ss->total);
+    int pos = 0;
+    for (int step = ss->tree_top; step > 0; step >>= 1) {
+        if (pos + step <= ss->count && ss->tree[pos + step] <= r) {
+            pos += step;
+            r -= ss->tree[pos];
+        }
+    }
+    return pos;
+}
+
+void smartshuffle_played(SmartShuffle *ss, int track) {
+    if (track < 0 || track >= ss->count) return;
+    if (!ss->played[track]) {
+        ss->played[track] = 1;
+        ss->left--;
+        set_weight(ss, track, 0);
+    }
+
+    if (ss->history_count == SMART_HISTORY) {
+        leave_history(ss, ss->history[ss->history_next]);
+    } else {
+        ss->history_count++;
+    }
+    ss->history[ss->history_next] = track;
+    ss->history_next = (ss->history_next + 1) % SMART_HISTORY;
+    enter_history(ss, track);
+}
+
+void smartshuffle_restart(SmartShuffle *ss) {
+    if (ss->count == 0) return;
+    memset(ss->played, 0, (size_t)ss->count);
+    ss->left = ss->count;
+    reweigh_all(ss);
+}
+
+void smartshuffle_free(SmartShuffle *ss) {
+    free_groups(ss);
+    free(ss->played);
+    memset(ss, 0, sizeof(*ss));
+}
@@ -0,0 +1,68 @@
+#ifndef SMARTSHUFFLE_H
+#define SMARTSHUFFLE_H
+
+#include "shuffle.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shuffle that keeps artists and albums apart. Every track not played yet
+// has a weight, and the next one is drawn in proportion to it: full weight
+// normally, less if its artist is among the last SMART_HISTORY tracks
+// played, and least if its album is. The weights live in a Fenwick tree,
+// so a draw and a weight change take O(log n); playing a track reweighs
+// the tracks of its album and artist, and of the ones that leave the
+// history.
+
+#define SMART_HISTORY 16
+
+#define SMART_WEIGHT 64          // nothing in common with recent tracks
+#define SMART_WEIGHT_ARTIST 8    // same artist as a recent track
+#define SMART_WEIGHT_ALBUM 1     // same album as a recent track
+
+#define SMART_NO_GROUP UINT32_MAX
+
+// Zero-initialize.
+typedef struct {
+    int count;
+    int left;             // tracks not played yet
+    uint64_t *tree;       // Fenwick tree of the weights, 1-based
+    uint64_t total;       // sum of the weights
+    int tree_top;         // largest power of two <= count
+    uint8_t *weight;
+    uint8_t *played;
+
+    uint32_t *album;      // group of each track
+    uint32_t *artist;     // group of each track, or SMART_NO_GROUP
+    uint32_t *members;    // tracks of each group, one group after another
+    uint32_t *group_start;   // members of group g: [group_start[g], group_start[g + 1])
+    uint16_t *recent;     // times each group is in the history
+    uint32_t group_count;
+
+    int history[SMART_HISTORY];   // ring of the last tracks played
+    int history_count;
+    int history_next;
+} SmartShuffle;
+
+// Group count tracks by album and artist keys; equal keys are the same
+// album or artist, and an artist key of 0 means unknown. With keep, the
+// tracks played and the history carry over from the previous build, whose
+// tracks must have kept their numbers; tracks added after them are not
+// played yet. Returns false if out of memory; the shuffle is empty then.
+bool smartshuffle_build(SmartShuffle *ss, int count, const uint32_t *album_keys,
+                        const uint32_t *artist_keys, bool keep);
+
+// A random track not played yet, weighted as above, or -1 if every track
+// was played.
+int smartshuffle_draw(const SmartShuffle *ss, ShuffleRng *rng);
+
+// Record that track is playing: it isn't drawn again until
+// smartshuffle_restart(), and its album and artist join the history.
+void smartshuffle_played(SmartShuffle *ss, int track);
+
+// Make every track available again, keeping the history.
+void smartshuffle_restart(SmartShuffle *ss);
+
+void smartshuffle_free(SmartShuffle *ss);
+
+#endif
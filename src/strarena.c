@@ -0,0 +1,43 @@
+#define _DEFAULT_SOURCE
+
+#include "strarena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STRARENA_INITIAL_CAPACITY 4096
+
+bool strarena_push(StrArena *arena, const char *s, size_t len, uint32_t *offset) {
+    size_t needed = arena->used + len + 1;
+    if (needed > UINT32_MAX) return false;
+
+    if (needed > arena->capacity) {
+        size_t capacity = arena->capacity ? arena->capacity : STRARENA_INITIAL_CAPACITY;
+        while (capacity < needed) capacity *= 2;
+        char *data = realloc(arena->data, capacity);
+        if (!data) return false;
+        arena->data = data;
+        arena->capacity = capacity;
+    }
+
+    memcpy(arena->data + arena->used, s, len);
+    arena->data[arena->used + len] = '\0';
+    *offset = (uint32_t)arena->used;
+    arena->used = needed;
+    return true;
+}
+
+const char *strarena_get(const StrArena *arena, uint32_t offset) {
+    return arena->data + offset;
+}
+
+void strarena_clear(StrArena *arena) {
+    arena->used = 0;
+}
+
+void strarena_free(StrArena *arena) {
+    free(arena->data);
+    arena->data = NULL;
+    arena->used = 0;
+    arena->capacity = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef STRARENA_H
+#define STRARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Growable block of NUL-terminated strings. Strings are referred to by
+// offset, so references stay valid when the block is reallocated.
+// Zero-initialize before use.
+typedef struct {
+    char *data;
+    size_t used;
+    size_t capacity;
+} StrArena;
+
+// Append len bytes of s plus a terminator. Returns false if out of memory
+// or past 4 GB.
+bool strarena_push(StrArena *arena, const char *s, size_t len, uint32_t *offset);
+
+// String at an offset returned by strarena_push(). Valid until the next push.
+const char *strarena_get(const StrArena *arena, uint32_t offset);
+
+// Forget all strings but keep the memory.
+void strarena_clear(StrArena *arena);
+
+void strarena_free(StrArena *arena);
+
+#endif
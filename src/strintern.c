@@ -0,0 +1,86 @@
+#define _DEFAULT_SOURCE
+
+#include "strintern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STRINTERN_INITIAL_CAPACITY 256
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    return hash;
+}
+
+static bool equal(const StrIntern *intern, uint32_t offset, const char *s, size_t len) {
+    const char *stored = strarena_get(&intern->strings, offset);
+    return strncmp(stored, s, len) == 0 && stored[len] == '\0';
+}
+
+// Keep the load factor under 1/2
+static bool grow(StrIntern *intern) {
+    uint32_t capacity = intern->capacity ? intern->capacity * 2 : STRINTERN_INITIAL_CAPACITY;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots) return false;
+
+    for (uint32_t i = 0; i < intern->capacity; i++) {
+        uint32_t offset = intern->slots[i];
+        if (offset == 0) continue;
+        const char *s = strarena_get(&intern->strings, offset);
+        uint32_t slot = hash_bytes(s, strlen(s)) & (capacity - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = offset;
+    }
+
+    free(intern->slots);
+    intern->slots = slots;
+    intern->capacity = capacity;
+    return true;
+}
+
+bool strintern_add(StrIntern *intern, const char *s, size_t len, uint32_t *offset) {
+    if (intern->strings.used == 0) {
+        uint32_t empty;
+        if (!strarena_push(&intern->strings, "", 0, &empty)) return false;
+    }
+    if (len == 0) {
+        *offset = 0;
+        return true;
+    }
+    if ((intern->count + 1) * 2 > intern->capacity && !grow(intern)) return false;
+
+    uint32_t mask = intern->capacity - 1;
+    uint32_t slot = hash_bytes(s, len) & mask;
+    for (; intern->slots[slot] != 0; slot = (slot + 1) & mask) {
+        if (equal(intern, intern->slots[slot], s, len)) {
+            *offset = intern->slots[slot];
+            return true;
+        }
+    }
+
+    if (!strarena_push(&intern->strings, s, len, offset)) return false;
+    intern->slots[slot] = *offset;
+    intern->count++;
+    return true;
+}
+
+const char *strintern_get(const StrIntern *intern, uint32_t offset) {
+    if (intern->strings.used == 0) return "";
+    return strarena_get(&intern->strings, offset);
+}
+
+void strintern_clear(StrIntern *intern) {
+    strarena_clear(&intern->strings);
+    if (intern->slots) memset(intern->slots, 0, intern->capacity * sizeof(uint32_t));
+    intern->count = 0;
+}
+
+void strintern_free(StrIntern *intern) {
+    strarena_free(&intern->strings);
+    free(intern->slots);
+    intern->slots = NULL;
+    intern->capacity = 0;
+    intern->count = 0;
+}
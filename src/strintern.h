@@ -0,0 +1,32 @@
+#ifndef STRINTERN_H
+#define STRINTERN_H
+
+#include "strarena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// String arena that stores each distinct string once, so the same artist
+// or album on thousands of tracks costs one copy. Offset 0 is always the
+// empty string. Zero-initialize before use.
+typedef struct {
+    StrArena strings;
+    uint32_t *slots;    // offsets of the stored strings, 0 for an empty slot
+    uint32_t capacity;  // power of two
+    uint32_t count;
+} StrIntern;
+
+// Offset of a string equal to the len bytes of s, storing it if it's new.
+// Returns false if out of memory.
+bool strintern_add(StrIntern *intern, const char *s, size_t len, uint32_t *offset);
+
+// String at an offset returned by strintern_add(). Valid until the next add.
+const char *strintern_get(const StrIntern *intern, uint32_t offset);
+
+// Forget all strings but keep the memory.
+void strintern_clear(StrIntern *intern);
+
+void strintern_free(StrIntern *intern);
+
+#endif
@@ -0,0 +1,424 @@
+#define _DEFAULT_SOURCE
+
+#include "tags.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// First read of a file. Covers STREAMINFO and VORBIS_COMMENT of a typical
+// FLAC file, or the first two Ogg pages.
+#define TAGS_HEAD_SIZE (16 * 1024)
+
+// Comment blocks larger than this (embedded cover art) are cut; the text
+// fields come before the picture in practice
+#define TAGS_COMMENT_MAX (256 * 1024)
+
+// Searched backwards for the last Ogg page
+#define TAGS_TAIL_SIZE (64 * 1024)
+
+#define FLAC_STREAMINFO 0
+#define FLAC_VORBIS_COMMENT 4
+
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char *p) {
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+// Copy at most TAGS_FIELD_MAX - 1 bytes, stopping at a NUL and never
+// splitting a UTF-8 sequence
+static void copy_field(char *dst, const unsigned char *src, size_t len) {
+    const unsigned char *nul = memchr(src, '\0', len);
+    if (nul) len = (size_t)(nul - src);
+    if (len > TAGS_FIELD_MAX - 1) {
+        len = TAGS_FIELD_MAX - 1;
+        while (len > 0 && (src[len] & 0xC0) == 0x80) len--;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Vorbis comment structure, shared by FLAC and Ogg Vorbis. A truncated
+// one yields the fields that are complete.
+static void parse_comments(const unsigned char *p, size_t len, Tags *tags) {
+    if (len < 4) return;
+    size_t pos = 4 + (size_t)le32(p);
+    if (pos > len || len - pos < 4) return;
+    uint32_t count = le32(p + pos);
+    pos += 4;
+
+    char album_artist[TAGS_FIELD_MAX] = "";
+    for (uint32_t i = 0; i < count && len - pos >= 4; i++) {
+        size_t field_len = le32(p + pos);
+        pos += 4;
+        if (field_len > len - pos) break;
+
+        const unsigned char *field = p + pos;
+        pos += field_len;
+        const unsigned char *eq = memchr(field, '=', field_len);
+        if (!eq) continue;
+
+        size_t key_len = (size_t)(eq - field);
+        const unsigned char *value = eq + 1;
+        size_t value_len = field_len - key_len - 1;
+        char *dst = NULL;
+        if (key_len == 6 && strncasecmp((const char *)field, "ARTIST", 6) == 0) {
+            dst = tags->artist;
+        } else if (key_len == 5 && strncasecmp((const char *)field, "TITLE", 5) == 0) {
+            dst = tags->title;
+        } else if (key_len == 5 && strncasecmp((const char *)field, "ALBUM", 5) == 0) {
+            dst = tags->album;
+        } else if (key_len == 11 && strncasecmp((const char *)field, "ALBUMARTIST", 11) == 0) {
+            dst = album_artist;
+        }
+        // The first of repeated fields wins
+        if (dst && dst[0] == '\0') copy_field(dst, value, value_len);
+    }
+
+    if (tags->artist[0] == '\0') memcpy(tags->artist, album_artist, sizeof(album_artist));
+}
+
+// Bytes [offset, offset + len) of the file: from head if it has them,
+// otherwise read into *buf. Returns NULL on a short read.
+static const unsigned char *file_range(int fd, const unsigned char *head, size_t head_len,
+                                       uint64_t offset, size_t len, unsigned char **buf) {
+    if (offset + len <= head_len) return head + offset;
+
+    unsigned char *p = realloc(*buf, len ? len : 1);
+    if (!p) return NULL;
+    *buf = p;
+    ssize_t n = pread(fd, p, len, (off_t)offset);
+    return n == (ssize_t)len ? p : NULL;
+}
+
+static bool read_flac(int fd, const unsigned char *head, size_t head_len, uint64_t offset, Tags *tags) {
+    offset += 4;   // "fLaC"
+    unsigned char *buf = NULL;
+    bool have_info = false, have_comments = false, last = false;
+
+    while (!last && !(have_info && have_comments)) {
+        unsigned char header[4];
+        const unsigned char *h = file_range(fd, head, head_len, offset, 4, &buf);
+        if (!h) break;
+        memcpy(header, h, 4);
+        last = header[0] & 0x80;
+        unsigned type = header[0] & 0x7F;
+        size_t len = (size_t)header[1] << 16 | (size_t)header[2] << 8 | header[3];
+        offset += 4;
+
+        if (type == FLAC_STREAMINFO && len >= 18) {
+            const unsigned char *p = file_range(fd, head, head_len, offset, 18, &buf);
+            if (!p) break;
+            uint32_t rate = (uint32_t)p[10] << 12 | (uint32_t)p[11] << 4 | p[12] >> 4;
+            uint64_t samples = (uint64_t)(p[13] & 0x0F) << 32 | (uint64_t)p[14] << 24 |
+                               (uint64_t)p[15] << 16 | (uint64_t)p[16] << 8 | p[17];
+            if (rate > 0) tags->duration_ms = (uint32_t)(samples * 1000 / rate);
+            have_info = true;
+        } else if (type == FLAC_VORBIS_COMMENT) {
+            size_t wanted = len < TAGS_COMMENT_MAX ? len : TAGS_COMMENT_MAX;
+            const unsigned char *p = file_range(fd, head, head_len, offset, wanted, &buf);
+            if (!p) break;
+            parse_comments(p, wanted, tags);
+            have_comments = true;
+        }
+        offset += len;
+    }
+
+    free(buf);
+    return have_info || have_comments;
+}
+
+// Duration from the granule position of the last page of the stream
+static uint32_t ogg_duration(int fd, uint32_t serial, uint32_t rate) {
+    struct stat st;
+    if (rate == 0 || fstat(fd, &st) != 0 || st.st_size < 27) return 0;
+
+    size_t len = st.st_size < TAGS_TAIL_SIZE ? (size_t)st.st_size : TAGS_TAIL_SIZE;
+    unsigned char *tail = malloc(len);
+    if (!tail) return 0;
+
+    uint32_t duration = 0;
+    if (pread(fd, tail, len, (off_t)(st.st_size - (off_t)len)) == (ssize_t)len) {
+        for (size_t i = len - 27 + 1; i-- > 0;) {
+            if (memcmp(tail + i, "OggS", 4) != 0 || tail[i + 4] != 0) continue;
+            uint64_t granule = le64(tail + i + 6);
+            if (le32(tail + i + 14) != serial || granule == UINT64_MAX) continue;
+            duration = (uint32_t)(granule * 1000 / rate);
+            break;
+        }
+    }
+    free(tail);
+    return duration;
+}
+
+// Walk the pages of the first logical stream, collecting the
+// identification and comment packets
+static bool read_ogg(int fd, const unsigned char *head, size_t head_len, Tags *tags) {
+    unsigned char *buf = NULL;
+    unsigned char *packet = NULL;
+    size_t packet_len = 0, packet_capacity = 0;
+    int packet_index = 0;
+    uint32_t serial = 0, rate = 0;
+    uint64_t offset = 0;
+    bool ok = false, done = false;
+
+    while (!done) {
+        const unsigned char *page = file_range(fd, head, head_len, offset, 27, &buf);
+        if (!page || memcmp(page, "OggS", 4) != 0) break;
+        uint32_t page_serial = le32(page + 14);
+        unsigned segments = page[26];
+        if (offset == 0) serial = page_serial;
+
+        unsigned char lacing[255];
+        const unsigned char *table = file_range(fd, head, head_len, offset + 27, segments, &buf);
+        if (!table) break;
+        memcpy(lacing, table, segments);
+        size_t body_len = 0;
+        for (unsigned i = 0; i < segments; i++) body_len += lacing[i];
+
+        uint64_t body_offset = offset + 27 + segments;
+        offset = body_offset + body_len;
+        if (page_serial != serial) continue;   // another multiplexed stream
+
+        const unsigned char *body = file_range(fd, head, head_len, body_offset, body_len, &buf);
+        if (!body) break;
+
+        size_t pos = 0;
+        for (unsigned i = 0; i < segments && !done; i++) {
+            size_t seg = lacing[i];
+            if (packet_len + seg > TAGS_COMMENT_MAX) {
+                // Embedded cover art; the text fields are in what fits
+                if (packet_index == 1) parse_comments(packet + 7, packet_len - 7, tags);
+                ok = packet_index == 1;
+                done = true;
+                break;
+            }
+            if (packet_len + seg > packet_capacity) {
+                size_t capacity = packet_capacity ? packet_capacity * 2 : 4096;
+                while (capacity < packet_len + seg) capacity *= 2;
+                unsigned char *p = realloc(packet, capacity);
+                if (!p) {
+                    done = true;
+                    break;
+                }
+                packet = p;
+                packet_capacity = capacity;
+            }
+            memcpy(packet + packet_len, body + pos, seg);
+            packet_len += seg;
+            pos += seg;
+            if (seg == 255) continue;   // packet goes on
+
+            // A whole packet
+            if (packet_index == 0) {
+                if (packet_len < 16 || packet[0] != 1 || memcmp(packet + 1, "vorbis", 6) != 0) {
+                    done = true;
+                    break;
+                }
+                rate = le32(packet + 12);
+            } else {
+                if (packet_len >= 7 && packet[0] == 3 && memcmp(packet + 1, "vorbis", 6) == 0) {
+                    parse_comments(packet + 7, packet_len - 7, tags);
+                }
+                ok = true;
+                done = true;
+            }
+            packet_index++;
+            packet_len = 0;
+        }
+    }
+
+    if (rate > 0) {
+        tags->duration_ms = ogg_duration(fd, serial, rate);
+        ok = true;
+    }
+    free(buf);
+    free(packet);
+    return ok;
+}
+
+bool tags_read(const char *path, Tags *tags) {
+    memset(tags, 0, sizeof(*tags));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    unsigned char head[TAGS_HEAD_SIZE];
+    ssize_t n = pread(fd, head, sizeof(head), 0);
+    size_t head_len = n > 0 ? (size_t)n : 0;
+
+    // FLAC files sometimes start with an ID3v2 tag
+    uint64_t offset = 0;
+    if (head_len >= 10 && memcmp(head, "ID3", 3) == 0) {
+        offset = 10 + ((uint64_t)(head[6] & 0x7F) << 21 | (uint64_t)(head[7] & 0x7F) << 14 |
+                       (uint64_t)(head[8] & 0x7F) << 7 | (head[9] & 0x7F));
+        if (head[5] & 0x10) offset += 10;   // footer
+    }
+
+    bool ok = false;
+    unsigned char magic[4];
+    unsigned char *buf = NULL;
+    const unsigned char *m = file_range(fd, head, head_len, offset, 4, &buf);
+    if (m) memcpy(magic, m, 4);
+    free(buf);
+
+    if (m && memcmp(magic, "fLaC", 4) == 0) {
+        ok = read_flac(fd, head, head_len, offset, tags);
+    } else if (head_len >= 4 && memcmp(head, "OggS", 4) == 0) {
+        ok = read_ogg(fd, head, head_len, tags);
+    }
+
+    close(fd);
+    return ok;
+}
+
+// Background reading
+
+struct TagReader {
+    int refs;   // the owner plus every queued or running job
+
+    pthread_mutex_t lock;   // guards the batch list
+    TagBatch *head;
+    TagBatch *tail;
+
+    uint64_t files;         // counters updated with __atomic builtins
+    uint64_t failed;
+    uint64_t read_ns;
+};
+
+typedef struct {
+    TagReader *reader;
+    uint32_t generation;
+    uint32_t count;
+    uint32_t *tracks;
+    uint32_t *paths;   // offsets into strings
+    char *strings;
+} TagJob;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void unref(TagReader *reader) {
+    if (__atomic_sub_fetch(&reader->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    TagBatch *batch = reader->head;
+    while (batch) {
+        TagBatch *next = batch->next;
+        free(batch);
+        batch = next;
+    }
+    pthread_mutex_destroy(&reader->lock);
+    free(reader);
+}
+
+static void tag_job(void *arg, const PoolToken *token) {
+    TagJob *job = arg;
+    TagReader *reader = job->reader;
+
+    TagBatch *batch = pool_cancelled(token) ? NULL :
+        malloc(sizeof(TagBatch) + job->count * sizeof(TagResult));
+    if (batch) {
+        batch->next = NULL;
+        batch->generation = job->generation;
+        batch->count = 0;
+        for (uint32_t i = 0; i < job->count; i++) {
+            if (pool_cancelled(token)) {
+                free(batch);
+                batch = NULL;
+                break;
+            }
+            TagResult *result = &batch->results[batch->count++];
+            result->track = job->tracks[i];
+
+            uint64_t start = now_ns();
+            errno = 0;
+            result->ok = tags_read(job->strings + job->paths[i], &result->tags);
+            result->missing = !result->ok && errno == ENOENT;
+            __atomic_fetch_add(&reader->read_ns, now_ns() - start, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&reader->files, 1, __ATOMIC_RELAXED);
+            if (!result->ok) __atomic_fetch_add(&reader->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (batch) {
+        pthread_mutex_lock(&reader->lock);
+        if (reader->tail) reader->tail->next = batch;
+        else reader->head = batch;
+        reader->tail = batch;
+        pthread_mutex_unlock(&reader->lock);
+    }
+    free(job);
+    unref(reader);
+}
+
+TagReader *tagreader_create(void) {
+    TagReader *reader = calloc(1, sizeof(TagReader));
+    if (!reader) return NULL;
+    reader->refs = 1;
+    pthread_mutex_init(&reader->lock, NULL);
+    return reader;
+}
+
+bool tagreader_submit(TagReader *reader, PoolLane lane, PoolGroup *group, uint32_t generation,
+                      const uint32_t *tracks, const char *const *paths, uint32_t count) {
+    size_t strings_size = 0;
+    for (uint32_t i = 0; i < count; i++) strings_size += strlen(paths[i]) + 1;
+
+    // One block: the job, track ids, path offsets, then the paths
+    TagJob *job = malloc(sizeof(TagJob) + count * 2 * sizeof(uint32_t) + strings_size);
+    if (!job) return false;
+    job->reader = reader;
+    job->generation = generation;
+    job->count = count;
+    job->tracks = (uint32_t *)(job + 1);
+    job->paths = job->tracks + count;
+    job->strings = (char *)(job->paths + count);
+
+    size_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t len = strlen(paths[i]) + 1;
+        job->tracks[i] = tracks[i];
+        job->paths[i] = (uint32_t)used;
+        memcpy(job->strings + used, paths[i], len);
+        used += len;
+    }
+
+    __atomic_fetch_add(&reader->refs, 1, __ATOMIC_RELAXED);
+    if (!pool_submit(lane, group, tag_job, job)) {
+        free(job);
+        unref(reader);
+        return false;
+    }
+    return true;
+}
+
+TagBatch *tagreader_take(TagReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    TagBatch *batches = reader->head;
+    reader->head = NULL;
+    reader->tail = NULL;
+    pthread_mutex_unlock(&reader->lock);
+    return batches;
+}
+
+void tagreader_get_stats(TagReader *reader, TagReaderStats *stats) {
+    stats->files = __atomic_load_n(&reader->files, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&reader->failed, __ATOMIC_RELAXED);
+    stats->read_ms = (double)__atomic_load_n(&reader->read_ns, __ATOMIC_RELAXED) / 1e6;
+}
+
+void tagreader_free(TagReader *reader) {
+    if (reader) unref(reader);
+}
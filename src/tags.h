@@ -0,0 +1,70 @@
+#ifndef TAGS_H
+#define TAGS_H
+
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Artist, title, album and duration of FLAC and Ogg Vorbis files, read
+// straight from the container headers: no decoder is set up and only the
+// first metadata blocks or pages are read, plus the last page of an Ogg
+// file for its length. A file costs one or two small reads.
+
+#define TAGS_FIELD_MAX 256
+
+typedef struct {
+    char artist[TAGS_FIELD_MAX];   // empty if absent
+    char title[TAGS_FIELD_MAX];
+    char album[TAGS_FIELD_MAX];
+    uint32_t duration_ms;          // 0 if unknown
+} Tags;
+
+// Returns false if the file can't be read or isn't FLAC or Ogg Vorbis;
+// errno is set if it can't be opened. Values are cut at
+// TAGS_FIELD_MAX - 1 bytes on a UTF-8 boundary.
+bool tags_read(const char *path, Tags *tags);
+
+// Reads tags on the worker pool. Files are submitted in groups; each group
+// comes back as one batch in the order they finish.
+
+typedef struct {
+    uint32_t track;   // the caller's id for the file
+    bool ok;
+    bool missing;     // the file doesn't exist
+    Tags tags;
+} TagResult;
+
+typedef struct TagBatch {
+    struct TagBatch *next;
+    uint32_t generation;   // as passed to tagreader_submit()
+    uint32_t count;
+    TagResult results[];
+} TagBatch;
+
+typedef struct {
+    uint64_t files;        // read so far, including failures
+    uint64_t failed;
+    double read_ms;        // time spent in tags_read(), summed over workers
+} TagReaderStats;
+
+typedef struct TagReader TagReader;
+
+TagReader *tagreader_create(void);
+
+// Queue reading count files as one job. paths are copied. Jobs cancelled
+// through group return no batch. Returns false if the pool isn't running
+// or memory runs out.
+bool tagreader_submit(TagReader *reader, PoolLane lane, PoolGroup *group, uint32_t generation,
+                      const uint32_t *tracks, const char *const *paths, uint32_t count);
+
+// Detach the finished batches, oldest first. Release each with free().
+TagBatch *tagreader_take(TagReader *reader);
+
+void tagreader_get_stats(TagReader *reader, TagReaderStats *stats);
+
+// Release the reader. Jobs still queued keep it alive until they finish;
+// cancel their group first to make that quick.
+void tagreader_free(TagReader *reader);
+
+#endif
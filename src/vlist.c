@@ -0,0 +1,107 @@
+#define _DEFAULT_SOURCE
+
+#include "vlist.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Time constant of smooth scrolling: the gap shrinks by 1/e every this
+// many seconds, so a page settles in about a fifth of a second
+#define VLIST_GLIDE_SECONDS 0.05
+
+static int clamp_top(const VList *vl, int top, int count) {
+    if (top > count - vl->rows) top = count - vl->rows;
+    return top < 0 ? 0 : top;
+}
+
+// Head for top, from at most a screen away
+static void scroll_to(VList *vl, int top) {
+    vl->top = top;
+    if (!vl->smooth) {
+        vl->scroll = top;
+    } else if (vl->scroll < top - vl->rows) {
+        vl->scroll = top - vl->rows;
+    } else if (vl->scroll > top + vl->rows) {
+        vl->scroll = top + vl->rows;
+    }
+}
+
+void vlist_init(VList *vl, int rows, bool smooth) {
+    vl->rows = rows > 0 ? rows : 1;
+    vl->top = 0;
+    vl->scroll = 0.0;
+    vl->smooth = smooth;
+}
+
+void vlist_free(VList *vl) {
+    free(vl->cache);
+    vl->cache = NULL;
+}
+
+int vlist_move(const VList *vl, int selected, int count, VListMove move) {
+    if (count <= 0) return 0;
+    switch (move) {
+        case VLIST_UP:        selected--; break;
+        case VLIST_DOWN:      selected++; break;
+        case VLIST_PAGE_UP:   selected -= vl->rows - 1; break;
+        case VLIST_PAGE_DOWN: selected += vl->rows - 1; break;
+        case VLIST_HOME:      selected = 0; break;
+        case VLIST_END:       selected = count - 1; break;
+    }
+    if (selected >= count) selected = count - 1;
+    return selected < 0 ? 0 : selected;
+}
+
+void vlist_follow(VList *vl, int selected, int count) {
+    int top = vl->top;
+    if (selected < top) top = selected;
+    if (selected >= top + vl->rows) top = selected - vl->rows + 1;
+    top = clamp_top(vl, top, count);
+    if (top != vl->top) scroll_to(vl, top);
+}
+
+void vlist_scroll_by(VList *vl, int rows, int count) {
+    scroll_to(vl, clamp_top(vl, vl->top + rows, count));
+}
+
+void vlist_reset(VList *vl, int row) {
+    vl->top = row > 0 ? row : 0;
+    vl->scroll = vl->top;
+}
+
+bool vlist_animate(VList *vl, double dt) {
+    double gap = vl->top - vl->scroll;
+    if (gap == 0.0) return false;
+    gap *= exp(-dt / VLIST_GLIDE_SECONDS);
+    vl->scroll = fabs(gap) < 0.01 ? vl->top : vl->top - gap;
+    return true;
+}
+
+int vlist_first(const VList *vl, double *offset) {
+    int first = (int)floor(vl->scroll);
+    *offset = vl->scroll - first;
+    return first;
+}
+
+const char *vlist_text(VList *vl, int row, uint32_t generation, VListFormatFn format, void *user) {
+    if (!vl->cache) {
+        vl->cache = malloc(VLIST_CACHE * sizeof(VListText));
+        for (int i = 0; vl->cache && i < VLIST_CACHE; i++) vl->cache[i].row = -1;
+    }
+    if (!vl->cache) {
+        format(user, row, vl->scratch, sizeof(vl->scratch));
+        vl->stats.formatted++;
+        return vl->scratch;
+    }
+
+    VListText *entry = &vl->cache[row & (VLIST_CACHE - 1)];
+    if (entry->row == row && entry->generation == generation) {
+        vl->stats.cached++;
+        return entry->text;
+    }
+    format(user, row, entry->text, sizeof(entry->text));
+    entry->row = row;
+    entry->generation = generation;
+    vl->stats.formatted++;
+    return entry->text;
+}
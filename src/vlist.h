@@ -0,0 +1,80 @@
+#ifndef VLIST_H
+#define VLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Scrolling and row text for the long lists (playlist, search results,
+// browser). Nothing here depends on how many rows there are: a frame only
+// looks at the rows on screen, and their text is formatted once and kept
+// in a small cache keyed by row until the caller says the texts changed.
+//
+// The view scrolls smoothly: top is where it is headed, scroll where it
+// is now, and vlist_animate() closes the gap a little every frame. Jumps
+// of more than a screen start one screen short of the target, so End in a
+// million rows looks the same as Page Down.
+
+#define VLIST_TEXT_MAX 320
+#define VLIST_CACHE 128   // rows whose text is kept, a power of two
+
+typedef enum {
+    VLIST_UP,
+    VLIST_DOWN,
+    VLIST_PAGE_UP,
+    VLIST_PAGE_DOWN,
+    VLIST_HOME,
+    VLIST_END
+} VListMove;
+
+// Writes the text of a row; the row model of a list
+typedef void (*VListFormatFn)(void *user, int row, char *buf, size_t size);
+
+typedef struct {
+    int row;               // -1 if unused
+    uint32_t generation;
+    char text[VLIST_TEXT_MAX];
+} VListText;
+
+typedef struct {
+    uint64_t formatted;    // rows formatted
+    uint64_t cached;       // rows taken from the cache
+} VListStats;
+
+// Zero-initialize, then vlist_init(). Release with vlist_free().
+typedef struct {
+    int rows;              // rows that fit on screen
+    int top;               // first row once scrolling settles
+    double scroll;         // first row now, fractional while moving
+    bool smooth;
+    VListText *cache;      // direct-mapped, allocated on first use
+    char scratch[VLIST_TEXT_MAX];   // for the text without a cache
+    VListStats stats;
+} VList;
+
+void vlist_init(VList *vl, int rows, bool smooth);
+void vlist_free(VList *vl);
+
+// The row a key moves the selection to, in a list of count rows
+int vlist_move(const VList *vl, int selected, int count, VListMove move);
+
+// Scroll as little as needed to show the selected row
+void vlist_follow(VList *vl, int selected, int count);
+
+// Scroll by rows (mouse wheel), leaving the selection where it is
+void vlist_scroll_by(VList *vl, int rows, int count);
+
+// Show row at the top at once, without scrolling there
+void vlist_reset(VList *vl, int row);
+
+// Move scroll toward top over dt seconds. Returns true while it moves.
+bool vlist_animate(VList *vl, double dt);
+
+// First row to draw and how far up it is shifted, in rows (0 to 1)
+int vlist_first(const VList *vl, double *offset);
+
+// Text of a row: cached if it was formatted under the same generation,
+// which the caller changes whenever the texts may have.
+const char *vlist_text(VList *vl, int row, uint32_t generation, VListFormatFn format, void *user);
+
+#endif
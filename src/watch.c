@@ -0,0 +1,200 @@
+#define _DEFAULT_SOURCE
+
+#include "watch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+// One per watch descriptor; the kernel hands them out counting up
+typedef struct {
+    uint32_t id;
+    bool active;
+    bool pending;
+    bool gone;
+    double first_ms;   // first event since the directory was last reported
+} WatchEntry;
+
+struct Watch {
+    int fd;
+    WatchEntry *entries;   // indexed by watch descriptor
+    int entry_capacity;
+
+    int *pending;          // descriptors with unreported events, oldest first
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+
+    WatchChange *changes;  // returned by watch_poll()
+    uint32_t change_capacity;
+
+    double last_event_ms;
+    bool overflow;
+};
+
+static double monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+Watch *watch_open(void) {
+    Watch *watch = calloc(1, sizeof(Watch));
+    if (!watch) return NULL;
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        free(watch);
+        return NULL;
+    }
+    return watch;
+}
+
+void watch_close(Watch *watch) {
+    if (!watch) return;
+    close(watch->fd);
+    free(watch->entries);
+    free(watch->pending);
+    free(watch->changes);
+    free(watch);
+}
+
+bool watch_add(Watch *watch, const char *path, uint32_t id) {
+    int wd = inotify_add_watch(watch->fd, path, WATCH_MASK);
+    if (wd < 0) return false;
+
+    if (wd >= watch->entry_capacity) {
+        int capacity = watch->entry_capacity ? watch->entry_capacity : 64;
+        while (capacity <= wd) capacity *= 2;
+        WatchEntry *entries = realloc(watch->entries, (size_t)capacity * sizeof(WatchEntry));
+        if (!entries) {
+            inotify_rm_watch(watch->fd, wd);
+            return false;
+        }
+        memset(entries + watch->entry_capacity, 0,
+               (size_t)(capacity - watch->entry_capacity) * sizeof(WatchEntry));
+        watch->entries = entries;
+        watch->entry_capacity = capacity;
+    }
+
+    WatchEntry *entry = &watch->entries[wd];
+    entry->id = id;
+    entry->active = true;
+    entry->gone = false;
+    return true;
+}
+
+void watch_remove(Watch *watch, uint32_t id) {
+    for (int wd = 0; wd < watch->entry_capacity; wd++) {
+        WatchEntry *entry = &watch->entries[wd];
+        if (entry->active && entry->id == id) {
+            inotify_rm_watch(watch->fd, wd);
+            entry->active = false;
+            entry->pending = false;   // dropped from the list on the next poll
+        }
+    }
+}
+
+static void mark_pending(Watch *watch, int wd, double now) {
+    if (wd < 0 || wd >= watch->entry_capacity) return;
+    WatchEntry *entry = &watch->entries[wd];
+    if (!entry->active && !entry->gone) return;
+    if (entry->pending) return;
+
+    if (watch->pending_count == watch->pending_capacity) {
+        uint32_t capacity = watch->pending_capacity ? watch->pending_capacity * 2 : 64;
+        int *pending = realloc(watch->pending, capacity * sizeof(int));
+        if (!pending) {
+            watch->overflow = true;   // report everything rather than lose this
+            return;
+        }
+        watch->pending = pending;
+        watch->pending_capacity = capacity;
+    }
+    watch->pending[watch->pending_count++] = wd;
+    entry->pending = true;
+    entry->first_ms = now;
+}
+
+static void read_events(Watch *watch, double now) {
+    // Aligned for struct inotify_event
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(watch->fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            break;   // EAGAIN: drained
+        }
+
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            watch->last_event_ms = now;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                watch->overflow = true;
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watch->entry_capacity) continue;
+
+            WatchEntry *entry = &watch->entries[event->wd];
+            if (event->mask & IN_MOVE_SELF) {
+                // Its path no longer leads to it; IN_IGNORED follows
+                inotify_rm_watch(watch->fd, event->wd);
+            }
+            if ((event->mask & IN_IGNORED) && entry->active) {
+                entry->active = false;
+                entry->gone = true;
+            }
+            mark_pending(watch, event->wd, now);
+        }
+    }
+}
+
+const WatchChange *watch_poll(Watch *watch, uint32_t *count, bool *overflow) {
+    double now = monotonic_ms();
+    read_events(watch, now);
+
+    *count = 0;
+    *overflow = false;
+    bool settled = now - watch->last_event_ms >= WATCH_SETTLE_MS;
+    if (watch->overflow && settled) {
+        *overflow = true;
+        watch->overflow = false;
+    }
+    if (watch->pending_count == 0) return watch->changes;
+
+    if (watch->change_capacity < watch->pending_count) {
+        WatchChange *changes = realloc(watch->changes, watch->pending_count * sizeof(WatchChange));
+        if (!changes) return watch->changes;
+        watch->changes = changes;
+        watch->change_capacity = watch->pending_count;
+    }
+
+    // Report what has settled, keep the rest in order
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < watch->pending_count; i++) {
+        int wd = watch->pending[i];
+        WatchEntry *entry = &watch->entries[wd];
+        if (!entry->pending) continue;   // removed meanwhile
+
+        if (settled || now - entry->first_ms >= WATCH_MAX_DELAY_MS) {
+            watch->changes[*count].id = entry->id;
+            watch->changes[*count].gone = entry->gone;
+            (*count)++;
+            entry->pending = false;
+            entry->gone = false;
+        } else {
+            watch->pending[kept++] = wd;
+        }
+    }
+    watch->pending_count = kept;
+    return watch->changes;
+}
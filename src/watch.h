@@ -0,0 +1,46 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Directory change notification with inotify. Only the entries of a
+// directory are watched (files created, deleted, renamed or written), not
+// its subdirectories. Changes are reported per directory, under the id the
+// caller gave it, once they have settled: a directory is reported when no
+// event arrived for WATCH_SETTLE_MS, or WATCH_MAX_DELAY_MS after its first
+// event during a long burst. An rsync of a whole album is one report, not
+// one per file.
+//
+// Everything runs on the caller's thread; watch_poll() never blocks.
+
+#define WATCH_SETTLE_MS 250
+#define WATCH_MAX_DELAY_MS 2000
+
+typedef struct {
+    uint32_t id;
+    bool gone;   // the directory was deleted or moved away; no longer watched
+} WatchChange;
+
+typedef struct Watch Watch;
+
+// Returns NULL if inotify isn't available
+Watch *watch_open(void);
+void watch_close(Watch *watch);
+
+// Watch the directory at path and report it as id. Watching the same
+// directory again replaces its id. Returns false if it can't be watched,
+// e.g. because fs.inotify.max_user_watches has been reached.
+bool watch_add(Watch *watch, const char *path, uint32_t id);
+
+// Stop watching the directory reported as id. Its pending changes are
+// dropped.
+void watch_remove(Watch *watch, uint32_t id);
+
+// Read the events that arrived since the last call and return the
+// directories whose changes have settled, each once, valid until the next
+// call. *overflow is set if the kernel dropped events: any directory may
+// have changed.
+const WatchChange *watch_poll(Watch *watch, uint32_t *count, bool *overflow);
+
+#endif
@@ -0,0 +1,208 @@
+// Benchmark for browser listings: reads a directory of ENTRIES playlist
+// files on the worker pool and times type-ahead (dirlist_seek()) in it.
+// Before that, it checks type-ahead in a small directory of year-named and
+// zero-padded names, which natural order doesn't keep together by prefix,
+// and checks random prefixes in the large one against a linear scan. It
+// exits with 1 if any seek lands elsewhere. Everything goes to a temporary
+// directory, removed afterwards.
+//
+// Usage: dirbench [ENTRIES]   (default 100000)
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700   // nftw()
+
+#include "dirlist.h"
+#include "pool.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHECKED_PREFIXES 500
+#define TIMED_SEEKS 100000
+
+static const char *const small_dirs[] = {
+    "1999 Album", "200 Tracks", "2001 A Space Odyssey", "19 Songs", "01 Intro", "1 Intro",
+    "010 Ten", "10 Ten", "Abba", "abacus",
+};
+static const char *const small_files[] = { "1998.m3u", "01 list.m3u" };
+
+// Prefix typed and the entry it must select
+static const char *const small_seeks[][2] = {
+    { "19", "19 Songs" },     { "199", "1999 Album" },   { "20", "200 Tracks" },
+    { "2001", "2001 A Space Odyssey" },                  { "01", "01 Intro" },
+    { "010", "010 Ten" },     { "1 ", "1 Intro" },       { "10", "10 Ten" },
+    { "AB", "abacus" },       { "abb", "Abba" },         { "1998", "1998.m3u" },
+    { "01 l", "01 list.m3u" }, { "3", "abacus" },        { "zz", "1998.m3u" },
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned int next_random(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static bool touch(const char *dir, const char *name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+}
+
+static const DirListing *read_listing(DirList *dl, const char *path) {
+    const DirListing *listing = dirlist_get(dl, path);
+    while (listing && (!listing->done || listing->reading || listing->pending > 0)) {
+        struct timespec tick = { 0, 1000000 };
+        nanosleep(&tick, NULL);
+        dirlist_poll(dl);
+    }
+    return listing;
+}
+
+// What dirlist_seek() promises, the slow way: a match before anything
+// else, a directory before a playlist file, then case-folded byte order;
+// without a match, the entry that follows prefix, or the last entry
+static uint32_t expected_seek(const DirListing *listing, const char *prefix) {
+    size_t len = strlen(prefix);
+    uint32_t best = listing->count;
+    int best_rank = 4;
+    for (uint32_t i = 0; i < listing->count; i++) {
+        const char *name = dirlist_name(listing, i);
+        bool matches = strncasecmp(name, prefix, len) == 0;
+        if (!matches && strcasecmp(name, prefix) < 0) continue;
+        int rank = (matches ? 0 : 2) + (listing->entries[i].kind == DIRLIST_DIR ? 0 : 1);
+        if (rank < best_rank || (rank == best_rank && strcasecmp(name, dirlist_name(listing, best)) < 0)) {
+            best = i;
+            best_rank = rank;
+        }
+    }
+    return best < listing->count ? best : listing->count - 1;
+}
+
+static int check_small(const char *root, bool locale_sort) {
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s/small", root);
+    mkdir(dir, 0755);
+    for (size_t i = 0; i < sizeof(small_dirs) / sizeof(small_dirs[0]); i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, small_dirs[i]);
+        mkdir(path, 0755);
+    }
+    for (size_t i = 0; i < sizeof(small_files) / sizeof(small_files[0]); i++) touch(dir, small_files[i]);
+
+    DirList *dl = dirlist_open(locale_sort, NULL);
+    const DirListing *listing = dl ? read_listing(dl, dir) : NULL;
+    if (!listing) {
+        fprintf(stderr, "dirbench: can't list %s\n", dir);
+        dirlist_close(dl);
+        return 1;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(small_seeks) / sizeof(small_seeks[0]); i++) {
+        const char *got = dirlist_name(listing, dirlist_seek(listing, small_seeks[i][0]));
+        if (strcmp(got, small_seeks[i][1]) != 0) {
+            fprintf(stderr, "dirbench: %s sort: \"%s\" selected \"%s\", not \"%s\"\n",
+                    locale_sort ? "locale" : "natural", small_seeks[i][0], got, small_seeks[i][1]);
+            failures++;
+        }
+    }
+    printf("check   %s sort: %zu prefixes, %d wrong\n", locale_sort ? "locale" : "natural",
+           sizeof(small_seeks) / sizeof(small_seeks[0]), failures);
+    dirlist_close(dl);
+    return failures > 0;
+}
+
+int main(int argc, char *argv[]) {
+    int entries = argc > 1 ? atoi(argv[1]) : 100000;
+    if (entries <= 0) entries = 1;
+    setlocale(LC_ALL, "");
+
+    char tmp[] = "/tmp/dirbench-XXXXXX";
+    if (!mkdtemp(tmp)) {
+        fprintf(stderr, "dirbench: can't create %s\n", tmp);
+        return 1;
+    }
+    if (!pool_init(0)) {
+        fprintf(stderr, "dirbench: failed to start worker pool\n");
+        return 1;
+    }
+
+    int status = check_small(tmp, false) | check_small(tmp, true);
+
+    // Years, zero-padded track numbers and words, as in a music library
+    char big[256];
+    snprintf(big, sizeof(big), "%s/big", tmp);
+    mkdir(big, 0755);
+    unsigned int state = 1;
+    for (int i = 0; i < entries; i++) {
+        char name[64];
+        unsigned int r = next_random(&state);
+        switch (r % 3) {
+            case 0: snprintf(name, sizeof(name), "%u Album %d.m3u", 1950 + r / 3 % 80, i); break;
+            case 1: snprintf(name, sizeof(name), "%02u Track %d.m3u", r / 3 % 120, i); break;
+            default: snprintf(name, sizeof(name), "%c%c list %d.m3u", 'a' + r / 3 % 26, 'A' + r / 78 % 26, i); break;
+        }
+        if (!touch(big, name)) {
+            fprintf(stderr, "dirbench: can't create files in %s\n", big);
+            nftw(tmp, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+            return 1;
+        }
+    }
+
+    DirList *dl = dirlist_open(false, NULL);
+    double start = now_ms();
+    const DirListing *listing = dl ? read_listing(dl, big) : NULL;
+    double list_ms = now_ms() - start;
+    if (!listing || listing->count == 0) {
+        fprintf(stderr, "dirbench: can't list %s\n", big);
+        status = 1;
+    } else {
+        printf("list    %u entries in %.1f ms\n", listing->count, list_ms);
+
+        char prefixes[CHECKED_PREFIXES][8];
+        int wrong = 0;
+        for (int i = 0; i < CHECKED_PREFIXES; i++) {
+            // Start of a random name, one to five bytes, case flipped at times
+            const char *name = dirlist_name(listing, next_random(&state) % listing->count);
+            size_t len = 1 + next_random(&state) % 5;
+            snprintf(prefixes[i], sizeof(prefixes[i]), "%.*s", (int)len, name);
+            if (next_random(&state) % 2) prefixes[i][0] ^= 0x20 * (prefixes[i][0] >= 'a');
+            if (dirlist_seek(listing, prefixes[i]) != expected_seek(listing, prefixes[i])) {
+                if (wrong++ < 5) fprintf(stderr, "dirbench: \"%s\" selected the wrong entry\n", prefixes[i]);
+            }
+        }
+        printf("check   %d random prefixes, %d wrong\n", CHECKED_PREFIXES, wrong);
+        if (wrong > 0) status = 1;
+
+        volatile uint32_t sink = 0;
+        start = now_ms();
+        for (int i = 0; i < TIMED_SEEKS; i++) sink += dirlist_seek(listing, prefixes[i % CHECKED_PREFIXES]);
+        (void)sink;
+        printf("seek    %.2f us each\n", (now_ms() - start) * 1000.0 / TIMED_SEEKS);
+    }
+    dirlist_close(dl);
+
+    nftw(tmp, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return status;
+}
@@ -0,0 +1,129 @@
+// Benchmark for frame-parallel FLAC decoding: decodes one long file with
+// 1 to 16 decoder instances and reports wall time, speedup over one
+// instance and the decoder time summed over the threads. The peak sample
+// is checked to be the same in every run.
+//
+// Usage: flacbench [FILE]   (default: a synthetic 20-minute stereo file)
+#define _DEFAULT_SOURCE
+
+#include "flacpar.h"
+
+#include <FLAC/stream_encoder.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MINUTES 20
+#define RATE 44100
+#define CHANNELS 2
+#define BLOCK 4096   // sample frames handed to the encoder at a time
+
+static const int thread_counts[] = { 1, 2, 3, 4, 6, 8, 12, 16 };
+
+static unsigned int next_random(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// A few drifting tones over a little noise, so the encoder can't shrink
+// the frames to nothing
+static bool make_file(const char *path) {
+    FLAC__StreamEncoder *enc = FLAC__stream_encoder_new();
+    if (!enc) return false;
+    uint64_t total = (uint64_t)MINUTES * 60 * RATE;
+    FLAC__stream_encoder_set_channels(enc, CHANNELS);
+    FLAC__stream_encoder_set_bits_per_sample(enc, 16);
+    FLAC__stream_encoder_set_sample_rate(enc, RATE);
+    FLAC__stream_encoder_set_compression_level(enc, 5);
+    FLAC__stream_encoder_set_total_samples_estimate(enc, total);
+    if (FLAC__stream_encoder_init_file(enc, path, NULL, NULL) != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        FLAC__stream_encoder_delete(enc);
+        return false;
+    }
+
+    static FLAC__int32 block[BLOCK * CHANNELS];
+    unsigned int state = 1;
+    bool ok = true;
+    for (uint64_t at = 0; ok && at < total; at += BLOCK) {
+        unsigned int frames = total - at < BLOCK ? (unsigned int)(total - at) : BLOCK;
+        for (unsigned int i = 0; i < frames; i++) {
+            double t = (double)(at + i) / RATE;
+            double tone = 0.3 * sin(2 * M_PI * (220.0 + 20.0 * sin(t / 7.0)) * t) +
+                          0.2 * sin(2 * M_PI * 331.0 * t);
+            for (int c = 0; c < CHANNELS; c++) {
+                int noise = (int)(next_random(&state) % 512) - 256;
+                block[i * CHANNELS + c] = (FLAC__int32)(tone * (c ? 20000 : 24000)) + noise;
+            }
+        }
+        ok = FLAC__stream_encoder_process_interleaved(enc, block, frames);
+    }
+    ok = FLAC__stream_encoder_finish(enc) && ok;
+    FLAC__stream_encoder_delete(enc);
+    return ok;
+}
+
+// Stands in for an analysis pass: the peak over all channels
+static void on_block(const FlacParInfo *info, const float *samples, size_t frames, uint64_t first_frame,
+                     void *user) {
+    (void)first_frame;
+    float *peak = user;
+    size_t n = frames * info->channels;
+    for (size_t i = 0; i < n; i++) {
+        float v = fabsf(samples[i]);
+        if (v > *peak) *peak = v;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char made[4096] = "";
+    const char *path = argc > 1 ? argv[1] : NULL;
+    if (!path) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(made, sizeof(made), "%s/flacbench-%d.flac", tmp && tmp[0] ? tmp : "/tmp", (int)getpid());
+        if (!make_file(made)) {
+            fprintf(stderr, "flacbench: can't write %s\n", made);
+            unlink(made);
+            return 1;
+        }
+        path = made;
+    }
+
+    FlacParInfo info;
+    if (!flacpar_probe(path, &info)) {
+        fprintf(stderr, "flacbench: %s is not a FLAC file\n", path);
+        if (made[0]) unlink(made);
+        return 1;
+    }
+    printf("file    %.1f min, %u Hz, %u channels, %u bits; %ld CPUs\n",
+           info.sample_rate ? (double)info.total_samples / info.sample_rate / 60.0 : 0.0,
+           info.sample_rate, info.channels, info.bits_per_sample, sysconf(_SC_NPROCESSORS_ONLN));
+
+    double base = 0.0;
+    float base_peak = 0.0f;
+    int status = 0;
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        float peak = 0.0f;
+        FlacParStats stats;
+        if (!flacpar_decode(path, thread_counts[i], on_block, &peak, &stats)) {
+            fprintf(stderr, "flacbench: decoding with %d threads failed\n", thread_counts[i]);
+            status = 1;
+            break;
+        }
+        if (i == 0) {
+            base = stats.wall_seconds;
+            base_peak = peak;
+        } else if (peak != base_peak) {
+            fprintf(stderr, "flacbench: %d threads decoded different audio\n", thread_counts[i]);
+            status = 1;
+        }
+        printf("%2d threads  %3d segments%s  %7.3f s wall, %5.2fx, %7.3f s decoding, %.0fx realtime\n",
+               stats.threads, stats.segments, stats.used_seektable ? " (seektable)" : "",
+               stats.wall_seconds, base / stats.wall_seconds, stats.decode_seconds,
+               (double)stats.frames_decoded / info.sample_rate / stats.wall_seconds);
+    }
+
+    if (made[0]) unlink(made);
+    return status;
+}
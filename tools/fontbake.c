@@ -0,0 +1,111 @@
+// Build-time tool: rasterizes the commonly needed glyphs of a font into
+// the layout of the glyph cache's first atlas page and writes them, along
+// with the font file itself, as a C header. Startup then only has to
+// upload a texture; the embedded font is parsed only for rarer glyphs.
+//
+// Usage: fontbake FONT SIZE > font_atlas.h
+#define _DEFAULT_SOURCE
+
+#include "glyphcache.h"
+
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Ranges baked in: ASCII, Latin-1, Latin Extended-A, Cyrillic and the
+// usual typographic punctuation found in tags and file names
+static const int ranges[][2] = {
+    { 0x0020, 0x007e },
+    { 0x00a0, 0x00ff },
+    { 0x0100, 0x017f },
+    { 0x0400, 0x045f },
+    { 0x2013, 0x2014 },
+    { 0x2018, 0x201d },
+    { 0x2026, 0x2026 },
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s FONT SIZE\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    int font_size = atoi(argv[2]);
+    int cell = GLYPHCACHE_CELL(font_size);
+    int max_edge = cell - GLYPHCACHE_CELL_GUTTER;
+    int per_row = GLYPHCACHE_PAGE_SIZE / cell;
+
+    SetTraceLogLevel(LOG_WARNING);
+
+    int data_size = 0;
+    unsigned char *data = LoadFileData(path, &data_size);
+    if (!data) {
+        fprintf(stderr, "fontbake: cannot read %s\n", path);
+        return 1;
+    }
+
+    int codepoints[1024];
+    int count = 0;
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+        for (int cp = ranges[r][0]; cp <= ranges[r][1] && count < per_row * per_row; cp++) {
+            codepoints[count++] = cp;
+        }
+    }
+
+    GlyphInfo *glyphs = LoadFontData(data, data_size, font_size, codepoints, count, FONT_DEFAULT);
+    if (!glyphs) {
+        fprintf(stderr, "fontbake: cannot rasterize %s\n", path);
+        return 1;
+    }
+
+    printf("// Generated by tools/fontbake from %s. Do not edit.\n\n", path);
+    printf("#define FONT_ATLAS_FONT_SIZE %d\n", font_size);
+    printf("#define FONT_ATLAS_CELL %d\n", cell);
+    printf("#define FONT_ATLAS_GLYPH_COUNT %d\n\n", count);
+
+    // Glyph i occupies cell i of the page, in reading order. Bitmaps are
+    // stored back to back, clipped to the cell like the cache does.
+    printf("static const struct {\n"
+           "    int codepoint;\n"
+           "    short width, height, offset_x, offset_y, advance;\n"
+           "    unsigned int pixels;  // offset into font_atlas_alpha\n"
+           "} font_atlas_glyphs[FONT_ATLAS_GLYPH_COUNT] = {\n");
+    unsigned int offset = 0;
+    for (int i = 0; i < count; i++) {
+        int width = glyphs[i].image.data ? glyphs[i].image.width : 0;
+        int height = glyphs[i].image.data ? glyphs[i].image.height : 0;
+        if (width > max_edge) width = max_edge;
+        if (height > max_edge) height = max_edge;
+        printf("    { 0x%04x, %d, %d, %d, %d, %d, %u },\n", codepoints[i], width, height,
+               glyphs[i].offsetX, glyphs[i].offsetY, glyphs[i].advanceX, offset);
+        offset += (unsigned int)(width * height);
+    }
+    printf("};\n\n");
+
+    printf("static const unsigned char font_atlas_alpha[%u] = {", offset ? offset : 1);
+    unsigned int written = 0;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *src = glyphs[i].image.data;
+        if (!src) continue;
+        int width = glyphs[i].image.width < max_edge ? glyphs[i].image.width : max_edge;
+        int height = glyphs[i].image.height < max_edge ? glyphs[i].image.height : max_edge;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                printf("%s0x%02x,", written % 16 == 0 ? "\n    " : " ", src[y * glyphs[i].image.width + x]);
+                written++;
+            }
+        }
+    }
+    if (written == 0) printf("\n    0");
+    printf("\n};\n\n");
+
+    printf("static const unsigned char font_ttf_data[%d] = {", data_size);
+    for (int i = 0; i < data_size; i++) {
+        printf("%s0x%02x,", i % 16 == 0 ? "\n    " : " ", data[i]);
+    }
+    printf("\n};\n");
+
+    UnloadFontData(glyphs, count);
+    UnloadFileData(data);
+    return ferror(stdout) ? 1 : 0;
+}
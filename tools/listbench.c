@@ -0,0 +1,133 @@
+// Benchmark for the list view: scrolls a synthetic playlist of ROWS rows
+// the way the player does, one key per frame with smooth scrolling at
+// 60 fps, and reports the time per frame spent on scrolling and on the
+// text of the rows on screen. Run once with the row text cache and once
+// formatting every row on screen every frame, as the list used to.
+//
+// Usage: listbench [ROWS]   (default 1000000)
+#define _DEFAULT_SOURCE
+
+#include "vlist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VISIBLE_ROWS 22
+#define FRAME_SECONDS (1.0 / 60.0)
+#define GLIDE_FRAMES 12   // frames without a key after a jump
+
+static const char *const words[] = {
+    "love", "night", "dark", "side", "moon", "blue", "river", "fire", "heart", "city",
+    "dream", "stone", "light", "rain", "summer", "ghost", "golden", "wild", "electric", "silver"
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static unsigned int next_random(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// A row like the playlist's: number, artist and a title of a few words
+static void format_row(void *user, int row, char *buf, size_t size) {
+    (void)user;
+    unsigned int a = (unsigned int)row * 2654435761u;
+    snprintf(buf, size, "%2d. Artist %d - %s %s %s", row + 1, row / 120,
+             words[a % WORD_COUNT], words[(a >> 8) % WORD_COUNT], words[(a >> 16) % WORD_COUNT]);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    int frames;
+    double p50_ms, p99_ms, max_ms;
+    VListStats stats;
+} Run;
+
+// Keys of the script, one per frame; -1 is a jump to a random row, -2 a
+// frame without a key
+static int script_key(int frame) {
+    if (frame < 300) return VLIST_DOWN;
+    if (frame < 400) return VLIST_PAGE_DOWN;
+    if (frame < 500) return frame == 400 ? VLIST_END : frame < 400 + GLIDE_FRAMES ? -2 : VLIST_UP;
+    if (frame < 600) return VLIST_PAGE_UP;
+    if (frame == 600) return VLIST_HOME;
+    int step = (frame - 601) % (GLIDE_FRAMES + 1);
+    return step == 0 ? -1 : -2;
+}
+
+static bool run(int rows, int frames, bool cache, Run *out) {
+    double *times = malloc((size_t)frames * sizeof(double));
+    if (!times) return false;
+
+    VList vl = {0};
+    vlist_init(&vl, VISIBLE_ROWS, true);
+    unsigned int state = 1;
+    int selected = 0;
+    uint32_t generation = 0;
+    volatile size_t sink = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        double start = now_ms();
+        int key = script_key(frame);
+        if (key == -1) {
+            selected = (int)(next_random(&state) % (unsigned int)rows);
+        } else if (key >= 0) {
+            selected = vlist_move(&vl, selected, rows, (VListMove)key);
+        }
+        vlist_follow(&vl, selected, rows);
+        vlist_animate(&vl, FRAME_SECONDS);
+
+        if (!cache) generation++;
+        double offset;
+        int first = vlist_first(&vl, &offset);
+        for (int i = 0; i <= vl.rows && first + i < rows; i++) {
+            sink += strlen(vlist_text(&vl, first + i, generation, format_row, NULL));
+        }
+        times[frame] = now_ms() - start;
+    }
+    (void)sink;
+
+    qsort(times, (size_t)frames, sizeof(double), compare_double);
+    out->frames = frames;
+    out->p50_ms = times[frames / 2];
+    out->p99_ms = times[frames * 99 / 100];
+    out->max_ms = times[frames - 1];
+    out->stats = vl.stats;
+    free(times);
+    vlist_free(&vl);
+    return true;
+}
+
+static void print_run(const char *name, const Run *r) {
+    printf("%-8s %d frames: p50 %.4f ms, p99 %.4f ms, max %.4f ms; %llu rows formatted, %llu cached\n",
+           name, r->frames, r->p50_ms, r->p99_ms, r->max_ms,
+           (unsigned long long)r->stats.formatted, (unsigned long long)r->stats.cached);
+}
+
+int main(int argc, char *argv[]) {
+    int rows = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (rows <= 0) rows = 1;
+    int frames = 601 + 200 * (GLIDE_FRAMES + 1);
+
+    Run cached, uncached;
+    if (!run(rows, frames, true, &cached) || !run(rows, frames, false, &uncached)) {
+        fprintf(stderr, "listbench: out of memory\n");
+        return 1;
+    }
+    printf("list    %d rows, %d on screen\n", rows, VISIBLE_ROWS);
+    print_run("cached", &cached);
+    print_run("uncached", &uncached);
+    return 0;
+}
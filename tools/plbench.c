@@ -0,0 +1,148 @@
+// Benchmark for playlist files: scans a library, writes it out as M3U8,
+// PLS and XSPF, and loads each file back, reporting the time and the
+// throughput of each step next to the recursive scan's. Parsing alone is
+// timed too. Everything goes to a temporary directory, removed afterwards.
+//
+// Usage: plbench [DIR]   (default: a synthetic tree of 100,080 empty files)
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700   // nftw()
+
+#include "playlist.h"
+#include "plfile.h"
+#include "pool.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARTISTS 834
+#define ALBUMS 10
+#define TRACKS 12
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool make_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+}
+
+// ARTISTS x ALBUMS x TRACKS .flac files
+static bool make_tree(const char *root) {
+    char path[PLAYLIST_MAX_PATH];
+    for (int a = 0; a < ARTISTS; a++) {
+        snprintf(path, sizeof(path), "%s/Artist %d", root, a);
+        if (mkdir(path, 0755) != 0) return false;
+        for (int b = 0; b < ALBUMS; b++) {
+            snprintf(path, sizeof(path), "%s/Artist %d/Album %d", root, a, b);
+            if (mkdir(path, 0755) != 0) return false;
+            for (int t = 1; t <= TRACKS; t++) {
+                snprintf(path, sizeof(path), "%s/Artist %d/Album %d/%02d - Track.flac", root, a, b, t);
+                if (!make_file(path)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static double file_mb(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (double)st.st_size / (1024.0 * 1024.0) : 0.0;
+}
+
+static void report(const char *label, int tracks, double ms, double mb) {
+    printf("%-12s %8d tracks %9.1f ms %10.0f tracks/s", label, tracks, ms, ms > 0 ? tracks / ms * 1000.0 : 0.0);
+    if (mb > 0) printf(" %7.1f MB/s", ms > 0 ? mb / ms * 1000.0 : 0.0);
+    printf("\n");
+}
+
+static bool count_entry(void *user, const PlFileEntry *entry) {
+    (void)entry;
+    (*(int *)user)++;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    char tmp[] = "/tmp/plbench-XXXXXX";
+    char tree[PLAYLIST_MAX_PATH] = "";
+    if (!mkdtemp(tmp) || setenv("XDG_CACHE_HOME", tmp, 1) != 0) {
+        fprintf(stderr, "plbench: can't create %s\n", tmp);
+        return 1;
+    }
+    if (!pool_init(0)) {
+        fprintf(stderr, "plbench: failed to start worker pool\n");
+        return 1;
+    }
+
+    const char *root = argc > 1 ? argv[1] : NULL;
+    if (!root) {
+        snprintf(tree, sizeof(tree), "%s/library", tmp);
+        if (mkdir(tree, 0755) != 0 || !make_tree(tree)) {
+            fprintf(stderr, "plbench: can't create %s\n", tree);
+            return 1;
+        }
+        root = tree;
+    }
+
+    // The scan to compare with: no library index, so every directory is read
+    Playlist pl = {0};
+    double start = now_ms();
+    bool ok = playlist_scan_recursive(&pl, root);
+    ScanProgress progress;
+    while (ok && pl.scan) {
+        playlist_scan_poll(&pl, &progress);
+        if (pl.scan) usleep(1000);
+    }
+    if (!ok) fprintf(stderr, "plbench: can't scan %s\n", root);
+    report("scan", pl.count, now_ms() - start, 0.0);
+
+    static const char *const names[] = { "library.m3u8", "library.pls", "library.xspf" };
+    char paths[3][PLAYLIST_MAX_PATH];
+    for (int i = 0; ok && i < 3; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%s", tmp, names[i]);
+        start = now_ms();
+        ok = playlist_save_file(&pl, paths[i]);
+        char label[32];
+        snprintf(label, sizeof(label), "write %s", strrchr(names[i], '.') + 1);
+        report(label, pl.count, now_ms() - start, file_mb(paths[i]));
+    }
+    playlist_free(&pl);
+
+    for (int i = 0; ok && i < 3; i++) {
+        Playlist loaded = {0};
+        start = now_ms();
+        ok = playlist_load_file(&loaded, paths[i]);
+        char label[32];
+        snprintf(label, sizeof(label), "load %s", strrchr(names[i], '.') + 1);
+        report(label, loaded.count, now_ms() - start, file_mb(paths[i]));
+        playlist_free(&loaded);
+    }
+
+    if (ok) {
+        int entries = 0;
+        start = now_ms();
+        ok = plfile_read(paths[0], count_entry, &entries);
+        report("parse m3u8", entries, now_ms() - start, file_mb(paths[0]));
+    }
+
+    pool_shutdown();
+    nftw(tmp, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return ok ? 0 : 1;
+}
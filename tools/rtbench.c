@@ -0,0 +1,174 @@
+// Stress benchmark for real-time scheduling: runs a stand-in for the
+// player's audio path while every CPU is kept busy, once with the threads
+// left as created and once with the low-latency settings applied through
+// rtsched, and reports the underruns of each run.
+//
+// The callback thread wakes every LOW_LATENCY period (128 frames at 48 kHz)
+// and takes a period from a ring the decode thread fills, burning a little
+// CPU for the mix. It underruns when it wakes too late for the device's
+// second buffer or finds the ring short. The decode thread spends
+// DECODE_LOAD of real time burning CPU per chunk it adds, like a decoder.
+// Load threads (two per CPU by default) spin on SCHED_OTHER.
+//
+// Real-time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO; without them
+// the second run shows the refusal and keeps SCHED_OTHER.
+//
+// Usage: rtbench [SECONDS] [LOAD_THREADS]   (default 5, 2 per CPU)
+#define _DEFAULT_SOURCE
+
+#include "rtsched.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATE 48000
+#define PERIOD_FRAMES 128
+#define PERIODS 2
+#define RING_FRAMES 65536
+#define CHUNK_FRAMES 4096
+#define DECODE_LOAD 0.10     // decode time per second of audio
+#define MIX_NS 20000         // callback work per period
+#define MAX_LOAD_THREADS 256
+
+typedef struct {
+    volatile bool stop;
+    int64_t ring;             // decoded frames not yet played
+    unsigned long underruns;
+    unsigned long late;       // of those, woke after the device ran dry
+    unsigned long periods;
+    int64_t max_late_ns;
+} Run;
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Spend ns of this thread's CPU time, however often it is preempted
+static void burn(int64_t ns) {
+    int64_t end = clock_ns(CLOCK_THREAD_CPUTIME_ID) + ns;
+    while (clock_ns(CLOCK_THREAD_CPUTIME_ID) < end) {
+    }
+}
+
+static void sleep_until(int64_t ns) {
+    struct timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static void *callback_thread(void *arg) {
+    Run *run = arg;
+    rtsched_apply(RTSCHED_THREAD_CALLBACK, pthread_self());
+    const int64_t period = (int64_t)PERIOD_FRAMES * 1000000000 / RATE;
+    const int64_t slack = (PERIODS - 1) * period;   // what the device still holds
+    int64_t next = clock_ns(CLOCK_MONOTONIC) + period;
+
+    while (!run->stop) {
+        sleep_until(next);
+        int64_t late = clock_ns(CLOCK_MONOTONIC) - next;
+        if (late > run->max_late_ns) run->max_late_ns = late;
+
+        bool underrun = false;
+        if (late > slack) {
+            run->late++;
+            underrun = true;
+            next += (late / period) * period;   // the device skipped ahead
+        }
+        if (__atomic_load_n(&run->ring, __ATOMIC_ACQUIRE) < PERIOD_FRAMES) {
+            underrun = true;
+        } else {
+            __atomic_fetch_sub(&run->ring, PERIOD_FRAMES, __ATOMIC_RELEASE);
+        }
+        if (underrun) run->underruns++;
+        burn(MIX_NS);
+        run->periods++;
+        next += period;
+    }
+    return NULL;
+}
+
+static void *decode_thread(void *arg) {
+    Run *run = arg;
+    rtsched_apply(RTSCHED_THREAD_DECODE, pthread_self());
+    const int64_t cost = (int64_t)(DECODE_LOAD * CHUNK_FRAMES * 1e9 / RATE);
+    const int64_t nap = (int64_t)CHUNK_FRAMES * 1000000000 / RATE / 4;
+
+    while (!run->stop) {
+        if (__atomic_load_n(&run->ring, __ATOMIC_ACQUIRE) <= RING_FRAMES - CHUNK_FRAMES) {
+            burn(cost);
+            __atomic_fetch_add(&run->ring, CHUNK_FRAMES, __ATOMIC_RELEASE);
+        } else {
+            sleep_until(clock_ns(CLOCK_MONOTONIC) + nap);
+        }
+    }
+    return NULL;
+}
+
+static void *load_thread(void *arg) {
+    Run *run = arg;
+    volatile unsigned long sink = 0;
+    while (!run->stop) {
+        for (int i = 0; i < 100000; i++) sink += (unsigned long)i * i;
+    }
+    return NULL;
+}
+
+static bool run_once(const char *name, int seconds, int loads) {
+    Run run;
+    memset(&run, 0, sizeof(run));
+    run.ring = RING_FRAMES;
+
+    pthread_t threads[MAX_LOAD_THREADS + 2];
+    int started = 0;
+    bool ok = true;
+    for (int i = 0; i < loads && ok; i++) {
+        ok = pthread_create(&threads[started], NULL, load_thread, &run) == 0;
+        if (ok) started++;
+    }
+    if (ok) ok = pthread_create(&threads[started], NULL, decode_thread, &run) == 0;
+    if (ok) started++;
+    if (ok) ok = pthread_create(&threads[started], NULL, callback_thread, &run) == 0;
+    if (ok) started++;
+    if (ok) sleep((unsigned int)seconds);
+    run.stop = true;
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    if (!ok) {
+        fprintf(stderr, "rtbench: can't start threads\n");
+        return false;
+    }
+
+    printf("%-8s %lu periods, %lu underruns (%lu woke late), max lateness %.2f ms\n",
+           name, run.periods, run.underruns, run.late, (double)run.max_late_ns / 1e6);
+    for (int i = 0; i < RTSCHED_THREAD_COUNT; i++) {
+        if (!rtsched_configured((RtSchedThread)i)) continue;
+        const char *error = rtsched_error((RtSchedThread)i);
+        printf("         %s: %s%s%s\n", i == RTSCHED_THREAD_CALLBACK ? "callback" : "decode",
+               rtsched_describe((RtSchedThread)i), error ? ", " : "", error ? error : "");
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int loads = argc > 2 ? atoi(argv[2]) : (int)(cpus > 0 ? cpus * 2 : 2);
+    if (seconds <= 0) seconds = 1;
+    if (loads < 0) loads = 0;
+    if (loads > MAX_LOAD_THREADS) loads = MAX_LOAD_THREADS;
+    printf("load    %d threads on %ld CPUs, %d s per run, %d x %d-frame periods at %d Hz\n",
+           loads, cpus, seconds, PERIODS, PERIOD_FRAMES, RATE);
+
+    if (!run_once("default", seconds, loads)) return 1;
+
+    RtSchedThreadConfig callback = { RTSCHED_POLICY_FIFO, RTSCHED_DEFAULT_CALLBACK_PRIORITY, 0 };
+    RtSchedThreadConfig decode = { RTSCHED_POLICY_FIFO, RTSCHED_DEFAULT_DECODE_PRIORITY, 0 };
+    rtsched_configure(RTSCHED_THREAD_CALLBACK, &callback);
+    rtsched_configure(RTSCHED_THREAD_DECODE, &decode);
+    return run_once("rt", seconds, loads) ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+// Benchmark for recursive library scans: a cold scan with no library
+// index, a warm one where nothing changed, and one after a single album
+// directory changed. Reports when the full track list is first available
+// and when the scan finishes. The index goes to a temporary cache
+// directory, never to the user's, and is removed afterwards.
+//
+// Usage: scanbench [DIR]   (default: a synthetic tree of empty files)
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700   // nftw()
+
+#include "playlist.h"
+#include "pool.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARTISTS 400
+#define ALBUMS 10
+#define TRACKS 12
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool make_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+}
+
+// ARTISTS x ALBUMS x TRACKS .flac files plus a cover per album
+static bool make_tree(const char *root) {
+    char path[PLAYLIST_MAX_PATH];
+    for (int a = 0; a < ARTISTS; a++) {
+        snprintf(path, sizeof(path), "%s/Artist %d", root, a);
+        if (mkdir(path, 0755) != 0) return false;
+        for (int b = 0; b < ALBUMS; b++) {
+            snprintf(path, sizeof(path), "%s/Artist %d/Album %d", root, a, b);
+            if (mkdir(path, 0755) != 0) return false;
+            snprintf(path, sizeof(path), "%s/Artist %d/Album %d/cover.jpg", root, a, b);
+            if (!make_file(path)) return false;
+            for (int t = 1; t <= TRACKS; t++) {
+                snprintf(path, sizeof(path), "%s/Artist %d/Album %d/%02d - Track.flac", root, a, b, t);
+                if (!make_file(path)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+// The index is written by a pool job after the scan; wait for it
+static bool wait_for_index(const char *root) {
+    for (int i = 0; i < 5000; i++) {
+        LibIndex index;
+        if (libindex_open(&index, root, 0)) {
+            libindex_close(&index);
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+static bool run(const char *label, const char *root) {
+    Playlist pl = {0};
+    pl.library_index = true;
+
+    double start = now_ms();
+    if (!playlist_scan_recursive(&pl, root)) {
+        fprintf(stderr, "scanbench: can't scan %s\n", root);
+        return false;
+    }
+    double ready_ms = pl.count > 0 ? now_ms() - start : -1.0;
+
+    ScanProgress progress;
+    do {
+        playlist_scan_poll(&pl, &progress);
+        if (!progress.done) usleep(1000);
+    } while (!progress.done);
+    double done_ms = now_ms() - start;
+    if (ready_ms < 0) ready_ms = done_ms;
+
+    printf("%-8s %8d tracks %6llu dirs %6llu unchanged   list %8.1f ms   done %8.1f ms\n",
+           label, pl.count, (unsigned long long)progress.dirs,
+           (unsigned long long)progress.reused, ready_ms, done_ms);
+    playlist_free(&pl);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    char cache[] = "/tmp/scanbench-XXXXXX";
+    char tree[PLAYLIST_MAX_PATH] = "";
+    if (!mkdtemp(cache) || setenv("XDG_CACHE_HOME", cache, 1) != 0) {
+        fprintf(stderr, "scanbench: can't create %s\n", cache);
+        return 1;
+    }
+    if (!pool_init(0)) {
+        fprintf(stderr, "scanbench: failed to start worker pool\n");
+        return 1;
+    }
+
+    const char *root = argc > 1 ? argv[1] : NULL;
+    if (!root) {
+        snprintf(tree, sizeof(tree), "%s/library", cache);
+        if (mkdir(tree, 0755) != 0 || !make_tree(tree)) {
+            fprintf(stderr, "scanbench: can't create %s\n", tree);
+            return 1;
+        }
+        root = tree;
+    }
+
+    bool ok = run("cold", root) && wait_for_index(root) && run("warm", root);
+
+    // Adding a file changes one directory's mtime
+    if (ok && tree[0]) {
+        char path[PLAYLIST_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/Artist 7/Album 3/13 - Bonus.flac", tree);
+        ok = make_file(path) && run("changed", root);
+    }
+
+    pool_shutdown();
+    nftw(cache, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return ok ? 0 : 1;
+}
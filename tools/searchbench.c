@@ -0,0 +1,106 @@
+// Benchmark for as-you-type search: builds the index over a synthetic
+// library of ENTRIES tracks, then types a set of queries one character at
+// a time, as the search box does, and reports the latency of every
+// keystroke plus a few matches of each final query.
+//
+// Usage: searchbench [ENTRIES]   (default 100000)
+#define _DEFAULT_SOURCE
+
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const words[] = {
+    "love", "night", "dark", "side", "moon", "blue", "river", "fire", "heart", "city",
+    "dream", "stone", "light", "rain", "summer", "ghost", "golden", "wild", "electric", "silver",
+    "shadow", "ocean", "train", "highway", "morning", "paper", "glass", "winter", "storm", "echo"
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static const char *const queries[] = {
+    "dark side",        // words, several entries each
+    "moon",
+    "artist 17",
+    "electric ghost",
+    "dsotm",            // fuzzy: no entry contains it
+    "gldnshdw",
+    "xyzzy",            // nothing at all
+};
+
+static unsigned int next_random(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static void random_words(unsigned int *state, int count, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < count && len < size; i++) {
+        const char *word = words[next_random(state) % WORD_COUNT];
+        int n = snprintf(buf + len, size - len, "%s%c%s", i ? " " : "", i ? word[0] : word[0] - 32, word + 1);
+        if (n < 0) break;
+        len += (size_t)n;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t entries = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 100000;
+    unsigned int state = 1;
+
+    SearchIndex index = {0};
+    for (uint32_t i = 0; i < entries; i++) {
+        char artist[64], title[96], album[96], name[128];
+        snprintf(artist, sizeof(artist), "Artist %u", i / 120);
+        random_words(&state, 1 + (int)(next_random(&state) % 4), title, sizeof(title));
+        random_words(&state, 1 + (int)(next_random(&state) % 3), album, sizeof(album));
+        snprintf(name, sizeof(name), "%02u - %s.flac", i % 12 + 1, title);
+        const char *fields[] = { title, artist, album, name };
+        if (!search_index_add(&index, fields, 4)) {
+            fprintf(stderr, "searchbench: out of memory\n");
+            return 1;
+        }
+    }
+    if (!search_index_finish(&index)) {
+        fprintf(stderr, "searchbench: out of memory\n");
+        return 1;
+    }
+    printf("index   %u entries, %.1f ms, %.1f MB text, %u postings\n",
+           index.count, index.build_ms, (double)index.text.used / (1024.0 * 1024.0),
+           index.bucket_start[1u << 16]);
+
+    Search search = {0};
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        char typed[SEARCH_QUERY_MAX];
+        size_t len = strlen(queries[q]);
+        search_invalidate(&search);
+        for (size_t i = 1; i <= len; i++) {
+            memcpy(typed, queries[q], i);
+            typed[i] = '\0';
+            if (!search_run(&search, &index, typed)) {
+                fprintf(stderr, "searchbench: out of memory\n");
+                return 1;
+            }
+        }
+
+        printf("%-16s %6u matches", queries[q], search.count);
+        for (uint32_t i = 0; i < search.count && i < 2; i++) {
+            size_t text_len;
+            const char *text = index.text.data + index.offsets[search.ids[i]];
+            text_len = strcspn(text, "\n");
+            printf("  [%.*s]", (int)text_len, text);
+        }
+        printf("\n");
+    }
+
+    SearchLatency latency;
+    search_get_latency(&search, &latency);
+    printf("latency %u keystrokes: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           latency.samples, latency.p50_ms, latency.p95_ms, latency.p99_ms, latency.max_ms);
+
+    search_free(&search);
+    search_index_free(&index);
+    return 0;
+}
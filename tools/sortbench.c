@@ -0,0 +1,115 @@
+// Benchmark for playlist sorting: the old bubble sort over fixed-size
+// name buffers, qsort() with strcasecmp() and natsort_order() on synthetic
+// track names.
+//
+// Usage: sortbench [COUNT...]   (default 1000 10000 100000)
+#define _DEFAULT_SOURCE
+
+#include "natsort.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define NAME_SIZE 512
+#define BUBBLE_MAX 1000   // quadratic; larger counts take minutes
+
+static const char *words[] = {
+    "Intro", "blue", "Night", "drive", "Ölmez", "Река", "outro", "Live", "remix", "Part",
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static int compare_casecmp(const void *a, const void *b) {
+    return strcasecmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// What playlist_scan() did before: swap whole buffers
+static void bubble_sort(char (*names)[NAME_SIZE], int count) {
+    char tmp[NAME_SIZE];
+    for (int i = 0; i < count - 1; i++) {
+        for (int j = 0; j < count - i - 1; j++) {
+            if (strcasecmp(names[j], names[j + 1]) > 0) {
+                strcpy(tmp, names[j]);
+                strcpy(names[j], names[j + 1]);
+                strcpy(names[j + 1], tmp);
+            }
+        }
+    }
+}
+
+static bool check_order(const char *const *names, const uint32_t *order, uint32_t count, bool locale) {
+    for (uint32_t i = 1; i < count; i++) {
+        if (natsort_compare(names[order[i - 1]], names[order[i]], locale) > 0) return false;
+    }
+    return true;
+}
+
+static bool run(uint32_t count) {
+    char (*buffers)[NAME_SIZE] = malloc((size_t)count * NAME_SIZE);
+    const char **names = malloc((size_t)count * sizeof(char *));
+    const char **sorted = malloc((size_t)count * sizeof(char *));
+    uint32_t *order = malloc((size_t)count * sizeof(uint32_t));
+    if (!buffers || !names || !sorted || !order) {
+        fprintf(stderr, "sortbench: out of memory\n");
+        return false;
+    }
+
+    // Disc/track numbers with and without padding, mixed case, some UTF-8
+    srand(count);
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(buffers[i], NAME_SIZE, rand() % 2 ? "%u - %s %s %u.flac" : "%02u - %s %s %u.ogg",
+                 (unsigned)(rand() % 100), words[rand() % 10], words[rand() % 10], (unsigned)rand() % 1000);
+        names[i] = buffers[i];
+    }
+
+    double start = now_ms();
+    memcpy(sorted, names, (size_t)count * sizeof(char *));
+    qsort(sorted, count, sizeof(char *), compare_casecmp);
+    double casecmp_ms = now_ms() - start;
+
+    start = now_ms();
+    bool ok = natsort_order(names, count, false, order);
+    double natural_ms = now_ms() - start;
+    ok = ok && check_order(names, order, count, false);
+
+    start = now_ms();
+    ok = ok && natsort_order(names, count, true, order);
+    double locale_ms = now_ms() - start;
+    ok = ok && check_order(names, order, count, true);
+
+    printf("%8u  qsort/strcasecmp %9.2f ms  natural %9.2f ms  locale %9.2f ms", count,
+           casecmp_ms, natural_ms, locale_ms);
+    if (count <= BUBBLE_MAX) {
+        start = now_ms();
+        bubble_sort(buffers, (int)count);
+        printf("  bubble %9.2f ms", now_ms() - start);
+    }
+    printf("%s\n", ok ? "" : "  ORDER WRONG");
+
+    free(buffers);
+    free(names);
+    free(sorted);
+    free(order);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_COLLATE, "");
+
+    static const uint32_t defaults[] = { 1000, 10000, 100000 };
+    bool ok = true;
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) ok = run((uint32_t)strtoul(argv[i], NULL, 10)) && ok;
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) ok = run(defaults[i]) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+// Benchmark for reading tags: files per second on one thread and on the
+// worker pool, with the files dropped from the page cache first (cold) and
+// right after a pass over them (warm). Dropping only works for files on a
+// disk; on tmpfs both runs are warm.
+//
+// Usage: tagbench [DIR]   (default: synthetic FLAC and Ogg Vorbis files)
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700   // nftw(), posix_fadvise()
+
+#include "pool.h"
+#include "tags.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILES 4000
+#define AUDIO_SIZE (64 * 1024)   // stands in for the audio after the headers
+#define RATE 44100
+#define BATCH 32
+
+static char **paths;
+static uint32_t path_count;
+static uint32_t path_capacity;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool add_path(const char *path) {
+    if (path_count == path_capacity) {
+        uint32_t capacity = path_capacity ? path_capacity * 2 : 1024;
+        char **p = realloc(paths, capacity * sizeof(char *));
+        if (!p) return false;
+        paths = p;
+        path_capacity = capacity;
+    }
+    paths[path_count] = strdup(path);
+    return paths[path_count++] != NULL;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+// Vorbis comment structure with artist, title and album
+static size_t make_comments(unsigned char *p, int n) {
+    char fields[3][64];
+    snprintf(fields[0], sizeof(fields[0]), "ARTIST=Artist %d", n / 120);
+    snprintf(fields[1], sizeof(fields[1]), "TITLE=Track %d", n);
+    snprintf(fields[2], sizeof(fields[2]), "ALBUM=Album %d", n / 12);
+
+    const char *vendor = "tagbench";
+    size_t len = 0;
+    put32(p, (uint32_t)strlen(vendor));
+    memcpy(p + 4, vendor, strlen(vendor));
+    len = 4 + strlen(vendor);
+    put32(p + len, 3);
+    len += 4;
+    for (int i = 0; i < 3; i++) {
+        size_t field_len = strlen(fields[i]);
+        put32(p + len, (uint32_t)field_len);
+        memcpy(p + len + 4, fields[i], field_len);
+        len += 4 + field_len;
+    }
+    return len;
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+    return write(fd, data, len) == (ssize_t)len;
+}
+
+static bool make_flac(const char *path, int n) {
+    unsigned char head[512];
+    memset(head, 0, sizeof(head));
+    memcpy(head, "fLaC", 4);
+
+    // STREAMINFO: 3 minutes of 44.1 kHz stereo
+    unsigned char *info = head + 4;
+    info[0] = 0;
+    info[3] = 34;
+    uint64_t samples = 180ULL * RATE;
+    unsigned char *p = info + 4;
+    p[10] = (unsigned char)(RATE >> 12);
+    p[11] = (unsigned char)(RATE >> 4);
+    p[12] = (unsigned char)((RATE & 0x0F) << 4 | 1 << 1);   // 2 channels
+    p[13] = (unsigned char)(15 << 4 | (samples >> 32 & 0x0F));   // 16 bits
+    p[14] = (unsigned char)(samples >> 24);
+    p[15] = (unsigned char)(samples >> 16);
+    p[16] = (unsigned char)(samples >> 8);
+    p[17] = (unsigned char)samples;
+
+    unsigned char *comment = info + 4 + 34;
+    size_t comment_len = make_comments(comment + 4, n);
+    comment[0] = 0x80 | 4;   // last block
+    comment[1] = (unsigned char)(comment_len >> 16);
+    comment[2] = (unsigned char)(comment_len >> 8);
+    comment[3] = (unsigned char)comment_len;
+    size_t head_len = (size_t)(comment + 4 + comment_len - head);
+
+    static unsigned char audio[AUDIO_SIZE];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, head, head_len) && write_all(fd, audio, sizeof(audio)) && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+// One Ogg page holding body, which must fit in 255 segments
+static bool write_page(int fd, uint8_t type, uint64_t granule, uint32_t sequence,
+                       const unsigned char *body, size_t len) {
+    unsigned char header[27 + 255];
+    memcpy(header, "OggS", 4);
+    header[4] = 0;
+    header[5] = type;
+    put64(header + 6, granule);
+    put32(header + 14, 0x7461670a);   // serial
+    put32(header + 18, sequence);
+    put32(header + 22, 0);            // CRC, not checked when reading tags
+    unsigned segments = 0;
+    for (size_t left = len; ; left -= 255) {
+        header[27 + segments++] = (unsigned char)(left < 255 ? left : 255);
+        if (left < 255) break;
+    }
+    header[26] = (unsigned char)segments;
+    return write_all(fd, header, 27 + segments) && write_all(fd, body, len);
+}
+
+static bool make_ogg(const char *path, int n) {
+    unsigned char ident[30];
+    memset(ident, 0, sizeof(ident));
+    ident[0] = 1;
+    memcpy(ident + 1, "vorbis", 6);
+    ident[11] = 2;   // channels
+    put32(ident + 12, RATE);
+    ident[28] = 0xb8;   // block sizes
+    ident[29] = 1;      // framing
+
+    unsigned char comment[512];
+    comment[0] = 3;
+    memcpy(comment + 1, "vorbis", 6);
+    size_t comment_len = 7 + make_comments(comment + 7, n);
+    comment[comment_len++] = 1;   // framing
+
+    static unsigned char audio[4096];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_page(fd, 0x02, 0, 0, ident, sizeof(ident)) &&
+              write_page(fd, 0x00, 0, 1, comment, comment_len);
+    uint32_t pages = AUDIO_SIZE / sizeof(audio);
+    for (uint32_t i = 0; ok && i < pages; i++) {
+        uint64_t granule = (uint64_t)180 * RATE * (i + 1) / pages;
+        ok = write_page(fd, i + 1 == pages ? 0x04 : 0x00, granule, 2 + i, audio, sizeof(audio));
+    }
+    ok = ok && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+static bool make_files(const char *dir) {
+    char path[4096];
+    for (int i = 0; i < FILES; i++) {
+        bool flac = i % 2 == 0;
+        snprintf(path, sizeof(path), "%s/%05d.%s", dir, i, flac ? "flac" : "ogg");
+        if (!(flac ? make_flac(path, i) : make_ogg(path, i)) || !add_path(path)) return false;
+    }
+    return true;
+}
+
+static int collect(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    const char *ext = strrchr(path, '.');
+    if (type == FTW_F && ext && (strcasecmp(ext, ".flac") == 0 || strcasecmp(ext, ".ogg") == 0)) {
+        return add_path(path) ? 0 : -1;
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static void drop_cache(void) {
+    for (uint32_t i = 0; i < path_count; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void report(const char *label, uint32_t files, uint32_t failed, double ms) {
+    printf("%-14s %7u files %5u failed %9.1f ms %10.0f files/s\n",
+           label, files, failed, ms, ms > 0 ? files * 1000.0 / ms : 0.0);
+}
+
+static void run_single(const char *label) {
+    uint32_t failed = 0;
+    double start = now_ms();
+    for (uint32_t i = 0; i < path_count; i++) {
+        Tags tags;
+        if (!tags_read(paths[i], &tags)) failed++;
+    }
+    report(label, path_count, failed, now_ms() - start);
+}
+
+static bool run_pool(const char *label) {
+    TagReader *reader = tagreader_create();
+    if (!reader) return false;
+
+    double start = now_ms();
+    for (uint32_t first = 0; first < path_count; first += BATCH) {
+        uint32_t ids[BATCH];
+        uint32_t count = path_count - first < BATCH ? path_count - first : BATCH;
+        for (uint32_t i = 0; i < count; i++) ids[i] = first + i;
+        if (!tagreader_submit(reader, POOL_LANE_BULK, NULL, 0, ids,
+                              (const char *const *)paths + first, count)) {
+            tagreader_free(reader);
+            return false;
+        }
+    }
+
+    uint32_t done = 0, failed = 0;
+    while (done < path_count) {
+        TagBatch *batch = tagreader_take(reader);
+        if (!batch) usleep(100);
+        while (batch) {
+            TagBatch *next = batch->next;
+            for (uint32_t i = 0; i < batch->count; i++) failed += !batch->results[i].ok;
+            done += batch->count;
+            free(batch);
+            batch = next;
+        }
+    }
+    report(label, path_count, failed, now_ms() - start);
+    tagreader_free(reader);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    char tmp[] = "/tmp/tagbench-XXXXXX";
+    bool made = false;
+    if (argc > 1) {
+        if (nftw(argv[1], collect, 16, FTW_PHYS) != 0) {
+            fprintf(stderr, "tagbench: can't read %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        if (!mkdtemp(tmp) || !make_files(tmp)) {
+            fprintf(stderr, "tagbench: can't create files in %s\n", tmp);
+            return 1;
+        }
+        made = true;
+    }
+    if (!pool_init(0)) {
+        fprintf(stderr, "tagbench: failed to start worker pool\n");
+        return 1;
+    }
+
+    drop_cache();
+    run_single("cold 1 thread");
+    run_single("warm 1 thread");
+    drop_cache();
+    bool ok = run_pool("cold pool") && run_pool("warm pool");
+
+    pool_shutdown();
+    if (made) nftw(tmp, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    for (uint32_t i = 0; i < path_count; i++) free(paths[i]);
+    free(paths);
+    return ok ? 0 : 1;
+}